@@ -0,0 +1,8 @@
+#ifndef CPU_FEATURES
+#define CPU_FEATURES
+
+// Instruction set extensions of the cpu we are running on, asked once. The SIMD paths are compiled
+// with a target attribute, so the same binary still runs on a cpu without them as long as it checks here.
+bool cpu_has_avx2();
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef FILE_IO
+#define FILE_IO
+
+#include <cstddef>
+#include <string>
+
+// Writes the bytes to path.tmp and renames that over path. The rename is atomic, so a crash halfway or
+// a reader at the same time sees the old file or the new one, never a half written one. False when
+// anything fails, the old file is then left as it was.
+bool write_file_atomically(const std::string &path, const void *data, size_t size);
+
+#endif
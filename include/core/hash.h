@@ -0,0 +1,33 @@
+#ifndef HASH
+#define HASH
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// FNV-1a on 64 bit words, bytewise for the tail. Not cryptographic, it is for hash tables and for
+// noticing that a file changed. Cooked files store it, changing it invalidates them.
+inline uint64_t hash_bytes(const void *data, size_t size)
+{
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+	uint64_t hash = 14695981039346656037ull;
+
+	size_t words = size / sizeof(uint64_t);
+	for (size_t i = 0; i < words; i++)
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i * sizeof(uint64_t), sizeof(uint64_t));
+		hash ^= word;
+		hash *= 1099511628211ull;
+	}
+
+	for (size_t i = words * sizeof(uint64_t); i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef JOB_SYSTEM
+#define JOB_SYSTEM
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Counter used to track a group of jobs. It is incremented on submit and
+// decremented when a job finishes, so a value of 0 means "everything done".
+struct JobCounter
+{
+	std::atomic<int> value{0};
+
+	bool done() const { return value.load(std::memory_order_acquire) == 0; }
+};
+
+// A job is a small type-erased callable stored inline ( no heap allocation ).
+// Captures bigger than the inline storage are rejected at compile time, capture
+// a pointer to your data instead.
+struct Job
+{
+	static constexpr size_t STORAGE_SIZE = 48;
+
+	void (*invoke)(void *storage) = nullptr;
+	JobCounter *counter = nullptr;
+	const JobCounter *dependency = nullptr; // job is not started until this reaches 0
+	alignas(std::max_align_t) unsigned char storage[STORAGE_SIZE];
+
+	template <typename F>
+	static Job make(F &&function, JobCounter *counter = nullptr, const JobCounter *dependency = nullptr)
+	{
+		using Fn = std::decay_t<F>;
+		static_assert(sizeof(Fn) <= STORAGE_SIZE, "Job capture is too big, capture a pointer instead");
+		static_assert(std::is_trivially_copyable_v<Fn>, "Job captures must be trivially copyable");
+
+		Job job;
+		new (job.storage) Fn(std::forward<F>(function));
+		job.invoke = [](void *storage)
+		{ (*reinterpret_cast<Fn *>(storage))(); };
+		job.counter = counter;
+		job.dependency = dependency;
+		return job;
+	}
+};
+
+// Fixed capacity double ended queue owned by one worker. The owner pushes and
+// pops at the bottom ( LIFO, cache friendly ), other workers steal from the top.
+class WorkStealingQueue
+{
+	static constexpr uint32_t CAPACITY = 4096;
+
+	std::mutex lock;
+	std::unique_ptr<Job[]> jobs = std::make_unique<Job[]>(CAPACITY);
+	uint32_t top = 0;
+	uint32_t bottom = 0;
+
+public:
+	bool push(const Job &job);
+	bool pop(Job &job);
+	bool steal(Job &job);
+	uint32_t size();
+};
+
+class JobSystem
+{
+	bool isInitialized = false;
+
+	std::vector<std::thread> workers;
+	// queue 0 belongs to the main thread, then one per worker, then FOREIGN_QUEUES for other threads
+	// that submit, like the scene loader
+	std::vector<std::unique_ptr<WorkStealingQueue>> queues;
+	std::atomic<uint32_t> nextForeignSlot{0};
+
+	std::atomic<bool> running{false};
+	std::atomic<int> pendingJobs{0};
+	std::atomic<int> sleepingWorkers{0};
+	std::mutex sleepLock;
+	std::condition_variable wakeCondition;
+
+	void worker_loop(uint32_t threadIndex);
+	bool try_execute_one(uint32_t threadIndex, bool anyQueue = false);
+	bool find_job(uint32_t threadIndex, Job &job, bool anyQueue);
+	void execute(Job &job);
+
+public:
+	// queues for threads that are neither the main thread nor a worker, more of them share
+	static constexpr uint32_t FOREIGN_QUEUES = 4;
+
+	static JobSystem &Get();
+
+	// workerCount < 0 picks hardware_concurrency - 1 ( the main thread is also a worker while waiting )
+	bool init(int workerCount = -1);
+	void shutdown();
+
+	// number of threads that can execute jobs ( workers + main thread )
+	uint32_t thread_count() const { return isInitialized ? (uint32_t)workers.size() + 1 : 0; }
+	// bound of thread_index(), to size per thread scratch
+	uint32_t thread_index_count() const { return (uint32_t)queues.size(); }
+	// 0 for the main thread, 1..N for the workers, past them for foreign threads. Their jobs go to
+	// their own queue, the workers steal from it but the main thread does not, so a long job submitted
+	// by a loader thread never ends up in the frame's wait.
+	static uint32_t thread_index();
+
+	void submit(const Job &job);
+
+	template <typename F>
+		requires(!std::is_same_v<std::decay_t<F>, Job>)
+	void submit(F &&function, JobCounter *counter = nullptr, const JobCounter *dependency = nullptr)
+	{
+		submit(Job::make(std::forward<F>(function), counter, dependency));
+	}
+
+	// Blocks until the counter reaches zero. The calling thread runs jobs while waiting.
+	void wait(const JobCounter &counter);
+
+	// Splits [0, count) into chunks of at most grainSize and calls function(begin, end) for each chunk in parallel.
+	template <typename F>
+	void parallel_for(uint32_t count, uint32_t grainSize, F &&function)
+	{
+		if (count == 0)
+			return;
+
+		if (grainSize == 0)
+			grainSize = 1;
+
+		if (!isInitialized || count <= grainSize)
+		{
+			function(0u, count);
+			return;
+		}
+
+		using Fn = std::remove_reference_t<F>;
+		Fn *fn = &function;
+
+		JobCounter counter;
+		for (uint32_t begin = 0; begin < count; begin += grainSize)
+		{
+			uint32_t end = std::min(begin + grainSize, count);
+			submit([fn, begin, end]()
+				   { (*fn)(begin, end); },
+				   &counter);
+		}
+
+		wait(counter);
+	}
+
+	// Micro-benchmark: job dispatch overhead and parallel_for scaling from 1 to N workers
+	static void run_benchmark();
+};
+
+#endif
@@ -12,7 +12,7 @@ private:
 	bool isInitialized = false;
 	char type;
 	std::string title = "Collaboration v1.0\n\n";
-	std::string questionEntry = "Which tool are you going to use? (select option [1-4] or q for quit): ";
+	std::string questionEntry = "Which tool are you going to use? (select option [1-6] or q for quit): ";
 	std::map<char, std::string> optionSet;
 
 public:
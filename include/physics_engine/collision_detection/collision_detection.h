@@ -1,12 +1,155 @@
 #ifndef COLLISION_DETECTION
 #define COLLISION_DETECTION
 
+#include "physics_engine/collision_detection/dynamic_aabb_tree.h"
+#include "physics_engine/collision_detection/narrowphase.h"
+#include "physics_engine/collision_detection/sweep_and_prune.h"
+
 #include <iostream>
+#include <vector>
+
+enum class BroadphaseType : uint32_t
+{
+	Tree,		   // few things moving, or queries and ray casts every step
+	SweepAndPrune, // most things moving a little every step
+};
+
+const char *broadphase_type_name(BroadphaseType type);
 
+struct BroadphaseStats
+{
+	BroadphaseType type;
+	uint32_t proxies;
+	uint32_t pairs;
+	uint32_t moved; // proxies reinserted into the tree since the last update
+	float updateMs; // moves and pair update of the last step
+	int32_t treeHeight;
+	float areaRatio;
+	int sweepAxis;
+	bool simd;
+};
+
+// Collision detection of the physics engine. Proxies are the AABBs of whatever the caller puts in, named
+// by the user data it gives them, and update_pairs hands back the pairs of user data that may touch. The
+// tree or sweep and prune does the work and can be switched at any time, the proxies stay valid.
+// find_contacts then runs the narrowphase on those pairs.
 class CollisionDetection {
 
+	BroadphaseType type = BroadphaseType::Tree;
+	DynamicAabbTree tree;
+	SweepAndPrune sweepAndPrune;
+	Narrowphase narrowphase;
+
+	// by proxy: the proxy in the active broadphase ( ~0u when free ), and what it was given, to fill
+	// the other broadphase when switching
+	std::vector<uint32_t> backendProxies;
+	std::vector<Aabb> aabbs;
+	std::vector<uint32_t> userData;
+	std::vector<uint32_t> freeIds;
+
+	std::vector<BroadphasePair> pairs;
+	std::vector<BroadphasePair> activePairs;
+	BroadphaseStats stats{};
+	uint32_t moved = 0;
+	float moveMs = 0.f;
+
+	// by user data, the ones whose tree proxy was added, removed or reinserted since the last
+	// update_pairs. Their pairs are the only ones the tree redoes, the others are kept as they are
+	std::vector<uint8_t> dataChanged;
+	std::vector<uint32_t> changedData;
+
+	uint32_t allocate_proxy(const Aabb &aabb, uint32_t data);
+	void mark_changed(uint32_t data);
+
 public:
-	CollisionDetection();
+	void set_broadphase(BroadphaseType type);
+	BroadphaseType broadphase() const { return type; }
+
+	// AVX2 sweep of the sweep and prune and sphere batch of the narrowphase, when the cpu has it
+	void set_simd(bool enabled)
+	{
+		sweepAndPrune.simd = enabled;
+		narrowphase.simd = enabled;
+	}
+
+	uint32_t add_proxy(const Aabb &aabb, uint32_t userData);
+	void add_proxies(const Aabb *aabbs, const uint32_t *userData, uint32_t count, uint32_t *outProxies);
+	void remove_proxy(uint32_t proxy);
+	void remove_proxies(const uint32_t *proxies, uint32_t count);
+	void clear();
+
+	void move_proxy(uint32_t proxy, const Aabb &aabb, const glm::vec3 &displacement);
+	// same for a whole array, proxies[i] gets aabbs[i]
+	void move_proxies(const uint32_t *proxies, const Aabb *aabbs, const glm::vec3 *displacements, uint32_t count);
+
+	// pairs of user data that may touch, a < b, sorted and each pair once. The tree reports the pairs of
+	// its fat AABBs, so it may report a few more than sweep and prune
+	const std::vector<BroadphasePair> &update_pairs();
+
+	// callback(userData), returning false stops the query
+	template <typename F>
+	void query(const Aabb &aabb, F &&callback) const;
+
+	// callback(userData, ray) returns the fraction to clip the ray to, 0 stops
+	template <typename F>
+	void ray_cast(const Ray &ray, F &&callback) const;
+
+	// convex hulls for Shape::convex_hull, they stay through clear
+	uint32_t add_hull(const glm::vec3 *points, uint32_t count) { return narrowphase.add_hull(points, count); }
+
+	// manifolds of the pairs of the last update_pairs, shapes and transforms are indexed by user data.
+	// With active, by user data too, pairs where neither side is active are skipped: two sleeping or
+	// static objects keep the contacts they had
+	const std::vector<ContactManifold> &find_contacts(const Shape *shapes, const ShapeTransform *transforms, const uint8_t *active = nullptr);
+
+	const BroadphaseStats &get_stats() const { return stats; }
+	const NarrowphaseStats &get_narrowphase_stats() const { return narrowphase.get_stats(); }
 };
 
+// sweep and prune keeps nothing a query could use, so queries test every box
+template <typename F>
+void CollisionDetection::query(const Aabb &aabb, F &&callback) const
+{
+	if (type == BroadphaseType::Tree)
+	{
+		tree.query(aabb, [&](uint32_t proxy)
+				   { return callback(tree.user_data(proxy)); });
+		return;
+	}
+
+	for (uint32_t proxy = 0; proxy < aabbs.size(); proxy++)
+	{
+		if (backendProxies[proxy] != ~0u && aabbs[proxy].overlaps(aabb) && !callback(userData[proxy]))
+			return;
+	}
+}
+
+template <typename F>
+void CollisionDetection::ray_cast(const Ray &ray, F &&callback) const
+{
+	if (type == BroadphaseType::Tree)
+	{
+		tree.ray_cast(ray, [&](uint32_t proxy, const Ray &clipped)
+					  { return callback(tree.user_data(proxy), clipped); });
+		return;
+	}
+
+	glm::vec3 inverseDirection = 1.f / ray.direction;
+	Ray clipped = ray;
+	for (uint32_t proxy = 0; proxy < aabbs.size(); proxy++)
+	{
+		if (backendProxies[proxy] == ~0u || !aabbs[proxy].ray_overlaps(ray.origin, inverseDirection, clipped.maxFraction))
+			continue;
+
+		float fraction = callback(userData[proxy], clipped);
+		if (fraction == 0.f)
+			return;
+		clipped.maxFraction = std::min(clipped.maxFraction, fraction);
+	}
+}
+
+// tree and sweep and prune against testing every pair, 1k to 100k moving boxes. The brute force pass
+// at 100k takes tens of seconds
+void run_broadphase_benchmark();
+
 #endif
@@ -0,0 +1,249 @@
+#ifndef DYNAMIC_AABB_TREE
+#define DYNAMIC_AABB_TREE
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+struct Ray
+{
+	glm::vec3 origin;
+	glm::vec3 direction; // not normalized, hits are reported as fractions of it
+	float maxFraction = 1.f;
+};
+
+struct Aabb
+{
+	glm::vec3 min{0.f};
+	glm::vec3 max{0.f};
+
+	bool overlaps(const Aabb &other) const
+	{
+		return min.x <= other.max.x && max.x >= other.min.x && min.y <= other.max.y && max.y >= other.min.y &&
+			   min.z <= other.max.z && max.z >= other.min.z;
+	}
+
+	bool contains(const Aabb &other) const
+	{
+		return min.x <= other.min.x && min.y <= other.min.y && min.z <= other.min.z && max.x >= other.max.x &&
+			   max.y >= other.max.y && max.z >= other.max.z;
+	}
+
+	// the cost the tree minimizes, proportional to the chance of a random ray or box hitting it
+	float surface_area() const
+	{
+		glm::vec3 d = max - min;
+		return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	// slab test against the ray up to maxFraction, directions with a zero component give infinities
+	// that compare the right way
+	bool ray_overlaps(const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxFraction) const
+	{
+		glm::vec3 t0 = (min - origin) * inverseDirection;
+		glm::vec3 t1 = (max - origin) * inverseDirection;
+		glm::vec3 tNear = glm::min(t0, t1);
+		glm::vec3 tFar = glm::max(t0, t1);
+		float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.f));
+		float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxFraction));
+		return enter <= exit;
+	}
+
+	glm::vec3 center() const { return (min + max) * 0.5f; }
+
+	static Aabb merge(const Aabb &a, const Aabb &b) { return Aabb{glm::min(a.min, b.min), glm::max(a.max, b.max)}; }
+};
+
+// two overlapping proxies, a < b
+struct BroadphasePair
+{
+	uint32_t a;
+	uint32_t b;
+
+	bool operator==(const BroadphasePair &other) const = default;
+	bool operator<(const BroadphasePair &other) const { return a != other.a ? a < other.a : b < other.b; }
+};
+
+// Bounding volume hierarchy over proxies that move every step. Leaves store a fat AABB, enlarged by a
+// margin and by the predicted displacement, so a proxy only has to be reinserted when it leaves it.
+// Insertion picks the sibling with the lowest surface area cost, and the path back up to the root is
+// rebalanced with rotations. Pairs are kept between steps, only the ones of moved proxies are redone.
+class DynamicAabbTree
+{
+public:
+	static constexpr uint32_t NULL_NODE = ~0u;
+
+	// traversal stack on the stack, a tree taller than that traverses with one on the heap. A depth
+	// first walk never holds more than height + 1 nodes.
+	static constexpr uint32_t STACK_SIZE = 128;
+
+private:
+	struct Node
+	{
+		Aabb aabb;
+		uint32_t parent; // next free node while on the free list
+		uint32_t child1;
+		uint32_t child2;
+		int32_t height; // 0 for leaves, -1 for free nodes
+		uint32_t userData;
+
+		bool leaf() const { return child1 == NULL_NODE; }
+	};
+
+	std::vector<Node> nodes;
+	uint32_t root = NULL_NODE;
+	uint32_t freeList = NULL_NODE;
+	uint32_t leafCount = 0;
+
+	// proxies inserted, moved or removed since the last update_pairs
+	std::vector<uint32_t> moveBuffer;
+	std::vector<uint8_t> dirty;
+
+	std::vector<BroadphasePair> pairs;
+	std::vector<BroadphasePair> newPairs;
+	std::vector<std::vector<BroadphasePair>> threadPairs;
+
+	uint32_t allocate_node();
+	void free_node(uint32_t node);
+	void mark_dirty(uint32_t proxy);
+
+	void insert_leaf(uint32_t leaf);
+	void remove_leaf(uint32_t leaf);
+	uint32_t balance(uint32_t node);
+
+	// top down median split over the leaves in [begin, end), returns the subtree root
+	uint32_t build(uint32_t *leaves, uint32_t begin, uint32_t end);
+
+public:
+	// added to every side of the AABBs, and the displacement is extended by this factor
+	float margin = 0.1f;
+	float displacementMultiplier = 2.f;
+
+	uint32_t create_proxy(const Aabb &aabb, uint32_t userData);
+	void destroy_proxy(uint32_t proxy);
+
+	// rebuilds the tree when the batch is at least its size, inserts them one by one otherwise, proxies
+	// are written to outProxies
+	void create_proxies(const Aabb *aabbs, const uint32_t *userData, uint32_t count, uint32_t *outProxies);
+	// removes the leaves one by one, or rebuilds the tree from the rest when most of it goes
+	void destroy_proxies(const uint32_t *proxies, uint32_t count);
+
+	// true when the proxy left its fat AABB and was reinserted
+	bool move_proxy(uint32_t proxy, const Aabb &aabb, const glm::vec3 &displacement);
+
+	// rebuilds the tree top down from the current leaves
+	void rebuild();
+	void clear();
+
+	// pairs of proxies with overlapping fat AABBs, sorted and without duplicates
+	const std::vector<BroadphasePair> &update_pairs();
+	// the pairs the last update_pairs found for the proxies changed before it, sorted. Every other pair
+	// it returned was there the update before
+	const std::vector<BroadphasePair> &new_pairs() const { return newPairs; }
+
+	uint32_t user_data(uint32_t proxy) const { return nodes[proxy].userData; }
+	const Aabb &fat_aabb(uint32_t proxy) const { return nodes[proxy].aabb; }
+	uint32_t proxy_count() const { return leafCount; }
+	int32_t height() const { return root == NULL_NODE ? 0 : nodes[root].height; }
+
+	// sum of the surface areas of the internal nodes relative to the root, lower is a better tree
+	float area_ratio() const;
+
+	// callback(proxy) for every proxy whose fat AABB overlaps, returning false stops the query
+	template <typename F>
+	void query(const Aabb &aabb, F &&callback) const;
+
+	// callback(proxy, ray) for every proxy whose fat AABB the ray hits, returns the fraction to clip the
+	// ray to: 0 stops, ray.maxFraction keeps going unclipped
+	template <typename F>
+	void ray_cast(const Ray &ray, F &&callback) const;
+};
+
+template <typename F>
+void DynamicAabbTree::query(const Aabb &aabb, F &&callback) const
+{
+	if (root == NULL_NODE)
+		return;
+
+	uint32_t localStack[STACK_SIZE];
+	std::vector<uint32_t> heapStack;
+	uint32_t *stack = localStack;
+	if ((uint32_t)nodes[root].height + 1 > STACK_SIZE)
+	{
+		heapStack.resize(nodes[root].height + 1);
+		stack = heapStack.data();
+	}
+
+	uint32_t count = 0;
+	stack[count++] = root;
+
+	while (count > 0)
+	{
+		uint32_t index = stack[--count];
+		const Node &node = nodes[index];
+		if (!node.aabb.overlaps(aabb))
+			continue;
+
+		if (node.leaf())
+		{
+			if (!callback(index))
+				return;
+		}
+		else
+		{
+			stack[count++] = node.child1;
+			stack[count++] = node.child2;
+		}
+	}
+}
+
+template <typename F>
+void DynamicAabbTree::ray_cast(const Ray &ray, F &&callback) const
+{
+	if (root == NULL_NODE)
+		return;
+
+	glm::vec3 inverseDirection = 1.f / ray.direction;
+	float maxFraction = ray.maxFraction;
+
+	uint32_t localStack[STACK_SIZE];
+	std::vector<uint32_t> heapStack;
+	uint32_t *stack = localStack;
+	if ((uint32_t)nodes[root].height + 1 > STACK_SIZE)
+	{
+		heapStack.resize(nodes[root].height + 1);
+		stack = heapStack.data();
+	}
+
+	uint32_t count = 0;
+	stack[count++] = root;
+
+	while (count > 0)
+	{
+		uint32_t index = stack[--count];
+		const Node &node = nodes[index];
+
+		if (!node.aabb.ray_overlaps(ray.origin, inverseDirection, maxFraction))
+			continue;
+
+		if (node.leaf())
+		{
+			Ray clipped = ray;
+			clipped.maxFraction = maxFraction;
+
+			float fraction = callback(index, clipped);
+			if (fraction == 0.f)
+				return;
+			maxFraction = std::min(maxFraction, fraction);
+		}
+		else
+		{
+			stack[count++] = node.child1;
+			stack[count++] = node.child2;
+		}
+	}
+}
+
+#endif
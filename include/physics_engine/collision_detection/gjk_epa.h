@@ -0,0 +1,64 @@
+#ifndef GJK_EPA
+#define GJK_EPA
+
+#include "physics_engine/collision_detection/shapes.h"
+
+// A shape reduced to its core in world space: the point of a sphere, the segment of a capsule, a box
+// or a hull. GJK and EPA run on the cores and the radius is put back around the result, which keeps
+// rounded shapes exact and GJK away from the curved surfaces it converges slowly on.
+struct ConvexCore
+{
+	ShapeType type;
+	glm::vec3 position;
+	glm::quat orientation;
+	glm::vec3 halfExtents; // box, y is the half height of the capsule segment
+	const glm::vec3 *vertices = nullptr;
+	uint32_t vertexCount = 0;
+	float radius = 0.f;
+
+	ConvexCore(const Shape &shape, const ShapeTransform &transform, const ConvexHull *hulls);
+
+	// furthest point of the core along direction
+	glm::vec3 support(const glm::vec3 &direction) const;
+};
+
+// One vertex of the Minkowski difference and the two support points it came from
+struct SimplexVertex
+{
+	glm::vec3 w; // a - b
+	glm::vec3 a;
+	glm::vec3 b;
+};
+
+struct Simplex
+{
+	SimplexVertex vertices[4];
+	float lambda[4]; // barycentric weights of the closest point
+	uint32_t count = 0;
+};
+
+struct GjkResult
+{
+	bool overlap;	 // the cores intersect, the distance is 0 and the points meaningless
+	float distance;	 // between the cores
+	glm::vec3 pointA; // closest points on the cores
+	glm::vec3 pointB;
+	uint32_t iterations;
+};
+
+// Distance between the cores. The simplex is left as it ended, EPA starts from it on overlap.
+GjkResult gjk_distance(const ConvexCore &a, const ConvexCore &b, Simplex &simplex);
+
+struct EpaResult
+{
+	glm::vec3 normal; // from a to b
+	float depth;	  // of the cores
+	glm::vec3 pointA; // deepest points on the cores
+	glm::vec3 pointB;
+};
+
+// Penetration of overlapping cores, expanding the simplex GJK ended with. False when the polytope could
+// not be grown from it, which only happens for cores that merely touch.
+bool epa_penetration(const ConvexCore &a, const ConvexCore &b, const Simplex &simplex, EpaResult &result);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef NARROWPHASE
+#define NARROWPHASE
+
+#include "physics_engine/collision_detection/dynamic_aabb_tree.h"
+#include "physics_engine/collision_detection/shapes.h"
+
+#include <cstdint>
+#include <vector>
+
+constexpr uint32_t MAX_MANIFOLD_POINTS = 4;
+
+struct ContactPoint
+{
+	glm::vec3 position; // halfway between the two surfaces
+	float depth;		// negative while the surfaces are still apart, within the contact margin
+};
+
+// Contacts of one pair, the normal points from a to b
+struct ContactManifold
+{
+	uint32_t a;
+	uint32_t b;
+	glm::vec3 normal;
+	uint32_t pointCount;
+	ContactPoint points[MAX_MANIFOLD_POINTS];
+};
+
+struct NarrowphaseStats
+{
+	uint32_t pairs;
+	uint32_t manifolds;
+	uint32_t points;
+	uint32_t batchedSpheres; // sphere pairs that went through the 8 wide batch
+	uint32_t convexPairs;	 // pairs without an analytical test, left to GJK and EPA
+	float collideMs;
+};
+
+// Contact generation for the broadphase pairs. Pairs are bucketed by their two shape types, so every
+// bucket runs one test over a homogeneous array: sphere pairs are gathered into SoA lanes and tested 8
+// at a time with AVX2, the other analytical tests and GJK/EPA are spread over the job system.
+class Narrowphase
+{
+	std::vector<ConvexHull> hulls;
+
+	// by shape type pair, the lower type first
+	std::vector<BroadphasePair> buckets[(uint32_t)ShapeType::Count][(uint32_t)ShapeType::Count];
+
+	// one slot per pair of a bucket, compacted into the manifolds in pair order
+	std::vector<ContactManifold> candidates;
+
+	// center x y z and radius of a and b, then the normal x y z and depth, padded to a multiple of 8
+	std::vector<float> sphereLanes[12];
+
+	std::vector<ContactManifold> manifolds;
+	NarrowphaseStats stats{};
+
+	void collide_sphere_batch(const std::vector<BroadphasePair> &pairs, const Shape *shapes, const ShapeTransform *transforms);
+
+public:
+	// contacts are reported while the surfaces are closer than this, so a solver can slow them down
+	// before they touch
+	float contactMargin = 0.02f;
+
+	// the AVX2 sphere batch when the cpu has it, off for the scalar one
+	bool simd = true;
+
+	// pairs per job
+	uint32_t grainSize = 256;
+
+	// the hull of a point cloud in body space. The points do not have to be the hull, support
+	// points of a cloud are the ones of its hull
+	uint32_t add_hull(const glm::vec3 *points, uint32_t count);
+	const ConvexHull &hull(uint32_t index) const { return hulls[index]; }
+
+	// manifolds of the pairs that touch, shapes and transforms are indexed by the ids in the pairs
+	const std::vector<ContactManifold> &collide(const std::vector<BroadphasePair> &pairs, const Shape *shapes, const ShapeTransform *transforms);
+
+	const NarrowphaseStats &get_stats() const { return stats; }
+};
+
+// The tests of one pair. They fill the normal and points of the manifold and return false when the
+// shapes are further apart than the margin. Shape a has to be of the first type in the name.
+bool collide_spheres(const Shape &a, const ShapeTransform &ta, const Shape &b, const ShapeTransform &tb, const ConvexHull *hulls, float margin, ContactManifold &manifold);
+bool collide_sphere_capsule(const Shape &a, const ShapeTransform &ta, const Shape &b, const ShapeTransform &tb, const ConvexHull *hulls, float margin, ContactManifold &manifold);
+bool collide_sphere_box(const Shape &a, const ShapeTransform &ta, const Shape &b, const ShapeTransform &tb, const ConvexHull *hulls, float margin, ContactManifold &manifold);
+bool collide_capsules(const Shape &a, const ShapeTransform &ta, const Shape &b, const ShapeTransform &tb, const ConvexHull *hulls, float margin, ContactManifold &manifold);
+
+// SAT over the 15 axes, faces are clipped against each other and the manifold reduced to 4 points
+bool collide_boxes(const Shape &a, const ShapeTransform &ta, const Shape &b, const ShapeTransform &tb, const ConvexHull *hulls, float margin, ContactManifold &manifold);
+
+// GJK on the cores, EPA when they overlap, for any two shapes. One point per manifold.
+bool collide_convex(const Shape &a, const ShapeTransform &ta, const Shape &b, const ShapeTransform &tb, const ConvexHull *hulls, float margin, ContactManifold &manifold);
+
+// every shape pair at 100k pairs each, and the box SAT checked against EPA on the same boxes as hulls
+void run_narrowphase_benchmark();
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef SHAPES
+#define SHAPES
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstdint>
+#include <vector>
+
+enum class ShapeType : uint32_t
+{
+	Sphere,
+	Capsule,
+	Box,
+	ConvexHull,
+	Count,
+};
+
+const char *shape_type_name(ShapeType type);
+
+// Collision shape in body space, centered on the body. Capsules are a segment along the local y axis
+// with a radius around it, hulls are an index into the hulls registered with the narrowphase.
+struct Shape
+{
+	ShapeType type = ShapeType::Box;
+	float radius = 0.5f;		 // sphere and capsule
+	float halfHeight = 0.f;		 // capsule, half of the segment
+	glm::vec3 halfExtents{0.5f}; // box
+	uint32_t hull = 0;			 // convex hull
+
+	static Shape sphere(float radius)
+	{
+		Shape shape;
+		shape.type = ShapeType::Sphere;
+		shape.radius = radius;
+		return shape;
+	}
+
+	static Shape capsule(float radius, float halfHeight)
+	{
+		Shape shape;
+		shape.type = ShapeType::Capsule;
+		shape.radius = radius;
+		shape.halfHeight = halfHeight;
+		return shape;
+	}
+
+	static Shape box(const glm::vec3 &halfExtents)
+	{
+		Shape shape;
+		shape.type = ShapeType::Box;
+		shape.halfExtents = halfExtents;
+		return shape;
+	}
+
+	static Shape convex_hull(uint32_t hull)
+	{
+		Shape shape;
+		shape.type = ShapeType::ConvexHull;
+		shape.hull = hull;
+		return shape;
+	}
+};
+
+struct ShapeTransform
+{
+	glm::vec3 position{0.f};
+	glm::quat orientation{1.f, 0.f, 0.f, 0.f};
+};
+
+// The points of a convex hull in body space. Support points are found by walking every vertex, which
+// beats a hill climb over the adjacency for the few dozen vertices a collision hull should have.
+struct ConvexHull
+{
+	std::vector<glm::vec3> vertices;
+};
+
+#endif
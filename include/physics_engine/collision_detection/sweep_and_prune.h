@@ -0,0 +1,62 @@
+#ifndef SWEEP_AND_PRUNE
+#define SWEEP_AND_PRUNE
+
+#include "physics_engine/collision_detection/dynamic_aabb_tree.h"
+
+#include <cstdint>
+#include <vector>
+
+// Broadphase that sorts every step instead of keeping a hierarchy. The boxes are radix sorted by their
+// minimum along the axis their centers vary the most on, then each box is swept against the ones that
+// start before it ends, testing the other two axes 8 boxes at a time with AVX2 when the cpu has it.
+// The sweep is split across the job system. Nothing is kept between steps, so it costs the same no
+// matter how much moved, which suits scenes where most things move a little every step.
+class SweepAndPrune
+{
+	// boxes by dense index, the proxy ids stay put when the last box fills a hole
+	std::vector<float> bounds[6]; // min x y z, max x y z
+	std::vector<uint32_t> userData;
+	std::vector<uint32_t> proxyIds;	  // dense index -> proxy
+	std::vector<uint32_t> denseIndex; // proxy -> dense index
+	std::vector<uint32_t> freeIds;
+
+	// the boxes in sweep order, sweep axis first, padded so the 8 wide loads never read past the end
+	std::vector<float> sorted[6];
+	std::vector<uint32_t> sortedUserData;
+
+	std::vector<uint32_t> keys[2];
+	std::vector<uint32_t> order[2];
+
+	std::vector<BroadphasePair> pairs;
+	std::vector<std::vector<BroadphasePair>> threadPairs;
+
+	int sweepAxis = 0;
+
+	int choose_axis() const;
+	void sort_boxes();
+
+public:
+	// the AVX2 sweep when the cpu has it, off for the scalar one
+	bool simd = true;
+
+	// bodies per job of the sweep
+	uint32_t grainSize = 1024;
+
+	uint32_t create_proxy(const Aabb &aabb, uint32_t userData);
+	void destroy_proxy(uint32_t proxy);
+	void create_proxies(const Aabb *aabbs, const uint32_t *userData, uint32_t count, uint32_t *outProxies);
+	void destroy_proxies(const uint32_t *proxies, uint32_t count);
+	void move_proxy(uint32_t proxy, const Aabb &aabb);
+	void clear();
+
+	// pairs of user data whose boxes overlap, a < b, sorted and each pair once
+	const std::vector<BroadphasePair> &update_pairs();
+
+	uint32_t proxy_count() const { return (uint32_t)proxyIds.size(); }
+	int sweep_axis() const { return sweepAxis; }
+
+	Aabb aabb(uint32_t proxy) const;
+	uint32_t user_data(uint32_t proxy) const { return userData[denseIndex[proxy]]; }
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef CONTACT_SOLVER
+#define CONTACT_SOLVER
+
+#include "physics_engine/rigid_body_world.h"
+#include "physics_engine/collision_detection/narrowphase.h"
+
+#include <cstdint>
+#include <vector>
+
+constexpr uint32_t SOLVER_LANES = 8;
+
+// Directions of a contact point, the normal first and then the two friction directions
+constexpr uint32_t CONTACT_DIRECTIONS = 3;
+
+// A body while the contacts are solved, its velocities and world inverse inertia ( xx yy zz xy xz yz )
+// copied out of the streams so a constraint reads one or two cache lines per body instead of twelve
+struct SolverBody
+{
+	glm::vec3 linear;
+	glm::vec3 angular;
+	float inverseInertia[6];
+};
+
+// One contact point between two bodies, by dense index. The normal comes first and then the two
+// friction directions, the second one is normal x tangent. Kept small, the solver streams through all
+// of them every iteration and the angular terms are cheaper to recompute than to load.
+struct ContactConstraint
+{
+	uint32_t a;
+	uint32_t b;
+	glm::vec3 normal;
+	glm::vec3 tangent;
+	glm::vec3 offsetA; // from the centers of the bodies to the point
+	glm::vec3 offsetB;
+	float mass[CONTACT_DIRECTIONS];
+	float impulse[CONTACT_DIRECTIONS]; // accumulated
+	float inverseMassA;
+	float inverseMassB;
+	float bias; // velocity the normal may approach with, negative to push a penetration out
+	float friction;
+};
+
+// 8 constraints of one color in lanes, no two of them share a dynamic body so they are solved at once.
+// [axis][lane], the lanes past count are padding with no mass.
+struct ContactBatch
+{
+	uint32_t a[SOLVER_LANES];
+	uint32_t b[SOLVER_LANES];
+	uint32_t constraints[SOLVER_LANES]; // where the lanes came from, to hand the impulses back
+	uint32_t count;
+	float normal[3][SOLVER_LANES];
+	float tangent[3][SOLVER_LANES];
+	float offsetA[3][SOLVER_LANES];
+	float offsetB[3][SOLVER_LANES];
+	float mass[CONTACT_DIRECTIONS][SOLVER_LANES];
+	float impulse[CONTACT_DIRECTIONS][SOLVER_LANES];
+	float inverseMassA[SOLVER_LANES];
+	float inverseMassB[SOLVER_LANES];
+	float bias[SOLVER_LANES];
+	float friction[SOLVER_LANES];
+};
+
+struct ContactSolverStats
+{
+	uint32_t islands;		  // of dynamic bodies, a body touching nothing is one
+	uint32_t sleepingIslands; // skipped
+	uint32_t splitIslands;	  // solved by color instead of as a whole
+	uint32_t colors;		  // of the largest split island
+	uint32_t constraints;	  // contact points solved
+	uint32_t bodiesAsleep;
+	float solveMs;
+};
+
+// Sequential impulses over the contacts of one step. Bodies touching through dynamic bodies form an
+// island ( union-find over the contacts, static bodies do not join islands ), islands share nothing
+// and are solved whole on separate jobs. Islands with more than splitThreshold points would keep one job
+// busy, they are split by greedy graph coloring into colors that touch every body at most once, and each
+// color is packed into batches of 8 solved lane by lane in parallel. Islands that rested for timeToSleep
+// are put to sleep and skipped until something awake touches them.
+class ContactSolver
+{
+	struct Island
+	{
+		uint32_t bodyBegin;
+		uint32_t bodyCount;
+		uint32_t constraintBegin;
+		uint32_t constraintCount;
+		bool asleep;
+	};
+
+	// impulses of the last step by body id pair, to start from
+	struct CachedManifold
+	{
+		uint64_t key;
+		uint32_t pointCount;
+		glm::vec3 positions[MAX_MANIFOLD_POINTS];
+		float impulses[MAX_MANIFOLD_POINTS][CONTACT_DIRECTIONS];
+	};
+
+	// by dense body index
+	std::vector<SolverBody> bodies;
+	std::vector<uint32_t> parents;
+	std::vector<uint32_t> bodyIslands;
+	std::vector<uint64_t> colorMasks;
+
+	std::vector<Island> islands;
+	std::vector<uint32_t> islandBodies;
+	std::vector<uint32_t> smallIslands;
+	std::vector<uint32_t> largeIslands;
+
+	std::vector<uint32_t> manifoldConstraints; // first constraint of a manifold, ~0u while asleep
+	std::vector<ContactConstraint> constraints;
+
+	// of the split island being solved
+	std::vector<uint32_t> constraintColors;
+	std::vector<uint32_t> colorBatches; // first batch of every color, and one past the last
+	std::vector<uint32_t> colorOrder;	// constraints by batch lane, ~0u for padding
+	std::vector<uint32_t> overflow;		// constraints that found no free color, solved one by one
+	std::vector<ContactBatch> batches;
+
+	std::vector<CachedManifold> cache;
+	std::vector<CachedManifold> nextCache;
+
+	// by body id
+	std::vector<float> sleepTimers;
+	std::vector<uint8_t> sleeping;
+
+	ContactSolverStats stats{};
+
+	uint32_t find(uint32_t body);
+	void build_islands(RigidBodyWorld &world, const std::vector<ContactManifold> &manifolds);
+	void prepare_constraints(RigidBodyWorld &world, const std::vector<ContactManifold> &manifolds, float dt);
+	void solve_split_island(const Island &island);
+	void store_impulses(const RigidBodyWorld &world, const std::vector<ContactManifold> &manifolds);
+	void update_sleep(RigidBodyWorld &world, float dt);
+	void copy_velocities(RigidBodyWorld &world, bool toStreams);
+
+public:
+	uint32_t iterations = 8;
+	float friction = 0.6f;
+
+	// fraction of the penetration past the slop pushed out every step
+	float baumgarte = 0.2f;
+	float slop = 0.005f;
+
+	// start from the impulses of the last step, points match when closer than this
+	bool warmStarting = true;
+	float warmStartDistance = 0.05f;
+
+	// off solves every island whole, to compare
+	bool splitIslands = true;
+	uint32_t splitThreshold = 512;
+
+	// the AVX2 batch solve when the cpu has it, off for the scalar lanes
+	bool simd = true;
+
+	// small islands per job, and batches of a color per job
+	uint32_t grainSize = 16;
+	uint32_t batchGrainSize = 8;
+
+	// bodies slower than this for timeToSleep seconds, all of an island, fall asleep
+	bool sleepEnabled = true;
+	float sleepLinearVelocity = 0.05f;
+	float sleepAngularVelocity = 0.1f;
+	float timeToSleep = 0.5f;
+
+	// manifolds are by body handle id, as the user data of the proxies. Call it from the world's
+	// constraintSolver hook, it works on the integrated velocities.
+	void solve(RigidBodyWorld &world, const std::vector<ContactManifold> &manifolds, float dt);
+	void clear();
+
+	const ContactSolverStats &get_stats() const { return stats; }
+};
+
+// stacks of boxes ( many small islands ) and a pile of boxes side by side ( one large island ) settling on the ground,
+// solved by color against as whole islands, and the step once they sleep
+void run_solver_benchmark();
+
+#endif
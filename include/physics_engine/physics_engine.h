@@ -1,11 +1,40 @@
 #ifndef PHYSICS_ENGINE
 #define PHYSICS_ENGINE
 
+#include "physics_engine/rigid_body_world.h"
+#include "physics_engine/collision_detection/collision_detection.h"
+#include "physics_engine/contact_solver.h"
+
 #include <iostream>
 
 class PhysicsEngine {
 
 	bool isInitialized = false;
+
+	RigidBodyWorld world;
+	int spawnCount = 1000;
+
+	CollisionDetection collision;
+	std::vector<uint32_t> bodyProxies; // by body handle id
+	bool simd = true;
+
+	std::vector<Shape> bodyShapes; // by body handle id
+	std::vector<ShapeTransform> bodyTransforms; // refreshed before the narrowphase
+	std::vector<uint8_t> bodyActive; // by body handle id, dynamic and awake, pairs of two inactive bodies are not collided
+
+	ContactSolver solver;
+	bool groundAdded = false; // the static box the bodies land on, added with the first spawn
+
+	// scratch of the broadphase update
+	std::vector<uint32_t> movedProxies;
+	std::vector<Aabb> movedAabbs;
+	std::vector<glm::vec3> displacements;
+
+	void addGround();
+	void spawnBodies(uint32_t count);
+	void updateBroadphase();
+	void solveContacts(float dt);
+	void drawWorldWindow(float frameSeconds);
 public:
 	PhysicsEngine();
 
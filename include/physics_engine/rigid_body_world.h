@@ -0,0 +1,182 @@
+#ifndef RIGID_BODY_WORLD
+#define RIGID_BODY_WORLD
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Stable name of a body. Bodies are stored densely and move around on removal, the handle does not.
+// Ids are reused once a body is removed, the generation tells a stale handle from the new body.
+struct BodyHandle
+{
+	uint32_t id = ~0u;
+	uint32_t generation = 0;
+
+	bool valid() const { return id != ~0u; }
+	bool operator==(const BodyHandle &other) const = default;
+};
+
+struct RigidBodyDesc
+{
+	glm::vec3 position{0.f};
+	glm::quat orientation{1.f, 0.f, 0.f, 0.f};
+	glm::vec3 linearVelocity{0.f};
+	glm::vec3 angularVelocity{0.f};
+
+	float mass = 1.f;		// 0 makes the body static
+	glm::vec3 inertia{1.f}; // principal moments in body space
+
+	float linearDamping = 0.01f;
+	float angularDamping = 0.05f;
+};
+
+// One float array per component, the integrator walks them linearly and the compiler vectorizes it.
+enum class BodyStream : uint32_t
+{
+	PositionX,
+	PositionY,
+	PositionZ,
+	OrientationX,
+	OrientationY,
+	OrientationZ,
+	OrientationW,
+	LinearVelocityX,
+	LinearVelocityY,
+	LinearVelocityZ,
+	AngularVelocityX,
+	AngularVelocityY,
+	AngularVelocityZ,
+	ForceX,
+	ForceY,
+	ForceZ,
+	TorqueX,
+	TorqueY,
+	TorqueZ,
+	InverseMass,
+	InverseInertiaX, // body space, principal axes
+	InverseInertiaY,
+	InverseInertiaZ,
+	InverseInertiaWorldXX, // world space, symmetric, refreshed after every step
+	InverseInertiaWorldYY,
+	InverseInertiaWorldZZ,
+	InverseInertiaWorldXY,
+	InverseInertiaWorldXZ,
+	InverseInertiaWorldYZ,
+	LinearDamping,
+	AngularDamping,
+	Awake, // 1, or 0 while asleep, which stops the velocity integration
+	PreviousPositionX, // state before the last step, for interpolation
+	PreviousPositionY,
+	PreviousPositionZ,
+	PreviousOrientationX,
+	PreviousOrientationY,
+	PreviousOrientationZ,
+	PreviousOrientationW,
+	Count,
+};
+
+struct RigidBodyWorldStats
+{
+	uint32_t bodies;
+	uint32_t steps; // taken by the last advance
+	float stepMs;	// of the last step
+};
+
+// Rigid bodies in structure of arrays layout, stepped at a fixed rate independent of the frame rate.
+// advance() is fed the frame time and runs as many fixed steps as it covers, step() runs exactly one
+// and is what headless runs and benchmarks call. Both run on the job system when it is up.
+class RigidBodyWorld
+{
+	std::vector<float> streams[(size_t)BodyStream::Count];
+
+	std::vector<uint32_t> bodyIds;	  // dense index -> handle id
+	std::vector<uint32_t> denseIndex; // handle id -> dense index, ~0u when free
+	std::vector<uint32_t> freeIds;
+	std::vector<uint32_t> generations; // handle id -> bumped every time the id is freed
+
+	float accumulator = 0.f;
+	RigidBodyWorldStats stats{};
+
+	void save_previous_state(uint32_t begin, uint32_t end);
+	void wake(uint32_t index) { streams[(size_t)BodyStream::Awake][index] = 1.f; }
+	void integrate_velocities(uint32_t begin, uint32_t end, float dt);
+	void integrate_positions(uint32_t begin, uint32_t end, float dt);
+	void update_inertia(uint32_t begin, uint32_t end);
+
+	template <typename F>
+	void for_each_range(F &&function);
+
+public:
+	glm::vec3 gravity{0.f, -9.81f, 0.f};
+	float fixedTimestep = 1.f / 60.f;
+
+	// frame time beyond this many steps is dropped instead of falling further behind every frame
+	uint32_t maxStepsPerAdvance = 4;
+
+	// bodies per job, the passes run single threaded below it
+	uint32_t grainSize = 4096;
+	bool multithreaded = true;
+
+	// called every step once the velocities are integrated and before the positions are, where the
+	// collisions are found and the contacts solved
+	std::function<void(float dt)> constraintSolver;
+
+	BodyHandle add_body(const RigidBodyDesc &desc);
+	void remove_body(BodyHandle body);
+	void clear();
+	void reserve(uint32_t count);
+
+	uint32_t body_count() const { return (uint32_t)bodyIds.size(); }
+	bool contains(BodyHandle body) const
+	{
+		return body.id < denseIndex.size() && denseIndex[body.id] != ~0u && generations[body.id] == body.generation;
+	}
+	uint32_t index(BodyHandle body) const
+	{
+		assert(contains(body) && "stale or invalid body handle");
+		return denseIndex[body.id];
+	}
+	BodyHandle handle(uint32_t index) const { return handle_of_id(bodyIds[index]); }
+	// current handle of an id, for the systems that only keep the id like the broadphase user data
+	BodyHandle handle_of_id(uint32_t id) const { return BodyHandle{id, id < generations.size() ? generations[id] : 0}; }
+
+	float *stream(BodyStream stream) { return streams[(size_t)stream].data(); }
+	const float *stream(BodyStream stream) const { return streams[(size_t)stream].data(); }
+
+	glm::vec3 position(BodyHandle body) const;
+	glm::quat orientation(BodyHandle body) const;
+	glm::vec3 linear_velocity(BodyHandle body) const;
+	glm::vec3 angular_velocity(BodyHandle body) const;
+
+	void set_transform(BodyHandle body, const glm::vec3 &position, const glm::quat &orientation);
+	void set_velocity(BodyHandle body, const glm::vec3 &linear, const glm::vec3 &angular);
+
+	// sleeping bodies keep still until something wakes them, setting a velocity or applying anything does
+	bool awake(BodyHandle body) const { return stream(BodyStream::Awake)[index(body)] != 0.f; }
+	void set_awake(BodyHandle body, bool awake);
+
+	// accumulated until the end of the next step
+	void apply_force(BodyHandle body, const glm::vec3 &force);
+	void apply_torque(BodyHandle body, const glm::vec3 &torque);
+	void apply_impulse(BodyHandle body, const glm::vec3 &impulse, const glm::vec3 &point);
+
+	// runs the fixed steps frameSeconds covers, returns how many
+	uint32_t advance(float frameSeconds);
+	void step(float dt);
+
+	// how far the time left over from advance is into the next step, for drawing between two steps
+	float interpolation_alpha() const { return accumulator / fixedTimestep; }
+	glm::vec3 interpolated_position(BodyHandle body) const;
+	glm::quat interpolated_orientation(BodyHandle body) const;
+
+	const RigidBodyWorldStats &get_stats() const { return stats; }
+};
+
+// ns per body per step of the integrator at 10k and 100k bodies, single threaded and on the job system
+void run_physics_benchmark();
+
+#endif
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstdint>
+
+// Calls of the global operator new since startup, on every thread. The engine replaces the global
+// operator new and delete to count them, the difference around a piece of code is what it allocated.
+uint64_t heap_allocation_count();
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <optional>
+
+// Linear allocator for cpu data that only lives until the frame slot comes around again. Allocations
+// bump a pointer through one block, deallocate does nothing and reset hands the whole block back.
+// When a frame needs more than the block the rest comes from the heap, and the next reset grows the
+// block so the steady state stays inside it.
+class FrameArena : public std::pmr::memory_resource
+{
+public:
+    FrameArena() = default;
+    FrameArena(const FrameArena &) = delete;
+    FrameArena &operator=(const FrameArena &) = delete;
+    ~FrameArena() override;
+
+    void init(size_t capacity);
+    void destroy();
+
+    // call once nothing allocated from the arena is used anymore, after the fence and deletion queue of the slot
+    void reset();
+
+    size_t capacity() const { return _capacity; }
+    size_t used() const { return _used; }
+    size_t high_water() const { return _highWater; }
+    size_t overflow_count() const { return _overflowCount; } // heap blocks taken since init
+
+private:
+    void *do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {}
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+
+    // the heap behind the block, counts how often it is needed
+    struct Overflow : std::pmr::memory_resource
+    {
+        size_t count{0};
+
+        void *do_allocate(size_t bytes, size_t alignment) override;
+        void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+    };
+
+    std::byte *_block{nullptr};
+    size_t _capacity{0};
+    size_t _used{0};
+    size_t _highWater{0};
+    size_t _overflowCount{0};
+
+    Overflow _overflow;
+    std::optional<std::pmr::monotonic_buffer_resource> _linear;
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <chrono>
+
+// Holds the frame loop to a target rate. The wait is slept through and only the last stretch is spun,
+// that stretch follows how much the os actually oversleeps so it stays short on a quiet system.
+class FramePacer
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    // 0 disables the limiter
+    void set_target_fps(float fps);
+    float target_fps() const { return _targetFps; }
+
+    // blocks until the next frame is due, returns the time waited in ms
+    float wait();
+
+    // current spin stretch, the largest recent oversleep
+    float sleep_margin_ms() const { return std::chrono::duration<float, std::milli>(_margin).count(); }
+
+private:
+    float _targetFps{0.f};
+    clock::duration _period{clock::duration::zero()};
+    clock::time_point _next{};
+    clock::duration _margin{std::chrono::microseconds(500)};
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Offscreen run of the engine without a window or swapchain, for frame time regression runs on
+// build hosts without a display ( lavapipe or any other software vulkan ).
+struct HeadlessSettings
+{
+    uint32_t frameCount{300};
+    uint32_t width{1700};
+    uint32_t height{900};
+
+    // one csv row per frame: cpu and gpu time, draws and triangles
+    std::string timingsPath{"frame_timings.csv"};
+
+    // png readbacks of the draw image written to <capturePath>_<frame>.png, empty disables them.
+    // every captureInterval frames, or only the last frame when it is 0
+    std::string capturePath;
+    uint32_t captureInterval{0};
+
+    // scene loaded and fully uploaded before the measured frames start
+    std::string scenePath;
+
+    // device memory the streamed textures of the scene may take, 0 keeps the engine default
+    uint32_t textureBudgetMB{0};
+
+    // every render graph barrier on its own and on ALL_COMMANDS, the baseline for the barrier numbers
+    bool conservativeBarriers{false};
+
+    // background on the compute queue when the device has one, off for the graphics queue only baseline
+    bool asyncCompute{true};
+
+    // instead of the timed frames: fragments the movable image pool with streamed textures, defragments it
+    // and checks the textures still show their own contents through their bindless slots
+    bool defragmentationCheck{false};
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "vk_texture_streaming.h"
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// KTX2 files as the texture cooker writes them: one 2d image, one layer and face, a full mip chain and
+// no supercompression, so every level can be copied from the file into a staging buffer as it is.
+// levels[0] is the finest. The file is replaced atomically.
+bool write_ktx2(const std::string &path, VkFormat format, VkExtent2D extent, const std::vector<std::vector<uint8_t>> &levels);
+
+// Reads the levels from the file when the streamer needs them, only the header and level index stay in memory.
+class Ktx2TextureSource : public TextureSource
+{
+public:
+    // nullptr when the file is missing or holds something the engine does not upload as is
+    static std::unique_ptr<Ktx2TextureSource> open(const std::string &path);
+
+    VkFormat format() const override { return _format; }
+    VkExtent2D extent() const override { return _extent; }
+    uint32_t level_count() const override { return (uint32_t)_levels.size(); }
+    size_t level_size(uint32_t level) const override { return _levels[level].size; }
+    bool read_level(uint32_t level, void *dst) override;
+
+private:
+    struct Level
+    {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    std::ifstream _file;
+    VkFormat _format;
+    VkExtent2D _extent;
+    std::vector<Level> _levels;
+};
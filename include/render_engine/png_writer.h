@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Writes 8 bit RGBA pixels as a PNG. The image data goes out in stored ( uncompressed ) deflate blocks,
+// captures are meant for diffing and archiving, not for size.
+bool write_png(const std::string &path, uint32_t width, uint32_t height, const uint8_t *rgba);
@@ -4,6 +4,8 @@
 #include <iostream>
 #include <iomanip>
 
+#include "render_engine/headless.h"
+
 class RenderEngine {
 	bool isInitialized = false;
 public:
@@ -13,6 +15,9 @@ public:
 	void run();
 
 	int MainWindow();
+
+	// offscreen benchmark run, returns the process exit code
+	int Headless(const HeadlessSettings &settings);
 };
 
 #endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Watches the shader directory with inotify. Edited GLSL sources are compiled with glslc when it is on
+// the PATH, on a thread of the watcher so the frame never waits for it. The resulting .spv shows up like
+// any other rewritten binary on a later poll, and only then are the pipelines swapped.
+class ShaderWatcher
+{
+public:
+    ~ShaderWatcher();
+
+    // false when inotify is not available, poll then never reports anything
+    bool init(const std::string &directory);
+    void cleanup();
+
+    // file names of the .spv binaries written since the last call, never blocks
+    std::vector<std::string> poll();
+
+private:
+    std::string _directory;
+    int _fd{-1};
+    int _watch{-1};
+    bool _hasCompiler{false};
+
+    std::thread _compiler;
+    std::mutex _compileLock;
+    std::condition_variable _compileWake;
+    std::vector<std::string> _pendingSources;
+    bool _stopCompiler{false};
+
+    void compile_loop();
+    bool compile(const std::string &source);
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Block encoders for the formats the texture cooker emits. A block is 4x4 rgba8 texels in row order.
+
+// BC7 mode 6 only: one subset, rgba endpoints with a p-bit each and 4 bit indices. Blocks with
+// several unrelated colors would do better in the partitioned modes, but mode 6 is never worse than
+// BC1/BC3 and keeps the encoder fast enough to cook a scene without a cache.
+void encode_bc7_block(const uint8_t texels[64], uint8_t block[16]);
+
+// two BC4 blocks of the red and the green channel, tangent space normals with z rebuilt in the shader
+void encode_bc5_block(const uint8_t texels[64], uint8_t block[16]);
+
+// compress a whole level, blocks over the edge repeat the last row and column.
+// the block rows are spread over the job system
+std::vector<uint8_t> compress_bc7(const uint8_t *rgba, uint32_t width, uint32_t height);
+std::vector<uint8_t> compress_bc5(const uint8_t *rgba, uint32_t width, uint32_t height);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+
+enum class TextureKind
+{
+    Color,  // BC7, mips filtered in linear light
+    Normal, // BC5 of x and y, mips renormalized
+};
+
+// Offline step: loads a png / jpg / tga with stb_image, builds the full mip chain on the cpu, block
+// compresses every level and writes them as KTX2, ready to be streamed without any work at load time.
+bool cook_texture(const std::string &srcPath, const std::string &dstPath, TextureKind kind);
+
+std::string cooked_texture_path(const std::string &srcPath);
+
+// Path of the KTX2 cooked from srcPath, cooked first when it is missing or older than the source. Meant for
+// loader threads, the compression takes a while. srcPath itself when it is a KTX2 already or can not be cooked
+std::string load_cooked_texture(const std::string &srcPath, TextureKind kind);
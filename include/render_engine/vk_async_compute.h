@@ -0,0 +1,57 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_profiler.h"
+
+#include <vector>
+
+// Compute work recorded into its own command buffer and submitted to a compute queue of a
+// different family, so it runs next to whatever the graphics queue is still busy with.
+// Images written there are released to the graphics family when the batch is submitted, the
+// graphics command buffer acquires them and waits on the timeline value of the submit.
+class AsyncCompute
+{
+public:
+    void init(VkDevice device, VkQueue computeQueue, uint32_t computeQueueFamily, uint32_t graphicsQueueFamily, uint32_t frameCount, uint32_t timestampValidBits);
+    void cleanup();
+
+    // starts the command buffer of a frame slot. the graphics fence of the slot has to be waited on,
+    // the graphics submit that consumed the last batch of the slot waited on that batch
+    VkCommandBuffer begin(uint32_t frameIndex);
+
+    // the image is handed to the graphics queue in newLayout, for the given graphics stages and accesses
+    void release_image(VkImage image, VkImageAspectFlags aspect, VkImageLayout oldLayout, VkImageLayout newLayout,
+                       VkPipelineStageFlags2 srcStages, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStages, VkAccessFlags2 dstAccess);
+
+    // records the release barriers and submits the slot's command buffer
+    void submit(uint32_t frameIndex);
+
+    // records the acquire barriers of the last submit. false if nothing was submitted since the last call,
+    // otherwise fills the timeline wait for the graphics submit
+    bool record_graphics_work(VkCommandBuffer cmd, VkSemaphoreSubmitInfo &waitInfo);
+
+    // timestamps recorded on the compute queue, the same read back rules as the graphics ones
+    GpuTimestamps &timestamps(uint32_t frameIndex) { return _frames[frameIndex].timestamps; }
+
+private:
+    struct FrameResources
+    {
+        VkCommandPool commandPool;
+        VkCommandBuffer commandBuffer;
+        GpuTimestamps timestamps;
+    };
+
+    VkDevice _device;
+    VkQueue _computeQueue;
+    uint32_t _computeQueueFamily;
+    uint32_t _graphicsQueueFamily;
+
+    std::vector<FrameResources> _frames;
+
+    VkSemaphore _timeline;
+    uint64_t _nextValue{1};
+    uint64_t _pendingWaitValue{0};
+
+    std::vector<VkImageMemoryBarrier2> _releases;
+    std::vector<VkImageMemoryBarrier2> _acquires;
+};
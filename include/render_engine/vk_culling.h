@@ -0,0 +1,143 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_descriptors.h"
+
+#include <vector>
+
+class VulkanEngine;
+
+// per object data read by the culling pass and the indirect vertex shader, matches ObjectData in cull.comp
+struct GPUObjectData
+{
+    glm::mat4 transform;
+    glm::vec4 sphere; // local space center, radius
+    VkDeviceAddress vertexBuffer;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t materialIndex;
+    uint32_t batch;
+    uint32_t commandBase; // first draw command slot of the batch
+    uint32_t pad;
+};
+
+static_assert(sizeof(GPUObjectData) == 112);
+
+// matches CullData in cull.comp
+struct GPUCullData
+{
+    glm::mat4 pyramidViewProj;
+    glm::vec4 frustum[6];
+    glm::vec4 pyramidSize; // xy size of mip 0, z mip count
+    uint32_t objectCount;
+    uint32_t occlusionEnabled;
+    uint32_t pyramidImage;
+    uint32_t pyramidSampler;
+};
+
+// objects sharing an index buffer, drawn with one vkCmdDrawIndexedIndirectCount
+struct IndirectBatch
+{
+    VkBuffer indexBuffer;
+    uint32_t firstObject;
+    uint32_t objectCount;
+};
+
+struct CullStats
+{
+    bool valid;
+    uint32_t totalObjects;
+    uint32_t visibleObjects;
+    uint32_t visibleTriangles;
+};
+
+// GPU driven path: a compute pass culls every object against the frustum and last frame's depth
+// pyramid and writes the surviving draws, the draw count per batch comes from the same pass.
+class GpuCulling
+{
+public:
+    void init(VulkanEngine *engine, uint32_t frameCount);
+    void cleanup();
+
+    // replaces the object list, objects have to be sorted by batch. takes effect once uploaded
+    void set_objects(std::vector<GPUObjectData> &&objects, std::vector<IndirectBatch> &&batches);
+
+    bool has_objects() const { return _objectCount > 0 || _pending.objectCount > 0; }
+
+    // counts written by this frame slot the last time it was recorded, call after its fence
+    CullStats read_stats(uint32_t frameIndex);
+
+    // outside of a rendering scope, before the draws
+    void record_cull(VkCommandBuffer cmd, uint32_t frameIndex, const glm::mat4 &viewproj, bool occlusion);
+
+    // inside the geometry rendering scope
+    void record_draws(VkCommandBuffer cmd, const glm::mat4 &viewproj);
+
+    // downsamples the depth buffer for the occlusion test of the next frame.
+    // the depth image has to be in SHADER_READ_ONLY_OPTIMAL
+    void record_depth_pyramid(VkCommandBuffer cmd, DescriptorAllocatorGrowable &frameDescriptors, const AllocatedImage &depthImage, VkExtent2D drawExtent, const glm::mat4 &viewproj);
+
+private:
+    struct ObjectBuffers
+    {
+        AllocatedBuffer objects;
+        AllocatedBuffer drawCommands;
+        AllocatedBuffer counts;
+
+        VkDeviceAddress objectsAddress;
+        VkDeviceAddress drawCommandsAddress;
+        VkDeviceAddress countsAddress;
+
+        std::vector<IndirectBatch> batches;
+        uint32_t objectCount{0};
+        uint64_t uploadTicket{0};
+    };
+
+    struct FrameResources
+    {
+        AllocatedBuffer cullData;
+        VkDeviceAddress cullDataAddress;
+
+        // counts copied back for the stats
+        AllocatedBuffer readback;
+        uint32_t readbackObjects;
+        bool recorded;
+    };
+
+    VulkanEngine *_engine;
+
+    ObjectBuffers _active;
+    ObjectBuffers _pending;
+    uint32_t _objectCount{0};
+
+    std::vector<FrameResources> _frames;
+
+    VkPipelineLayout _cullLayout;
+    VkPipeline _cullPipeline;
+
+    MaterialPipeline _drawPipeline;
+
+    // depth pyramid, min reduction so every texel holds the farthest depth below it
+    AllocatedImage _pyramid;
+    std::vector<VkImageView> _pyramidMips;
+    uint32_t _pyramidLevels;
+    VkExtent2D _pyramidExtent;
+    uint32_t _pyramidIndex;
+    bool _pyramidValid{false};
+    glm::mat4 _pyramidViewProj;
+
+    VkSampler _reductionSampler;
+    uint32_t _reductionSamplerIndex;
+
+    VkDescriptorSetLayout _reduceSetLayout;
+    VkPipelineLayout _reduceLayout;
+    VkPipeline _reducePipeline;
+
+    void init_pipelines();
+    void init_pyramid();
+
+    VkPipeline build_draw_pipeline();
+
+    void activate_pending();
+    void destroy_object_buffers(const ObjectBuffers &buffers);
+};
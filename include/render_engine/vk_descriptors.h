@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <deque>
+#include <memory_resource>
 #include <span>
 
 #include "vk_types.h"
@@ -21,9 +22,13 @@ struct DescriptorLayoutBuilder
 //> writer
 struct DescriptorWriter
 {
-    std::deque<VkDescriptorImageInfo> imageInfos;
-    std::deque<VkDescriptorBufferInfo> bufferInfos;
-    std::vector<VkWriteDescriptorSet> writes;
+    // writers used while recording a frame take the frame arena, the infos then never touch the heap
+    explicit DescriptorWriter(std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+        : imageInfos(resource), bufferInfos(resource), writes(resource) {}
+
+    std::pmr::deque<VkDescriptorImageInfo> imageInfos;
+    std::pmr::deque<VkDescriptorBufferInfo> bufferInfos;
+    std::pmr::vector<VkWriteDescriptorSet> writes;
 
     void write_image(int binding, VkImageView image, VkSampler sampler, VkImageLayout layout, VkDescriptorType type);
     void write_buffer(int binding, VkBuffer buffer, size_t size, size_t offset, VkDescriptorType type);
@@ -78,4 +83,59 @@ private:
     std::vector<VkDescriptorPool> readyPools;
     uint32_t setsPerPool;
 };
-//< descriptor_allocator_grow
\ No newline at end of file
+//< descriptor_allocator_grow
+
+//> bindless
+// One update-after-bind set shared by every draw. Resources are registered once and addressed by
+// index from push constants and material data, nothing is allocated or written per draw.
+struct BindlessRegistry
+{
+    static constexpr uint32_t SAMPLED_IMAGE_BINDING = 0;
+    static constexpr uint32_t SAMPLER_BINDING = 1;
+    static constexpr uint32_t STORAGE_BUFFER_BINDING = 2;
+
+    VkDescriptorSetLayout layout;
+    VkDescriptorSet set;
+
+    // capacities are clamped to the update-after-bind limits of the device
+    void init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t maxImages, uint32_t maxSamplers, uint32_t maxBuffers);
+    void destroy(VkDevice device);
+
+    uint32_t add_image(VkImageView image, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    uint32_t add_sampler(VkSampler sampler);
+    uint32_t add_buffer(VkBuffer buffer, VkDeviceSize size, VkDeviceSize offset = 0);
+
+    // the slot is handed out again by the next add, only remove once no frame in flight can reference it
+    void remove_image(uint32_t index);
+    void remove_sampler(uint32_t index);
+    void remove_buffer(uint32_t index);
+
+    // writes everything registered since the last flush with a single vkUpdateDescriptorSets
+    void flush(VkDevice device);
+
+    // the view an image slot was last registered with
+    VkImageView image_view(uint32_t index) const { return imageViews[index]; }
+
+private:
+    struct Slots
+    {
+        uint32_t capacity{0};
+        uint32_t next{0};
+        std::vector<uint32_t> freeList;
+
+        uint32_t allocate();
+    };
+
+    VkDescriptorPool pool;
+
+    Slots images;
+    Slots samplers;
+    Slots buffers;
+
+    std::vector<VkImageView> imageViews;
+
+    std::deque<VkDescriptorImageInfo> imageInfos;
+    std::deque<VkDescriptorBufferInfo> bufferInfos;
+    std::vector<VkWriteDescriptorSet> writes;
+};
+//< bindless
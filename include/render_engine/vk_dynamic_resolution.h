@@ -0,0 +1,47 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_profiler.h"
+
+#include <vector>
+
+// Scales the draw extent so the resolution dependent passes fit a gpu time budget. The passes are timed
+// with queries of their own, a measurement only counts when it was taken at the current scale.
+class DynamicResolution
+{
+public:
+    void init(VkDevice device, uint32_t frameCount, uint32_t timestampValidBits, float timestampPeriod);
+    void destroy(VkDevice device);
+
+    // reads the time this frame slot measured and picks the scale of the next frame, call after its fence
+    void update(VkDevice device, uint32_t frameIndex);
+
+    // brackets the scaled passes, begin resets the queries so it has to be outside of a rendering scope
+    void begin(VkCommandBuffer cmd, uint32_t frameIndex);
+    void end(VkCommandBuffer cmd, uint32_t frameIndex);
+
+    // full is the largest extent the draw image can hold
+    VkExtent2D scaled_extent(VkExtent2D full) const;
+
+    float scale() const { return _scale; }
+    float gpu_time_ms() const { return _smoothedMs; }
+
+    bool enabled{true};
+    float targetMs{12.f};
+    float minScale{0.5f};
+    float maxScale{1.f};
+
+private:
+    struct FrameQueries
+    {
+        GpuTimestamps timestamps;
+        float scale{0.f}; // scale the queries were recorded at, 0 before the first recording
+    };
+
+    std::vector<FrameQueries> _frames;
+    std::vector<GpuTiming> _timings;
+    float _timestampPeriod{1.f};
+
+    float _scale{1.f};
+    float _smoothedMs{0.f};
+};
@@ -2,26 +2,114 @@
 
 #include "vk_types.h"
 
+#include <atomic>
+#include <chrono>
 #include <deque>
 #include <functional>
+#include <memory_resource>
 #include <span>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 #include "vk_mem_alloc.h"
 
 #include "camera.h"
+#include "frame_arena.h"
+#include "vk_async_compute.h"
+#include "frame_pacer.h"
+#include "headless.h"
+#include "vk_culling.h"
 #include "vk_descriptors.h"
+#include "vk_dynamic_resolution.h"
+#include "vk_frame_ring.h"
+#include "vk_loader.h"
+#include "vk_memory.h"
+#include "vk_mesh_cache.h"
 #include "vk_pipelines.h"
+#include "vk_profiler.h"
+#include "vk_render_graph.h"
+#include "shader_watcher.h"
+#include "vk_texture_streaming.h"
+#include "vk_uploader.h"
 
+// directory of the .spv binaries, also the one watched for hot reloads
+extern std::string SHADERS_PATH;
 
 struct EngineStats
 {
     float frametime;
     int triangle_count;
     int drawcall_count;
+    int culled_count;
     float mesh_draw_time;
+
+    // time blocked on the fence of the frame slot, and slept by the frame limiter
+    float fence_wait_time;
+    float pacer_wait_time;
+
+    // input polled to the gpu finishing the frame, measured when the slot is reused ( an upper bound ),
+    // and the same plus the wait for the display that the present mode implies
+    float input_to_gpu_latency{0.f};
+    float input_to_present_latency{0.f};
+
+    // startup cost of init_pipelines, and of the run that filled the pipeline cache
+    float pipeline_build_time;
+    float pipeline_cold_build_time;
+
+    // gpu time per pass, read back when the frame slot is reused
+    std::vector<GpuTiming> gpu_timings;
+    int gpu_timings_frame{-1}; // frame number gpu_timings were measured in
+
+    // gpu time of the background on the compute queue, 0 when it runs on the graphics queue
+    float async_compute_time{0.f};
+
+    // heap allocations on any thread while draw ran, and how much of its frame arena the slot used last time
+    uint64_t draw_heap_allocations{0};
+    size_t frame_arena_used{0};
+    size_t frame_arena_capacity{0};
+
+    // bytes of the frame ring the last frame wrote
+    size_t frame_ring_used{0};
+
+    // barriers and transient memory of the last render graph execution
+    RenderGraphStats render_graph;
+
+    // cpu time spent recording geometry commands, indexed by job system thread
+    std::vector<float> record_times;
+};
+
+struct RenderObject
+{
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    VkBuffer indexBuffer;
+
+    MaterialInstance *material;
+
+    glm::mat4 transform;
+    VkDeviceAddress vertexBufferAddress;
+};
+
+struct DrawContext
+{
+    std::vector<RenderObject> OpaqueSurfaces;
+};
+
+// a scene import running on its own thread, picked up by update_scene once done
+struct SceneLoadRequest
+{
+    std::string path;
+    std::thread thread;
+    std::atomic<bool> done{false};
+
+    // the cooked file when the cache could be used, the plain import otherwise
+    std::unique_ptr<CookedMeshScene> cooked;
+    std::optional<MeshSceneData> imported;
+
+    // of whichever of the two was used
+    std::vector<SceneMaterial> materials;
 };
 
 struct ComputePushConstants
@@ -35,6 +123,7 @@ struct ComputePushConstants
 struct ComputeEffect
 {
     const char *name;
+    const char *shader; // file name in the shader directory
 
     VkPipeline pipeline;
     VkPipelineLayout layout;
@@ -42,6 +131,14 @@ struct ComputeEffect
     ComputePushConstants data;
 };
 
+// a pipeline rebuilt when one of its shader binaries changes on disk
+struct ReloadablePipeline
+{
+    std::vector<std::string> shaders;
+    VkPipeline *pipeline;
+    std::function<VkPipeline()> build;
+};
+
 struct DeletionQueue
 {
     std::deque<std::function<void()>> deletors;
@@ -63,33 +160,128 @@ struct DeletionQueue
     }
 };
 
+// DeletionQueue for resources retired while recording a frame. Every closure is placed in the
+// memory resource instead of a std::function of its own, flush runs them newest first.
+struct FrameDeletionQueue
+{
+    explicit FrameDeletionQueue(std::pmr::memory_resource *resource) : resource(resource) {}
+
+    template <typename F>
+    void push_function(F &&function)
+    {
+        using Node = Deletor<std::decay_t<F>>;
+
+        Node *node = new (resource->allocate(sizeof(Node), alignof(Node))) Node(std::forward<F>(function));
+        node->next = last;
+        last = node;
+    }
+
+    void flush()
+    {
+        while (last != nullptr)
+        {
+            DeletorBase *deletor = last;
+            last = deletor->next;
+            deletor->run_and_destroy(resource);
+        }
+    }
+
+private:
+    struct DeletorBase
+    {
+        DeletorBase *next{nullptr};
+
+        virtual void run_and_destroy(std::pmr::memory_resource *resource) = 0;
+    };
+
+    template <typename F>
+    struct Deletor final : DeletorBase
+    {
+        F function;
+
+        template <typename G>
+        explicit Deletor(G &&f) : function(std::forward<G>(f)) {}
+
+        void run_and_destroy(std::pmr::memory_resource *resource) override
+        {
+            function();
+            this->~Deletor();
+            resource->deallocate(this, sizeof(Deletor), alignof(Deletor));
+        }
+    };
+
+    std::pmr::memory_resource *resource;
+    DeletorBase *last{nullptr};
+};
+
 struct FrameData
 {
     VkCommandPool _commandPool;
     VkCommandBuffer _mainCommandBuffer;
 
+    // one pool + secondary command buffer per job system thread, pools are not thread safe
+    std::vector<VkCommandPool> _threadCommandPools;
+    std::vector<VkCommandBuffer> _threadCommandBuffers;
+
     VkSemaphore _swapchainSemaphore, _renderSemaphore;
     VkFence _renderFence;
 
     DescriptorAllocatorGrowable _frameDescriptors;
 
-    DeletionQueue _deletionQueue;
+    GpuTimestamps _gpuTimestamps;
+
+    // cpu memory of the frame, reset once the fence and the deletion queue of the slot are through.
+    // only the thread running draw allocates from it
+    FrameArena _frameArena;
+
+    // target of the background on the compute queue, copied into the draw image
+    AllocatedImage _backgroundImage;
+
+    FrameDeletionQueue _deletionQueue{&_frameArena};
+
+    // frame number last submitted from this slot, and when the input it reacted to was polled
+    int _submittedFrame{-1};
+    std::chrono::steady_clock::time_point _inputTime;
 };
 
-constexpr unsigned int FRAME_OVERLAP = 2;
+// resources exist for this many frames, _framesInFlight of them are used
+constexpr unsigned int MAX_FRAMES_IN_FLIGHT = 4;
 
 class VulkanEngine
 {
 public:
-    FrameData _frames[FRAME_OVERLAP];
+    FrameData _frames[MAX_FRAMES_IN_FLIGHT];
 
-    FrameData &get_current_frame() { return _frames[_frameNumber % FRAME_OVERLAP]; };
+    FrameData &get_current_frame() { return _frames[_frameSlot]; };
     FrameData &get_last_frame();
+
+    // frames the cpu may record ahead of the gpu, 1 to MAX_FRAMES_IN_FLIGHT. changes apply at the next frame
+    void set_frames_in_flight(uint32_t count);
+    uint32_t frames_in_flight() const { return _framesInFlight; }
+
+    // takes effect when the swapchain is recreated, falls back to fifo when the surface lacks the mode
+    void set_present_mode(VkPresentModeKHR mode);
+
     VkQueue _graphicsQueue;
     uint32_t _graphicsQueueFamily;
 
+    // dedicated transfer queue when the device has one, the graphics queue otherwise
+    VkQueue _transferQueue;
+    uint32_t _transferQueueFamily;
+
+    // compute queue of a family without graphics, only valid when _hasAsyncCompute
+    VkQueue _computeQueue;
+    uint32_t _computeQueueFamily;
+    uint32_t _computeTimestampValidBits;
+    bool _hasAsyncCompute{false};
+
     bool _isInitialized{false};
     int _frameNumber{0};
+
+    uint32_t _framesInFlight{2};
+    uint32_t _requestedFramesInFlight{2};
+    uint32_t _frameSlot{0};
+    uint32_t _lastFrameSlot{0};
     bool stop_rendering{false};
     VkExtent2D _windowExtent{1700, 900};
 
@@ -103,27 +295,54 @@ public:
     VkDevice _device;                          // Vulkan device for commands
     VkSurfaceKHR _surface;                     // Vulkan window surface
 
+    float _timestampPeriod;                    // nanoseconds per gpu timestamp tick
+    uint32_t _timestampValidBits;
+    VkDeviceSize _bufferOffsetAlignment;       // larger of the uniform and storage buffer offset alignments
+
     VkSwapchainKHR _swapchain;
     VkFormat _swapchainImageFormat;
 
+    VkPresentModeKHR _presentMode{VK_PRESENT_MODE_FIFO_KHR};       // requested
+    VkPresentModeKHR _activePresentMode{VK_PRESENT_MODE_FIFO_KHR}; // what the swapchain got
+    std::vector<VkPresentModeKHR> _supportedPresentModes;
+    float _displayRefreshRate{60.f};
+
+    FramePacer _framePacer;
+    std::chrono::steady_clock::time_point _inputTime;
+
     std::vector<VkImage> _swapchainImages;
     std::vector<VkImageView> _swapchainImageViews;
     VkExtent2D _swapchainExtent;
 
     DeletionQueue _mainDeletionQueue;
 
+    // owns the allocator, every allocation is tagged with what it is for
+    GpuMemory _memory;
     VmaAllocator _allocator;
 
     // draw resources
     AllocatedImage _drawImage;
-    AllocatedImage _depthImage;
+    AllocatedImage _depthImage; // owned by the render graph, refreshed every frame
     VkExtent2D _drawExtent;
 
+    // declares the passes of every frame and places the image barriers between them
+    RenderGraph _renderGraph;
+    RGImageState _drawImageState;
+    RGImageState _swapchainImageState;
+    RGImage _depthImageHandle;
+
+    // picks _drawExtent below the draw image size when the gpu runs over budget, blitted up to the swapchain
+    DynamicResolution _dynamicResolution;
+
     DescriptorAllocator globalDescriptorAllocator;
 
     VkDescriptorSet _drawImageDescriptors;
     VkDescriptorSetLayout _drawImageDescriptorLayout;
 
+    // shared by every pipeline the engine and imgui create, kept on disk between runs
+    PipelineCache _pipelineCache;
+    bool _usePipelineCache{true};
+
     VkPipeline _gradientPipeline;
     VkPipelineLayout _gradientPipelineLayout;
 
@@ -133,20 +352,99 @@ public:
     VkCommandPool _immCommandPool;
 
     std::vector<ComputeEffect> backgroundEffects;
+
+    ShaderWatcher _shaderWatcher;
+    std::vector<ReloadablePipeline> _reloadablePipelines;
     int currentBackgroundEffect{0};
 
     VkPipelineLayout _trianglePipelineLayout;
     VkPipeline _trianglePipeline;
 
+    MaterialPipeline _meshPipeline;
+    MaterialInstance _defaultMaterial;
+
+    // one descriptor set for every texture, sampler and storage buffer the draws reference
+    BindlessRegistry _bindless;
+
+    AllocatedBuffer _materialBuffer;
+    uint32_t _materialBufferIndex;
+    uint32_t _materialCount{0};
+
+    AllocatedImage _whiteImage;
+    uint32_t _whiteImageIndex;
+    VkSampler _defaultSamplerLinear;
+    uint32_t _defaultSamplerIndex;
+
+    DrawContext mainDrawContext;
+    GPUSceneData sceneData;
+
+    // scene data and per draw constants of every frame, bound as set 1 of the mesh pipelines with
+    // the offsets of the current frame's allocations
+    FrameRingBuffer _frameRing;
+    VkDescriptorSetLayout _frameDataLayout;
+    VkDescriptorSet _frameDataSet;
+    uint32_t _sceneDataOffset;
+    uint32_t _drawDataOffset;
+    uint32_t _textureTableOffset;
+
+    // mip residency of streamed textures, materials reference them with TextureStreamer::material_index
+    TextureStreamer _textureStreamer;
+
+    // culls and draws the resident scenes on the gpu, mainDrawContext is only filled on the cpu path
+    GpuCulling _gpuCulling;
+    bool _gpuDriven{true};
+    bool _occlusionCulling{true};
+    size_t _culledSceneCount{0};
+
+    Camera mainCamera;
+
+    std::vector<std::shared_ptr<MeshScene>> loadedScenes;
+    std::vector<std::unique_ptr<SceneLoadRequest>> _sceneLoads;
+
+    // streams uploads through the transfer queue without stalling the frame loop
+    TransferUploader _uploader;
+
+    // renders the background on the compute queue while the graphics queue finishes the previous frame
+    AsyncCompute _asyncCompute;
+    bool _useAsyncCompute{true};
+    std::vector<GpuTiming> _computeTimings;
+
     void immediate_submit(std::function<void(VkCommandBuffer cmd)> &&function);
 
-    AllocatedBuffer create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage);
+    AllocatedBuffer create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, MemoryCategory category = MemoryCategory::Buffers);
 
-    AllocatedImage create_image(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped);
+    AllocatedImage create_image(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped, MemoryCategory category = MemoryCategory::Textures);
     AllocatedImage create_image(void *data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped);
 
+    // hands a texture to the streamer. A cooked KTX2 has its levels read from the file as they become resident,
+    // other images are decoded and filtered down to rgba8 mips right away.
+    // invalid when the file can not be used, reference it from materials with TextureStreamer::material_index
+    StreamedTexture load_texture(const std::string &path);
+
+    // appends a material to the bindless material table and returns its index
+    uint32_t add_material(const GPUGLTFMaterial &material);
+
+    // queues the upload of a mesh into device local buffers, ticket is the uploader timeline value of the copy
+    GPUMeshBuffers upload_mesh(std::span<const uint32_t> indices, std::span<const Vertex> vertices, uint64_t &ticket);
+
+    // imports a scene on a loader thread, it shows up in loadedScenes once uploaded
+    void load_scene_async(const std::string &path);
+
+    // compute pipeline of one shader in the shader directory, null if it does not build
+    VkPipeline build_compute_pipeline(VkPipelineLayout layout, const char *shaderFile);
+
+    // pipeline is replaced by the result of build whenever one of the shaders is rewritten
+    void register_reloadable_pipeline(std::vector<std::string> shaders, VkPipeline *pipeline, std::function<VkPipeline()> &&build);
+
     EngineStats stats;
 
+    bool _headless{false};
+    HeadlessSettings _headlessSettings;
+
+    // copy of the draw image of the current frame, headless captures only
+    AllocatedBuffer _captureBuffer;
+    bool _captureRequested{false};
+
     bool resize_requested{false};
     bool freeze_rendering{false};
 
@@ -162,30 +460,87 @@ public:
     // draw loop
     void draw();
 
-    void draw_background(VkCommandBuffer cmd);
+    void draw_background(VkCommandBuffer cmd, VkDescriptorSet targetImage);
+
+    // records and submits the background of the current frame slot to the compute queue
+    void record_async_background();
 
     void draw_geometry(VkCommandBuffer cmd);
 
+    // draws the survivors of the culling pass with one indirect count draw per scene
+    void draw_geometry_indirect(VkCommandBuffer cmd);
+
+    // records a slice of the draw list into the secondary command buffer of a thread, returns the cpu time in ms
+    float record_geometry_chunk(uint32_t chunkIndex, uint32_t chunkCount, GPUDrawData *draws, int &drawcallCount, int &triangleCount);
+
+    void update_scene();
+
+    // material table entries and streamed textures of a scene that was just loaded
+    void create_scene_materials(MeshScene &scene, const std::vector<SceneMaterial> &materials);
+
+    // asks the streamer for the mips of every visible material texture, from the size its surfaces cover on screen
+    void request_texture_levels();
+
+    // rebuilds the object list of the culling pass when a scene finished uploading
+    void update_culling_objects();
+
     void draw_main(VkCommandBuffer cmd);
 
     // run main loop
     void run();
 
+    // initializes the engine without a window or swapchain, frames end in the draw image
+    void init_headless(const HeadlessSettings &settings);
+
+    // renders settings.frameCount frames and writes their timings, returns a process exit code
+    int run_headless();
+
+    // the defragmentation scenario of HeadlessSettings::defragmentationCheck, returns a process exit code
+    int run_defragmentation_check();
+
 private:
     void init_vulkan();
     void init_swapchain();
     void init_commands();
     void init_sync_structures();
     void init_descriptors();
+    void init_bindless();
+    void init_frame_data();
+    void init_uploader();
+    void init_profiler();
 
     void init_pipelines();
     void init_background_pipelines();
     void init_triangle_pipeline();
+    void init_mesh_pipeline();
+
+    VkPipeline build_triangle_pipeline();
+    VkPipeline build_mesh_pipeline();
+
+    void reload_changed_shaders();
 
     void init_imgui();
 
     void resize_swapchain();
     void draw_imgui(VkCommandBuffer cmd, VkImageView targetImageView);
+    void draw_gpu_timeline();
+    void draw_frame_pacing_settings();
+    void draw_dynamic_resolution_settings();
+    void draw_render_graph_stats();
+    void draw_texture_streaming_stats();
+    void draw_memory_stats();
+
+    void build_render_graph(uint32_t swapchainImageIndex, bool asyncBackground);
+
+    // applies a pending frames in flight change, waits for the gpu
+    void apply_frames_in_flight();
+    void advance_frame();
+
+    // measured when a frame slot is reused, from the time its fence was waited on
+    void update_latency(std::chrono::steady_clock::time_point waitStart, std::chrono::steady_clock::time_point waitEnd);
+
+    // waits for the last submitted frame and writes its capture as png
+    void write_capture(const std::string &path);
 
     void create_swapchain(uint32_t width, uint32_t height);
     void destroy_swapchain();
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_memory.h"
+
+// Persistently mapped buffer for constants written by the cpu every frame. Each frame slot owns a
+// fixed region of it, allocations bump through the region of the current slot and are bound with
+// dynamic offsets, so one descriptor set covers every frame and nothing is created per frame.
+class FrameRingBuffer
+{
+public:
+    struct Allocation
+    {
+        void *data;
+        uint32_t offset; // from the start of the buffer, the dynamic offset to bind it with
+    };
+
+    // alignment is the larger of the uniform and storage buffer offset alignments of the device
+    void init(GpuMemory *memory, VkDeviceSize frameSize, uint32_t frameCount, VkDeviceSize alignment);
+    void destroy();
+
+    // drops what the slot allocated the last time around, its fence has to be waited on
+    void begin_frame(uint32_t frameIndex);
+
+    Allocation allocate(VkDeviceSize size);
+
+    template <typename T>
+    uint32_t push(const T &value)
+    {
+        Allocation allocation = allocate(sizeof(T));
+        *static_cast<T *>(allocation.data) = value;
+        return allocation.offset;
+    }
+
+    // makes the writes of the current slot visible to the gpu, a no-op on coherent memory
+    void flush();
+
+    VkBuffer buffer() const { return _buffer.buffer; }
+    // also the largest range a dynamic binding of the buffer can use
+    VkDeviceSize frame_size() const { return _frameSize; }
+    VkDeviceSize used() const { return _head - _frameStart; }
+    VkDeviceSize high_water() const { return _highWater; }
+
+private:
+    GpuMemory *_memory;
+    VmaAllocator _allocator;
+    AllocatedBuffer _buffer;
+
+    VkDeviceSize _frameSize{0};
+    VkDeviceSize _alignment{1};
+
+    VkDeviceSize _frameStart{0};
+    VkDeviceSize _head{0};
+    VkDeviceSize _highWater{0};
+};
@@ -2,10 +2,15 @@
 
 #include <vulkan/vulkan.h>
 #include <cmath>
+#include <cstddef>
 
 namespace vkutil
 {
     void transition_image(VkCommandBuffer cmd, VkImage image, VkImageLayout currentLayout, VkImageLayout newLayout);
     void copy_image_to_image(VkCommandBuffer cmd, VkImage source, VkImage destination, VkExtent2D srcSize, VkExtent2D dstSize);
     void generate_mipmaps(VkCommandBuffer cmd, VkImage image, VkExtent2D imageSize);
+
+    // bytes of one mip level of a 2d image, block compressed formats round up to whole 4x4 blocks.
+    // 0 for formats textures are not uploaded in
+    size_t image_level_size(VkFormat format, VkExtent2D extent, uint32_t level = 0);
 }
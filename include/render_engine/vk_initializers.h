@@ -5,10 +5,11 @@
 namespace vkinit {
 //> init_cmd
 VkCommandPoolCreateInfo command_pool_create_info(uint32_t queueFamilyIndex, VkCommandPoolCreateFlags flags = 0);
-VkCommandBufferAllocateInfo command_buffer_allocate_info(VkCommandPool pool, uint32_t count = 1);
+VkCommandBufferAllocateInfo command_buffer_allocate_info(VkCommandPool pool, uint32_t count = 1, VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
 //< init_cmd
 
 VkCommandBufferBeginInfo command_buffer_begin_info(VkCommandBufferUsageFlags flags = 0);
+VkCommandBufferInheritanceRenderingInfo command_buffer_inheritance_rendering_info(const VkFormat* colorFormat, VkFormat depthFormat);
 VkCommandBufferSubmitInfo command_buffer_submit_info(VkCommandBuffer cmd);
 
 VkFenceCreateInfo fence_create_info(VkFenceCreateFlags flags = 0);
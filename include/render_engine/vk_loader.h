@@ -0,0 +1,77 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_texture_streaming.h"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+// one imported mesh, a range of the index and vertex arrays of its scene.
+// indices are relative to firstVertex so the mesh can be drawn through an offset vertex buffer address
+struct GeoSurface
+{
+    std::string name;
+    uint32_t startIndex;
+    uint32_t count;
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+    uint32_t material{~0u}; // into the materials of the scene, ~0u draws with the default material
+
+    glm::vec4 bounds; // bounding sphere in mesh space, center and radius
+};
+
+// what the import knows about a material, the engine turns it into a GPUGLTFMaterial
+struct SceneMaterial
+{
+    glm::vec4 colorFactors;
+    std::string colorTexture; // path of the image file, empty when the material has none
+};
+
+// placement of a surface in the world, one per node referencing the mesh
+struct MeshInstance
+{
+    uint32_t surface;
+    glm::mat4 transform;
+};
+
+// cpu side result of an import, ready to be uploaded
+struct MeshSceneData
+{
+    std::string name;
+    std::vector<GeoSurface> surfaces;
+    std::vector<MeshInstance> instances;
+    std::vector<SceneMaterial> materials;
+
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+
+    // every other file the import read, like the .bin buffers of a glTF
+    std::vector<std::string> dependencies;
+};
+
+// an imported scene whose geometry lives in one pair of device local buffers
+struct MeshScene
+{
+    std::string name;
+    std::vector<GeoSurface> surfaces;
+    std::vector<MeshInstance> instances;
+
+    // one per SceneMaterial, with the streamed color texture it samples ( invalid when it has none )
+    std::vector<MaterialInstance> materials;
+    std::vector<StreamedTexture> materialTextures;
+
+    GPUMeshBuffers meshBuffers;
+    uint64_t uploadTicket;
+};
+
+// Imports a glTF / OBJ / anything assimp understands. The meshes are optimized in parallel on the
+// job system, so this is meant to be called from a loader thread and not from the frame loop.
+std::optional<MeshSceneData> load_mesh_scene(const std::string &path);
+
+// Removes duplicated vertices, reorders the triangles for the post-transform vertex cache ( Tipsify )
+// and then the vertices in the order they are first referenced, for linear vertex fetches.
+void optimize_mesh(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices);
+
+// average cache miss ratio ( transformed vertices per triangle ) of a FIFO cache of cacheSize entries
+float mesh_acmr(const std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize = 16);
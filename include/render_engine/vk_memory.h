@@ -0,0 +1,58 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <atomic>
+
+enum class MemoryCategory : uint32_t
+{
+    Textures,
+    Meshes,
+    Staging,
+    RenderTargets,
+    Buffers, // frame data, culling and material tables, everything else
+    Count,
+};
+
+const char *memory_category_name(MemoryCategory category);
+
+struct MemoryCategoryStats
+{
+    VkDeviceSize bytes;
+    uint32_t allocations;
+};
+
+// Owns the VMA allocator and keeps track of what the device memory is spent on. Every allocation is
+// tagged with a category when it is made and untagged before it is freed, the totals are kept as
+// they go so reading them costs nothing. Heap usage and budget come from VK_EXT_memory_budget when
+// the device has it.
+class GpuMemory
+{
+public:
+    void init(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device, bool memoryBudget);
+    void destroy();
+
+    VmaAllocator allocator() const { return _allocator; }
+    bool has_memory_budget() const { return _memoryBudget; }
+
+    // may be called from any thread
+    void tag(VmaAllocation allocation, MemoryCategory category);
+    void untag(VmaAllocation allocation);
+
+    MemoryCategoryStats category_stats(MemoryCategory category) const;
+
+    // pool for images that can be moved by defragmentation, their owner handles the moves.
+    // null if no single memory type fits sampled images
+    VmaPool movable_image_pool() const { return _movableImagePool; }
+
+    // share of the pool's device memory blocks not covered by allocations, 0 with a single block
+    float movable_image_fragmentation() const;
+
+private:
+    VmaAllocator _allocator;
+    bool _memoryBudget{false};
+    VmaPool _movableImagePool{VK_NULL_HANDLE};
+
+    std::atomic<VkDeviceSize> _categoryBytes[(size_t)MemoryCategory::Count]{};
+    std::atomic<uint32_t> _categoryAllocations[(size_t)MemoryCategory::Count]{};
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "vk_loader.h"
+
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+// Cooked mesh scenes: the output of load_mesh_scene written in the layout the gpu consumes, so loading
+// is an mmap and a memcpy into the staging ring. The header carries a format version and the hash of
+// the source asset, and the size and modification time of every other file the import read. A cache
+// that does not match any of them is cooked again.
+constexpr uint32_t COOKED_MESH_MAGIC = 0x48534d43; // "CMSH"
+constexpr uint32_t COOKED_MESH_VERSION = 4;
+
+struct CookedMeshHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash;
+
+    uint32_t vertexStride; // sizeof(Vertex) when cooked, guards against layout changes
+    uint32_t surfaceCount;
+    uint32_t instanceCount;
+    uint32_t dependencyCount;
+    uint32_t materialCount;
+    uint32_t reserved;
+
+    uint64_t vertexCount;
+    uint64_t indexCount;
+
+    // byte offsets from the start of the file, 16 byte aligned
+    uint64_t dependenciesOffset;
+    uint64_t materialsOffset;
+    uint64_t surfacesOffset;
+    uint64_t instancesOffset;
+    uint64_t verticesOffset;
+    uint64_t indicesOffset;
+    uint64_t fileSize;
+};
+
+// a file the import read besides the source, like the .bin buffers of a glTF
+struct CookedDependency
+{
+    char path[256];
+    uint64_t size;
+    int64_t modified; // nanoseconds since the epoch
+};
+
+struct CookedMaterial
+{
+    char colorTexture[256];
+    float colorFactors[4];
+};
+
+struct CookedSurface
+{
+    char name[64];
+    uint32_t startIndex;
+    uint32_t count;
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+    uint32_t material;
+    uint32_t reserved[3];
+    float bounds[4];
+};
+
+struct CookedInstance
+{
+    uint32_t surface;
+    uint32_t reserved[3];
+    float transform[16];
+};
+
+// read only view of a cooked file, the mapping lives as long as the object
+class CookedMeshScene
+{
+public:
+    ~CookedMeshScene();
+
+    // maps the file, null if it is missing, truncated or cooked from another version of the source
+    static std::unique_ptr<CookedMeshScene> open(const std::string &path, uint64_t sourceHash);
+
+    std::span<const Vertex> vertices() const;
+    std::span<const uint32_t> indices() const;
+
+    std::vector<GeoSurface> surfaces() const;
+    std::vector<MeshInstance> instances() const;
+    std::vector<SceneMaterial> materials() const;
+
+    // false when a dependency was changed or removed since the cook
+    bool dependencies_unchanged() const;
+
+private:
+    CookedMeshScene() = default;
+
+    void *_data{nullptr};
+    size_t _size{0};
+    const CookedMeshHeader *_header{nullptr};
+};
+
+std::optional<uint64_t> hash_file(const std::string &path);
+
+std::string cooked_mesh_path(const std::string &sourcePath);
+
+bool cook_mesh_scene(const MeshSceneData &data, uint64_t sourceHash, const std::string &path);
+
+// Maps the cooked version of the source, cooking it first when there is no valid one.
+// if the cache can not be written the freshly imported scene is handed back through imported instead
+std::unique_ptr<CookedMeshScene> load_cooked_mesh_scene(const std::string &sourcePath, std::optional<MeshSceneData> &imported);
+
+// cold start comparison of an assimp import against the mmap of the cooked file, on a generated grid
+void run_mesh_cache_benchmark();
@@ -20,7 +20,7 @@ public:
 
     void clear();
 
-    VkPipeline build_pipeline(VkDevice device);
+    VkPipeline build_pipeline(VkDevice device, VkPipelineCache cache = VK_NULL_HANDLE);
     
     void set_shaders(VkShaderModule vertexShader, VkShaderModule fragmentShader);
     void set_input_topology(VkPrimitiveTopology topology);
@@ -37,6 +37,30 @@ public:
     void enable_depthtest(bool depthWriteEnable, VkCompareOp op);
 };
 
+// VkPipelineCache persisted between runs. The file starts with the identity of the device and driver
+// that produced it, a cache written by anything else is dropped and the pipelines are compiled again.
+class PipelineCache
+{
+public:
+    VkPipelineCache cache{VK_NULL_HANDLE};
+
+    // creates the cache, seeded from the file when it matches this device. false if it starts empty
+    bool load(VkDevice device, VkPhysicalDevice physicalDevice, const std::string &path);
+
+    // writes the current contents back, buildTime is stored to compare later warm starts against
+    bool save(VkDevice device, float buildTime);
+
+    void destroy(VkDevice device);
+
+    // pipeline build time of the run that wrote the loaded file, negative when nothing was loaded
+    float coldBuildTime() const { return _coldBuildTime; }
+
+private:
+    std::string _path;
+    VkPhysicalDeviceProperties _properties;
+    float _coldBuildTime{-1.f};
+};
+
 namespace vkutil
 {
     bool load_shader_module(const char *filePath, VkDevice device, VkShaderModule *outShaderModule);
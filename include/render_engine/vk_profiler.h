@@ -0,0 +1,49 @@
+#pragma once
+
+#include "vk_types.h"
+
+#include <vector>
+
+// resolved gpu time of one named scope, start is relative to the first timestamp of the frame
+struct GpuTiming
+{
+    const char *name;
+    uint32_t depth;
+    float start_ms;
+    float duration_ms;
+};
+
+// Timestamp queries of one frame in flight. Scopes can be nested, results are read back
+// when the frame slot comes around again so reading never waits on the gpu.
+struct GpuTimestamps
+{
+    void init(VkDevice device, uint32_t maxScopes, uint32_t timestampValidBits);
+    void destroy(VkDevice device);
+
+    // resets the query pool, must be recorded outside of a rendering scope before any other scope
+    void reset(VkCommandBuffer cmd);
+
+    void begin_scope(VkCommandBuffer cmd, const char *name);
+    void end_scope(VkCommandBuffer cmd);
+
+    // fetches the results of the last recording without waiting, false if they are not available
+    bool read_results(VkDevice device, float timestampPeriod, std::vector<GpuTiming> &timings);
+
+private:
+    struct Scope
+    {
+        const char *name;
+        uint32_t depth;
+        uint32_t beginQuery;
+        uint32_t endQuery;
+    };
+
+    VkQueryPool _pool{VK_NULL_HANDLE};
+    uint32_t _maxQueries{0};
+    uint32_t _nextQuery{0};
+    uint64_t _timestampMask{~0ull};
+
+    std::vector<Scope> _scopes;
+    std::vector<uint32_t> _openScopes;
+    std::vector<uint64_t> _results;
+};
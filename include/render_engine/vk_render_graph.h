@@ -0,0 +1,218 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_memory.h"
+
+#include <initializer_list>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// how a pass touches an image, decides layout, stages and access of the barriers in front of it
+enum class RGUsage : uint8_t
+{
+    ComputeStorageWrite,
+    ComputeStorageReadWrite,
+    ComputeSampled,
+    FragmentSampled,
+    ColorAttachment,
+    DepthAttachment,
+    TransferSrc,
+    TransferDst,
+    Present,
+};
+
+struct RGImage
+{
+    uint32_t index{~0u};
+
+    bool valid() const { return index != ~0u; }
+};
+
+struct RGImageUse
+{
+    RGImage image;
+    RGUsage usage;
+    bool discard{false}; // the pass overwrites everything, the previous contents are not kept
+};
+
+// where the last access left an image, imported images carry it over from one frame to the next
+struct RGImageState
+{
+    VkImageLayout layout{VK_IMAGE_LAYOUT_UNDEFINED};
+
+    // the last write, and the stages and accesses that already see it
+    VkPipelineStageFlags2 writeStages{VK_PIPELINE_STAGE_2_NONE};
+    VkAccessFlags2 writeAccess{VK_ACCESS_2_NONE};
+    VkPipelineStageFlags2 visibleStages{VK_PIPELINE_STAGE_2_NONE};
+    VkAccessFlags2 visibleAccess{VK_ACCESS_2_NONE};
+
+    // reads since the last write, the next write waits for them
+    VkPipelineStageFlags2 readStages{VK_PIPELINE_STAGE_2_NONE};
+};
+
+// transient images only live inside one execution, images with disjoint lifetimes share memory
+struct RGTransientDesc
+{
+    VkFormat format;
+    VkExtent3D extent;
+    VkImageUsageFlags usage;
+    VkImageAspectFlags aspect;
+
+    bool operator==(const RGTransientDesc &other) const
+    {
+        return format == other.format && usage == other.usage && aspect == other.aspect && extent.width == other.extent.width &&
+               extent.height == other.extent.height && extent.depth == other.extent.depth;
+    }
+};
+
+struct RenderGraphStats
+{
+    uint32_t passes;
+    uint32_t imageBarriers;
+    uint32_t barrierBatches;       // vkCmdPipelineBarrier2 calls
+    uint32_t fullPipelineBarriers; // barriers waiting on ALL_COMMANDS
+    VkDeviceSize transientBytes;   // transient images without aliasing
+    VkDeviceSize aliasedBytes;     // memory they actually take
+};
+
+// Passes declare the images they read and write, execute records them in order with the barriers
+// the declared usages need in between. Barriers in front of a pass go out as one batch and only
+// wait on the stages that touched the image before. Rebuilt every frame, the transient memory is kept
+// as long as the transient images and their lifetimes stay the same. The pass closures are placed in
+// the memory resource given to reset and the uses in arrays the graph keeps, so a frame that builds
+// the same graph as the last one does not touch the heap.
+class RenderGraph
+{
+public:
+    // retiredFrames is how many executions a replaced transient allocation is kept for, the frames in flight
+    void init(VkDevice device, GpuMemory *memory, uint32_t retiredFrames);
+    void cleanup();
+
+    // drops the passes and images of the last frame, the closures of the new ones go into passMemory
+    void reset(std::pmr::memory_resource *passMemory);
+
+    // state is read at the first use and written back by execute
+    RGImage import_image(const char *name, const AllocatedImage &image, VkImageAspectFlags aspect, RGImageState *state);
+    RGImage create_image(const char *name, const RGTransientDesc &desc);
+
+    // record is called once with the command buffer, it is never destroyed so it may only capture plain values
+    template <typename F>
+    void add_pass(const char *name, std::initializer_list<RGImageUse> uses, F &&record)
+    {
+        using Fn = std::decay_t<F>;
+        static_assert(std::is_trivially_destructible_v<Fn>, "pass closures are dropped with the frame, capture pointers instead");
+
+        void *closure = new (_passMemory->allocate(sizeof(Fn), alignof(Fn))) Fn(std::forward<F>(record));
+        add_pass(name, uses, closure, [](void *closure, VkCommandBuffer cmd)
+                 { (*static_cast<Fn *>(closure))(cmd); });
+    }
+
+    // layout the image is left in after the last pass
+    void set_final_usage(RGImage image, RGUsage usage);
+
+    // lifetimes and transient memory, images can be looked up afterwards
+    void compile();
+    void execute(VkCommandBuffer cmd);
+
+    const AllocatedImage &image(RGImage image) const { return _images[image.index].image; }
+
+    // every barrier on its own, waiting on ALL_COMMANDS like vkutil::transition_image, to compare against
+    bool conservativeBarriers{false};
+
+    const RenderGraphStats &stats() const { return _stats; }
+
+private:
+    struct ImageResource
+    {
+        const char *name;
+        AllocatedImage image;
+        VkImageAspectFlags aspect;
+
+        RGImageState state;
+        RGImageState *imported; // nullptr for transient images
+
+        RGTransientDesc desc;
+        uint32_t firstPass;
+        uint32_t lastPass;
+        uint32_t memorySlot;
+
+        bool hasFinalUsage;
+        RGUsage finalUsage;
+    };
+
+    struct Pass
+    {
+        const char *name;
+
+        // range of _uses
+        uint32_t firstUse;
+        uint32_t useCount;
+
+        void *closure;
+        void (*record)(void *closure, VkCommandBuffer cmd);
+    };
+
+    // transient images of one layout and the memory they alias
+    struct TransientPool
+    {
+        struct Slot
+        {
+            VmaAllocation allocation;
+
+            // stages and writes of the last image that used the memory, the next one waits for them
+            VkPipelineStageFlags2 lastStages;
+            VkAccessFlags2 lastWriteAccess;
+        };
+
+        struct Entry
+        {
+            RGTransientDesc desc;
+            uint32_t firstPass;
+            uint32_t lastPass;
+
+            bool operator==(const Entry &) const = default;
+        };
+
+        std::vector<Entry> key;
+        std::vector<AllocatedImage> images;
+        std::vector<uint32_t> imageSlots;
+        std::vector<Slot> slots;
+        VkDeviceSize transientBytes{0};
+        VkDeviceSize aliasedBytes{0};
+    };
+
+    struct RetiredPool
+    {
+        TransientPool pool;
+        uint32_t framesLeft;
+    };
+
+    VkDevice _device;
+    GpuMemory *_memory;
+    VmaAllocator _allocator;
+    uint32_t _retiredFrames;
+
+    std::pmr::memory_resource *_passMemory{nullptr};
+    std::vector<ImageResource> _images;
+    std::vector<Pass> _passes;
+    std::vector<RGImageUse> _uses;
+
+    // transient images of the frame being compiled, compared against the key of the pool
+    std::vector<TransientPool::Entry> _key;
+
+    TransientPool _pool;
+    std::vector<RetiredPool> _retired;
+
+    std::vector<VkImageMemoryBarrier2> _barriers;
+    RenderGraphStats _stats{};
+
+    void add_pass(const char *name, std::initializer_list<RGImageUse> uses, void *closure, void (*record)(void *closure, VkCommandBuffer cmd));
+
+    void build_pool(const std::vector<TransientPool::Entry> &key);
+    void destroy_pool(TransientPool &pool);
+
+    void add_barrier(ImageResource &resource, const RGImageUse &use);
+    void flush_barriers(VkCommandBuffer cmd);
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_frame_ring.h"
+
+#include <memory>
+#include <vector>
+
+class VulkanEngine;
+
+// Mip chain of one texture on the cpu side, the streamer reads levels from it when they become resident.
+// Level 0 is the finest, levels are expected to halve down to the last one.
+class TextureSource
+{
+public:
+    virtual ~TextureSource() = default;
+
+    virtual VkFormat format() const = 0;
+    virtual VkExtent2D extent() const = 0; // of level 0
+    virtual uint32_t level_count() const = 0;
+    virtual size_t level_size(uint32_t level) const = 0;
+
+    // writes level_size(level) bytes to dst, false if the level can not be read
+    virtual bool read_level(uint32_t level, void *dst) = 0;
+};
+
+// rgba8 pixels kept in memory, the mips are box filtered on the cpu when the source is created
+class MemoryTextureSource : public TextureSource
+{
+public:
+    MemoryTextureSource(const uint8_t *pixels, VkExtent2D extent, VkFormat format = VK_FORMAT_R8G8B8A8_UNORM);
+
+    VkFormat format() const override { return _format; }
+    VkExtent2D extent() const override { return _extent; }
+    uint32_t level_count() const override { return (uint32_t)_levels.size(); }
+    size_t level_size(uint32_t level) const override { return _levels[level].size(); }
+    bool read_level(uint32_t level, void *dst) override;
+
+private:
+    VkFormat _format;
+    VkExtent2D _extent;
+    std::vector<std::vector<uint8_t>> _levels;
+};
+
+struct StreamedTexture
+{
+    uint32_t index{~0u};
+
+    bool valid() const { return index != ~0u; }
+};
+
+struct TextureStreamingStats
+{
+    uint32_t textures;
+    uint32_t pendingUploads;
+    VkDeviceSize residentBytes; // device memory of the resident and the pending mip chains
+    VkDeviceSize budgetBytes;   // the configured budget, lowered when the heap has less room left
+    VkDeviceSize streamedBytes; // uploaded since init
+    uint32_t evictions;
+
+    bool defragmenting;
+    float fragmentation;          // of the movable image pool
+    uint32_t defragmentations;    // finished runs
+    VkDeviceSize defragmentedBytes; // moved since init
+};
+
+// Keeps the mips textures are needed at resident within a device memory budget. Every texture has a
+// coarse tail that stays resident, finer levels are requested per frame ( from a distance heuristic or
+// directly ) and streamed in, textures that were not needed for the longest lose their finest level first
+// when the budget runs out. A residency change uploads a new image holding the new levels and swaps it in
+// once the upload completes, so the shaders read streamed textures through a per frame table of
+// bindless slots instead of through a fixed slot.
+//
+// The same indirection makes the images movable, so they live in the movable pool of GpuMemory and get
+// defragmented incrementally once it fragments: a pass copies a few images into their new place at the
+// start of a frame, points the table at the copies and lets go of the old images once no frame in
+// flight can still sample them.
+class TextureStreamer
+{
+public:
+    // material texture indices with this bit set name a streamed texture instead of a bindless slot
+    static constexpr uint32_t STREAMED_TEXTURE_BIT = 0x80000000u;
+
+    // fallbackImage is the bindless slot shown until the first levels of a texture arrive.
+    // tailSize is the largest extent that is always kept resident
+    void init(VulkanEngine *engine, uint32_t fallbackImage, VkDeviceSize budget, uint32_t tailSize = 64);
+    void cleanup();
+
+    StreamedTexture add(std::unique_ptr<TextureSource> &&source);
+    void remove(StreamedTexture texture);
+
+    // what a material stores in place of a bindless image slot
+    static uint32_t material_index(StreamedTexture texture) { return STREAMED_TEXTURE_BIT | texture.index; }
+
+    // the finest level the texture is needed at, taken into account at the next update
+    void request(StreamedTexture texture, uint32_t level);
+
+    // distance heuristic, a surface using the texture covers about this many pixels across on screen
+    void request_screen_size(StreamedTexture texture, float pixels);
+
+    // once per frame after the fence of the slot, before the bindless set is flushed: swaps in finished
+    // uploads, evicts down to the budget and queues the uploads of newly requested levels
+    void update();
+
+    // bindless slot of every streamed texture for this frame, returns the dynamic offset of the table
+    uint32_t write_residency_table(FrameRingBuffer &ring);
+
+    // copies of the defragmentation moves update started, before anything of the frame samples them
+    void record_defragmentation(VkCommandBuffer cmd);
+
+    // starts a defragmentation run at the next update regardless of the threshold
+    void request_defragmentation() { _defragmentationRequested = true; }
+
+    // the bindless slot the residency table gives the texture and the image behind it, for checks
+    uint32_t resident_slot(StreamedTexture texture) const { return _textures[texture.index].resident.bindlessIndex; }
+    const AllocatedImage &resident_image(StreamedTexture texture) const { return _textures[texture.index].resident.image; }
+
+    VkDeviceSize budgetBytes;
+    VkDeviceSize maxUploadBytesPerFrame{16 * 1024 * 1024};
+
+    // share of the pool's blocks left unused before a defragmentation run starts
+    float defragmentThreshold{0.25f};
+
+    const TextureStreamingStats &stats() const { return _stats; }
+
+private:
+    struct Residency
+    {
+        AllocatedImage image;
+        uint32_t bindlessIndex{~0u};
+        uint32_t firstLevel{~0u}; // ~0u when nothing is resident
+        VkDeviceSize bytes{0};
+        uint64_t uploadTicket{0};
+    };
+
+    struct Texture
+    {
+        std::unique_ptr<TextureSource> source;
+
+        Residency resident;
+        Residency pending;
+
+        uint32_t tailLevel;
+        uint32_t requestedLevel;
+        uint64_t lastRequestFrame{0};
+
+        // the resident image is being moved, it is neither swapped out nor freed until the pass ends
+        bool moving{false};
+    };
+
+    struct Move
+    {
+        uint32_t texture;
+        AllocatedImage source; // the old image, its memory is released when the pass ends
+        uint32_t sourceBindlessIndex;
+        VkImage destination;
+        uint32_t levelCount;
+    };
+
+    VulkanEngine *_engine;
+    uint32_t _fallbackImage;
+    uint32_t _tailSize;
+    uint32_t _memoryHeap{~0u};
+    uint64_t _frame{0};
+
+    std::vector<Texture> _textures;
+    std::vector<uint32_t> _freeTextures;
+
+    std::vector<uint8_t> _staging;
+    std::vector<VkDeviceSize> _levelOffsets;
+    std::vector<uint32_t> _order;
+
+    TextureStreamingStats _stats{};
+
+    VmaDefragmentationContext _defragmentation{VK_NULL_HANDLE};
+    VmaDefragmentationPassMoveInfo _defragmentationPass{};
+    std::vector<Move> _moves;
+    std::vector<VkImageCopy> _moveRegions; // reused while recording, keeps the frame free of allocations
+    bool _movesRecorded{false};
+    bool _defragmentationRequested{false};
+    bool _passOpen{false};
+    uint64_t _passFrame{0};
+    uint64_t _defragmentationFrame{0}; // when the last run finished
+
+    bool alive(const Texture &texture) const { return texture.source != nullptr; }
+    uint32_t current_level(const Texture &texture) const;
+
+    // creates the image for levels [firstLevel, level_count) and queues their upload
+    bool stream(Texture &texture, uint32_t firstLevel);
+    void retire(Residency &residency);
+    VkDeviceSize effective_budget();
+
+    void update_defragmentation();
+    void begin_defragmentation_pass();
+    void end_defragmentation_pass();
+};
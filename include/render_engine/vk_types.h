@@ -50,7 +50,9 @@ struct AllocatedBuffer {
 struct GPUGLTFMaterial {
     glm::vec4 colorFactors;
     glm::vec4 metal_rough_factors;
-    glm::vec4 extra[14];
+    // bindless slots: color image, metal rough image, sampler, unused
+    glm::uvec4 textures;
+    glm::vec4 extra[13];
 };
 
 static_assert(sizeof(GPUGLTFMaterial) == 256);
@@ -77,7 +79,8 @@ struct MaterialPipeline {
 
 struct MaterialInstance {
     MaterialPipeline* pipeline;
-    VkDescriptorSet materialSet;
+    // index into the bindless material table
+    uint32_t materialIndex;
     MaterialPass passType;
 };
 //< mat_types
@@ -100,9 +103,21 @@ struct GPUMeshBuffers {
 
 // push constants for our mesh object draws
 struct GPUDrawPushConstants {
-    glm::mat4 worldMatrix;
     VkDeviceAddress vertexBuffer;
+    // bindless storage buffer slot of the material table
+    uint32_t materialBuffer;
+    // entry of the draw in the GPUDrawData array of the frame
+    uint32_t drawIndex;
 };
+
+// per draw constants, written into the frame ring every frame
+struct GPUDrawData {
+    glm::mat4 worldMatrix;
+    uint32_t materialIndex;
+    uint32_t pad[3];
+};
+
+static_assert(sizeof(GPUDrawData) == 80);
 //< vbuf_types
 
 //> node_types
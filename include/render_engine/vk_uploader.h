@@ -0,0 +1,111 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_memory.h"
+
+#include <deque>
+#include <span>
+#include <vector>
+
+// Streams buffer and image uploads through a dedicated transfer queue.
+// Data is copied into a persistently mapped staging ring, all copies queued during
+// a frame are recorded into one command buffer and submitted together, and completion
+// is tracked with a timeline semaphore so nothing on the CPU has to wait for the GPU.
+class TransferUploader
+{
+public:
+    void init(VkDevice device, GpuMemory *memory, VkQueue transferQueue, uint32_t transferQueueFamily, uint32_t graphicsQueueFamily, size_t ringSize);
+    void cleanup();
+
+    // queue an upload, the returned ticket is the timeline value signaled once the copy is done.
+    // images are left in SHADER_READ_ONLY_OPTIMAL, mipmapped images get their mips generated on the graphics queue
+    uint64_t upload_image(const AllocatedImage &image, const void *data, size_t size, bool mipmapped);
+
+    // every mip level comes with the data, levelOffsets[i] is where level i starts in it
+    uint64_t upload_image_levels(const AllocatedImage &image, const void *data, size_t size, std::span<const VkDeviceSize> levelOffsets);
+    uint64_t upload_buffer(VkBuffer buffer, const void *data, size_t size, size_t dstOffset = 0);
+
+    // record and submit all queued copies as a single batch
+    void flush();
+
+    // records the graphics queue side of finished uploads ( queue ownership acquire, mip generation ).
+    // returns false if there is nothing to wait for, otherwise fills the timeline wait for the graphics submit
+    bool record_graphics_work(VkCommandBuffer cmd, VkSemaphoreSubmitInfo &waitInfo);
+
+    bool is_complete(uint64_t ticket);
+    uint64_t completed_value();
+
+    // blocks until the ticket has been signaled, only meant for loading screens and shutdown
+    void wait(uint64_t ticket);
+
+private:
+    struct ImageCopy
+    {
+        AllocatedImage image;
+        VkBuffer srcBuffer;
+        VkDeviceSize srcOffset;
+        bool mipmapped;
+
+        // relative to srcOffset, empty when only level 0 is copied
+        std::vector<VkDeviceSize> levelOffsets;
+    };
+
+    struct BufferCopy
+    {
+        VkBuffer dstBuffer;
+        VkBuffer srcBuffer;
+        VkDeviceSize srcOffset;
+        VkDeviceSize dstOffset;
+        VkDeviceSize size;
+    };
+
+    struct Batch
+    {
+        uint64_t timelineValue;
+        size_t ringEnd;                           // ring space up to here is released once the batch completes
+        std::vector<AllocatedBuffer> oversized;   // uploads that did not fit the ring
+    };
+
+    // resources waiting for the graphics queue to take them over
+    struct GraphicsWork
+    {
+        uint64_t timelineValue;
+        std::vector<ImageCopy> images;
+        std::vector<BufferCopy> buffers;
+    };
+
+    VkDevice _device;
+    GpuMemory *_memory;
+    VmaAllocator _allocator;
+
+    VkQueue _transferQueue;
+    uint32_t _transferQueueFamily;
+    uint32_t _graphicsQueueFamily;
+
+    VkCommandPool _commandPool;
+    static constexpr uint32_t COMMAND_BUFFER_COUNT = 4;
+    VkCommandBuffer _commandBuffers[COMMAND_BUFFER_COUNT];
+    uint64_t _commandBufferValues[COMMAND_BUFFER_COUNT] = {};
+    uint32_t _nextCommandBuffer{0};
+
+    VkSemaphore _timeline;
+    uint64_t _nextValue{1};
+    uint64_t _lastGraphicsWaitValue{0};
+
+    AllocatedBuffer _ring;
+    size_t _ringSize{0};
+    size_t _ringHead{0};
+    size_t _ringTail{0};
+
+    std::vector<ImageCopy> _pendingImages;
+    std::vector<BufferCopy> _pendingBuffers;
+    std::vector<AllocatedBuffer> _pendingOversized;
+
+    std::deque<Batch> _inFlight;
+    std::deque<GraphicsWork> _graphicsWork;
+
+    bool allocate_staging(size_t size, VkBuffer &buffer, VkDeviceSize &offset, void *&mapped);
+    bool try_allocate_ring(size_t size, size_t &offset);
+    void destroy_staging(const AllocatedBuffer &buffer);
+    void collect();
+};
@@ -185,6 +185,14 @@ static void SetupVulkan(ImVector<const char *> instance_extensions)
 		err = vkCreateDescriptorPool(g_Device, &pool_info, g_Allocator, &g_DescriptorPool);
 		check_vk_result(err);
 	}
+
+	// Create Pipeline Cache, shared by the imgui pipelines of this device for the lifetime of the window
+	{
+		VkPipelineCacheCreateInfo cache_info = {};
+		cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		err = vkCreatePipelineCache(g_Device, &cache_info, g_Allocator, &g_PipelineCache);
+		check_vk_result(err);
+	}
 }
 
 // All the ImGui_ImplVulkanH_XXX structures/functions are optional helpers used by the demo.
@@ -223,6 +231,8 @@ static void SetupVulkanWindow(ImGui_ImplVulkanH_Window *wd, VkSurfaceKHR surface
 
 static void CleanupVulkan()
 {
+	vkDestroyPipelineCache(g_Device, g_PipelineCache, g_Allocator);
+	g_PipelineCache = VK_NULL_HANDLE;
 	vkDestroyDescriptorPool(g_Device, g_DescriptorPool, g_Allocator);
 
 #ifdef APP_USE_VULKAN_DEBUG_REPORT
@@ -0,0 +1,11 @@
+#include "core/cpu_features.h"
+
+bool cpu_has_avx2()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	static const bool supported = __builtin_cpu_supports("avx2");
+	return supported;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,32 @@
+#include "core/file_io.h"
+
+#include <filesystem>
+#include <fstream>
+
+bool write_file_atomically(const std::string &path, const void *data, size_t size)
+{
+	std::string tempPath = path + ".tmp";
+	std::error_code error;
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			return false;
+
+		file.write(static_cast<const char *>(data), (std::streamsize)size);
+		if (!file.good())
+		{
+			file.close();
+			std::filesystem::remove(tempPath, error);
+			return false;
+		}
+	}
+
+	std::filesystem::rename(tempPath, path, error);
+	if (error)
+	{
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,319 @@
+#include "core/job_system.h"
+
+// Third party
+
+#include <fmt/core.h>
+#include <fmt/color.h>
+
+#include <chrono>
+#include <cmath>
+
+static constexpr uint32_t FOREIGN_THREAD = ~0u;
+
+// set for the main thread by init and for the workers by their loop
+static thread_local uint32_t tls_threadIndex = FOREIGN_THREAD;
+static thread_local uint32_t tls_foreignSlot = FOREIGN_THREAD;
+
+bool WorkStealingQueue::push(const Job &job)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (bottom - top >= CAPACITY)
+		return false;
+
+	jobs[bottom % CAPACITY] = job;
+	bottom++;
+	return true;
+}
+
+bool WorkStealingQueue::pop(Job &job)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (bottom == top)
+		return false;
+
+	bottom--;
+	job = jobs[bottom % CAPACITY];
+	return true;
+}
+
+bool WorkStealingQueue::steal(Job &job)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (bottom == top)
+		return false;
+
+	job = jobs[top % CAPACITY];
+	top++;
+	return true;
+}
+
+uint32_t WorkStealingQueue::size()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return bottom - top;
+}
+
+JobSystem &JobSystem::Get()
+{
+	static JobSystem jobSystem;
+	return jobSystem;
+}
+
+uint32_t JobSystem::thread_index()
+{
+	if (tls_threadIndex != FOREIGN_THREAD)
+		return tls_threadIndex;
+
+	JobSystem &jobs = Get();
+	if (!jobs.isInitialized)
+		return 0;
+
+	if (tls_foreignSlot == FOREIGN_THREAD)
+		tls_foreignSlot = jobs.nextForeignSlot.fetch_add(1, std::memory_order_relaxed) % FOREIGN_QUEUES;
+
+	return (uint32_t)jobs.workers.size() + 1 + tls_foreignSlot;
+}
+
+bool JobSystem::init(int workerCount)
+{
+	if (this->isInitialized)
+		return true;
+
+	if (workerCount < 0)
+	{
+		unsigned int hardwareThreads = std::thread::hardware_concurrency();
+		workerCount = hardwareThreads > 1 ? (int)hardwareThreads - 1 : 0;
+	}
+
+	tls_threadIndex = 0;
+
+	// one queue for the main thread, one per worker and the foreign ones
+	queues.clear();
+	for (int i = 0; i < workerCount + 1 + (int)FOREIGN_QUEUES; i++)
+	{
+		queues.push_back(std::make_unique<WorkStealingQueue>());
+	}
+
+	running = true;
+	pendingJobs = 0;
+
+	for (int i = 0; i < workerCount; i++)
+	{
+		uint32_t threadIndex = i + 1;
+		workers.emplace_back([this, threadIndex]()
+							 { worker_loop(threadIndex); });
+	}
+
+	this->isInitialized = true;
+
+	fmt::print(fg(fmt::color::steel_blue), "Job System started with {} worker threads.\n", workerCount);
+
+	return true;
+}
+
+void JobSystem::shutdown()
+{
+	if (!this->isInitialized)
+		return;
+
+	// drain whatever is left before stopping the workers, foreign queues included
+	while (pendingJobs.load() > 0)
+	{
+		if (!try_execute_one(thread_index(), true))
+			std::this_thread::yield();
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+		running = false;
+	}
+	wakeCondition.notify_all();
+
+	for (std::thread &worker : workers)
+	{
+		worker.join();
+	}
+
+	workers.clear();
+	queues.clear();
+
+	this->isInitialized = false;
+}
+
+void JobSystem::submit(const Job &job)
+{
+	if (!this->isInitialized)
+	{
+		// no workers, run it right away on the calling thread
+		Job inlineJob = job;
+		if (inlineJob.counter)
+			inlineJob.counter->value.fetch_add(1, std::memory_order_relaxed);
+		execute(inlineJob);
+		return;
+	}
+
+	if (job.counter)
+		job.counter->value.fetch_add(1, std::memory_order_relaxed);
+
+	uint32_t threadIndex = thread_index();
+	if (threadIndex >= queues.size() || !queues[threadIndex]->push(job))
+	{
+		// queue is full, execute it inline instead of growing
+		Job inlineJob = job;
+		execute(inlineJob);
+		return;
+	}
+
+	// sequentially consistent on purpose, pairs with the sleeping worker check below
+	pendingJobs.fetch_add(1);
+
+	if (sleepingWorkers.load() > 0)
+	{
+		// taking the lock makes sure a worker about to sleep sees the new job
+		{
+			std::lock_guard<std::mutex> guard(sleepLock);
+		}
+		wakeCondition.notify_one();
+	}
+}
+
+void JobSystem::wait(const JobCounter &counter)
+{
+	while (!counter.done())
+	{
+		if (!try_execute_one(thread_index()))
+			std::this_thread::yield();
+	}
+}
+
+bool JobSystem::find_job(uint32_t threadIndex, Job &job, bool anyQueue)
+{
+	uint32_t queueCount = (uint32_t)queues.size();
+	if (queueCount == 0)
+		return false;
+
+	if (threadIndex < queueCount && queues[threadIndex]->pop(job))
+		return true;
+
+	// only workers take jobs of foreign threads, the others wait on their own work
+	uint32_t foreignBegin = (uint32_t)workers.size() + 1;
+	bool worker = threadIndex > 0 && threadIndex < foreignBegin;
+
+	// steal from the other queues, starting next to us to spread the contention
+	for (uint32_t i = 1; i <= queueCount; i++)
+	{
+		uint32_t victim = (threadIndex + i) % queueCount;
+		if (victim == threadIndex || (victim >= foreignBegin && !worker && !anyQueue))
+			continue;
+
+		if (queues[victim]->steal(job))
+			return true;
+	}
+
+	return false;
+}
+
+bool JobSystem::try_execute_one(uint32_t threadIndex, bool anyQueue)
+{
+	Job job;
+	if (!find_job(threadIndex, job, anyQueue))
+		return false;
+
+	pendingJobs.fetch_sub(1, std::memory_order_acq_rel);
+
+	execute(job);
+	return true;
+}
+
+void JobSystem::execute(Job &job)
+{
+	// not ready yet, run other jobs until the dependency is satisfied
+	if (job.dependency)
+		wait(*job.dependency);
+
+	job.invoke(job.storage);
+
+	if (job.counter)
+		job.counter->value.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void JobSystem::worker_loop(uint32_t threadIndex)
+{
+	tls_threadIndex = threadIndex;
+
+	while (running.load(std::memory_order_acquire))
+	{
+		if (try_execute_one(threadIndex))
+			continue;
+
+		std::unique_lock<std::mutex> sleep(sleepLock);
+		sleepingWorkers.fetch_add(1);
+		wakeCondition.wait(sleep, [this]()
+						   { return pendingJobs.load() > 0 || !running.load(); });
+		sleepingWorkers.fetch_sub(1);
+	}
+}
+
+void JobSystem::run_benchmark()
+{
+	JobSystem &jobs = JobSystem::Get();
+
+	bool wasInitialized = jobs.isInitialized;
+	jobs.shutdown();
+
+	unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	constexpr uint32_t DISPATCH_JOBS = 100000;
+	constexpr uint32_t WORK_ITEMS = 1 << 22;
+	constexpr uint32_t GRAIN = 4096;
+
+	std::vector<float> results(WORK_ITEMS);
+
+	fmt::print(fg(fmt::color::bisque), "\nJob System benchmark ( {} hardware threads )\n", hardwareThreads);
+	fmt::print("{:>8} {:>16} {:>16} {:>10}\n", "threads", "dispatch ns/job", "parallel_for ms", "speedup");
+
+	double singleThreadMs = 0.0;
+
+	for (unsigned int threads = 1; threads <= hardwareThreads; threads++)
+	{
+		jobs.init((int)threads - 1);
+
+		// dispatch overhead: empty jobs, submit + execute + wait
+		JobCounter counter;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < DISPATCH_JOBS; i++)
+		{
+			jobs.submit([]() {}, &counter);
+		}
+		jobs.wait(counter);
+		auto end = std::chrono::high_resolution_clock::now();
+
+		double dispatchNs = std::chrono::duration<double, std::nano>(end - start).count() / DISPATCH_JOBS;
+
+		// scaling: a compute bound parallel_for
+		float *out = results.data();
+		start = std::chrono::high_resolution_clock::now();
+		jobs.parallel_for(WORK_ITEMS, GRAIN, [out](uint32_t begin, uint32_t end)
+						  {
+			for (uint32_t i = begin; i < end; i++)
+			{
+				float x = (float)i * 0.001f;
+				out[i] = std::sqrt(x) * std::sin(x) + std::cos(x * 0.5f);
+			} });
+		end = std::chrono::high_resolution_clock::now();
+
+		double parallelMs = std::chrono::duration<double, std::milli>(end - start).count();
+		if (threads == 1)
+			singleThreadMs = parallelMs;
+
+		fmt::print("{:>8} {:>16.1f} {:>16.3f} {:>9.2f}x\n", threads, dispatchNs, parallelMs, singleThreadMs / parallelMs);
+
+		jobs.shutdown();
+	}
+
+	if (wasInitialized)
+		jobs.init();
+}
@@ -1,15 +1,133 @@
 #include "main_entry.h"
 
 #include "render_engine/render_engine.h"
+#include "render_engine/texture_cooker.h"
 #include "physics_engine/physics_engine.h"
 #include "sound_engine/sound_engine.h"
 #include "scripting/scripting.h"
 
+#include "core/job_system.h"
+
 #include <fmt/core.h>
 #include <fmt/color.h>
 
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void printUsage()
+{
+	fmt::print("usage: Collaboration [--headless [--frames N] [--size WxH] [--timings file.csv] [--capture prefix] [--capture-interval N] [--scene path] [--texture-budget MB] [--conservative-barriers] [--no-async-compute] [--defragmentation-check]]\n");
+	fmt::print("       Collaboration --cook-texture <image> <out.ktx2> [--normal]\n");
+}
+
+// Parses the headless benchmark options, false on anything it does not understand
+static bool parseHeadlessArguments(int argc, char *argv[], HeadlessSettings &settings)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+		if (strcmp(arg, "--headless") == 0)
+			continue;
+
+		if (strcmp(arg, "--conservative-barriers") == 0)
+		{
+			settings.conservativeBarriers = true;
+			continue;
+		}
+
+		if (strcmp(arg, "--no-async-compute") == 0)
+		{
+			settings.asyncCompute = false;
+			continue;
+		}
+
+		if (strcmp(arg, "--defragmentation-check") == 0)
+		{
+			settings.defragmentationCheck = true;
+			continue;
+		}
+
+		if (value == nullptr)
+			return false;
+
+		if (strcmp(arg, "--frames") == 0)
+			settings.frameCount = (uint32_t)std::strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--size") == 0)
+		{
+			if (sscanf(value, "%ux%u", &settings.width, &settings.height) != 2)
+				return false;
+		}
+		else if (strcmp(arg, "--timings") == 0)
+			settings.timingsPath = value;
+		else if (strcmp(arg, "--capture") == 0)
+			settings.capturePath = value;
+		else if (strcmp(arg, "--capture-interval") == 0)
+			settings.captureInterval = (uint32_t)std::strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "--scene") == 0)
+			settings.scenePath = value;
+		else if (strcmp(arg, "--texture-budget") == 0)
+			settings.textureBudgetMB = (uint32_t)std::strtoul(value, nullptr, 10);
+		else
+			return false;
+
+		i++;
+	}
+
+	return settings.frameCount > 0 && settings.width > 0 && settings.height > 0;
+}
+
+// offline texture cooking, one image per invocation
+static int cookTexture(int argc, char *argv[])
+{
+	if (argc < 4 || argc > 5 || (argc == 5 && strcmp(argv[4], "--normal") != 0))
+	{
+		printUsage();
+		return 1;
+	}
+
+	if (!JobSystem::Get().init())
+		return 1;
+
+	bool cooked = cook_texture(argv[2], argv[3], argc == 5 ? TextureKind::Normal : TextureKind::Color);
+
+	JobSystem::Get().shutdown();
+	return cooked ? 0 : 1;
+}
+
 int main(int argc, char *argv[])
 {
+	if (argc > 1 && strcmp(argv[1], "--cook-texture") == 0)
+		return cookTexture(argc, argv);
+
+	bool headless = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--headless") == 0)
+			headless = true;
+	}
+
+	// CI runs go straight to the renderer, without the interactive menu
+	if (headless)
+	{
+		HeadlessSettings settings;
+		if (!parseHeadlessArguments(argc, argv, settings))
+		{
+			printUsage();
+			return 1;
+		}
+
+		if (!JobSystem::Get().init())
+			return 1;
+
+		int result = RenderEngine().Headless(settings);
+
+		JobSystem::Get().shutdown();
+		return result;
+	}
+
 	MainEntry *pMainEntry = new MainEntry();
 	pMainEntry->run();
 	return 0;
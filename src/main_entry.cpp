@@ -2,10 +2,15 @@
 
 #include "render_engine/render_engine.h"
 #include "physics_engine/physics_engine.h"
+#include "physics_engine/collision_detection/collision_detection.h"
+#include "physics_engine/contact_solver.h"
 #include "sound_engine/sound_engine.h"
 #include "animation_engine/animation_engine.h"
 #include "scripting/scripting.h"
 
+#include "core/job_system.h"
+#include "render_engine/vk_mesh_cache.h"
+
 #include <sys/ioctl.h>
 #include <unistd.h>
 #include <sstream>
@@ -29,7 +34,7 @@ std::string MainEntry::getOptionsDescription()
 
 	std::string separator = this->Separator(w.ws_col - 2);
 
-	std::string optionsText = "Render Engine { 1 | R }  Physics Engine { 2 | P }  Sound Engine { 3 | S }  Scripting Engine { 4 | C }  Animation Engine { 5 | A }  Quit { q | Q }";
+	std::string optionsText = "Render Engine { 1 | R }  Physics Engine { 2 | P }  Sound Engine { 3 | S }  Scripting Engine { 4 | C }  Animation Engine { 5 | A }  Benchmarks { 6 | B }  Quit { q | Q }";
 
 	// Centering the options text ( terminalWidth - optionsTextLength ) / 2
 	size_t gap = w.ws_col - optionsText.length();
@@ -58,9 +63,11 @@ bool MainEntry::init()
 	this->optionSet['3'] = "Sound Engine";
 	this->optionSet['4'] = "Scripting";
 	this->optionSet['5'] = "Animation Engine";
+	this->optionSet['6'] = "Benchmarks";
 	this->optionSet['q'] = "Quit";
 
-	this->isInitialized = true; // INIT ( to do )
+	// worker threads shared by all of the engines
+	this->isInitialized = JobSystem::Get().init();
 
 	if (this->isInitialized)
 		return true;
@@ -136,6 +143,21 @@ void MainEntry::run()
 			pAnimation->run();
 		}
 		break;
+		case '6':
+		case 'B':
+		case 'b':
+		{
+			// Benchmarks
+			this->showMessage(type);
+
+			JobSystem::run_benchmark();
+			run_mesh_cache_benchmark();
+			run_physics_benchmark();
+			run_broadphase_benchmark();
+			run_narrowphase_benchmark();
+			run_solver_benchmark();
+		}
+		break;
 		case 'q':
 		case 'Q':
 		{
@@ -146,6 +168,8 @@ void MainEntry::run()
 		default:
 			fmt::print(fg(fmt::color::red), "Please, try another option.\n"); // Out of range option
 		}
+
+		JobSystem::Get().shutdown();
 	}
 }
 
@@ -1,10 +1,416 @@
 #include "physics_engine/collision_detection/collision_detection.h"
 
+#include "core/cpu_features.h"
+#include "core/job_system.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
 //Third party
 
 #include <fmt/core.h>
 #include <fmt/color.h>
 
-CollisionDetection::CollisionDetection(){
-	fmt::print(fg(fmt::color::chocolate), "\n{}\n", "Collision Detection entry point.");
+const char *broadphase_type_name(BroadphaseType type)
+{
+	switch (type)
+	{
+	case BroadphaseType::Tree:
+		return "dynamic aabb tree";
+	case BroadphaseType::SweepAndPrune:
+		return "sweep and prune";
+	default:
+		return "unknown";
+	}
+}
+
+uint32_t CollisionDetection::allocate_proxy(const Aabb &aabb, uint32_t data)
+{
+	uint32_t proxy;
+	if (!freeIds.empty())
+	{
+		proxy = freeIds.back();
+		freeIds.pop_back();
+	}
+	else
+	{
+		proxy = (uint32_t)backendProxies.size();
+		backendProxies.push_back(~0u);
+		aabbs.emplace_back();
+		userData.push_back(0);
+	}
+
+	aabbs[proxy] = aabb;
+	userData[proxy] = data;
+	return proxy;
+}
+
+void CollisionDetection::mark_changed(uint32_t data)
+{
+	if (type != BroadphaseType::Tree)
+		return;
+
+	if (dataChanged.size() <= data)
+		dataChanged.resize(data + 1, 0);
+
+	if (!dataChanged[data])
+	{
+		dataChanged[data] = 1;
+		changedData.push_back(data);
+	}
+}
+
+void CollisionDetection::set_broadphase(BroadphaseType newType)
+{
+	if (newType == type)
+		return;
+
+	tree.clear();
+	sweepAndPrune.clear();
+	type = newType;
+
+	// every pair is found again by the new one
+	pairs.clear();
+	for (uint32_t data : changedData)
+		dataChanged[data] = 0;
+	changedData.clear();
+
+	// every live proxy goes into the new one as a batch
+	std::vector<uint32_t> proxies;
+	std::vector<Aabb> liveAabbs;
+	std::vector<uint32_t> liveUserData;
+	for (uint32_t proxy = 0; proxy < backendProxies.size(); proxy++)
+	{
+		if (backendProxies[proxy] == ~0u)
+			continue;
+
+		proxies.push_back(proxy);
+		liveAabbs.push_back(aabbs[proxy]);
+		liveUserData.push_back(userData[proxy]);
+	}
+
+	std::vector<uint32_t> created(proxies.size());
+	if (type == BroadphaseType::Tree)
+		tree.create_proxies(liveAabbs.data(), liveUserData.data(), (uint32_t)proxies.size(), created.data());
+	else
+		sweepAndPrune.create_proxies(liveAabbs.data(), liveUserData.data(), (uint32_t)proxies.size(), created.data());
+
+	for (size_t i = 0; i < proxies.size(); i++)
+	{
+		backendProxies[proxies[i]] = created[i];
+		mark_changed(liveUserData[i]);
+	}
+}
+
+uint32_t CollisionDetection::add_proxy(const Aabb &aabb, uint32_t data)
+{
+	uint32_t proxy = allocate_proxy(aabb, data);
+	backendProxies[proxy] = type == BroadphaseType::Tree ? tree.create_proxy(aabb, data) : sweepAndPrune.create_proxy(aabb, data);
+	mark_changed(data);
+	return proxy;
+}
+
+void CollisionDetection::add_proxies(const Aabb *batchAabbs, const uint32_t *batchUserData, uint32_t count, uint32_t *outProxies)
+{
+	std::vector<uint32_t> created(count);
+	if (type == BroadphaseType::Tree)
+		tree.create_proxies(batchAabbs, batchUserData, count, created.data());
+	else
+		sweepAndPrune.create_proxies(batchAabbs, batchUserData, count, created.data());
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		outProxies[i] = allocate_proxy(batchAabbs[i], batchUserData[i]);
+		backendProxies[outProxies[i]] = created[i];
+		mark_changed(batchUserData[i]);
+	}
+}
+
+void CollisionDetection::remove_proxy(uint32_t proxy)
+{
+	if (type == BroadphaseType::Tree)
+		tree.destroy_proxy(backendProxies[proxy]);
+	else
+		sweepAndPrune.destroy_proxy(backendProxies[proxy]);
+
+	backendProxies[proxy] = ~0u;
+	freeIds.push_back(proxy);
+	mark_changed(userData[proxy]);
+}
+
+void CollisionDetection::remove_proxies(const uint32_t *proxies, uint32_t count)
+{
+	std::vector<uint32_t> removed(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		removed[i] = backendProxies[proxies[i]];
+		backendProxies[proxies[i]] = ~0u;
+		freeIds.push_back(proxies[i]);
+		mark_changed(userData[proxies[i]]);
+	}
+
+	if (type == BroadphaseType::Tree)
+		tree.destroy_proxies(removed.data(), count);
+	else
+		sweepAndPrune.destroy_proxies(removed.data(), count);
+}
+
+void CollisionDetection::clear()
+{
+	tree.clear();
+	sweepAndPrune.clear();
+
+	backendProxies.clear();
+	aabbs.clear();
+	userData.clear();
+	freeIds.clear();
+
+	pairs.clear();
+	dataChanged.clear();
+	changedData.clear();
+	stats = BroadphaseStats{};
+	moved = 0;
+	moveMs = 0.f;
+}
+
+void CollisionDetection::move_proxy(uint32_t proxy, const Aabb &aabb, const glm::vec3 &displacement)
+{
+	aabbs[proxy] = aabb;
+
+	if (type == BroadphaseType::Tree)
+	{
+		if (tree.move_proxy(backendProxies[proxy], aabb, displacement))
+		{
+			moved++;
+			mark_changed(userData[proxy]);
+		}
+	}
+	else
+		sweepAndPrune.move_proxy(backendProxies[proxy], aabb);
+}
+
+void CollisionDetection::move_proxies(const uint32_t *proxies, const Aabb *movedAabbs, const glm::vec3 *displacements, uint32_t count)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	for (uint32_t i = 0; i < count; i++)
+		move_proxy(proxies[i], movedAabbs[i], displacements[i]);
+
+	moveMs += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+const std::vector<BroadphasePair> &CollisionDetection::update_pairs()
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	if (type == BroadphaseType::Tree)
+	{
+		tree.update_pairs();
+
+		// proxies are tree nodes, the caller knows its objects by their user data. Like in the tree the
+		// pairs of unchanged objects still hold, only the new ones are looked up and merged in
+		if (!changedData.empty())
+		{
+			auto changed = [this](uint32_t data)
+			{ return data < dataChanged.size() && dataChanged[data]; };
+			std::erase_if(pairs, [&](const BroadphasePair &pair)
+						  { return changed(pair.a) || changed(pair.b); });
+
+			size_t kept = pairs.size();
+			for (const BroadphasePair &pair : tree.new_pairs())
+			{
+				uint32_t a = tree.user_data(pair.a);
+				uint32_t b = tree.user_data(pair.b);
+				pairs.push_back(BroadphasePair{std::min(a, b), std::max(a, b)});
+			}
+
+			std::sort(pairs.begin() + kept, pairs.end());
+			std::inplace_merge(pairs.begin(), pairs.begin() + kept, pairs.end());
+
+			for (uint32_t data : changedData)
+				dataChanged[data] = 0;
+			changedData.clear();
+		}
+	}
+	else
+		pairs = sweepAndPrune.update_pairs();
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	stats.type = type;
+	stats.proxies = type == BroadphaseType::Tree ? tree.proxy_count() : sweepAndPrune.proxy_count();
+	stats.pairs = (uint32_t)pairs.size();
+	stats.moved = moved;
+	stats.updateMs = moveMs + std::chrono::duration<float, std::milli>(end - start).count();
+	stats.treeHeight = type == BroadphaseType::Tree ? tree.height() : 0;
+	stats.areaRatio = type == BroadphaseType::Tree ? tree.area_ratio() : 0.f;
+	stats.sweepAxis = sweepAndPrune.sweep_axis();
+	stats.simd = sweepAndPrune.simd && cpu_has_avx2();
+
+	moved = 0;
+	moveMs = 0.f;
+	return pairs;
+}
+
+const std::vector<ContactManifold> &CollisionDetection::find_contacts(const Shape *shapes, const ShapeTransform *transforms, const uint8_t *active)
+{
+	if (active == nullptr)
+		return narrowphase.collide(pairs, shapes, transforms);
+
+	activePairs.clear();
+	for (const BroadphasePair &pair : pairs)
+	{
+		if (active[pair.a] || active[pair.b])
+			activePairs.push_back(pair);
+	}
+	return narrowphase.collide(activePairs, shapes, transforms);
+}
+
+void run_broadphase_benchmark()
+{
+	constexpr uint32_t OBJECT_COUNTS[] = {1000, 10000, 100000};
+	constexpr uint32_t STEPS = 60;
+	constexpr float DT = 1.f / 60.f;
+	constexpr float DENSITY = 0.05f; // boxes per unit of volume, a handful of neighbours each
+
+	fmt::print(fg(fmt::color::bisque), "\nBroadphase benchmark ( unit boxes moving for {} steps, {} threads )\n", STEPS, JobSystem::Get().thread_count());
+	fmt::print("{:>8} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10} {:>14} {:>10} {:>8}\n", "objects", "batch ms", "one by one", "tree ms",
+			   "sap ms", "sap scalar", "pairs", "brute force ms", "speedup", "missed");
+
+	auto elapsed_ms = [](auto start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	};
+
+	for (uint32_t count : OBJECT_COUNTS)
+	{
+		float side = std::cbrt(count / DENSITY);
+
+		uint32_t seed = 7;
+		auto random = [&seed]()
+		{
+			seed = seed * 1664525u + 1013904223u;
+			return (seed >> 8) / 16777216.f;
+		};
+
+		std::vector<glm::vec3> positions(count);
+		std::vector<glm::vec3> velocities(count);
+		std::vector<glm::vec3> displacements(count);
+		std::vector<Aabb> aabbs(count);
+		std::vector<uint32_t> ids(count);
+		std::vector<uint32_t> proxies(count);
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			positions[i] = glm::vec3(random(), random(), random()) * side;
+			velocities[i] = (glm::vec3(random(), random(), random()) - 0.5f) * 4.f;
+			aabbs[i] = Aabb{positions[i] - 0.5f, positions[i] + 0.5f};
+			ids[i] = i;
+		}
+
+		// insertion of every proxy on its own, for comparison with the batch
+		CollisionDetection single;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < count; i++)
+			single.add_proxy(aabbs[i], i);
+		double singleMs = elapsed_ms(start);
+
+		CollisionDetection broadphase;
+		start = std::chrono::high_resolution_clock::now();
+		broadphase.add_proxies(aabbs.data(), ids.data(), count, proxies.data());
+		double batchMs = elapsed_ms(start);
+		broadphase.update_pairs();
+
+		// sweep and prune with and without the AVX2 sweep, on the same boxes as the tree
+		CollisionDetection sweep;
+		sweep.set_broadphase(BroadphaseType::SweepAndPrune);
+		sweep.add_proxies(aabbs.data(), ids.data(), count, proxies.data());
+
+		CollisionDetection scalarSweep;
+		scalarSweep.set_broadphase(BroadphaseType::SweepAndPrune);
+		scalarSweep.set_simd(false);
+		scalarSweep.add_proxies(aabbs.data(), ids.data(), count, proxies.data());
+
+		double stepMs = 0.0;
+		double sweepMs = 0.0;
+		double scalarSweepMs = 0.0;
+		for (uint32_t step = 0; step < STEPS; step++)
+		{
+			for (uint32_t i = 0; i < count; i++)
+			{
+				// bounce off the walls of the volume
+				for (int axis = 0; axis < 3; axis++)
+				{
+					if ((positions[i][axis] < 0.f && velocities[i][axis] < 0.f) || (positions[i][axis] > side && velocities[i][axis] > 0.f))
+						velocities[i][axis] = -velocities[i][axis];
+				}
+
+				displacements[i] = velocities[i] * DT;
+				positions[i] += displacements[i];
+				aabbs[i] = Aabb{positions[i] - 0.5f, positions[i] + 0.5f};
+			}
+
+			start = std::chrono::high_resolution_clock::now();
+			broadphase.move_proxies(proxies.data(), aabbs.data(), displacements.data(), count);
+			broadphase.update_pairs();
+			stepMs += elapsed_ms(start);
+
+			start = std::chrono::high_resolution_clock::now();
+			sweep.move_proxies(proxies.data(), aabbs.data(), displacements.data(), count);
+			sweep.update_pairs();
+			sweepMs += elapsed_ms(start);
+
+			start = std::chrono::high_resolution_clock::now();
+			scalarSweep.move_proxies(proxies.data(), aabbs.data(), displacements.data(), count);
+			scalarSweep.update_pairs();
+			scalarSweepMs += elapsed_ms(start);
+		}
+		stepMs /= STEPS;
+		sweepMs /= STEPS;
+		scalarSweepMs /= STEPS;
+
+		const std::vector<BroadphasePair> &pairs = broadphase.update_pairs();
+		const std::vector<BroadphasePair> &sweepPairs = sweep.update_pairs();
+		const std::vector<BroadphasePair> &scalarSweepPairs = scalarSweep.update_pairs();
+
+		// every pair against every other on the tight boxes, laid out so the inner loop is cheap to be fair to it
+		std::vector<float> bounds[6];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			for (uint32_t i = 0; i < count; i++)
+			{
+				bounds[axis].push_back(aabbs[i].min[axis]);
+				bounds[axis + 3].push_back(aabbs[i].max[axis]);
+			}
+		}
+
+		std::vector<BroadphasePair> exact;
+		start = std::chrono::high_resolution_clock::now();
+		for (uint32_t a = 0; a < count; a++)
+		{
+			for (uint32_t b = a + 1; b < count; b++)
+			{
+				bool overlap = (bounds[0][a] <= bounds[3][b]) & (bounds[3][a] >= bounds[0][b]) & (bounds[1][a] <= bounds[4][b]) &
+							   (bounds[4][a] >= bounds[1][b]) & (bounds[2][a] <= bounds[5][b]) & (bounds[5][a] >= bounds[2][b]);
+				if (overlap)
+					exact.push_back(BroadphasePair{a, b});
+			}
+		}
+		double bruteMs = elapsed_ms(start);
+
+		// the fat pairs have to cover all of the exact ones, sweep and prune has to find exactly them
+		uint32_t missed = 0;
+		for (const BroadphasePair &pair : exact)
+		{
+			if (!std::binary_search(pairs.begin(), pairs.end(), pair))
+				missed++;
+		}
+		if (sweepPairs != exact || scalarSweepPairs != exact)
+			fmt::print(fg(fmt::color::red), "sweep and prune pairs differ from brute force ( {} and {} against {} )\n", sweepPairs.size(),
+					   scalarSweepPairs.size(), exact.size());
+
+		fmt::print("{:>8} {:>10.2f} {:>10.2f} {:>10.3f} {:>10.3f} {:>10.3f} {:>10} {:>14.1f} {:>9.0f}x {:>8}\n", count, batchMs, singleMs, stepMs,
+				   sweepMs, scalarSweepMs, exact.size(), bruteMs, bruteMs / std::min(stepMs, sweepMs), missed);
+	}
 }
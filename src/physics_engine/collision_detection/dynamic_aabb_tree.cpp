@@ -0,0 +1,507 @@
+#include "physics_engine/collision_detection/dynamic_aabb_tree.h"
+
+#include "core/job_system.h"
+
+uint32_t DynamicAabbTree::allocate_node()
+{
+	uint32_t node;
+	if (freeList != NULL_NODE)
+	{
+		node = freeList;
+		freeList = nodes[node].parent;
+	}
+	else
+	{
+		node = (uint32_t)nodes.size();
+		nodes.emplace_back();
+	}
+
+	nodes[node].parent = NULL_NODE;
+	nodes[node].child1 = NULL_NODE;
+	nodes[node].child2 = NULL_NODE;
+	nodes[node].height = 0;
+	nodes[node].userData = ~0u;
+	return node;
+}
+
+void DynamicAabbTree::free_node(uint32_t node)
+{
+	nodes[node].parent = freeList;
+	nodes[node].height = -1;
+	freeList = node;
+}
+
+void DynamicAabbTree::mark_dirty(uint32_t proxy)
+{
+	if (dirty.size() <= proxy)
+		dirty.resize(nodes.size(), 0);
+
+	if (!dirty[proxy])
+	{
+		dirty[proxy] = 1;
+		moveBuffer.push_back(proxy);
+	}
+}
+
+uint32_t DynamicAabbTree::create_proxy(const Aabb &aabb, uint32_t userData)
+{
+	uint32_t proxy = allocate_node();
+	nodes[proxy].aabb = Aabb{aabb.min - margin, aabb.max + margin};
+	nodes[proxy].userData = userData;
+
+	insert_leaf(proxy);
+	leafCount++;
+	mark_dirty(proxy);
+	return proxy;
+}
+
+void DynamicAabbTree::destroy_proxy(uint32_t proxy)
+{
+	remove_leaf(proxy);
+	free_node(proxy);
+	leafCount--;
+	mark_dirty(proxy);
+}
+
+void DynamicAabbTree::create_proxies(const Aabb *aabbs, const uint32_t *userData, uint32_t count, uint32_t *outProxies)
+{
+	if (count == 0)
+		return;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t proxy = allocate_node();
+		nodes[proxy].aabb = Aabb{aabbs[i].min - margin, aabbs[i].max + margin};
+		nodes[proxy].userData = userData[i];
+		outProxies[i] = proxy;
+		mark_dirty(proxy);
+	}
+
+	// a batch at least the size of the tree gets a top down build of everything, which is a much
+	// better tree than inserting them one by one. A smaller one is inserted leaf by leaf, a subtree
+	// hung in as a whole can be taller than the rotations are able to even out.
+	if (count >= leafCount)
+	{
+		leafCount += count;
+		rebuild();
+		return;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+		insert_leaf(outProxies[i]);
+	leafCount += count;
+}
+
+void DynamicAabbTree::destroy_proxies(const uint32_t *proxies, uint32_t count)
+{
+	if (count * 2 <= leafCount)
+	{
+		for (uint32_t i = 0; i < count; i++)
+			destroy_proxy(proxies[i]);
+		return;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		free_node(proxies[i]);
+		mark_dirty(proxies[i]);
+	}
+	leafCount -= count;
+
+	rebuild();
+}
+
+bool DynamicAabbTree::move_proxy(uint32_t proxy, const Aabb &aabb, const glm::vec3 &displacement)
+{
+	Node &node = nodes[proxy];
+
+	// still inside its fat AABB, unless that has grown far too big from an earlier fast move
+	if (node.aabb.contains(aabb))
+	{
+		Aabb loose{aabb.min - 4.f * margin, aabb.max + 4.f * margin};
+		glm::vec3 d = glm::abs(displacement) * displacementMultiplier;
+		loose.min -= d;
+		loose.max += d;
+		if (loose.contains(node.aabb))
+			return false;
+	}
+
+	// enlarged towards where it is heading
+	Aabb fat{aabb.min - margin, aabb.max + margin};
+	glm::vec3 d = displacement * displacementMultiplier;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (d[axis] < 0.f)
+			fat.min[axis] += d[axis];
+		else
+			fat.max[axis] += d[axis];
+	}
+
+	remove_leaf(proxy);
+	nodes[proxy].aabb = fat;
+	insert_leaf(proxy);
+	mark_dirty(proxy);
+	return true;
+}
+
+void DynamicAabbTree::insert_leaf(uint32_t leaf)
+{
+	if (root == NULL_NODE)
+	{
+		root = leaf;
+		nodes[root].parent = NULL_NODE;
+		return;
+	}
+
+	// walk down to the sibling that grows the total surface area the least
+	Aabb leafAabb = nodes[leaf].aabb;
+	uint32_t index = root;
+	while (!nodes[index].leaf())
+	{
+		const Node &node = nodes[index];
+
+		float area = node.aabb.surface_area();
+		float combinedArea = Aabb::merge(node.aabb, leafAabb).surface_area();
+
+		// a new parent for this node and the leaf, or the cost pushed down to the children
+		float cost = 2.f * combinedArea;
+		float inheritanceCost = 2.f * (combinedArea - area);
+
+		auto child_cost = [&](uint32_t child)
+		{
+			const Node &c = nodes[child];
+			float merged = Aabb::merge(c.aabb, leafAabb).surface_area();
+			return (c.leaf() ? merged : merged - c.aabb.surface_area()) + inheritanceCost;
+		};
+
+		float cost1 = child_cost(node.child1);
+		float cost2 = child_cost(node.child2);
+
+		if (cost < cost1 && cost < cost2)
+			break;
+
+		index = cost1 < cost2 ? node.child1 : node.child2;
+	}
+
+	uint32_t sibling = index;
+	uint32_t oldParent = nodes[sibling].parent;
+	uint32_t newParent = allocate_node();
+
+	nodes[newParent].parent = oldParent;
+	nodes[newParent].aabb = Aabb::merge(leafAabb, nodes[sibling].aabb);
+	nodes[newParent].height = 1 + std::max(nodes[sibling].height, nodes[leaf].height);
+	nodes[newParent].child1 = sibling;
+	nodes[newParent].child2 = leaf;
+	nodes[sibling].parent = newParent;
+	nodes[leaf].parent = newParent;
+
+	if (oldParent == NULL_NODE)
+		root = newParent;
+	else if (nodes[oldParent].child1 == sibling)
+		nodes[oldParent].child1 = newParent;
+	else
+		nodes[oldParent].child2 = newParent;
+
+	// refit and rebalance up to the root
+	index = nodes[leaf].parent;
+	while (index != NULL_NODE)
+	{
+		index = balance(index);
+
+		Node &node = nodes[index];
+		node.height = 1 + std::max(nodes[node.child1].height, nodes[node.child2].height);
+		node.aabb = Aabb::merge(nodes[node.child1].aabb, nodes[node.child2].aabb);
+
+		index = node.parent;
+	}
+}
+
+void DynamicAabbTree::remove_leaf(uint32_t leaf)
+{
+	if (leaf == root)
+	{
+		root = NULL_NODE;
+		return;
+	}
+
+	uint32_t parent = nodes[leaf].parent;
+	uint32_t grandParent = nodes[parent].parent;
+	uint32_t sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+	free_node(parent);
+
+	if (grandParent == NULL_NODE)
+	{
+		root = sibling;
+		nodes[sibling].parent = NULL_NODE;
+		return;
+	}
+
+	// the sibling takes the place of the parent
+	if (nodes[grandParent].child1 == parent)
+		nodes[grandParent].child1 = sibling;
+	else
+		nodes[grandParent].child2 = sibling;
+	nodes[sibling].parent = grandParent;
+
+	uint32_t index = grandParent;
+	while (index != NULL_NODE)
+	{
+		index = balance(index);
+
+		Node &node = nodes[index];
+		node.height = 1 + std::max(nodes[node.child1].height, nodes[node.child2].height);
+		node.aabb = Aabb::merge(nodes[node.child1].aabb, nodes[node.child2].aabb);
+
+		index = node.parent;
+	}
+}
+
+/*
+  Rotates the taller child of a up when the heights of the children differ by more than one, returns
+  the node that took the place of a.
+
+         a
+       /   \
+      b     c
+           / \
+          f   g
+*/
+uint32_t DynamicAabbTree::balance(uint32_t iA)
+{
+	Node &a = nodes[iA];
+	if (a.leaf() || a.height < 2)
+		return iA;
+
+	uint32_t iB = a.child1;
+	uint32_t iC = a.child2;
+	Node &b = nodes[iB];
+	Node &c = nodes[iC];
+
+	int32_t difference = c.height - b.height;
+
+	// c goes up, a takes the shorter child of c
+	if (difference > 1)
+	{
+		uint32_t iF = c.child1;
+		uint32_t iG = c.child2;
+		Node &f = nodes[iF];
+		Node &g = nodes[iG];
+
+		c.child1 = iA;
+		c.parent = a.parent;
+		a.parent = iC;
+
+		if (c.parent == NULL_NODE)
+			root = iC;
+		else if (nodes[c.parent].child1 == iA)
+			nodes[c.parent].child1 = iC;
+		else
+			nodes[c.parent].child2 = iC;
+
+		if (f.height > g.height)
+		{
+			c.child2 = iF;
+			a.child2 = iG;
+			g.parent = iA;
+			a.aabb = Aabb::merge(b.aabb, g.aabb);
+			c.aabb = Aabb::merge(a.aabb, f.aabb);
+			a.height = 1 + std::max(b.height, g.height);
+			c.height = 1 + std::max(a.height, f.height);
+		}
+		else
+		{
+			c.child2 = iG;
+			a.child2 = iF;
+			f.parent = iA;
+			a.aabb = Aabb::merge(b.aabb, f.aabb);
+			c.aabb = Aabb::merge(a.aabb, g.aabb);
+			a.height = 1 + std::max(b.height, f.height);
+			c.height = 1 + std::max(a.height, g.height);
+		}
+
+		return iC;
+	}
+
+	// b goes up, a takes the shorter child of b
+	if (difference < -1)
+	{
+		uint32_t iD = b.child1;
+		uint32_t iE = b.child2;
+		Node &d = nodes[iD];
+		Node &e = nodes[iE];
+
+		b.child1 = iA;
+		b.parent = a.parent;
+		a.parent = iB;
+
+		if (b.parent == NULL_NODE)
+			root = iB;
+		else if (nodes[b.parent].child1 == iA)
+			nodes[b.parent].child1 = iB;
+		else
+			nodes[b.parent].child2 = iB;
+
+		if (d.height > e.height)
+		{
+			b.child2 = iD;
+			a.child1 = iE;
+			e.parent = iA;
+			a.aabb = Aabb::merge(c.aabb, e.aabb);
+			b.aabb = Aabb::merge(a.aabb, d.aabb);
+			a.height = 1 + std::max(c.height, e.height);
+			b.height = 1 + std::max(a.height, d.height);
+		}
+		else
+		{
+			b.child2 = iE;
+			a.child1 = iD;
+			d.parent = iA;
+			a.aabb = Aabb::merge(c.aabb, d.aabb);
+			b.aabb = Aabb::merge(a.aabb, e.aabb);
+			a.height = 1 + std::max(c.height, d.height);
+			b.height = 1 + std::max(a.height, e.height);
+		}
+
+		return iB;
+	}
+
+	return iA;
+}
+
+uint32_t DynamicAabbTree::build(uint32_t *leaves, uint32_t begin, uint32_t end)
+{
+	if (end - begin == 1)
+		return leaves[begin];
+
+	// split at the median of the centers along the axis they spread out the most
+	Aabb centers{nodes[leaves[begin]].aabb.center(), nodes[leaves[begin]].aabb.center()};
+	for (uint32_t i = begin + 1; i < end; i++)
+	{
+		glm::vec3 center = nodes[leaves[i]].aabb.center();
+		centers.min = glm::min(centers.min, center);
+		centers.max = glm::max(centers.max, center);
+	}
+
+	glm::vec3 extent = centers.max - centers.min;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+	uint32_t middle = begin + (end - begin) / 2;
+	std::nth_element(leaves + begin, leaves + middle, leaves + end, [this, axis](uint32_t l, uint32_t r)
+					 { return nodes[l].aabb.min[axis] + nodes[l].aabb.max[axis] < nodes[r].aabb.min[axis] + nodes[r].aabb.max[axis]; });
+
+	uint32_t child1 = build(leaves, begin, middle);
+	uint32_t child2 = build(leaves, middle, end);
+
+	uint32_t node = allocate_node();
+	nodes[node].child1 = child1;
+	nodes[node].child2 = child2;
+	nodes[node].aabb = Aabb::merge(nodes[child1].aabb, nodes[child2].aabb);
+	nodes[node].height = 1 + std::max(nodes[child1].height, nodes[child2].height);
+	nodes[child1].parent = node;
+	nodes[child2].parent = node;
+	return node;
+}
+
+void DynamicAabbTree::rebuild()
+{
+	// leaves are the only live nodes with height 0, everything above them is thrown away
+	std::vector<uint32_t> leaves;
+	leaves.reserve(leafCount);
+	for (uint32_t i = 0; i < nodes.size(); i++)
+	{
+		if (nodes[i].height == 0)
+			leaves.push_back(i);
+		else if (nodes[i].height > 0)
+			free_node(i);
+	}
+
+	root = NULL_NODE;
+	if (leaves.empty())
+		return;
+
+	root = build(leaves.data(), 0, (uint32_t)leaves.size());
+	nodes[root].parent = NULL_NODE;
+}
+
+void DynamicAabbTree::clear()
+{
+	nodes.clear();
+	root = NULL_NODE;
+	freeList = NULL_NODE;
+	leafCount = 0;
+
+	moveBuffer.clear();
+	dirty.clear();
+	pairs.clear();
+	newPairs.clear();
+}
+
+const std::vector<BroadphasePair> &DynamicAabbTree::update_pairs()
+{
+	newPairs.clear();
+	if (moveBuffer.empty())
+		return pairs;
+
+	dirty.resize(nodes.size(), 0);
+
+	// pairs between two proxies that stayed where they were still hold
+	std::erase_if(pairs, [this](const BroadphasePair &pair)
+				  { return dirty[pair.a] || dirty[pair.b]; });
+
+	JobSystem &jobs = JobSystem::Get();
+	threadPairs.resize(std::max(jobs.thread_index_count(), 1u));
+	for (std::vector<BroadphasePair> &found : threadPairs)
+		found.clear();
+
+	jobs.parallel_for((uint32_t)moveBuffer.size(), 64, [this](uint32_t begin, uint32_t end)
+					  {
+		std::vector<BroadphasePair> &found = threadPairs[JobSystem::thread_index()];
+		for (uint32_t i = begin; i < end; i++)
+		{
+			uint32_t proxy = moveBuffer[i];
+
+			// destroyed since
+			if (nodes[proxy].height != 0)
+				continue;
+
+			query(nodes[proxy].aabb, [&](uint32_t other)
+				  {
+				// two changed proxies find each other, the lower one keeps the pair
+				if (other == proxy || (dirty[other] && other < proxy))
+					return true;
+
+				found.push_back(BroadphasePair{std::min(proxy, other), std::max(proxy, other)});
+				return true; });
+		} });
+
+	newPairs.clear();
+	for (const std::vector<BroadphasePair> &found : threadPairs)
+		newPairs.insert(newPairs.end(), found.begin(), found.end());
+	std::sort(newPairs.begin(), newPairs.end());
+
+	size_t kept = pairs.size();
+	pairs.insert(pairs.end(), newPairs.begin(), newPairs.end());
+	std::inplace_merge(pairs.begin(), pairs.begin() + kept, pairs.end());
+
+	for (uint32_t proxy : moveBuffer)
+		dirty[proxy] = 0;
+	moveBuffer.clear();
+
+	return pairs;
+}
+
+float DynamicAabbTree::area_ratio() const
+{
+	if (root == NULL_NODE)
+		return 0.f;
+
+	float total = 0.f;
+	for (const Node &node : nodes)
+	{
+		if (node.height > 0)
+			total += node.aabb.surface_area();
+	}
+
+	return total / nodes[root].aabb.surface_area();
+}
@@ -0,0 +1,514 @@
+#include "physics_engine/collision_detection/gjk_epa.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+	constexpr uint32_t GJK_MAX_ITERATIONS = 64;
+	constexpr float GJK_TOLERANCE = 1e-6f; // relative progress that counts as converged
+
+	constexpr uint32_t EPA_MAX_VERTICES = 128;
+	constexpr uint32_t EPA_MAX_FACES = 256;
+	constexpr uint32_t EPA_MAX_EDGES = 128;
+	constexpr float EPA_TOLERANCE = 1e-4f;
+
+	SimplexVertex minkowski_support(const ConvexCore &a, const ConvexCore &b, const glm::vec3 &direction)
+	{
+		SimplexVertex vertex;
+		vertex.a = a.support(direction);
+		vertex.b = b.support(-direction);
+		vertex.w = vertex.a - vertex.b;
+		return vertex;
+	}
+
+	glm::vec3 keep(Simplex &simplex, const SimplexVertex &vertex)
+	{
+		simplex.vertices[0] = vertex;
+		simplex.lambda[0] = 1.f;
+		simplex.count = 1;
+		return vertex.w;
+	}
+
+	glm::vec3 keep(Simplex &simplex, const SimplexVertex &first, const SimplexVertex &second, float t)
+	{
+		simplex.vertices[0] = first;
+		simplex.vertices[1] = second;
+		simplex.lambda[0] = 1.f - t;
+		simplex.lambda[1] = t;
+		simplex.count = 2;
+		return first.w + (second.w - first.w) * t;
+	}
+
+	// The solvers find the point of the simplex closest to the origin, and shrink the simplex to the
+	// vertices of the feature it lies on
+	glm::vec3 solve_segment(Simplex &simplex)
+	{
+		SimplexVertex a = simplex.vertices[0];
+		SimplexVertex b = simplex.vertices[1];
+
+		glm::vec3 ab = b.w - a.w;
+		float t = -glm::dot(a.w, ab);
+		if (t <= 0.f)
+			return keep(simplex, a);
+
+		float lengthSquared = glm::dot(ab, ab);
+		if (t >= lengthSquared)
+			return keep(simplex, b);
+
+		return keep(simplex, a, b, t / lengthSquared);
+	}
+
+	// voronoi regions of the triangle, as in Real-Time Collision Detection 5.1.5
+	glm::vec3 solve_triangle(Simplex &simplex)
+	{
+		SimplexVertex a = simplex.vertices[0];
+		SimplexVertex b = simplex.vertices[1];
+		SimplexVertex c = simplex.vertices[2];
+
+		glm::vec3 ab = b.w - a.w;
+		glm::vec3 ac = c.w - a.w;
+
+		float d1 = -glm::dot(ab, a.w);
+		float d2 = -glm::dot(ac, a.w);
+		if (d1 <= 0.f && d2 <= 0.f)
+			return keep(simplex, a);
+
+		float d3 = -glm::dot(ab, b.w);
+		float d4 = -glm::dot(ac, b.w);
+		if (d3 >= 0.f && d4 <= d3)
+			return keep(simplex, b);
+
+		float vc = d1 * d4 - d3 * d2;
+		if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+			return keep(simplex, a, b, d1 / (d1 - d3));
+
+		float d5 = -glm::dot(ab, c.w);
+		float d6 = -glm::dot(ac, c.w);
+		if (d6 >= 0.f && d5 <= d6)
+			return keep(simplex, c);
+
+		float vb = d5 * d2 - d1 * d6;
+		if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+			return keep(simplex, a, c, d2 / (d2 - d6));
+
+		float va = d3 * d6 - d5 * d4;
+		if (va <= 0.f && d4 - d3 >= 0.f && d5 - d6 >= 0.f)
+			return keep(simplex, b, c, (d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+		float denominator = 1.f / (va + vb + vc);
+		float v = vb * denominator;
+		float w = vc * denominator;
+		simplex.lambda[0] = 1.f - v - w;
+		simplex.lambda[1] = v;
+		simplex.lambda[2] = w;
+		return a.w + ab * v + ac * w;
+	}
+
+	// closest point on the faces the origin is in front of, inside when there are none
+	glm::vec3 solve_tetrahedron(Simplex &simplex, bool &inside)
+	{
+		constexpr uint32_t FACES[4][4] = {{0, 1, 2, 3}, {0, 2, 3, 1}, {0, 3, 1, 2}, {1, 3, 2, 0}};
+
+		inside = true;
+		Simplex best;
+		glm::vec3 closest(0.f);
+		float bestDistance = std::numeric_limits<float>::max();
+
+		for (const uint32_t *face : FACES)
+		{
+			const glm::vec3 &a = simplex.vertices[face[0]].w;
+			glm::vec3 normal = glm::cross(simplex.vertices[face[1]].w - a, simplex.vertices[face[2]].w - a);
+			float origin = -glm::dot(a, normal);
+			float opposite = glm::dot(simplex.vertices[face[3]].w - a, normal);
+
+			// a flat tetrahedron has no inside, every face gets tested
+			bool degenerate = opposite * opposite <= 1e-12f * glm::dot(normal, normal);
+			if (!degenerate && origin * opposite >= 0.f)
+				continue;
+
+			inside = false;
+			Simplex triangle;
+			triangle.vertices[0] = simplex.vertices[face[0]];
+			triangle.vertices[1] = simplex.vertices[face[1]];
+			triangle.vertices[2] = simplex.vertices[face[2]];
+			triangle.count = 3;
+
+			glm::vec3 point = solve_triangle(triangle);
+			float distance = glm::dot(point, point);
+			if (distance < bestDistance)
+			{
+				bestDistance = distance;
+				best = triangle;
+				closest = point;
+			}
+		}
+
+		if (!inside)
+			simplex = best;
+
+		return closest;
+	}
+
+	struct EpaFace
+	{
+		uint32_t vertices[3];
+		glm::vec3 normal;
+		float distance;
+		bool live;
+	};
+
+	struct EpaEdge
+	{
+		uint32_t from;
+		uint32_t to;
+	};
+
+	bool add_face(EpaFace *faces, uint32_t &faceCount, const SimplexVertex *vertices, uint32_t v0, uint32_t v1, uint32_t v2)
+	{
+		if (faceCount == EPA_MAX_FACES)
+			return false;
+
+		EpaFace &face = faces[faceCount++];
+		face.vertices[0] = v0;
+		face.vertices[1] = v1;
+		face.vertices[2] = v2;
+		face.live = true;
+
+		glm::vec3 normal = glm::cross(vertices[v1].w - vertices[v0].w, vertices[v2].w - vertices[v0].w);
+		float length = glm::length(normal);
+		if (length > 1e-12f)
+		{
+			face.normal = normal / length;
+			face.distance = glm::dot(face.normal, vertices[v0].w);
+		}
+		else
+		{
+			// a sliver still closes the polytope but must never be picked
+			face.normal = glm::vec3(0.f);
+			face.distance = std::numeric_limits<float>::max();
+		}
+		return true;
+	}
+}
+
+ConvexCore::ConvexCore(const Shape &shape, const ShapeTransform &transform, const ConvexHull *hulls)
+	: type(shape.type), position(transform.position), orientation(transform.orientation), halfExtents(0.f)
+{
+	switch (shape.type)
+	{
+	case ShapeType::Sphere:
+		radius = shape.radius;
+		break;
+	case ShapeType::Capsule:
+		radius = shape.radius;
+		halfExtents.y = shape.halfHeight;
+		break;
+	case ShapeType::Box:
+		halfExtents = shape.halfExtents;
+		break;
+	case ShapeType::ConvexHull:
+		vertices = hulls[shape.hull].vertices.data();
+		vertexCount = (uint32_t)hulls[shape.hull].vertices.size();
+		break;
+	default:
+		break;
+	}
+}
+
+glm::vec3 ConvexCore::support(const glm::vec3 &direction) const
+{
+	glm::vec3 local = glm::conjugate(orientation) * direction;
+	glm::vec3 point(0.f);
+
+	switch (type)
+	{
+	case ShapeType::Sphere:
+		return position;
+	case ShapeType::Capsule:
+		point.y = local.y >= 0.f ? halfExtents.y : -halfExtents.y;
+		break;
+	case ShapeType::Box:
+		point = glm::vec3(local.x >= 0.f ? halfExtents.x : -halfExtents.x, local.y >= 0.f ? halfExtents.y : -halfExtents.y,
+						  local.z >= 0.f ? halfExtents.z : -halfExtents.z);
+		break;
+	case ShapeType::ConvexHull:
+	{
+		float best = -std::numeric_limits<float>::max();
+		for (uint32_t i = 0; i < vertexCount; i++)
+		{
+			float distance = glm::dot(vertices[i], local);
+			if (distance > best)
+			{
+				best = distance;
+				point = vertices[i];
+			}
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	return position + orientation * point;
+}
+
+GjkResult gjk_distance(const ConvexCore &a, const ConvexCore &b, Simplex &simplex)
+{
+	GjkResult result{};
+
+	glm::vec3 direction = a.position - b.position;
+	if (glm::dot(direction, direction) < 1e-12f)
+		direction = glm::vec3(1.f, 0.f, 0.f);
+
+	glm::vec3 v = keep(simplex, minkowski_support(a, b, direction));
+
+	for (result.iterations = 0; result.iterations < GJK_MAX_ITERATIONS; result.iterations++)
+	{
+		float distanceSquared = glm::dot(v, v);
+
+		// the origin is on the simplex, the cores touch or overlap
+		if (distanceSquared < 1e-12f)
+		{
+			result.overlap = true;
+			break;
+		}
+
+		SimplexVertex vertex = minkowski_support(a, b, -v);
+
+		// no support point gets closer to the origin than v already is
+		if (distanceSquared - glm::dot(v, vertex.w) <= GJK_TOLERANCE * distanceSquared)
+			break;
+
+		bool duplicate = false;
+		for (uint32_t i = 0; i < simplex.count; i++)
+			duplicate |= simplex.vertices[i].w == vertex.w;
+		if (duplicate)
+			break;
+
+		simplex.vertices[simplex.count++] = vertex;
+
+		bool inside = false;
+		switch (simplex.count)
+		{
+		case 2:
+			v = solve_segment(simplex);
+			break;
+		case 3:
+			v = solve_triangle(simplex);
+			break;
+		default:
+			v = solve_tetrahedron(simplex, inside);
+			break;
+		}
+
+		if (inside)
+		{
+			result.overlap = true;
+			break;
+		}
+	}
+
+	if (result.overlap)
+		return result;
+
+	result.pointA = glm::vec3(0.f);
+	result.pointB = glm::vec3(0.f);
+	for (uint32_t i = 0; i < simplex.count; i++)
+	{
+		result.pointA += simplex.vertices[i].a * simplex.lambda[i];
+		result.pointB += simplex.vertices[i].b * simplex.lambda[i];
+	}
+	result.distance = glm::length(v);
+	return result;
+}
+
+bool epa_penetration(const ConvexCore &a, const ConvexCore &b, const Simplex &simplex, EpaResult &result)
+{
+	SimplexVertex vertices[EPA_MAX_VERTICES];
+	EpaFace faces[EPA_MAX_FACES];
+	EpaEdge horizon[EPA_MAX_EDGES];
+
+	uint32_t vertexCount = simplex.count;
+	for (uint32_t i = 0; i < simplex.count; i++)
+		vertices[i] = simplex.vertices[i];
+
+	// GJK stops as soon as the origin touches the simplex, grow it into a tetrahedron first
+	if (vertexCount == 1)
+	{
+		const glm::vec3 AXES[6] = {{1.f, 0.f, 0.f}, {-1.f, 0.f, 0.f}, {0.f, 1.f, 0.f}, {0.f, -1.f, 0.f}, {0.f, 0.f, 1.f}, {0.f, 0.f, -1.f}};
+		for (const glm::vec3 &axis : AXES)
+		{
+			SimplexVertex vertex = minkowski_support(a, b, axis);
+			if (glm::length(vertex.w - vertices[0].w) > 1e-5f)
+			{
+				vertices[vertexCount++] = vertex;
+				break;
+			}
+		}
+	}
+
+	if (vertexCount == 2)
+	{
+		glm::vec3 line = glm::normalize(vertices[1].w - vertices[0].w);
+		glm::vec3 axis = std::abs(line.x) < 0.57f ? glm::vec3(1.f, 0.f, 0.f) : (std::abs(line.y) < 0.57f ? glm::vec3(0.f, 1.f, 0.f) : glm::vec3(0.f, 0.f, 1.f));
+		glm::vec3 side = glm::normalize(glm::cross(line, axis));
+		glm::vec3 up = glm::cross(line, side);
+
+		// around the line in steps of 60 degrees until a support point leaves it
+		for (int step = 0; step < 6; step++)
+		{
+			float angle = (float)step * 1.0471976f;
+			SimplexVertex vertex = minkowski_support(a, b, side * std::cos(angle) + up * std::sin(angle));
+			glm::vec3 offset = vertex.w - vertices[0].w;
+			if (glm::length(offset - line * glm::dot(offset, line)) > 1e-5f)
+			{
+				vertices[vertexCount++] = vertex;
+				break;
+			}
+		}
+	}
+
+	if (vertexCount == 3)
+	{
+		glm::vec3 normal = glm::cross(vertices[1].w - vertices[0].w, vertices[2].w - vertices[0].w);
+		if (glm::dot(normal, normal) < 1e-20f)
+			return false;
+
+		normal = glm::normalize(normal);
+		SimplexVertex vertex = minkowski_support(a, b, normal);
+		if (std::abs(glm::dot(vertex.w - vertices[0].w, normal)) < 1e-5f)
+			vertex = minkowski_support(a, b, -normal);
+		if (std::abs(glm::dot(vertex.w - vertices[0].w, normal)) < 1e-5f)
+			return false;
+
+		vertices[vertexCount++] = vertex;
+	}
+
+	if (vertexCount < 4)
+		return false;
+
+	// wound so every face normal points out
+	if (glm::dot(glm::cross(vertices[1].w - vertices[0].w, vertices[2].w - vertices[0].w), vertices[3].w - vertices[0].w) > 0.f)
+		std::swap(vertices[1], vertices[2]);
+
+	uint32_t faceCount = 0;
+	add_face(faces, faceCount, vertices, 0, 1, 2);
+	add_face(faces, faceCount, vertices, 0, 3, 1);
+	add_face(faces, faceCount, vertices, 0, 2, 3);
+	add_face(faces, faceCount, vertices, 1, 3, 2);
+
+	EpaFace *closest = nullptr;
+	for (;;)
+	{
+		closest = nullptr;
+		for (uint32_t i = 0; i < faceCount; i++)
+		{
+			if (faces[i].live && (!closest || faces[i].distance < closest->distance))
+				closest = &faces[i];
+		}
+
+		if (!closest || closest->distance == std::numeric_limits<float>::max())
+			return false;
+
+		SimplexVertex vertex = minkowski_support(a, b, closest->normal);
+		if (glm::dot(vertex.w, closest->normal) - closest->distance <= EPA_TOLERANCE * std::max(1.f, closest->distance))
+			break;
+		if (vertexCount == EPA_MAX_VERTICES)
+			break;
+
+		uint32_t newVertex = vertexCount;
+		vertices[vertexCount++] = vertex;
+
+		// faces the new vertex sees go, their outline is the horizon the new faces are built on
+		uint32_t edgeCount = 0;
+		bool overflow = false;
+		for (uint32_t i = 0; i < faceCount; i++)
+		{
+			EpaFace &face = faces[i];
+			if (!face.live || glm::dot(face.normal, vertex.w - vertices[face.vertices[0]].w) <= 0.f)
+				continue;
+
+			face.live = false;
+			for (int e = 0; e < 3; e++)
+			{
+				EpaEdge edge{face.vertices[e], face.vertices[(e + 1) % 3]};
+
+				// an edge two removed faces share is inside the hole
+				bool shared = false;
+				for (uint32_t k = 0; k < edgeCount; k++)
+				{
+					if (horizon[k].from == edge.to && horizon[k].to == edge.from)
+					{
+						horizon[k] = horizon[--edgeCount];
+						shared = true;
+						break;
+					}
+				}
+
+				if (!shared)
+				{
+					if (edgeCount == EPA_MAX_EDGES)
+						overflow = true;
+					else
+						horizon[edgeCount++] = edge;
+				}
+			}
+		}
+
+		// compact the removed faces away, the slots get reused
+		uint32_t liveCount = 0;
+		for (uint32_t i = 0; i < faceCount; i++)
+		{
+			if (faces[i].live)
+				faces[liveCount++] = faces[i];
+		}
+		faceCount = liveCount;
+
+		for (uint32_t i = 0; i < edgeCount && !overflow; i++)
+			overflow = !add_face(faces, faceCount, vertices, horizon[i].from, horizon[i].to, newVertex);
+
+		if (overflow)
+		{
+			closest = nullptr;
+			for (uint32_t i = 0; i < faceCount; i++)
+			{
+				if (faces[i].live && (!closest || faces[i].distance < closest->distance))
+					closest = &faces[i];
+			}
+			if (!closest || closest->distance == std::numeric_limits<float>::max())
+				return false;
+			break;
+		}
+	}
+
+	// barycentric coordinates of the origin projected on the face give the points on the cores
+	const SimplexVertex &v0 = vertices[closest->vertices[0]];
+	const SimplexVertex &v1 = vertices[closest->vertices[1]];
+	const SimplexVertex &v2 = vertices[closest->vertices[2]];
+
+	glm::vec3 e0 = v1.w - v0.w;
+	glm::vec3 e1 = v2.w - v0.w;
+	glm::vec3 p = closest->normal * closest->distance - v0.w;
+	float d00 = glm::dot(e0, e0);
+	float d01 = glm::dot(e0, e1);
+	float d11 = glm::dot(e1, e1);
+	float d20 = glm::dot(p, e0);
+	float d21 = glm::dot(p, e1);
+	float denominator = d00 * d11 - d01 * d01;
+
+	float u = 0.f;
+	float w = 0.f;
+	if (denominator > 1e-20f)
+	{
+		u = (d11 * d20 - d01 * d21) / denominator;
+		w = (d00 * d21 - d01 * d20) / denominator;
+	}
+
+	result.normal = closest->normal;
+	result.depth = closest->distance;
+	result.pointA = v0.a + (v1.a - v0.a) * u + (v2.a - v0.a) * w;
+	result.pointB = v0.b + (v1.b - v0.b) * u + (v2.b - v0.b) * w;
+	return true;
+}
@@ -0,0 +1,857 @@
+#include "physics_engine/collision_detection/narrowphase.h"
+
+#include "physics_engine/collision_detection/gjk_epa.h"
+#include "core/cpu_features.h"
+#include "core/job_system.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <string>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define NARROWPHASE_X86 1
+#endif
+
+//Third party
+
+#include <fmt/core.h>
+#include <fmt/color.h>
+
+namespace
+{
+	constexpr uint32_t LANE_WIDTH = 8;
+	constexpr uint32_t MAX_CLIP_POINTS = 8;
+
+	// faces are preferred over edges and a over b, a manifold that flips between features every step
+	// jitters, so the other axis has to be clearly better to win
+	constexpr float RELATIVE_TOLERANCE = 0.98f;
+	constexpr float ABSOLUTE_TOLERANCE = 0.001f;
+
+	using CollideFunction = bool (*)(const Shape &, const ShapeTransform &, const Shape &, const ShapeTransform &, const ConvexHull *, float,
+									 ContactManifold &);
+
+	// by shape type pair, the lower type first, the sphere pairs go through the batch instead
+	constexpr CollideFunction COLLIDE[(uint32_t)ShapeType::Count][(uint32_t)ShapeType::Count] = {
+		{collide_spheres, collide_sphere_capsule, collide_sphere_box, collide_convex},
+		{nullptr, collide_capsules, collide_convex, collide_convex},
+		{nullptr, nullptr, collide_boxes, collide_convex},
+		{nullptr, nullptr, nullptr, collide_convex},
+	};
+
+	// one point from the two surface points, the depth is how far a's point is past b's along the normal
+	void set_single_point(ContactManifold &manifold, const glm::vec3 &normal, const glm::vec3 &pointA, const glm::vec3 &pointB)
+	{
+		manifold.normal = normal;
+		manifold.points[0].position = (pointA + pointB) * 0.5f;
+		manifold.points[0].depth = glm::dot(pointA - pointB, normal);
+		manifold.pointCount = 1;
+	}
+
+	bool collide_points(const glm::vec3 &centerA, float radiusA, const glm::vec3 &centerB, float radiusB, float margin, ContactManifold &manifold)
+	{
+		glm::vec3 offset = centerB - centerA;
+		float distance = glm::length(offset);
+		if (distance > radiusA + radiusB + margin)
+			return false;
+
+		glm::vec3 normal = distance > 1e-6f ? offset / distance : glm::vec3(0.f, 1.f, 0.f);
+		set_single_point(manifold, normal, centerA + normal * radiusA, centerB - normal * radiusB);
+		return true;
+	}
+
+	void capsule_segment(const Shape &shape, const ShapeTransform &transform, glm::vec3 &p, glm::vec3 &q)
+	{
+		glm::vec3 axis = transform.orientation * glm::vec3(0.f, shape.halfHeight, 0.f);
+		p = transform.position - axis;
+		q = transform.position + axis;
+	}
+
+	glm::vec3 closest_point_on_segment(const glm::vec3 &point, const glm::vec3 &p, const glm::vec3 &q)
+	{
+		glm::vec3 segment = q - p;
+		float lengthSquared = glm::dot(segment, segment);
+		if (lengthSquared < 1e-12f)
+			return p;
+
+		float t = std::clamp(glm::dot(point - p, segment) / lengthSquared, 0.f, 1.f);
+		return p + segment * t;
+	}
+
+	// closest points of two segments, as in Real-Time Collision Detection 5.1.9
+	void closest_points_segments(const glm::vec3 &p1, const glm::vec3 &q1, const glm::vec3 &p2, const glm::vec3 &q2, glm::vec3 &c1, glm::vec3 &c2)
+	{
+		glm::vec3 d1 = q1 - p1;
+		glm::vec3 d2 = q2 - p2;
+		glm::vec3 r = p1 - p2;
+		float a = glm::dot(d1, d1);
+		float e = glm::dot(d2, d2);
+		float f = glm::dot(d2, r);
+
+		float s = 0.f;
+		float t = 0.f;
+		if (a <= 1e-12f && e <= 1e-12f)
+		{
+		}
+		else if (a <= 1e-12f)
+			t = std::clamp(f / e, 0.f, 1.f);
+		else
+		{
+			float c = glm::dot(d1, r);
+			if (e <= 1e-12f)
+				s = std::clamp(-c / a, 0.f, 1.f);
+			else
+			{
+				float b = glm::dot(d1, d2);
+				float denominator = a * e - b * b;
+
+				// parallel segments have no unique closest points, any s does
+				s = denominator > 1e-12f ? std::clamp((b * f - c * e) / denominator, 0.f, 1.f) : 0.f;
+				t = (b * s + f) / e;
+
+				if (t < 0.f)
+				{
+					t = 0.f;
+					s = std::clamp(-c / a, 0.f, 1.f);
+				}
+				else if (t > 1.f)
+				{
+					t = 1.f;
+					s = std::clamp((b - c) / a, 0.f, 1.f);
+				}
+			}
+		}
+
+		c1 = p1 + d1 * s;
+		c2 = p2 + d2 * t;
+	}
+
+	// the deepest point, the one furthest from it, then the two spanning the largest area on either side
+	void reduce_points(const ContactPoint *points, uint32_t count, const glm::vec3 &normal, ContactManifold &manifold)
+	{
+		if (count <= MAX_MANIFOLD_POINTS)
+		{
+			for (uint32_t i = 0; i < count; i++)
+				manifold.points[i] = points[i];
+			manifold.pointCount = count;
+			return;
+		}
+
+		uint32_t deepest = 0;
+		for (uint32_t i = 1; i < count; i++)
+		{
+			if (points[i].depth > points[deepest].depth)
+				deepest = i;
+		}
+
+		uint32_t furthest = deepest;
+		float furthestDistance = -1.f;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			glm::vec3 offset = points[i].position - points[deepest].position;
+			float distance = glm::dot(offset, offset);
+			if (distance > furthestDistance)
+			{
+				furthestDistance = distance;
+				furthest = i;
+			}
+		}
+
+		uint32_t positive = deepest;
+		uint32_t negative = deepest;
+		float maxArea = 0.f;
+		float minArea = 0.f;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			glm::vec3 toDeepest = points[deepest].position - points[i].position;
+			glm::vec3 toFurthest = points[furthest].position - points[i].position;
+			float area = glm::dot(glm::cross(toDeepest, toFurthest), normal);
+			if (area > maxArea)
+			{
+				maxArea = area;
+				positive = i;
+			}
+			if (area < minArea)
+			{
+				minArea = area;
+				negative = i;
+			}
+		}
+
+		manifold.pointCount = 0;
+		manifold.points[manifold.pointCount++] = points[deepest];
+		if (furthest != deepest)
+			manifold.points[manifold.pointCount++] = points[furthest];
+		if (positive != deepest)
+			manifold.points[manifold.pointCount++] = points[positive];
+		if (negative != deepest)
+			manifold.points[manifold.pointCount++] = points[negative];
+	}
+
+	struct OrientedBox
+	{
+		glm::vec3 center;
+		glm::mat3 axes;
+		glm::vec3 extents;
+	};
+
+	// how far apart the boxes are along the axis, negative when they overlap on it
+	float box_separation(const OrientedBox &a, const OrientedBox &b, const glm::vec3 &axis)
+	{
+		float projectionA = a.extents.x * std::abs(glm::dot(axis, a.axes[0])) + a.extents.y * std::abs(glm::dot(axis, a.axes[1])) +
+							a.extents.z * std::abs(glm::dot(axis, a.axes[2]));
+		float projectionB = b.extents.x * std::abs(glm::dot(axis, b.axes[0])) + b.extents.y * std::abs(glm::dot(axis, b.axes[1])) +
+							b.extents.z * std::abs(glm::dot(axis, b.axes[2]));
+		return std::abs(glm::dot(b.center - a.center, axis)) - projectionA - projectionB;
+	}
+
+	// the incident face clipped against the sides of the reference face, points below it are contacts
+	bool box_face_contact(const OrientedBox &reference, const OrientedBox &incident, int axis, float margin, bool flip, ContactManifold &manifold)
+	{
+		glm::vec3 normal = reference.axes[axis];
+		if (glm::dot(incident.center - reference.center, normal) < 0.f)
+			normal = -normal;
+
+		// the face of the other box that points against the normal the most
+		int incidentAxis = 0;
+		float best = -1.f;
+		for (int k = 0; k < 3; k++)
+		{
+			float alignment = std::abs(glm::dot(normal, incident.axes[k]));
+			if (alignment > best)
+			{
+				best = alignment;
+				incidentAxis = k;
+			}
+		}
+
+		glm::vec3 incidentNormal = incident.axes[incidentAxis];
+		if (glm::dot(incidentNormal, normal) > 0.f)
+			incidentNormal = -incidentNormal;
+
+		glm::vec3 faceCenter = incident.center + incidentNormal * incident.extents[incidentAxis];
+		glm::vec3 u = incident.axes[(incidentAxis + 1) % 3] * incident.extents[(incidentAxis + 1) % 3];
+		glm::vec3 v = incident.axes[(incidentAxis + 2) % 3] * incident.extents[(incidentAxis + 2) % 3];
+
+		glm::vec3 polygon[MAX_CLIP_POINTS];
+		glm::vec3 clipped[MAX_CLIP_POINTS];
+		uint32_t count = 4;
+		polygon[0] = faceCenter + u + v;
+		polygon[1] = faceCenter - u + v;
+		polygon[2] = faceCenter - u - v;
+		polygon[3] = faceCenter + u - v;
+
+		// sutherland hodgman against the four side planes
+		for (int side = 0; side < 4 && count > 0; side++)
+		{
+			int sideAxis = (axis + 1 + side / 2) % 3;
+			glm::vec3 planeNormal = side % 2 == 0 ? reference.axes[sideAxis] : -reference.axes[sideAxis];
+			float planeOffset = glm::dot(planeNormal, reference.center) + reference.extents[sideAxis];
+
+			uint32_t clippedCount = 0;
+			for (uint32_t i = 0; i < count; i++)
+			{
+				const glm::vec3 &start = polygon[i];
+				const glm::vec3 &end = polygon[(i + 1) % count];
+				float startDistance = glm::dot(planeNormal, start) - planeOffset;
+				float endDistance = glm::dot(planeNormal, end) - planeOffset;
+
+				if (startDistance <= 0.f)
+					clipped[clippedCount++] = start;
+				if (((startDistance < 0.f && endDistance > 0.f) || (startDistance > 0.f && endDistance < 0.f)) && clippedCount < MAX_CLIP_POINTS)
+					clipped[clippedCount++] = start + (end - start) * (startDistance / (startDistance - endDistance));
+			}
+
+			count = clippedCount;
+			std::copy(clipped, clipped + count, polygon);
+		}
+
+		float faceOffset = glm::dot(normal, reference.center) + reference.extents[axis];
+		ContactPoint points[MAX_CLIP_POINTS];
+		uint32_t pointCount = 0;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			float separation = glm::dot(normal, polygon[i]) - faceOffset;
+			if (separation <= margin)
+				points[pointCount++] = ContactPoint{polygon[i] - normal * (separation * 0.5f), -separation};
+		}
+
+		if (pointCount == 0)
+			return false;
+
+		manifold.normal = flip ? -normal : normal;
+		reduce_points(points, pointCount, manifold.normal, manifold);
+		return true;
+	}
+
+	void box_edge_contact(const OrientedBox &a, const OrientedBox &b, int edgeA, int edgeB, glm::vec3 normal, ContactManifold &manifold)
+	{
+		if (glm::dot(b.center - a.center, normal) < 0.f)
+			normal = -normal;
+
+		// the edges of a and b furthest along the normal towards each other
+		glm::vec3 centerA = a.center;
+		glm::vec3 centerB = b.center;
+		for (int k = 0; k < 3; k++)
+		{
+			if (k != edgeA)
+				centerA += a.axes[k] * (glm::dot(normal, a.axes[k]) > 0.f ? a.extents[k] : -a.extents[k]);
+			if (k != edgeB)
+				centerB += b.axes[k] * (glm::dot(normal, b.axes[k]) > 0.f ? -b.extents[k] : b.extents[k]);
+		}
+
+		glm::vec3 halfA = a.axes[edgeA] * a.extents[edgeA];
+		glm::vec3 halfB = b.axes[edgeB] * b.extents[edgeB];
+
+		glm::vec3 pointA;
+		glm::vec3 pointB;
+		closest_points_segments(centerA - halfA, centerA + halfA, centerB - halfB, centerB + halfB, pointA, pointB);
+		set_single_point(manifold, normal, pointA, pointB);
+	}
+
+	void sphere_batch_scalar(uint32_t begin, uint32_t end, const float *__restrict ax, const float *__restrict ay, const float *__restrict az,
+							 const float *__restrict ar, const float *__restrict bx, const float *__restrict by, const float *__restrict bz,
+							 const float *__restrict br, float *__restrict nx, float *__restrict ny, float *__restrict nz, float *__restrict depth)
+	{
+		for (uint32_t i = begin; i < end; i++)
+		{
+			float dx = bx[i] - ax[i];
+			float dy = by[i] - ay[i];
+			float dz = bz[i] - az[i];
+			float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+
+			// concentric spheres get pushed apart along y
+			bool valid = distance > 1e-6f;
+			float inverse = valid ? 1.f / distance : 0.f;
+			nx[i] = dx * inverse;
+			ny[i] = valid ? dy * inverse : 1.f;
+			nz[i] = dz * inverse;
+			depth[i] = ar[i] + br[i] - distance;
+		}
+	}
+
+#ifdef NARROWPHASE_X86
+	__attribute__((target("avx2"))) void sphere_batch_avx2(uint32_t begin, uint32_t end, const float *ax, const float *ay, const float *az,
+														   const float *ar, const float *bx, const float *by, const float *bz, const float *br,
+														   float *nx, float *ny, float *nz, float *depth)
+	{
+		const __m256 epsilon = _mm256_set1_ps(1e-6f);
+		const __m256 one = _mm256_set1_ps(1.f);
+
+		for (uint32_t i = begin; i < end; i += LANE_WIDTH)
+		{
+			__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(bx + i), _mm256_loadu_ps(ax + i));
+			__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(by + i), _mm256_loadu_ps(ay + i));
+			__m256 dz = _mm256_sub_ps(_mm256_loadu_ps(bz + i), _mm256_loadu_ps(az + i));
+			__m256 distance = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz)));
+
+			__m256 valid = _mm256_cmp_ps(distance, epsilon, _CMP_GT_OQ);
+			__m256 inverse = _mm256_and_ps(valid, _mm256_div_ps(one, distance));
+			_mm256_storeu_ps(nx + i, _mm256_mul_ps(dx, inverse));
+			_mm256_storeu_ps(ny + i, _mm256_blendv_ps(one, _mm256_mul_ps(dy, inverse), valid));
+			_mm256_storeu_ps(nz + i, _mm256_mul_ps(dz, inverse));
+			_mm256_storeu_ps(depth + i, _mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(ar + i), _mm256_loadu_ps(br + i)), distance));
+		}
+	}
+#endif
+}
+
+const char *shape_type_name(ShapeType type)
+{
+	switch (type)
+	{
+	case ShapeType::Sphere:
+		return "sphere";
+	case ShapeType::Capsule:
+		return "capsule";
+	case ShapeType::Box:
+		return "box";
+	case ShapeType::ConvexHull:
+		return "convex hull";
+	default:
+		return "unknown";
+	}
+}
+
+bool collide_spheres(const Shape &a, const ShapeTransform &ta, const Shape &b, const ShapeTransform &tb, const ConvexHull *, float margin, ContactManifold &manifold)
+{
+	return collide_points(ta.position, a.radius, tb.position, b.radius, margin, manifold);
+}
+
+bool collide_sphere_capsule(const Shape &a, const ShapeTransform &ta, const Shape &b, const ShapeTransform &tb, const ConvexHull *, float margin, ContactManifold &manifold)
+{
+	glm::vec3 p, q;
+	capsule_segment(b, tb, p, q);
+	return collide_points(ta.position, a.radius, closest_point_on_segment(ta.position, p, q), b.radius, margin, manifold);
+}
+
+bool collide_sphere_box(const Shape &a, const ShapeTransform &ta, const Shape &b, const ShapeTransform &tb, const ConvexHull *, float margin, ContactManifold &manifold)
+{
+	glm::vec3 local = glm::conjugate(tb.orientation) * (ta.position - tb.position);
+	glm::vec3 clamped = glm::clamp(local, -b.halfExtents, b.halfExtents);
+	glm::vec3 offset = clamped - local;
+	float distance = glm::length(offset);
+
+	if (distance > 1e-6f)
+	{
+		if (distance > a.radius + margin)
+			return false;
+
+		glm::vec3 normal = tb.orientation * (offset / distance);
+		set_single_point(manifold, normal, ta.position + normal * a.radius, tb.position + tb.orientation * clamped);
+		return true;
+	}
+
+	// the center is inside, out through the closest face
+	int axis = 0;
+	float closest = std::numeric_limits<float>::max();
+	for (int k = 0; k < 3; k++)
+	{
+		float distanceToFace = b.halfExtents[k] - std::abs(local[k]);
+		if (distanceToFace < closest)
+		{
+			closest = distanceToFace;
+			axis = k;
+		}
+	}
+
+	glm::vec3 outward(0.f);
+	outward[axis] = local[axis] >= 0.f ? 1.f : -1.f;
+	glm::vec3 surface = local;
+	surface[axis] = outward[axis] * b.halfExtents[axis];
+
+	glm::vec3 normal = -(tb.orientation * outward);
+	set_single_point(manifold, normal, ta.position + normal * a.radius, tb.position + tb.orientation * surface);
+	return true;
+}
+
+bool collide_capsules(const Shape &a, const ShapeTransform &ta, const Shape &b, const ShapeTransform &tb, const ConvexHull *, float margin, ContactManifold &manifold)
+{
+	glm::vec3 p1, q1, p2, q2;
+	capsule_segment(a, ta, p1, q1);
+	capsule_segment(b, tb, p2, q2);
+
+	glm::vec3 closestA, closestB;
+	closest_points_segments(p1, q1, p2, q2, closestA, closestB);
+	if (!collide_points(closestA, a.radius, closestB, b.radius, margin, manifold))
+		return false;
+
+	// crossing segments touch in one point, parallel ones along the overlap of the two
+	glm::vec3 axisA = q1 - p1;
+	glm::vec3 axisB = q2 - p2;
+	float lengthA = glm::length(axisA);
+	float lengthB = glm::length(axisB);
+	if (lengthA < 1e-6f || lengthB < 1e-6f || std::abs(glm::dot(axisA, axisB)) < 0.999f * lengthA * lengthB)
+		return true;
+
+	glm::vec3 direction = axisA / lengthA;
+	float start = glm::dot(p2 - p1, direction);
+	float end = glm::dot(q2 - p1, direction);
+	float overlapStart = std::max(std::min(start, end), 0.f);
+	float overlapEnd = std::min(std::max(start, end), lengthA);
+	if (overlapEnd - overlapStart < 1e-4f)
+		return true;
+
+	glm::vec3 normal = manifold.normal;
+	manifold.pointCount = 0;
+	for (float s : {overlapStart, overlapEnd})
+	{
+		glm::vec3 onA = p1 + direction * s;
+		glm::vec3 onB = closest_point_on_segment(onA, p2, q2);
+		glm::vec3 pointA = onA + normal * a.radius;
+		glm::vec3 pointB = onB - normal * b.radius;
+
+		float depth = glm::dot(pointA - pointB, normal);
+		if (depth >= -margin)
+			manifold.points[manifold.pointCount++] = ContactPoint{(pointA + pointB) * 0.5f, depth};
+	}
+
+	return manifold.pointCount > 0;
+}
+
+bool collide_boxes(const Shape &a, const ShapeTransform &ta, const Shape &b, const ShapeTransform &tb, const ConvexHull *, float margin, ContactManifold &manifold)
+{
+	OrientedBox boxA{ta.position, glm::mat3_cast(ta.orientation), a.halfExtents};
+	OrientedBox boxB{tb.position, glm::mat3_cast(tb.orientation), b.halfExtents};
+
+	// the axis of least penetration among the faces of a, of b, and the edge pairs
+	float faceA = -std::numeric_limits<float>::max();
+	float faceB = -std::numeric_limits<float>::max();
+	int axisA = 0;
+	int axisB = 0;
+	for (int k = 0; k < 3; k++)
+	{
+		float separation = box_separation(boxA, boxB, boxA.axes[k]);
+		if (separation > margin)
+			return false;
+		if (separation > faceA)
+		{
+			faceA = separation;
+			axisA = k;
+		}
+
+		separation = box_separation(boxA, boxB, boxB.axes[k]);
+		if (separation > margin)
+			return false;
+		if (separation > faceB)
+		{
+			faceB = separation;
+			axisB = k;
+		}
+	}
+
+	float edge = -std::numeric_limits<float>::max();
+	int edgeA = 0;
+	int edgeB = 0;
+	glm::vec3 edgeAxis(0.f);
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			// parallel edges have no axis of their own, the face axes already cover them
+			glm::vec3 axis = glm::cross(boxA.axes[i], boxB.axes[j]);
+			float length = glm::length(axis);
+			if (length < 1e-5f)
+				continue;
+
+			axis /= length;
+			float separation = box_separation(boxA, boxB, axis);
+			if (separation > margin)
+				return false;
+			if (separation > edge)
+			{
+				edge = separation;
+				edgeA = i;
+				edgeB = j;
+				edgeAxis = axis;
+			}
+		}
+	}
+
+	float face = std::max(faceA, faceB);
+	bool hasEdge = edge > -std::numeric_limits<float>::max();
+	if (hasEdge && edge > RELATIVE_TOLERANCE * face + ABSOLUTE_TOLERANCE)
+	{
+		box_edge_contact(boxA, boxB, edgeA, edgeB, edgeAxis, manifold);
+		return true;
+	}
+
+	bool touching = faceB > RELATIVE_TOLERANCE * faceA + ABSOLUTE_TOLERANCE ? box_face_contact(boxB, boxA, axisB, margin, true, manifold)
+																			  : box_face_contact(boxA, boxB, axisA, margin, false, manifold);
+
+	// the face won within the tolerance but the boxes meet edge on, the clipped face is out of reach
+	if (!touching && hasEdge && edge <= margin)
+	{
+		box_edge_contact(boxA, boxB, edgeA, edgeB, edgeAxis, manifold);
+		touching = manifold.points[0].depth >= -margin;
+	}
+	return touching;
+}
+
+bool collide_convex(const Shape &a, const ShapeTransform &ta, const Shape &b, const ShapeTransform &tb, const ConvexHull *hulls, float margin, ContactManifold &manifold)
+{
+	ConvexCore coreA(a, ta, hulls);
+	ConvexCore coreB(b, tb, hulls);
+
+	Simplex simplex;
+	GjkResult gjk = gjk_distance(coreA, coreB, simplex);
+	if (!gjk.overlap)
+	{
+		if (gjk.distance > coreA.radius + coreB.radius + margin)
+			return false;
+
+		// the radii are around the cores, so the closest points move out along the line between them
+		if (gjk.distance > 1e-5f)
+		{
+			glm::vec3 normal = (gjk.pointB - gjk.pointA) / gjk.distance;
+			set_single_point(manifold, normal, gjk.pointA + normal * coreA.radius, gjk.pointB - normal * coreB.radius);
+			return true;
+		}
+	}
+
+	EpaResult epa;
+	if (!epa_penetration(coreA, coreB, simplex, epa))
+	{
+		// cores that touch without any volume in common, pushed apart along the centers
+		glm::vec3 offset = tb.position - ta.position;
+		glm::vec3 normal = glm::dot(offset, offset) > 1e-12f ? glm::normalize(offset) : glm::vec3(0.f, 1.f, 0.f);
+		glm::vec3 point = gjk.overlap ? (coreA.support(normal) + coreB.support(-normal)) * 0.5f : (gjk.pointA + gjk.pointB) * 0.5f;
+		set_single_point(manifold, normal, point + normal * coreA.radius, point - normal * coreB.radius);
+		return true;
+	}
+
+	set_single_point(manifold, epa.normal, epa.pointA + epa.normal * coreA.radius, epa.pointB - epa.normal * coreB.radius);
+	return true;
+}
+
+uint32_t Narrowphase::add_hull(const glm::vec3 *points, uint32_t count)
+{
+	hulls.push_back(ConvexHull{std::vector<glm::vec3>(points, points + count)});
+	return (uint32_t)hulls.size() - 1;
+}
+
+void Narrowphase::collide_sphere_batch(const std::vector<BroadphasePair> &pairs, const Shape *shapes, const ShapeTransform *transforms)
+{
+	uint32_t count = (uint32_t)pairs.size();
+	uint32_t padded = (count + LANE_WIDTH - 1) / LANE_WIDTH * LANE_WIDTH;
+
+	// the padding is zero, it is computed and thrown away
+	for (std::vector<float> &lane : sphereLanes)
+	{
+		lane.resize(padded);
+		std::fill(lane.begin() + count, lane.end(), 0.f);
+	}
+
+	float *lanes[12];
+	for (int i = 0; i < 12; i++)
+		lanes[i] = sphereLanes[i].data();
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const glm::vec3 &a = transforms[pairs[i].a].position;
+		const glm::vec3 &b = transforms[pairs[i].b].position;
+		lanes[0][i] = a.x;
+		lanes[1][i] = a.y;
+		lanes[2][i] = a.z;
+		lanes[3][i] = shapes[pairs[i].a].radius;
+		lanes[4][i] = b.x;
+		lanes[5][i] = b.y;
+		lanes[6][i] = b.z;
+		lanes[7][i] = shapes[pairs[i].b].radius;
+	}
+
+	auto batch = sphere_batch_scalar;
+#ifdef NARROWPHASE_X86
+	if (simd && cpu_has_avx2())
+		batch = sphere_batch_avx2;
+#endif
+
+	// jobs get whole groups of 8
+	JobSystem::Get().parallel_for(padded / LANE_WIDTH, std::max(grainSize / LANE_WIDTH, 1u), [&lanes, batch](uint32_t begin, uint32_t end)
+								  { batch(begin * LANE_WIDTH, end * LANE_WIDTH, lanes[0], lanes[1], lanes[2], lanes[3], lanes[4], lanes[5], lanes[6],
+										  lanes[7], lanes[8], lanes[9], lanes[10], lanes[11]); });
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		float depth = lanes[11][i];
+		if (depth < -contactMargin)
+			continue;
+
+		glm::vec3 normal(lanes[8][i], lanes[9][i], lanes[10][i]);
+		glm::vec3 pointA = glm::vec3(lanes[0][i], lanes[1][i], lanes[2][i]) + normal * lanes[3][i];
+		glm::vec3 pointB = glm::vec3(lanes[4][i], lanes[5][i], lanes[6][i]) - normal * lanes[7][i];
+
+		ContactManifold &manifold = manifolds.emplace_back();
+		manifold.a = pairs[i].a;
+		manifold.b = pairs[i].b;
+		manifold.normal = normal;
+		manifold.points[0] = ContactPoint{(pointA + pointB) * 0.5f, depth};
+		manifold.pointCount = 1;
+	}
+}
+
+const std::vector<ContactManifold> &Narrowphase::collide(const std::vector<BroadphasePair> &pairs, const Shape *shapes, const ShapeTransform *transforms)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	for (auto &row : buckets)
+	{
+		for (std::vector<BroadphasePair> &bucket : row)
+			bucket.clear();
+	}
+
+	// a pair keeps its order unless the types are the other way around, the manifold normal follows
+	for (const BroadphasePair &pair : pairs)
+	{
+		uint32_t typeA = (uint32_t)shapes[pair.a].type;
+		uint32_t typeB = (uint32_t)shapes[pair.b].type;
+		if (typeA <= typeB)
+			buckets[typeA][typeB].push_back(pair);
+		else
+			buckets[typeB][typeA].push_back(BroadphasePair{pair.b, pair.a});
+	}
+
+	manifolds.clear();
+	stats = NarrowphaseStats{};
+	stats.pairs = (uint32_t)pairs.size();
+
+	const std::vector<BroadphasePair> &spheres = buckets[(uint32_t)ShapeType::Sphere][(uint32_t)ShapeType::Sphere];
+	collide_sphere_batch(spheres, shapes, transforms);
+	stats.batchedSpheres = (uint32_t)spheres.size();
+
+	for (uint32_t typeA = 0; typeA < (uint32_t)ShapeType::Count; typeA++)
+	{
+		for (uint32_t typeB = typeA; typeB < (uint32_t)ShapeType::Count; typeB++)
+		{
+			const std::vector<BroadphasePair> &bucket = buckets[typeA][typeB];
+			if (bucket.empty() || (typeA == (uint32_t)ShapeType::Sphere && typeB == (uint32_t)ShapeType::Sphere))
+				continue;
+
+			CollideFunction function = COLLIDE[typeA][typeB];
+			if (function == collide_convex)
+				stats.convexPairs += (uint32_t)bucket.size();
+
+			candidates.resize(bucket.size());
+			JobSystem::Get().parallel_for((uint32_t)bucket.size(), grainSize, [&](uint32_t begin, uint32_t end)
+										  {
+				for (uint32_t i = begin; i < end; i++)
+				{
+					ContactManifold &manifold = candidates[i];
+					manifold.a = bucket[i].a;
+					manifold.b = bucket[i].b;
+					if (!function(shapes[manifold.a], transforms[manifold.a], shapes[manifold.b], transforms[manifold.b], hulls.data(), contactMargin, manifold))
+						manifold.pointCount = 0;
+				} });
+
+			for (const ContactManifold &manifold : candidates)
+			{
+				if (manifold.pointCount > 0)
+					manifolds.push_back(manifold);
+			}
+		}
+	}
+
+	stats.manifolds = (uint32_t)manifolds.size();
+	for (const ContactManifold &manifold : manifolds)
+		stats.points += manifold.pointCount;
+	stats.collideMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	return manifolds;
+}
+
+void run_narrowphase_benchmark()
+{
+	constexpr uint32_t PAIR_COUNT = 100000;
+	constexpr float RESTING_DEPTH = 0.05f;
+
+	fmt::print(fg(fmt::color::bisque), "\nNarrowphase benchmark ( {} pairs per shape pair, {} threads )\n", PAIR_COUNT, JobSystem::Get().thread_count());
+	fmt::print("{:>24} {:>10} {:>10} {:>10} {:>10}\n", "pair", "ms", "ns/pair", "contacts", "points");
+
+	uint32_t seed = 11;
+	auto random = [&seed]()
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) / 16777216.f;
+	};
+
+	auto random_orientation = [&random]()
+	{
+		glm::quat q(random() * 2.f - 1.f, random() * 2.f - 1.f, random() * 2.f - 1.f, random() * 2.f - 1.f);
+		return glm::normalize(q);
+	};
+
+	// an icosahedron of radius 0.5 and a box as hulls, the box one to check the SAT against
+	const float golden = 1.618034f;
+	std::vector<glm::vec3> icosahedron;
+	for (float s : {-1.f, 1.f})
+	{
+		for (float t : {-1.f, 1.f})
+		{
+			icosahedron.push_back(glm::normalize(glm::vec3(0.f, s, t * golden)) * 0.5f);
+			icosahedron.push_back(glm::normalize(glm::vec3(s, t * golden, 0.f)) * 0.5f);
+			icosahedron.push_back(glm::normalize(glm::vec3(t * golden, 0.f, s)) * 0.5f);
+		}
+	}
+
+	const glm::vec3 boxExtents(0.5f, 0.4f, 0.3f);
+	std::vector<glm::vec3> boxCorners;
+	for (int corner = 0; corner < 8; corner++)
+		boxCorners.push_back(glm::vec3(corner & 1 ? 1.f : -1.f, corner & 2 ? 1.f : -1.f, corner & 4 ? 1.f : -1.f) * boxExtents);
+
+	Narrowphase narrowphase;
+	uint32_t icosahedronHull = narrowphase.add_hull(icosahedron.data(), (uint32_t)icosahedron.size());
+	uint32_t boxHull = narrowphase.add_hull(boxCorners.data(), (uint32_t)boxCorners.size());
+
+	// one shape of every type, by type
+	const std::vector<Shape> shapesByType = {Shape::sphere(0.5f), Shape::capsule(0.3f, 0.4f), Shape::box(boxExtents), Shape::convex_hull(icosahedronHull)};
+
+	std::vector<Shape> shapes(PAIR_COUNT * 2);
+	std::vector<ShapeTransform> transforms(PAIR_COUNT * 2);
+	std::vector<BroadphasePair> pairs(PAIR_COUNT);
+
+	// b is put at a random direction and distance from a, about half the pairs touch
+	auto place = [&](uint32_t typeA, uint32_t typeB)
+	{
+		for (uint32_t i = 0; i < PAIR_COUNT; i++)
+		{
+			shapes[i * 2] = shapesByType[typeA];
+			shapes[i * 2 + 1] = shapesByType[typeB];
+
+			glm::vec3 direction = glm::normalize(glm::vec3(random(), random(), random()) - 0.5f + 1e-3f);
+			transforms[i * 2] = ShapeTransform{glm::vec3(0.f), random_orientation()};
+			transforms[i * 2 + 1] = ShapeTransform{direction * (0.3f + random() * 1.2f), random_orientation()};
+			pairs[i] = BroadphasePair{i * 2, i * 2 + 1};
+		}
+	};
+
+	auto run = [&](const char *name)
+	{
+		// once to grow the buckets and lanes
+		narrowphase.collide(pairs, shapes.data(), transforms.data());
+
+		auto start = std::chrono::high_resolution_clock::now();
+		const std::vector<ContactManifold> &manifolds = narrowphase.collide(pairs, shapes.data(), transforms.data());
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		const NarrowphaseStats &stats = narrowphase.get_stats();
+		fmt::print("{:>24} {:>10.2f} {:>10.1f} {:>10} {:>10}\n", name, ms, ms * 1e6 / PAIR_COUNT, manifolds.size(), stats.points);
+	};
+
+	for (uint32_t typeA = 0; typeA < (uint32_t)ShapeType::Count; typeA++)
+	{
+		for (uint32_t typeB = typeA; typeB < (uint32_t)ShapeType::Count; typeB++)
+		{
+			place(typeA, typeB);
+			std::string name = fmt::format("{} {}", shape_type_name((ShapeType)typeA), shape_type_name((ShapeType)typeB));
+			run(name.c_str());
+
+			if (typeA == (uint32_t)ShapeType::Sphere && typeB == (uint32_t)ShapeType::Sphere)
+			{
+				narrowphase.simd = false;
+				run("sphere sphere scalar");
+				narrowphase.simd = true;
+			}
+		}
+	}
+
+	// the same boxes once through the SAT and once as hulls through GJK and EPA, the deepest point of
+	// the manifold has to match the penetration depth. Only for resting contacts, deeper than that the
+	// SAT trades exactness for preferring faces
+	place((uint32_t)ShapeType::Box, (uint32_t)ShapeType::Box);
+	std::vector<ContactManifold> sat = narrowphase.collide(pairs, shapes.data(), transforms.data());
+	for (Shape &shape : shapes)
+		shape = Shape::convex_hull(boxHull);
+	const std::vector<ContactManifold> &epa = narrowphase.collide(pairs, shapes.data(), transforms.data());
+
+	float maxDepthError = 0.f;
+	uint32_t normalMismatches = 0;
+	uint32_t compared = 0;
+	for (size_t i = 0, j = 0; i < sat.size() && j < epa.size();)
+	{
+		if (sat[i].a != epa[j].a)
+		{
+			sat[i].a < epa[j].a ? i++ : j++;
+			continue;
+		}
+
+		float deepest = -std::numeric_limits<float>::max();
+		for (uint32_t k = 0; k < sat[i].pointCount; k++)
+			deepest = std::max(deepest, sat[i].points[k].depth);
+
+		// apart from each other the two measure different distances
+		if (deepest > 0.f && epa[j].points[0].depth > 0.f && epa[j].points[0].depth < RESTING_DEPTH)
+		{
+			compared++;
+			maxDepthError = std::max(maxDepthError, std::abs(deepest - epa[j].points[0].depth));
+			if (glm::dot(sat[i].normal, epa[j].normal) < 0.9998f)
+				normalMismatches++;
+		}
+		i++;
+		j++;
+	}
+
+	fmt::print("box sat against epa on {} resting pairs: max depth difference {:.5f}, {} normals more than 1 degree apart\n", compared,
+			   maxDepthError, normalMismatches);
+}
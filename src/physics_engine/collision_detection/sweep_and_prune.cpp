@@ -0,0 +1,310 @@
+#include "physics_engine/collision_detection/sweep_and_prune.h"
+
+#include "core/cpu_features.h"
+#include "core/job_system.h"
+
+#include <cstring>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define SAP_X86 1
+#endif
+
+namespace
+{
+	constexpr uint32_t PADDING = 8;
+
+	// sweep axis min and max, then min and max of the two other axes
+	struct SweepArrays
+	{
+		const float *min0;
+		const float *max0;
+		const float *min1;
+		const float *max1;
+		const float *min2;
+		const float *max2;
+		const uint32_t *userData;
+	};
+
+	void emit(std::vector<BroadphasePair> &out, uint32_t a, uint32_t b)
+	{
+		out.push_back(BroadphasePair{std::min(a, b), std::max(a, b)});
+	}
+
+	void sweep_scalar(const SweepArrays &s, uint32_t begin, uint32_t end, std::vector<BroadphasePair> &out)
+	{
+		for (uint32_t i = begin; i < end; i++)
+		{
+			// sorted by min, so everything from the first box that starts after this one ends is out
+			for (uint32_t j = i + 1; s.min0[j] <= s.max0[i]; j++)
+			{
+				if (s.min1[j] <= s.max1[i] && s.max1[j] >= s.min1[i] && s.min2[j] <= s.max2[i] && s.max2[j] >= s.min2[i])
+					emit(out, s.userData[i], s.userData[j]);
+			}
+		}
+	}
+
+#ifdef SAP_X86
+	__attribute__((target("avx2"))) void sweep_avx2(const SweepArrays &s, uint32_t begin, uint32_t end, std::vector<BroadphasePair> &out)
+	{
+		for (uint32_t i = begin; i < end; i++)
+		{
+			__m256 max0 = _mm256_set1_ps(s.max0[i]);
+			__m256 min1 = _mm256_set1_ps(s.min1[i]);
+			__m256 max1 = _mm256_set1_ps(s.max1[i]);
+			__m256 min2 = _mm256_set1_ps(s.min2[i]);
+			__m256 max2 = _mm256_set1_ps(s.max2[i]);
+
+			for (uint32_t j = i + 1;; j += 8)
+			{
+				__m256 inRange = _mm256_cmp_ps(_mm256_loadu_ps(s.min0 + j), max0, _CMP_LE_OQ);
+				int rangeMask = _mm256_movemask_ps(inRange);
+				if (rangeMask == 0)
+					break;
+
+				__m256 overlap = _mm256_and_ps(inRange, _mm256_cmp_ps(_mm256_loadu_ps(s.min1 + j), max1, _CMP_LE_OQ));
+				overlap = _mm256_and_ps(overlap, _mm256_cmp_ps(_mm256_loadu_ps(s.max1 + j), min1, _CMP_GE_OQ));
+				overlap = _mm256_and_ps(overlap, _mm256_cmp_ps(_mm256_loadu_ps(s.min2 + j), max2, _CMP_LE_OQ));
+				overlap = _mm256_and_ps(overlap, _mm256_cmp_ps(_mm256_loadu_ps(s.max2 + j), min2, _CMP_GE_OQ));
+
+				for (int mask = _mm256_movemask_ps(overlap); mask != 0; mask &= mask - 1)
+					emit(out, s.userData[i], s.userData[j + __builtin_ctz(mask)]);
+
+				// the padding past the last box never is in range, so this also ends the last block
+				if (rangeMask != 0xFF)
+					break;
+			}
+		}
+	}
+#endif
+
+	// floats as unsigned integers that sort the same way
+	uint32_t sortable_key(float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits ^ ((bits >> 31) ? 0xFFFFFFFFu : 0x80000000u);
+	}
+}
+
+uint32_t SweepAndPrune::create_proxy(const Aabb &aabb, uint32_t data)
+{
+	uint32_t proxy;
+	if (!freeIds.empty())
+	{
+		proxy = freeIds.back();
+		freeIds.pop_back();
+	}
+	else
+	{
+		proxy = (uint32_t)denseIndex.size();
+		denseIndex.push_back(~0u);
+	}
+
+	denseIndex[proxy] = proxy_count();
+	proxyIds.push_back(proxy);
+	userData.push_back(data);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		bounds[axis].push_back(aabb.min[axis]);
+		bounds[axis + 3].push_back(aabb.max[axis]);
+	}
+
+	return proxy;
+}
+
+void SweepAndPrune::destroy_proxy(uint32_t proxy)
+{
+	uint32_t index = denseIndex[proxy];
+	uint32_t last = proxy_count() - 1;
+
+	for (std::vector<float> &values : bounds)
+	{
+		values[index] = values[last];
+		values.pop_back();
+	}
+	userData[index] = userData[last];
+	userData.pop_back();
+
+	proxyIds[index] = proxyIds[last];
+	denseIndex[proxyIds[index]] = index;
+	proxyIds.pop_back();
+
+	denseIndex[proxy] = ~0u;
+	freeIds.push_back(proxy);
+}
+
+void SweepAndPrune::create_proxies(const Aabb *aabbs, const uint32_t *data, uint32_t count, uint32_t *outProxies)
+{
+	for (uint32_t i = 0; i < count; i++)
+		outProxies[i] = create_proxy(aabbs[i], data[i]);
+}
+
+void SweepAndPrune::destroy_proxies(const uint32_t *proxies, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+		destroy_proxy(proxies[i]);
+}
+
+void SweepAndPrune::move_proxy(uint32_t proxy, const Aabb &aabb)
+{
+	uint32_t index = denseIndex[proxy];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		bounds[axis][index] = aabb.min[axis];
+		bounds[axis + 3][index] = aabb.max[axis];
+	}
+}
+
+void SweepAndPrune::clear()
+{
+	for (std::vector<float> &values : bounds)
+		values.clear();
+
+	userData.clear();
+	proxyIds.clear();
+	denseIndex.clear();
+	freeIds.clear();
+	pairs.clear();
+}
+
+Aabb SweepAndPrune::aabb(uint32_t proxy) const
+{
+	uint32_t i = denseIndex[proxy];
+	return Aabb{glm::vec3(bounds[0][i], bounds[1][i], bounds[2][i]), glm::vec3(bounds[3][i], bounds[4][i], bounds[5][i])};
+}
+
+int SweepAndPrune::choose_axis() const
+{
+	// the axis the centers spread out the most on leaves the fewest boxes overlapping on it
+	uint32_t count = proxy_count();
+	double sum[3] = {};
+	double squares[3] = {};
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float *min = bounds[axis].data();
+		const float *max = bounds[axis + 3].data();
+		for (uint32_t i = 0; i < count; i++)
+		{
+			float center = min[i] + max[i];
+			sum[axis] += center;
+			squares[axis] += center * center;
+		}
+	}
+
+	double variance[3];
+	for (int axis = 0; axis < 3; axis++)
+		variance[axis] = squares[axis] - sum[axis] * sum[axis] / count;
+
+	return variance[0] > variance[1] ? (variance[0] > variance[2] ? 0 : 2) : (variance[1] > variance[2] ? 1 : 2);
+}
+
+void SweepAndPrune::sort_boxes()
+{
+	uint32_t count = proxy_count();
+
+	for (int i = 0; i < 2; i++)
+	{
+		keys[i].resize(count);
+		order[i].resize(count);
+	}
+
+	const float *min = bounds[sweepAxis].data();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		keys[0][i] = sortable_key(min[i]);
+		order[0][i] = i;
+	}
+
+	// lsd radix sort, 8 bits a pass, passes where every key has the same digit are skipped
+	int source = 0;
+	for (uint32_t shift = 0; shift < 32; shift += 8)
+	{
+		uint32_t histogram[256] = {};
+		for (uint32_t i = 0; i < count; i++)
+			histogram[(keys[source][i] >> shift) & 0xFF]++;
+
+		if (histogram[(keys[source][0] >> shift) & 0xFF] == count)
+			continue;
+
+		uint32_t offset = 0;
+		for (uint32_t &bucket : histogram)
+		{
+			uint32_t size = bucket;
+			bucket = offset;
+			offset += size;
+		}
+
+		int target = source ^ 1;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			uint32_t slot = histogram[(keys[source][i] >> shift) & 0xFF]++;
+			keys[target][slot] = keys[source][i];
+			order[target][slot] = order[source][i];
+		}
+		source = target;
+	}
+
+	// the sweep axis first, then the other two
+	int axes[3] = {sweepAxis, (sweepAxis + 1) % 3, (sweepAxis + 2) % 3};
+	for (int k = 0; k < 3; k++)
+	{
+		sorted[k * 2].resize(count + PADDING);
+		sorted[k * 2 + 1].resize(count + PADDING);
+
+		const float *srcMin = bounds[axes[k]].data();
+		const float *srcMax = bounds[axes[k] + 3].data();
+		float *dstMin = sorted[k * 2].data();
+		float *dstMax = sorted[k * 2 + 1].data();
+		for (uint32_t i = 0; i < count; i++)
+		{
+			dstMin[i] = srcMin[order[source][i]];
+			dstMax[i] = srcMax[order[source][i]];
+		}
+	}
+
+	sortedUserData.resize(count);
+	for (uint32_t i = 0; i < count; i++)
+		sortedUserData[i] = userData[order[source][i]];
+
+	// boxes past the end start at infinity and end every sweep
+	std::fill(sorted[0].begin() + count, sorted[0].end(), std::numeric_limits<float>::infinity());
+}
+
+const std::vector<BroadphasePair> &SweepAndPrune::update_pairs()
+{
+	pairs.clear();
+
+	uint32_t count = proxy_count();
+	if (count < 2)
+		return pairs;
+
+	sweepAxis = choose_axis();
+	sort_boxes();
+
+	SweepArrays arrays{sorted[0].data(), sorted[1].data(), sorted[2].data(), sorted[3].data(), sorted[4].data(), sorted[5].data(),
+					   sortedUserData.data()};
+
+	auto sweep = sweep_scalar;
+#ifdef SAP_X86
+	if (simd && cpu_has_avx2())
+		sweep = sweep_avx2;
+#endif
+
+	JobSystem &jobs = JobSystem::Get();
+	threadPairs.resize(std::max(jobs.thread_index_count(), 1u));
+	for (std::vector<BroadphasePair> &found : threadPairs)
+		found.clear();
+
+	jobs.parallel_for(count, grainSize, [this, &arrays, sweep](uint32_t begin, uint32_t end)
+					  { sweep(arrays, begin, end, threadPairs[JobSystem::thread_index()]); });
+
+	for (const std::vector<BroadphasePair> &found : threadPairs)
+		pairs.insert(pairs.end(), found.begin(), found.end());
+
+	// the order the jobs ran in should not leak out
+	std::sort(pairs.begin(), pairs.end());
+
+	return pairs;
+}
@@ -0,0 +1,1127 @@
+#include "physics_engine/contact_solver.h"
+
+#include "physics_engine/collision_detection/collision_detection.h"
+#include "core/cpu_features.h"
+#include "core/job_system.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <numeric>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define SOLVER_X86 1
+#endif
+
+//Third party
+
+#include <fmt/core.h>
+#include <fmt/color.h>
+
+namespace
+{
+	// the same tangent for the same normal, so warm started friction keeps pushing the same way
+	glm::vec3 tangent_of(const glm::vec3 &normal)
+	{
+		glm::vec3 tangent = std::abs(normal.x) > 0.57735f ? glm::vec3(normal.y, -normal.x, 0.f) : glm::vec3(0.f, normal.z, -normal.y);
+		return glm::normalize(tangent);
+	}
+
+	glm::vec3 inverse_inertia_times(const SolverBody &body, const glm::vec3 &v)
+	{
+		const float *i = body.inverseInertia;
+		return glm::vec3(i[0] * v.x + i[3] * v.y + i[4] * v.z, i[3] * v.x + i[1] * v.y + i[5] * v.z, i[4] * v.x + i[5] * v.y + i[2] * v.z);
+	}
+
+	// the velocities of the two bodies of a constraint while it is solved
+	struct ConstraintVelocities
+	{
+		glm::vec3 linearA;
+		glm::vec3 angularA;
+		glm::vec3 linearB;
+		glm::vec3 angularB;
+
+		ConstraintVelocities(const SolverBody *bodies, const ContactConstraint &c)
+			: linearA(bodies[c.a].linear), angularA(bodies[c.a].angular), linearB(bodies[c.b].linear), angularB(bodies[c.b].angular)
+		{
+		}
+
+		// static bodies are shared by islands solved at the same time, they are read but never written
+		void store(SolverBody *bodies, const ContactConstraint &c) const
+		{
+			if (c.inverseMassA > 0.f)
+			{
+				bodies[c.a].linear = linearA;
+				bodies[c.a].angular = angularA;
+			}
+			if (c.inverseMassB > 0.f)
+			{
+				bodies[c.b].linear = linearB;
+				bodies[c.b].angular = angularB;
+			}
+		}
+	};
+
+	// the angular parts of the jacobian of one direction, r x d, and the inverse inertia times them
+	struct Jacobian
+	{
+		glm::vec3 direction;
+		glm::vec3 angularA;
+		glm::vec3 angularB;
+		glm::vec3 inertiaA;
+		glm::vec3 inertiaB;
+
+		Jacobian(const SolverBody *bodies, const ContactConstraint &c, const glm::vec3 &direction)
+			: direction(direction), angularA(glm::cross(c.offsetA, direction)), angularB(glm::cross(c.offsetB, direction)),
+			  inertiaA(inverse_inertia_times(bodies[c.a], angularA)), inertiaB(inverse_inertia_times(bodies[c.b], angularB))
+		{
+		}
+
+		// velocity of b relative to a along the direction, positive when separating
+		float velocity(const ConstraintVelocities &v) const
+		{
+			return glm::dot(direction, v.linearB - v.linearA) + glm::dot(angularB, v.angularB) - glm::dot(angularA, v.angularA);
+		}
+
+		void apply(const ContactConstraint &c, float lambda, ConstraintVelocities &v) const
+		{
+			v.linearA -= direction * (lambda * c.inverseMassA);
+			v.angularA -= inertiaA * lambda;
+			v.linearB += direction * (lambda * c.inverseMassB);
+			v.angularB += inertiaB * lambda;
+		}
+
+		float effective_mass(const ContactConstraint &c) const
+		{
+			float k = c.inverseMassA + c.inverseMassB + glm::dot(angularA, inertiaA) + glm::dot(angularB, inertiaB);
+			return k > 0.f ? 1.f / k : 0.f;
+		}
+	};
+
+	void warm_start(SolverBody *bodies, const ContactConstraint &c)
+	{
+		ConstraintVelocities v(bodies, c);
+		Jacobian(bodies, c, c.normal).apply(c, c.impulse[0], v);
+		Jacobian(bodies, c, c.tangent).apply(c, c.impulse[1], v);
+		Jacobian(bodies, c, glm::cross(c.normal, c.tangent)).apply(c, c.impulse[2], v);
+		v.store(bodies, c);
+	}
+
+	void solve_constraint(SolverBody *bodies, ContactConstraint &c)
+	{
+		ConstraintVelocities v(bodies, c);
+
+		// friction first, bounded by the normal impulse so far
+		float limit = c.friction * c.impulse[0];
+		const glm::vec3 tangents[2] = {c.tangent, glm::cross(c.normal, c.tangent)};
+		for (uint32_t d = 1; d < CONTACT_DIRECTIONS; d++)
+		{
+			Jacobian jacobian(bodies, c, tangents[d - 1]);
+			float impulse = std::clamp(c.impulse[d] - c.mass[d] * jacobian.velocity(v), -limit, limit);
+			jacobian.apply(c, impulse - c.impulse[d], v);
+			c.impulse[d] = impulse;
+		}
+
+		Jacobian jacobian(bodies, c, c.normal);
+		float impulse = std::max(c.impulse[0] - c.mass[0] * (jacobian.velocity(v) + c.bias), 0.f);
+		jacobian.apply(c, impulse - c.impulse[0], v);
+		c.impulse[0] = impulse;
+
+		v.store(bodies, c);
+	}
+
+	// the bodies of every lane of a batch. The lane loops below have no branches and the compiler
+	// vectorizes them 8 wide
+	struct LaneBodies
+	{
+		float linearA[3][SOLVER_LANES];
+		float angularA[3][SOLVER_LANES];
+		float inertiaA[6][SOLVER_LANES];
+		float linearB[3][SOLVER_LANES];
+		float angularB[3][SOLVER_LANES];
+		float inertiaB[6][SOLVER_LANES];
+
+		void gather(const SolverBody *bodies, const ContactBatch &batch)
+		{
+			for (uint32_t lane = 0; lane < SOLVER_LANES; lane++)
+			{
+				const SolverBody &a = bodies[batch.a[lane]];
+				const SolverBody &b = bodies[batch.b[lane]];
+				for (int axis = 0; axis < 3; axis++)
+				{
+					linearA[axis][lane] = a.linear[axis];
+					angularA[axis][lane] = a.angular[axis];
+					linearB[axis][lane] = b.linear[axis];
+					angularB[axis][lane] = b.angular[axis];
+				}
+				for (int element = 0; element < 6; element++)
+				{
+					inertiaA[element][lane] = a.inverseInertia[element];
+					inertiaB[element][lane] = b.inverseInertia[element];
+				}
+			}
+		}
+
+		void scatter(SolverBody *bodies, const ContactBatch &batch) const
+		{
+			for (uint32_t lane = 0; lane < batch.count; lane++)
+			{
+				if (batch.inverseMassA[lane] > 0.f)
+				{
+					bodies[batch.a[lane]].linear = glm::vec3(linearA[0][lane], linearA[1][lane], linearA[2][lane]);
+					bodies[batch.a[lane]].angular = glm::vec3(angularA[0][lane], angularA[1][lane], angularA[2][lane]);
+				}
+				if (batch.inverseMassB[lane] > 0.f)
+				{
+					bodies[batch.b[lane]].linear = glm::vec3(linearB[0][lane], linearB[1][lane], linearB[2][lane]);
+					bodies[batch.b[lane]].angular = glm::vec3(angularB[0][lane], angularB[1][lane], angularB[2][lane]);
+				}
+			}
+		}
+	};
+
+	// Jacobian on 8 lanes
+	struct LaneJacobian
+	{
+		float direction[3][SOLVER_LANES];
+		float angularA[3][SOLVER_LANES];
+		float angularB[3][SOLVER_LANES];
+		float inertiaA[3][SOLVER_LANES];
+		float inertiaB[3][SOLVER_LANES];
+
+		static void cross(const float (&a)[3][SOLVER_LANES], const float (&b)[3][SOLVER_LANES], float (&out)[3][SOLVER_LANES])
+		{
+			for (uint32_t lane = 0; lane < SOLVER_LANES; lane++)
+			{
+				out[0][lane] = a[1][lane] * b[2][lane] - a[2][lane] * b[1][lane];
+				out[1][lane] = a[2][lane] * b[0][lane] - a[0][lane] * b[2][lane];
+				out[2][lane] = a[0][lane] * b[1][lane] - a[1][lane] * b[0][lane];
+			}
+		}
+
+		static void inertia_times(const float (&i)[6][SOLVER_LANES], const float (&v)[3][SOLVER_LANES], float (&out)[3][SOLVER_LANES])
+		{
+			for (uint32_t lane = 0; lane < SOLVER_LANES; lane++)
+			{
+				out[0][lane] = i[0][lane] * v[0][lane] + i[3][lane] * v[1][lane] + i[4][lane] * v[2][lane];
+				out[1][lane] = i[3][lane] * v[0][lane] + i[1][lane] * v[1][lane] + i[5][lane] * v[2][lane];
+				out[2][lane] = i[4][lane] * v[0][lane] + i[5][lane] * v[1][lane] + i[2][lane] * v[2][lane];
+			}
+		}
+
+		void set(const LaneBodies &bodies, const ContactBatch &batch)
+		{
+			cross(batch.offsetA, direction, angularA);
+			cross(batch.offsetB, direction, angularB);
+			inertia_times(bodies.inertiaA, angularA, inertiaA);
+			inertia_times(bodies.inertiaB, angularB, inertiaB);
+		}
+
+		void velocity(const LaneBodies &bodies, float *out) const
+		{
+			for (uint32_t lane = 0; lane < SOLVER_LANES; lane++)
+				out[lane] = 0.f;
+
+			for (int axis = 0; axis < 3; axis++)
+			{
+				for (uint32_t lane = 0; lane < SOLVER_LANES; lane++)
+					out[lane] += direction[axis][lane] * (bodies.linearB[axis][lane] - bodies.linearA[axis][lane]) +
+								 angularB[axis][lane] * bodies.angularB[axis][lane] - angularA[axis][lane] * bodies.angularA[axis][lane];
+			}
+		}
+
+		void apply(const ContactBatch &batch, const float *lambda, LaneBodies &bodies) const
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				for (uint32_t lane = 0; lane < SOLVER_LANES; lane++)
+				{
+					bodies.linearA[axis][lane] -= direction[axis][lane] * lambda[lane] * batch.inverseMassA[lane];
+					bodies.angularA[axis][lane] -= inertiaA[axis][lane] * lambda[lane];
+					bodies.linearB[axis][lane] += direction[axis][lane] * lambda[lane] * batch.inverseMassB[lane];
+					bodies.angularB[axis][lane] += inertiaB[axis][lane] * lambda[lane];
+				}
+			}
+		}
+	};
+
+	// the jacobians of the normal and the two friction directions
+	void set_jacobians(const LaneBodies &lanes, const ContactBatch &batch, LaneJacobian (&jacobians)[CONTACT_DIRECTIONS])
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			for (uint32_t lane = 0; lane < SOLVER_LANES; lane++)
+			{
+				jacobians[0].direction[axis][lane] = batch.normal[axis][lane];
+				jacobians[1].direction[axis][lane] = batch.tangent[axis][lane];
+			}
+		}
+		LaneJacobian::cross(batch.normal, batch.tangent, jacobians[2].direction);
+
+		for (LaneJacobian &jacobian : jacobians)
+			jacobian.set(lanes, batch);
+	}
+
+	void warm_start_batch(SolverBody *bodies, const ContactBatch &batch)
+	{
+		LaneBodies lanes;
+		lanes.gather(bodies, batch);
+
+		LaneJacobian jacobians[CONTACT_DIRECTIONS];
+		set_jacobians(lanes, batch, jacobians);
+		for (uint32_t d = 0; d < CONTACT_DIRECTIONS; d++)
+			jacobians[d].apply(batch, batch.impulse[d], lanes);
+
+		lanes.scatter(bodies, batch);
+	}
+
+	// solve_constraint on 8 lanes
+	void solve_batch(SolverBody *bodies, ContactBatch &batch)
+	{
+		LaneBodies lanes;
+		lanes.gather(bodies, batch);
+
+		LaneJacobian jacobians[CONTACT_DIRECTIONS];
+		set_jacobians(lanes, batch, jacobians);
+
+		float velocity[SOLVER_LANES];
+		float lambda[SOLVER_LANES];
+
+		for (uint32_t d = 1; d < CONTACT_DIRECTIONS; d++)
+		{
+			jacobians[d].velocity(lanes, velocity);
+			for (uint32_t lane = 0; lane < SOLVER_LANES; lane++)
+			{
+				float limit = batch.friction[lane] * batch.impulse[0][lane];
+				float impulse = std::clamp(batch.impulse[d][lane] - batch.mass[d][lane] * velocity[lane], -limit, limit);
+				lambda[lane] = impulse - batch.impulse[d][lane];
+				batch.impulse[d][lane] = impulse;
+			}
+			jacobians[d].apply(batch, lambda, lanes);
+		}
+
+		jacobians[0].velocity(lanes, velocity);
+		for (uint32_t lane = 0; lane < SOLVER_LANES; lane++)
+		{
+			float impulse = std::max(batch.impulse[0][lane] - batch.mass[0][lane] * (velocity[lane] + batch.bias[lane]), 0.f);
+			lambda[lane] = impulse - batch.impulse[0][lane];
+			batch.impulse[0][lane] = impulse;
+		}
+		jacobians[0].apply(batch, lambda, lanes);
+
+		lanes.scatter(bodies, batch);
+	}
+
+#ifdef SOLVER_X86
+	// x y z of 8 lanes
+	struct Lanes3
+	{
+		__m256 x, y, z;
+	};
+
+	__attribute__((target("avx2"))) inline Lanes3 load3(const float (&v)[3][SOLVER_LANES])
+	{
+		return Lanes3{_mm256_loadu_ps(v[0]), _mm256_loadu_ps(v[1]), _mm256_loadu_ps(v[2])};
+	}
+
+	__attribute__((target("avx2"))) inline void store3(float (&v)[3][SOLVER_LANES], const Lanes3 &value)
+	{
+		_mm256_storeu_ps(v[0], value.x);
+		_mm256_storeu_ps(v[1], value.y);
+		_mm256_storeu_ps(v[2], value.z);
+	}
+
+	__attribute__((target("avx2"))) inline Lanes3 cross8(const Lanes3 &a, const Lanes3 &b)
+	{
+		return Lanes3{_mm256_sub_ps(_mm256_mul_ps(a.y, b.z), _mm256_mul_ps(a.z, b.y)), _mm256_sub_ps(_mm256_mul_ps(a.z, b.x), _mm256_mul_ps(a.x, b.z)),
+					  _mm256_sub_ps(_mm256_mul_ps(a.x, b.y), _mm256_mul_ps(a.y, b.x))};
+	}
+
+	__attribute__((target("avx2"))) inline __m256 dot8(const Lanes3 &a, const Lanes3 &b)
+	{
+		return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a.x, b.x), _mm256_mul_ps(a.y, b.y)), _mm256_mul_ps(a.z, b.z));
+	}
+
+	// a += b * s
+	__attribute__((target("avx2"))) inline void add_scaled8(Lanes3 &a, const Lanes3 &b, __m256 s)
+	{
+		a.x = _mm256_add_ps(a.x, _mm256_mul_ps(b.x, s));
+		a.y = _mm256_add_ps(a.y, _mm256_mul_ps(b.y, s));
+		a.z = _mm256_add_ps(a.z, _mm256_mul_ps(b.z, s));
+	}
+
+	__attribute__((target("avx2"))) inline Lanes3 inertia_times8(const float (&i)[6][SOLVER_LANES], const Lanes3 &v)
+	{
+		__m256 xx = _mm256_loadu_ps(i[0]), yy = _mm256_loadu_ps(i[1]), zz = _mm256_loadu_ps(i[2]);
+		__m256 xy = _mm256_loadu_ps(i[3]), xz = _mm256_loadu_ps(i[4]), yz = _mm256_loadu_ps(i[5]);
+		return Lanes3{_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(xx, v.x), _mm256_mul_ps(xy, v.y)), _mm256_mul_ps(xz, v.z)),
+					  _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(xy, v.x), _mm256_mul_ps(yy, v.y)), _mm256_mul_ps(yz, v.z)),
+					  _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(xz, v.x), _mm256_mul_ps(yz, v.y)), _mm256_mul_ps(zz, v.z))};
+	}
+
+	// solve_batch with the lanes in registers
+	__attribute__((target("avx2"))) void solve_batch_avx2(SolverBody *bodies, ContactBatch &batch)
+	{
+		LaneBodies lanes;
+		lanes.gather(bodies, batch);
+
+		Lanes3 linearA = load3(lanes.linearA), angularA = load3(lanes.angularA);
+		Lanes3 linearB = load3(lanes.linearB), angularB = load3(lanes.angularB);
+		Lanes3 offsetA = load3(batch.offsetA), offsetB = load3(batch.offsetB);
+		Lanes3 normal = load3(batch.normal), tangent = load3(batch.tangent);
+		const Lanes3 directions[CONTACT_DIRECTIONS] = {normal, tangent, cross8(normal, tangent)};
+
+		__m256 inverseMassA = _mm256_loadu_ps(batch.inverseMassA);
+		__m256 inverseMassB = _mm256_loadu_ps(batch.inverseMassB);
+		__m256 limit = _mm256_mul_ps(_mm256_loadu_ps(batch.friction), _mm256_loadu_ps(batch.impulse[0]));
+		__m256 negativeLimit = _mm256_sub_ps(_mm256_setzero_ps(), limit);
+
+		// the two friction directions and then the normal
+		for (uint32_t d : {1u, 2u, 0u})
+		{
+			Lanes3 jacobianA = cross8(offsetA, directions[d]);
+			Lanes3 jacobianB = cross8(offsetB, directions[d]);
+
+			Lanes3 relative{_mm256_sub_ps(linearB.x, linearA.x), _mm256_sub_ps(linearB.y, linearA.y), _mm256_sub_ps(linearB.z, linearA.z)};
+			__m256 velocity = _mm256_sub_ps(_mm256_add_ps(dot8(directions[d], relative), dot8(jacobianB, angularB)), dot8(jacobianA, angularA));
+
+			__m256 previous = _mm256_loadu_ps(batch.impulse[d]);
+			__m256 mass = _mm256_loadu_ps(batch.mass[d]);
+			__m256 impulse;
+			if (d == 0)
+			{
+				velocity = _mm256_add_ps(velocity, _mm256_loadu_ps(batch.bias));
+				impulse = _mm256_max_ps(_mm256_sub_ps(previous, _mm256_mul_ps(mass, velocity)), _mm256_setzero_ps());
+			}
+			else
+				impulse = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(previous, _mm256_mul_ps(mass, velocity)), negativeLimit), limit);
+			_mm256_storeu_ps(batch.impulse[d], impulse);
+
+			__m256 lambda = _mm256_sub_ps(impulse, previous);
+			__m256 negativeLambda = _mm256_sub_ps(_mm256_setzero_ps(), lambda);
+			add_scaled8(linearA, directions[d], _mm256_mul_ps(negativeLambda, inverseMassA));
+			add_scaled8(angularA, inertia_times8(lanes.inertiaA, jacobianA), negativeLambda);
+			add_scaled8(linearB, directions[d], _mm256_mul_ps(lambda, inverseMassB));
+			add_scaled8(angularB, inertia_times8(lanes.inertiaB, jacobianB), lambda);
+		}
+
+		store3(lanes.linearA, linearA);
+		store3(lanes.angularA, angularA);
+		store3(lanes.linearB, linearB);
+		store3(lanes.angularB, angularB);
+		lanes.scatter(bodies, batch);
+	}
+#endif
+
+	void pack_lane(ContactBatch &batch, uint32_t lane, const ContactConstraint &c, uint32_t constraint)
+	{
+		batch.a[lane] = c.a;
+		batch.b[lane] = c.b;
+		batch.constraints[lane] = constraint;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			batch.normal[axis][lane] = c.normal[axis];
+			batch.tangent[axis][lane] = c.tangent[axis];
+			batch.offsetA[axis][lane] = c.offsetA[axis];
+			batch.offsetB[axis][lane] = c.offsetB[axis];
+		}
+		for (uint32_t d = 0; d < CONTACT_DIRECTIONS; d++)
+		{
+			batch.mass[d][lane] = c.mass[d];
+			batch.impulse[d][lane] = c.impulse[d];
+		}
+		batch.inverseMassA[lane] = c.inverseMassA;
+		batch.inverseMassB[lane] = c.inverseMassB;
+		batch.bias[lane] = c.bias;
+		batch.friction[lane] = c.friction;
+	}
+
+	uint64_t manifold_key(const ContactManifold &manifold)
+	{
+		return (uint64_t)manifold.a << 32 | manifold.b;
+	}
+}
+
+uint32_t ContactSolver::find(uint32_t body)
+{
+	// path halving
+	while (parents[body] != body)
+	{
+		parents[body] = parents[parents[body]];
+		body = parents[body];
+	}
+	return body;
+}
+
+void ContactSolver::build_islands(RigidBodyWorld &world, const std::vector<ContactManifold> &manifolds)
+{
+	uint32_t count = world.body_count();
+	const float *inverseMass = world.stream(BodyStream::InverseMass);
+	float *awake = world.stream(BodyStream::Awake);
+
+	parents.resize(count);
+	std::iota(parents.begin(), parents.end(), 0u);
+
+	// the lower index is the root, so a root comes before the rest of its island below
+	for (const ContactManifold &manifold : manifolds)
+	{
+		uint32_t a = world.index(world.handle_of_id(manifold.a));
+		uint32_t b = world.index(world.handle_of_id(manifold.b));
+		if (manifold.pointCount == 0 || inverseMass[a] <= 0.f || inverseMass[b] <= 0.f)
+			continue;
+
+		uint32_t rootA = find(a);
+		uint32_t rootB = find(b);
+		if (rootA != rootB)
+			parents[std::max(rootA, rootB)] = std::min(rootA, rootB);
+	}
+
+	islands.clear();
+	bodyIslands.assign(count, ~0u);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (inverseMass[i] <= 0.f)
+			continue;
+
+		uint32_t root = find(i);
+		if (bodyIslands[root] == ~0u)
+		{
+			bodyIslands[root] = (uint32_t)islands.size();
+			islands.push_back(Island{});
+		}
+		bodyIslands[i] = bodyIslands[root];
+		islands[bodyIslands[i]].bodyCount++;
+	}
+
+	// bodies grouped by island
+	uint32_t offset = 0;
+	for (Island &island : islands)
+	{
+		island.bodyBegin = offset;
+		offset += island.bodyCount;
+		island.bodyCount = 0;
+	}
+
+	islandBodies.resize(offset);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (bodyIslands[i] != ~0u)
+		{
+			Island &island = islands[bodyIslands[i]];
+			islandBodies[island.bodyBegin + island.bodyCount++] = i;
+		}
+	}
+
+	// an island sleeps while all of it does, something awake touching it wakes all of it. Turning sleep
+	// off wakes everything.
+	for (Island &island : islands)
+	{
+		uint32_t awakeCount = 0;
+		for (uint32_t i = island.bodyBegin; i < island.bodyBegin + island.bodyCount; i++)
+			awakeCount += awake[islandBodies[i]] != 0.f;
+
+		island.asleep = sleepEnabled && awakeCount == 0;
+		if (island.asleep)
+			continue;
+
+		for (uint32_t i = island.bodyBegin; i < island.bodyBegin + island.bodyCount; i++)
+		{
+			uint32_t body = islandBodies[i];
+			uint32_t id = world.handle(body).id;
+			awake[body] = 1.f;
+
+			// woken since the last step, by the island or by the caller
+			if (sleeping[id])
+			{
+				sleeping[id] = 0;
+				sleepTimers[id] = 0.f;
+			}
+		}
+	}
+}
+
+void ContactSolver::prepare_constraints(RigidBodyWorld &world, const std::vector<ContactManifold> &manifolds, float dt)
+{
+	const float *inverseMass = world.stream(BodyStream::InverseMass);
+
+	// the points of every manifold of an awake island, grouped by island
+	manifoldConstraints.resize(manifolds.size());
+	for (uint32_t m = 0; m < manifolds.size(); m++)
+	{
+		uint32_t a = world.index(world.handle_of_id(manifolds[m].a));
+		uint32_t b = world.index(world.handle_of_id(manifolds[m].b));
+		uint32_t island = bodyIslands[inverseMass[a] > 0.f ? a : b];
+
+		manifoldConstraints[m] = ~0u;
+		if (island != ~0u && !islands[island].asleep)
+			islands[island].constraintCount += manifolds[m].pointCount;
+	}
+
+	uint32_t total = 0;
+	smallIslands.clear();
+	largeIslands.clear();
+	for (uint32_t i = 0; i < islands.size(); i++)
+	{
+		Island &island = islands[i];
+		if (island.constraintCount > 0)
+		{
+			if (splitIslands && island.constraintCount > splitThreshold)
+				largeIslands.push_back(i);
+			else
+				smallIslands.push_back(i);
+		}
+
+		island.constraintBegin = total;
+		total += island.constraintCount;
+		island.constraintCount = 0;
+	}
+
+	for (uint32_t m = 0; m < manifolds.size(); m++)
+	{
+		uint32_t a = world.index(world.handle_of_id(manifolds[m].a));
+		uint32_t b = world.index(world.handle_of_id(manifolds[m].b));
+		uint32_t island = bodyIslands[inverseMass[a] > 0.f ? a : b];
+		if (island == ~0u || islands[island].asleep)
+			continue;
+
+		manifoldConstraints[m] = islands[island].constraintBegin + islands[island].constraintCount;
+		islands[island].constraintCount += manifolds[m].pointCount;
+	}
+
+	constraints.resize(total);
+	stats.constraints = total;
+
+	JobSystem::Get().parallel_for((uint32_t)manifolds.size(), 256, [&](uint32_t begin, uint32_t end)
+								  {
+		for (uint32_t m = begin; m < end; m++)
+		{
+			if (manifoldConstraints[m] == ~0u)
+				continue;
+
+			const ContactManifold &manifold = manifolds[m];
+			uint32_t a = world.index(world.handle_of_id(manifold.a));
+			uint32_t b = world.index(world.handle_of_id(manifold.b));
+			glm::vec3 positionA = world.position(world.handle_of_id(manifold.a));
+			glm::vec3 positionB = world.position(world.handle_of_id(manifold.b));
+			glm::vec3 tangent = tangent_of(manifold.normal);
+
+			const CachedManifold *cached = nullptr;
+			if (warmStarting)
+			{
+				auto found = std::lower_bound(cache.begin(), cache.end(), manifold_key(manifold), [](const CachedManifold &entry, uint64_t key)
+											  { return entry.key < key; });
+				if (found != cache.end() && found->key == manifold_key(manifold))
+					cached = &*found;
+			}
+
+			for (uint32_t p = 0; p < manifold.pointCount; p++)
+			{
+				const ContactPoint &point = manifold.points[p];
+				ContactConstraint &c = constraints[manifoldConstraints[m] + p];
+				c.a = a;
+				c.b = b;
+				c.normal = manifold.normal;
+				c.tangent = tangent;
+				c.offsetA = point.position - positionA;
+				c.offsetB = point.position - positionB;
+				c.inverseMassA = inverseMass[a];
+				c.inverseMassB = inverseMass[b];
+				c.friction = friction;
+
+				c.mass[0] = Jacobian(bodies.data(), c, c.normal).effective_mass(c);
+				c.mass[1] = Jacobian(bodies.data(), c, c.tangent).effective_mass(c);
+				c.mass[2] = Jacobian(bodies.data(), c, glm::cross(c.normal, c.tangent)).effective_mass(c);
+				for (uint32_t d = 0; d < CONTACT_DIRECTIONS; d++)
+					c.impulse[d] = 0.f;
+
+				// speculative while apart, the gap may close this step but no more. Pushed out gently once in
+				c.bias = point.depth < 0.f ? -point.depth / dt : -baumgarte * std::max(point.depth - slop, 0.f) / dt;
+
+				if (cached == nullptr)
+					continue;
+
+				// from the closest point of the last step, when it is close enough
+				float closest = warmStartDistance * warmStartDistance;
+				for (uint32_t q = 0; q < cached->pointCount; q++)
+				{
+					glm::vec3 offset = cached->positions[q] - point.position;
+					float distance = glm::dot(offset, offset);
+					if (distance < closest)
+					{
+						closest = distance;
+						for (uint32_t d = 0; d < CONTACT_DIRECTIONS; d++)
+							c.impulse[d] = cached->impulses[q][d];
+					}
+				}
+			}
+		} });
+}
+
+void ContactSolver::solve_split_island(const Island &island)
+{
+	SolverBody *solverBodies = bodies.data();
+	uint32_t first = island.constraintBegin;
+	uint32_t count = island.constraintCount;
+
+	// greedy coloring, a constraint takes the first color neither of its dynamic bodies has yet. Static
+	// bodies are never written so they take any number of constraints of a color
+	for (uint32_t i = island.bodyBegin; i < island.bodyBegin + island.bodyCount; i++)
+		colorMasks[islandBodies[i]] = 0;
+
+	uint32_t colorCounts[64] = {};
+	uint32_t colorCount = 0;
+	constraintColors.resize(count);
+	overflow.clear();
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const ContactConstraint &c = constraints[first + i];
+		uint64_t used = (c.inverseMassA > 0.f ? colorMasks[c.a] : 0) | (c.inverseMassB > 0.f ? colorMasks[c.b] : 0);
+		if (used == ~0ull)
+		{
+			constraintColors[i] = ~0u;
+			overflow.push_back(first + i);
+			continue;
+		}
+
+		uint32_t color = (uint32_t)std::countr_zero(~used);
+		if (c.inverseMassA > 0.f)
+			colorMasks[c.a] |= 1ull << color;
+		if (c.inverseMassB > 0.f)
+			colorMasks[c.b] |= 1ull << color;
+
+		constraintColors[i] = color;
+		colorCounts[color]++;
+		colorCount = std::max(colorCount, color + 1);
+	}
+
+	stats.colors = std::max(stats.colors, colorCount);
+
+	// every color into batches of 8, the last batch of a color padded
+	colorBatches.resize(colorCount + 1);
+	colorBatches[0] = 0;
+	for (uint32_t color = 0; color < colorCount; color++)
+		colorBatches[color + 1] = colorBatches[color] + (colorCounts[color] + SOLVER_LANES - 1) / SOLVER_LANES;
+
+	// sorted by color first, so every batch is packed at once
+	colorOrder.assign(colorBatches[colorCount] * SOLVER_LANES, ~0u);
+	uint32_t filled[64] = {};
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t color = constraintColors[i];
+		if (color != ~0u)
+			colorOrder[colorBatches[color] * SOLVER_LANES + filled[color]++] = first + i;
+	}
+
+	batches.resize(colorBatches[colorCount]);
+	JobSystem::Get().parallel_for((uint32_t)batches.size(), batchGrainSize, [this](uint32_t begin, uint32_t end)
+								  {
+		for (uint32_t i = begin; i < end; i++)
+		{
+			ContactBatch &batch = batches[i];
+			const uint32_t *lanes = colorOrder.data() + i * SOLVER_LANES;
+			batch.count = 0;
+
+			for (uint32_t lane = 0; lane < SOLVER_LANES; lane++)
+			{
+				if (lanes[lane] != ~0u)
+				{
+					pack_lane(batch, lane, constraints[lanes[lane]], lanes[lane]);
+					batch.count++;
+					continue;
+				}
+
+				// padding has no mass, it reads the bodies of the first lane and adds nothing to them
+				pack_lane(batch, lane, constraints[lanes[0]], lanes[0]);
+				batch.inverseMassA[lane] = batch.inverseMassB[lane] = 0.f;
+				for (uint32_t d = 0; d < CONTACT_DIRECTIONS; d++)
+					batch.mass[d][lane] = batch.impulse[d][lane] = 0.f;
+			}
+		} });
+
+	auto for_each_color = [&](auto &&function)
+	{
+		for (uint32_t color = 0; color < colorCount; color++)
+		{
+			ContactBatch *colorBegin = batches.data() + colorBatches[color];
+			JobSystem::Get().parallel_for(colorBatches[color + 1] - colorBatches[color], batchGrainSize, [&](uint32_t begin, uint32_t end)
+										  {
+				for (uint32_t i = begin; i < end; i++)
+					function(colorBegin[i]); });
+		}
+
+		for (uint32_t constraint : overflow)
+			function(constraints[constraint]);
+	};
+
+	auto solve = solve_batch;
+#ifdef SOLVER_X86
+	if (simd && cpu_has_avx2())
+		solve = solve_batch_avx2;
+#endif
+
+	if (warmStarting)
+	{
+		for_each_color([solverBodies](auto &constraint)
+					   {
+			if constexpr (std::is_same_v<std::decay_t<decltype(constraint)>, ContactBatch>)
+				warm_start_batch(solverBodies, constraint);
+			else
+				warm_start(solverBodies, constraint); });
+	}
+
+	for (uint32_t iteration = 0; iteration < iterations; iteration++)
+	{
+		for_each_color([solverBodies, solve](auto &constraint)
+					   {
+			if constexpr (std::is_same_v<std::decay_t<decltype(constraint)>, ContactBatch>)
+				solve(solverBodies, constraint);
+			else
+				solve_constraint(solverBodies, constraint); });
+	}
+
+	// the impulses back for the cache
+	for (const ContactBatch &batch : batches)
+	{
+		for (uint32_t lane = 0; lane < batch.count; lane++)
+		{
+			for (uint32_t d = 0; d < CONTACT_DIRECTIONS; d++)
+				constraints[batch.constraints[lane]].impulse[d] = batch.impulse[d][lane];
+		}
+	}
+}
+
+void ContactSolver::store_impulses(const RigidBodyWorld &world, const std::vector<ContactManifold> &manifolds)
+{
+	const float *inverseMass = world.stream(BodyStream::InverseMass);
+	const float *awake = world.stream(BodyStream::Awake);
+	auto resting = [&](uint32_t id)
+	{
+		if (!world.contains(world.handle_of_id(id)))
+			return false;
+
+		uint32_t i = world.index(world.handle_of_id(id));
+		return inverseMass[i] <= 0.f || awake[i] == 0.f;
+	};
+
+	// the impulses of sleeping islands are kept for when they wake, whether their pairs were collided or not
+	nextCache.clear();
+	for (const CachedManifold &entry : cache)
+	{
+		if (resting((uint32_t)(entry.key >> 32)) && resting((uint32_t)entry.key))
+			nextCache.push_back(entry);
+	}
+
+	for (uint32_t m = 0; m < manifolds.size(); m++)
+	{
+		const ContactManifold &manifold = manifolds[m];
+		uint32_t first = manifoldConstraints[m];
+		if (first == ~0u)
+			continue;
+
+		CachedManifold entry;
+		entry.key = manifold_key(manifold);
+		entry.pointCount = manifold.pointCount;
+		for (uint32_t p = 0; p < manifold.pointCount; p++)
+		{
+			entry.positions[p] = manifold.points[p].position;
+			for (uint32_t d = 0; d < CONTACT_DIRECTIONS; d++)
+				entry.impulses[p][d] = constraints[first + p].impulse[d];
+		}
+		nextCache.push_back(entry);
+	}
+
+	std::sort(nextCache.begin(), nextCache.end(), [](const CachedManifold &a, const CachedManifold &b)
+			  { return a.key < b.key; });
+	std::swap(cache, nextCache);
+}
+
+void ContactSolver::update_sleep(RigidBodyWorld &world, float dt)
+{
+	float linearLimit = sleepLinearVelocity * sleepLinearVelocity;
+	float angularLimit = sleepAngularVelocity * sleepAngularVelocity;
+
+	for (const Island &island : islands)
+	{
+		if (island.asleep)
+		{
+			stats.sleepingIslands++;
+			stats.bodiesAsleep += island.bodyCount;
+			continue;
+		}
+
+		// the island rested as long as its least rested body
+		float rested = timeToSleep;
+		for (uint32_t i = island.bodyBegin; i < island.bodyBegin + island.bodyCount; i++)
+		{
+			uint32_t body = islandBodies[i];
+			uint32_t id = world.handle(body).id;
+			glm::vec3 v = bodies[body].linear;
+			glm::vec3 w = bodies[body].angular;
+
+			bool resting = glm::dot(v, v) < linearLimit && glm::dot(w, w) < angularLimit;
+			sleepTimers[id] = resting ? sleepTimers[id] + dt : 0.f;
+			rested = std::min(rested, sleepTimers[id]);
+		}
+
+		if (!sleepEnabled || rested < timeToSleep)
+			continue;
+
+		for (uint32_t i = island.bodyBegin; i < island.bodyBegin + island.bodyCount; i++)
+		{
+			BodyHandle body = world.handle(islandBodies[i]);
+			world.set_awake(body, false);
+			sleeping[body.id] = 1;
+		}
+		stats.bodiesAsleep += island.bodyCount;
+	}
+}
+
+void ContactSolver::copy_velocities(RigidBodyWorld &world, bool toStreams)
+{
+	float *linear[3] = {world.stream(BodyStream::LinearVelocityX), world.stream(BodyStream::LinearVelocityY), world.stream(BodyStream::LinearVelocityZ)};
+	float *angular[3] = {world.stream(BodyStream::AngularVelocityX), world.stream(BodyStream::AngularVelocityY), world.stream(BodyStream::AngularVelocityZ)};
+	const float *inertia[6] = {world.stream(BodyStream::InverseInertiaWorldXX), world.stream(BodyStream::InverseInertiaWorldYY),
+							   world.stream(BodyStream::InverseInertiaWorldZZ), world.stream(BodyStream::InverseInertiaWorldXY),
+							   world.stream(BodyStream::InverseInertiaWorldXZ), world.stream(BodyStream::InverseInertiaWorldYZ)};
+
+	bodies.resize(world.body_count());
+	JobSystem::Get().parallel_for(world.body_count(), 4096, [&](uint32_t begin, uint32_t end)
+								  {
+		for (uint32_t i = begin; i < end; i++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				if (toStreams)
+				{
+					linear[axis][i] = bodies[i].linear[axis];
+					angular[axis][i] = bodies[i].angular[axis];
+				}
+				else
+				{
+					bodies[i].linear[axis] = linear[axis][i];
+					bodies[i].angular[axis] = angular[axis][i];
+				}
+			}
+
+			if (!toStreams)
+			{
+				for (int element = 0; element < 6; element++)
+					bodies[i].inverseInertia[element] = inertia[element][i];
+			}
+		} });
+}
+
+void ContactSolver::solve(RigidBodyWorld &world, const std::vector<ContactManifold> &manifolds, float dt)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	stats = ContactSolverStats{};
+
+	// sleep state by body id, ids only grow
+	uint32_t count = world.body_count();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t id = world.handle(i).id;
+		if (sleepTimers.size() <= id)
+		{
+			sleepTimers.resize(id + 1, 0.f);
+			sleeping.resize(id + 1, 0);
+		}
+	}
+	colorMasks.resize(count);
+
+	build_islands(world, manifolds);
+	copy_velocities(world, false);
+	prepare_constraints(world, manifolds, dt);
+
+	// whole islands a job each
+	SolverBody *solverBodies = bodies.data();
+	JobSystem::Get().parallel_for((uint32_t)smallIslands.size(), grainSize, [&](uint32_t begin, uint32_t end)
+								  {
+		for (uint32_t i = begin; i < end; i++)
+		{
+			const Island &island = islands[smallIslands[i]];
+			ContactConstraint *first = constraints.data() + island.constraintBegin;
+			ContactConstraint *last = first + island.constraintCount;
+
+			if (warmStarting)
+			{
+				for (ContactConstraint *c = first; c != last; c++)
+					warm_start(solverBodies, *c);
+			}
+
+			for (uint32_t iteration = 0; iteration < iterations; iteration++)
+			{
+				for (ContactConstraint *c = first; c != last; c++)
+					solve_constraint(solverBodies, *c);
+			}
+		} });
+
+	// the large ones one after the other, every color spread over the jobs
+	for (uint32_t island : largeIslands)
+		solve_split_island(islands[island]);
+
+	copy_velocities(world, true);
+	store_impulses(world, manifolds);
+	update_sleep(world, dt);
+
+	stats.islands = (uint32_t)islands.size();
+	stats.splitIslands = (uint32_t)largeIslands.size();
+	stats.solveMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void ContactSolver::clear()
+{
+	cache.clear();
+	sleepTimers.clear();
+	sleeping.clear();
+	stats = ContactSolverStats{};
+}
+
+void run_solver_benchmark()
+{
+	constexpr uint32_t SETTLE_STEPS = 240;
+	constexpr uint32_t TIMED_STEPS = 60;
+	constexpr float BOX_BOUND = 0.87f;
+
+	fmt::print(fg(fmt::color::bisque), "\nContact solver benchmark ( {} steps to settle, {} threads )\n", SETTLE_STEPS, JobSystem::Get().thread_count());
+	fmt::print("{:>8} {:>8} {:>8} {:>8} {:>12} {:>12} {:>10} {:>8} {:>14}\n", "scene", "bodies", "islands", "colors", "split ms", "whole ms", "drift",
+			   "asleep", "asleep step ms");
+
+	struct Scene
+	{
+		RigidBodyWorld world;
+		CollisionDetection collision;
+		ContactSolver solver;
+		std::vector<Shape> shapes;
+		std::vector<ShapeTransform> transforms;
+		std::vector<uint8_t> active;
+		std::vector<glm::vec3> spawned;
+		std::vector<uint32_t> proxies;
+		std::vector<uint32_t> movedProxies;
+		std::vector<Aabb> movedAabbs;
+		std::vector<glm::vec3> displacements;
+
+		void add(const glm::vec3 &position, const Shape &shape, float mass, const glm::vec3 &bound)
+		{
+			RigidBodyDesc desc;
+			desc.position = position;
+			desc.mass = mass;
+			desc.inertia = glm::vec3(mass / 6.f);
+			BodyHandle body = world.add_body(desc);
+
+			shapes.resize(body.id + 1);
+			transforms.resize(body.id + 1);
+			active.resize(body.id + 1);
+			spawned.resize(body.id + 1);
+			proxies.resize(body.id + 1);
+			shapes[body.id] = shape;
+			spawned[body.id] = position;
+			proxies[body.id] = collision.add_proxy(Aabb{position - bound, position + bound}, body.id);
+		}
+
+		// the awake bodies move their proxies, then their contacts are found and solved
+		void solve(float dt)
+		{
+			movedProxies.clear();
+			movedAabbs.clear();
+			displacements.clear();
+			for (uint32_t i = 0; i < world.body_count(); i++)
+			{
+				BodyHandle body = world.handle(i);
+				glm::vec3 position = world.position(body);
+				transforms[body.id] = ShapeTransform{position, world.orientation(body)};
+
+				active[body.id] = world.stream(BodyStream::InverseMass)[i] > 0.f && world.awake(body);
+				if (!active[body.id])
+					continue;
+
+				movedProxies.push_back(proxies[body.id]);
+				movedAabbs.push_back(Aabb{position - BOX_BOUND, position + BOX_BOUND});
+				displacements.push_back(world.linear_velocity(body) * dt);
+			}
+
+			collision.move_proxies(movedProxies.data(), movedAabbs.data(), displacements.data(), (uint32_t)movedProxies.size());
+			collision.update_pairs();
+			solver.solve(world, collision.find_contacts(shapes.data(), transforms.data(), active.data()), dt);
+		}
+
+		float drift() const
+		{
+			float largest = 0.f;
+			for (uint32_t i = 0; i < world.body_count(); i++)
+				largest = std::max(largest, glm::length(world.position(world.handle(i)) - spawned[world.handle(i).id]));
+			return largest;
+		}
+	};
+
+	// ground, then unit boxes resting on it and on each other
+	auto build = [](Scene &scene, bool pile)
+	{
+		scene.world.constraintSolver = [&scene](float dt)
+		{ scene.solve(dt); };
+
+		scene.add(glm::vec3(0.f, -0.5f, 0.f), Shape::box(glm::vec3(200.f, 0.5f, 200.f)), 0.f, glm::vec3(200.f, 0.5f, 200.f));
+
+		// 400 stacks of 5 apart, or one pile of 30 by 30 columns of 3 side by side
+		uint32_t columns = pile ? 900 : 400;
+		uint32_t height = pile ? 3 : 5;
+		for (uint32_t column = 0; column < columns; column++)
+		{
+			glm::vec3 base = pile ? glm::vec3((float)(column % 30), 0.f, (float)(column / 30)) : glm::vec3((float)(column % 20) * 3.f, 0.f, (float)(column / 20) * 3.f);
+			for (uint32_t level = 0; level < height; level++)
+				scene.add(base + glm::vec3(0.f, 0.5f + (float)level, 0.f), Shape::box(glm::vec3(0.5f)), 1.f, glm::vec3(BOX_BOUND));
+		}
+	};
+
+	for (bool pile : {false, true})
+	{
+		float solveMs[2] = {};
+		float drift = 0.f;
+		uint32_t islands = 0;
+		uint32_t colors = 0;
+		uint32_t bodies = 0;
+
+		// the same steps solved by color and as whole islands, awake all along
+		for (bool split : {true, false})
+		{
+			auto scene = std::make_unique<Scene>();
+			scene->solver.splitIslands = split;
+			scene->solver.sleepEnabled = false;
+			build(*scene, pile);
+
+			for (uint32_t step = 0; step < SETTLE_STEPS; step++)
+			{
+				scene->world.step(scene->world.fixedTimestep);
+				if (step >= SETTLE_STEPS - TIMED_STEPS)
+					solveMs[split ? 0 : 1] += scene->solver.get_stats().solveMs / TIMED_STEPS;
+			}
+
+			if (split)
+			{
+				drift = scene->drift();
+				islands = scene->solver.get_stats().islands;
+				colors = scene->solver.get_stats().colors;
+				bodies = scene->world.body_count();
+			}
+		}
+
+		// and with sleeping, the whole step once they rest
+		auto scene = std::make_unique<Scene>();
+		build(*scene, pile);
+		for (uint32_t step = 0; step < SETTLE_STEPS; step++)
+			scene->world.step(scene->world.fixedTimestep);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t step = 0; step < TIMED_STEPS; step++)
+			scene->world.step(scene->world.fixedTimestep);
+		double stepMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / TIMED_STEPS;
+
+		fmt::print("{:>8} {:>8} {:>8} {:>8} {:>12.3f} {:>12.3f} {:>10.4f} {:>8} {:>14.3f}\n", pile ? "pile" : "stacks", bodies, islands, colors, solveMs[0],
+				   solveMs[1], drift, scene->solver.get_stats().bodiesAsleep, stepMs);
+	}
+}
@@ -7,12 +7,21 @@
 #include <fmt/core.h>
 #include <fmt/color.h>
 
+#include <cmath>
+
 #define WIDTH 1280
 #define HEIGHT 720
 
 PhysicsEngine::PhysicsEngine()
 {
 	fmt::print(fg(fmt::color::dark_salmon), "\n{}\n", "Physics Engine entry point.");
+
+	// contacts are found and solved every step, between the velocity and the position integration
+	world.constraintSolver = [this](float dt)
+	{
+		updateBroadphase();
+		solveContacts(dt);
+	};
 }
 
 bool PhysicsEngine::init()
@@ -147,17 +156,8 @@ int PhysicsEngine::MainWindow()
 		ImGui_ImplSDL3_NewFrame();
 		ImGui::NewFrame();
 
-		// 2. Show a simple window that we create ourselves. We use a Begin/End pair to create a named window.
-		{
-			static float f = 0.0f;
-			static int counter = 0;
-
-			ImGui::Begin("Hello, Physics Engine!"); // Create a window called "Hello, world!" and append into it.
-
-			ImGui::Text("Things to do with physics engine"); // Display some text (you can use a format strings too)
-			ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
-			ImGui::End();
-		}
+		// the simulation runs at its own fixed rate, the frame only feeds it time
+		drawWorldWindow(io.DeltaTime);
 
 		// Rendering
 		ImGui::Render();
@@ -190,6 +190,204 @@ int PhysicsEngine::MainWindow()
 	return 0;
 }
 
+// half extent of the box around a unit cube in any orientation, the spheres and capsules fit in it too
+static constexpr float BODY_BOUND = 0.87f;
+
+static constexpr float GROUND_HALF_WIDTH = 1000.f;
+
+void PhysicsEngine::addGround()
+{
+	RigidBodyDesc desc;
+	desc.position = glm::vec3(0.f, -0.5f, 0.f);
+	desc.mass = 0.f;
+
+	glm::vec3 halfExtents(GROUND_HALF_WIDTH, 0.5f, GROUND_HALF_WIDTH);
+	uint32_t id = world.add_body(desc).id;
+	uint32_t proxy = collision.add_proxy(Aabb{desc.position - halfExtents, desc.position + halfExtents}, id);
+
+	if (bodyProxies.size() <= id)
+		bodyProxies.resize(id + 1, ~0u);
+	bodyProxies[id] = proxy;
+
+	if (bodyShapes.size() <= id)
+		bodyShapes.resize(id + 1);
+	bodyShapes[id] = Shape::box(halfExtents);
+
+	groundAdded = true;
+}
+
+void PhysicsEngine::spawnBodies(uint32_t count)
+{
+	if (!groundAdded)
+		addGround();
+
+	std::vector<Aabb> aabbs(count);
+	std::vector<uint32_t> ids(count);
+	std::vector<uint32_t> proxies(count);
+	std::vector<Shape> shapes(count);
+
+	// boxes, spheres and capsules dropped over a square, tumbling a little
+	world.reserve(world.body_count() + count);
+	uint32_t side = (uint32_t)std::ceil(std::sqrt((float)count));
+	for (uint32_t i = 0; i < count; i++)
+	{
+		RigidBodyDesc desc;
+		desc.position = glm::vec3((float)(i % side) * 2.f, 20.f + (float)(i % 7), (float)(i / side) * 2.f);
+		desc.angularVelocity = glm::vec3(0.3f * (float)(i % 5), 0.5f, 0.2f * (float)(i % 3));
+
+		// unit mass, the capsule gets the inertia of the box around it
+		switch (i % 3)
+		{
+		case 0:
+			shapes[i] = Shape::box(glm::vec3(0.5f));
+			desc.inertia = glm::vec3(1.f / 6.f);
+			break;
+		case 1:
+			shapes[i] = Shape::sphere(0.5f);
+			desc.inertia = glm::vec3(0.1f);
+			break;
+		default:
+			shapes[i] = Shape::capsule(0.3f, 0.4f);
+			desc.inertia = glm::vec3(0.58f, 0.18f, 0.58f) / 3.f;
+			break;
+		}
+
+		ids[i] = world.add_body(desc).id;
+		aabbs[i] = Aabb{desc.position - BODY_BOUND, desc.position + BODY_BOUND};
+	}
+
+	collision.add_proxies(aabbs.data(), ids.data(), count, proxies.data());
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (bodyProxies.size() <= ids[i])
+			bodyProxies.resize(ids[i] + 1, ~0u);
+		bodyProxies[ids[i]] = proxies[i];
+
+		if (bodyShapes.size() <= ids[i])
+			bodyShapes.resize(ids[i] + 1);
+		bodyShapes[ids[i]] = shapes[i];
+	}
+}
+
+void PhysicsEngine::updateBroadphase()
+{
+	uint32_t count = world.body_count();
+	movedProxies.resize(count);
+	movedAabbs.resize(count);
+	displacements.resize(count);
+	bodyActive.resize(bodyShapes.size());
+
+	const float *px = world.stream(BodyStream::PositionX);
+	const float *py = world.stream(BodyStream::PositionY);
+	const float *pz = world.stream(BodyStream::PositionZ);
+	const float *vx = world.stream(BodyStream::LinearVelocityX);
+	const float *vy = world.stream(BodyStream::LinearVelocityY);
+	const float *vz = world.stream(BodyStream::LinearVelocityZ);
+	const float *inverseMass = world.stream(BodyStream::InverseMass);
+	const float *awake = world.stream(BodyStream::Awake);
+
+	// static and sleeping bodies do not move, their proxies stay where they are
+	uint32_t moved = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t id = world.handle(i).id;
+		bodyActive[id] = inverseMass[i] > 0.f && awake[i] > 0.f;
+		if (!bodyActive[id])
+			continue;
+
+		glm::vec3 position(px[i], py[i], pz[i]);
+		movedProxies[moved] = bodyProxies[id];
+		movedAabbs[moved] = Aabb{position - BODY_BOUND, position + BODY_BOUND};
+		displacements[moved] = glm::vec3(vx[i], vy[i], vz[i]) * world.fixedTimestep;
+		moved++;
+	}
+
+	collision.move_proxies(movedProxies.data(), movedAabbs.data(), displacements.data(), moved);
+	collision.update_pairs();
+}
+
+void PhysicsEngine::solveContacts(float dt)
+{
+	uint32_t count = world.body_count();
+	bodyTransforms.resize(bodyShapes.size());
+
+	const float *px = world.stream(BodyStream::PositionX);
+	const float *py = world.stream(BodyStream::PositionY);
+	const float *pz = world.stream(BodyStream::PositionZ);
+	const float *qx = world.stream(BodyStream::OrientationX);
+	const float *qy = world.stream(BodyStream::OrientationY);
+	const float *qz = world.stream(BodyStream::OrientationZ);
+	const float *qw = world.stream(BodyStream::OrientationW);
+
+	for (uint32_t i = 0; i < count; i++)
+		bodyTransforms[world.handle(i).id] = ShapeTransform{glm::vec3(px[i], py[i], pz[i]), glm::quat(qw[i], qx[i], qy[i], qz[i])};
+
+	solver.solve(world, collision.find_contacts(bodyShapes.data(), bodyTransforms.data(), bodyActive.data()), dt);
+}
+
+void PhysicsEngine::drawWorldWindow(float frameSeconds)
+{
+	world.advance(frameSeconds);
+
+	const RigidBodyWorldStats &stats = world.get_stats();
+	const BroadphaseStats &broadphase = collision.get_stats();
+	const NarrowphaseStats &narrowphase = collision.get_narrowphase_stats();
+	const ContactSolverStats &contacts = solver.get_stats();
+
+	ImGui::Begin("Physics Engine");
+
+	ImGui::SliderInt("bodies to spawn", &spawnCount, 1, 100000);
+	if (ImGui::Button("spawn"))
+		spawnBodies((uint32_t)spawnCount);
+	ImGui::SameLine();
+	if (ImGui::Button("clear"))
+	{
+		world.clear();
+		collision.clear();
+		bodyProxies.clear();
+		bodyShapes.clear();
+		solver.clear();
+		groundAdded = false;
+	}
+
+	ImGui::SliderFloat("gravity", &world.gravity.y, -30.f, 0.f, "%.2f");
+	ImGui::Checkbox("multithreaded", &world.multithreaded);
+
+	if (ImGui::BeginCombo("broadphase", broadphase_type_name(collision.broadphase())))
+	{
+		for (BroadphaseType type : {BroadphaseType::Tree, BroadphaseType::SweepAndPrune})
+		{
+			if (ImGui::Selectable(broadphase_type_name(type), type == collision.broadphase()))
+				collision.set_broadphase(type);
+		}
+		ImGui::EndCombo();
+	}
+	if (ImGui::Checkbox("avx2", &simd))
+	{
+		collision.set_simd(simd);
+		solver.simd = simd;
+	}
+	ImGui::Checkbox("split large islands", &solver.splitIslands);
+	ImGui::SameLine();
+	ImGui::Checkbox("sleep", &solver.sleepEnabled);
+
+	ImGui::Text("%u bodies, %u steps this frame at %.0f hz, alpha %.2f", world.body_count(), stats.steps, 1.f / world.fixedTimestep, world.interpolation_alpha());
+	ImGui::Text("step %.3f ms ( %.2f ns per body )", stats.stepMs, stats.bodies > 0 ? stats.stepMs * 1e6f / stats.bodies : 0.f);
+	ImGui::Text("%s %.3f ms, %u pairs, %u proxies reinserted", broadphase_type_name(broadphase.type), broadphase.updateMs, broadphase.pairs, broadphase.moved);
+	if (broadphase.type == BroadphaseType::Tree)
+		ImGui::Text("tree height %d, area ratio %.1f", broadphase.treeHeight, broadphase.areaRatio);
+	else
+		ImGui::Text("sweep axis %c, %s", "xyz"[broadphase.sweepAxis], broadphase.simd ? "avx2" : "scalar");
+	ImGui::Text("narrowphase %.3f ms, %u manifolds, %u points ( %u sphere pairs batched, %u through gjk )", narrowphase.collideMs, narrowphase.manifolds,
+				narrowphase.points, narrowphase.batchedSpheres, narrowphase.convexPairs);
+	ImGui::Text("solver %.3f ms, %u constraints, %u islands ( %u asleep, %u split in %u colors ), %u bodies asleep", contacts.solveMs, contacts.constraints,
+				contacts.islands, contacts.sleepingIslands, contacts.splitIslands, contacts.colors, contacts.bodiesAsleep);
+	ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+
+	ImGui::End();
+}
+
 void PhysicsEngine::run()
 {
 	if(this->init())
@@ -0,0 +1,480 @@
+#include "physics_engine/rigid_body_world.h"
+
+#include "core/job_system.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+// Third party
+
+#include <fmt/core.h>
+#include <fmt/color.h>
+
+// The kernels take every stream as its own restrict parameter, compilers ignore restrict on local
+// pointers and would not vectorize the loops behind a pile of runtime alias checks.
+namespace
+{
+	void integrate_linear_velocity(uint32_t begin, uint32_t end, float dt, float gravity, float *__restrict v, float *__restrict force,
+								   const float *__restrict inverseMass, const float *__restrict damping, const float *__restrict awake)
+	{
+		for (uint32_t i = begin; i < end; i++)
+		{
+			// static bodies have no inverse mass and no gravity
+			float gravityScale = inverseMass[i] > 0.f ? 1.f : 0.f;
+
+			// implicit damping, stays stable for any damping * dt
+			v[i] = awake[i] * (v[i] + gravity * gravityScale + force[i] * inverseMass[i] * dt) / (1.f + dt * damping[i]);
+			force[i] = 0.f;
+		}
+	}
+
+	void integrate_angular_velocity(uint32_t begin, uint32_t end, float dt, float *__restrict wx, float *__restrict wy, float *__restrict wz,
+									float *__restrict tx, float *__restrict ty, float *__restrict tz,
+									const float *__restrict ixx, const float *__restrict iyy, const float *__restrict izz,
+									const float *__restrict ixy, const float *__restrict ixz, const float *__restrict iyz,
+									const float *__restrict damping, const float *__restrict awake)
+	{
+		for (uint32_t i = begin; i < end; i++)
+		{
+			float keep = awake[i] / (1.f + dt * damping[i]);
+			float scale = dt * keep;
+			wx[i] = wx[i] * keep + (ixx[i] * tx[i] + ixy[i] * ty[i] + ixz[i] * tz[i]) * scale;
+			wy[i] = wy[i] * keep + (ixy[i] * tx[i] + iyy[i] * ty[i] + iyz[i] * tz[i]) * scale;
+			wz[i] = wz[i] * keep + (ixz[i] * tx[i] + iyz[i] * ty[i] + izz[i] * tz[i]) * scale;
+			tx[i] = ty[i] = tz[i] = 0.f;
+		}
+	}
+
+	void integrate_position(uint32_t begin, uint32_t end, float dt, float *__restrict p, const float *__restrict v)
+	{
+		for (uint32_t i = begin; i < end; i++)
+			p[i] += v[i] * dt;
+	}
+
+	void integrate_orientation(uint32_t begin, uint32_t end, float dt, float *__restrict qx, float *__restrict qy, float *__restrict qz,
+							   float *__restrict qw, const float *__restrict wx, const float *__restrict wy, const float *__restrict wz)
+	{
+		float halfDt = 0.5f * dt;
+
+		for (uint32_t i = begin; i < end; i++)
+		{
+			// q += 0.5 * dt * ( w, 0 ) * q, then back onto the unit sphere
+			float x = qx[i], y = qy[i], z = qz[i], w = qw[i];
+			float nx = x + halfDt * (wx[i] * w + wy[i] * z - wz[i] * y);
+			float ny = y + halfDt * (wy[i] * w + wz[i] * x - wx[i] * z);
+			float nz = z + halfDt * (wz[i] * w + wx[i] * y - wy[i] * x);
+			float nw = w - halfDt * (wx[i] * x + wy[i] * y + wz[i] * z);
+
+			float invLength = 1.f / std::sqrt(nx * nx + ny * ny + nz * nz + nw * nw);
+			qx[i] = nx * invLength;
+			qy[i] = ny * invLength;
+			qz[i] = nz * invLength;
+			qw[i] = nw * invLength;
+		}
+	}
+
+	// R * diag( inverse inertia ) * R^T, only the upper half since it is symmetric
+	void world_inverse_inertia(uint32_t begin, uint32_t end, const float *__restrict qx, const float *__restrict qy, const float *__restrict qz,
+							   const float *__restrict qw, const float *__restrict ix, const float *__restrict iy, const float *__restrict iz,
+							   float *__restrict ixx, float *__restrict iyy, float *__restrict izz,
+							   float *__restrict ixy, float *__restrict ixz, float *__restrict iyz)
+	{
+		for (uint32_t i = begin; i < end; i++)
+		{
+			float x = qx[i], y = qy[i], z = qz[i], w = qw[i];
+
+			// rows of the rotation matrix
+			float r00 = 1.f - 2.f * (y * y + z * z), r01 = 2.f * (x * y - w * z), r02 = 2.f * (x * z + w * y);
+			float r10 = 2.f * (x * y + w * z), r11 = 1.f - 2.f * (x * x + z * z), r12 = 2.f * (y * z - w * x);
+			float r20 = 2.f * (x * z - w * y), r21 = 2.f * (y * z + w * x), r22 = 1.f - 2.f * (x * x + y * y);
+
+			ixx[i] = r00 * r00 * ix[i] + r01 * r01 * iy[i] + r02 * r02 * iz[i];
+			iyy[i] = r10 * r10 * ix[i] + r11 * r11 * iy[i] + r12 * r12 * iz[i];
+			izz[i] = r20 * r20 * ix[i] + r21 * r21 * iy[i] + r22 * r22 * iz[i];
+			ixy[i] = r00 * r10 * ix[i] + r01 * r11 * iy[i] + r02 * r12 * iz[i];
+			ixz[i] = r00 * r20 * ix[i] + r01 * r21 * iy[i] + r02 * r22 * iz[i];
+			iyz[i] = r10 * r20 * ix[i] + r11 * r21 * iy[i] + r12 * r22 * iz[i];
+		}
+	}
+}
+
+template <typename F>
+void RigidBodyWorld::for_each_range(F &&function)
+{
+	uint32_t count = body_count();
+	if (multithreaded)
+		JobSystem::Get().parallel_for(count, grainSize, function);
+	else
+		function(0u, count);
+}
+
+BodyHandle RigidBodyWorld::add_body(const RigidBodyDesc &desc)
+{
+	uint32_t id;
+	if (!freeIds.empty())
+	{
+		id = freeIds.back();
+		freeIds.pop_back();
+	}
+	else
+	{
+		id = (uint32_t)denseIndex.size();
+		denseIndex.push_back(~0u);
+		if (generations.size() <= id)
+			generations.push_back(0);
+	}
+
+	uint32_t index = body_count();
+	denseIndex[id] = index;
+	bodyIds.push_back(id);
+
+	for (std::vector<float> &values : streams)
+		values.push_back(0.f);
+
+	bool dynamic = desc.mass > 0.f;
+	stream(BodyStream::InverseMass)[index] = dynamic ? 1.f / desc.mass : 0.f;
+	stream(BodyStream::InverseInertiaX)[index] = dynamic && desc.inertia.x > 0.f ? 1.f / desc.inertia.x : 0.f;
+	stream(BodyStream::InverseInertiaY)[index] = dynamic && desc.inertia.y > 0.f ? 1.f / desc.inertia.y : 0.f;
+	stream(BodyStream::InverseInertiaZ)[index] = dynamic && desc.inertia.z > 0.f ? 1.f / desc.inertia.z : 0.f;
+	stream(BodyStream::LinearDamping)[index] = desc.linearDamping;
+	stream(BodyStream::AngularDamping)[index] = desc.angularDamping;
+	stream(BodyStream::Awake)[index] = 1.f;
+
+	BodyHandle body{id, generations[id]};
+	set_transform(body, desc.position, desc.orientation);
+	set_velocity(body, desc.linearVelocity, desc.angularVelocity);
+
+	return body;
+}
+
+void RigidBodyWorld::remove_body(BodyHandle body)
+{
+	if (!contains(body))
+		return;
+
+	// the last body takes the place of the removed one
+	uint32_t index = denseIndex[body.id];
+	uint32_t last = body_count() - 1;
+
+	for (std::vector<float> &values : streams)
+	{
+		values[index] = values[last];
+		values.pop_back();
+	}
+
+	bodyIds[index] = bodyIds[last];
+	denseIndex[bodyIds[index]] = index;
+	bodyIds.pop_back();
+
+	denseIndex[body.id] = ~0u;
+	generations[body.id]++;
+	freeIds.push_back(body.id);
+}
+
+void RigidBodyWorld::clear()
+{
+	for (std::vector<float> &values : streams)
+		values.clear();
+
+	// the generations outlive the bodies, handles from before the clear stay stale once their id is reused
+	for (uint32_t id = 0; id < denseIndex.size(); id++)
+	{
+		if (denseIndex[id] != ~0u)
+			generations[id]++;
+	}
+
+	bodyIds.clear();
+	denseIndex.clear();
+	freeIds.clear();
+	accumulator = 0.f;
+}
+
+void RigidBodyWorld::reserve(uint32_t count)
+{
+	for (std::vector<float> &values : streams)
+		values.reserve(count);
+
+	bodyIds.reserve(count);
+	denseIndex.reserve(count);
+	generations.reserve(count);
+}
+
+glm::vec3 RigidBodyWorld::position(BodyHandle body) const
+{
+	uint32_t i = index(body);
+	return glm::vec3(stream(BodyStream::PositionX)[i], stream(BodyStream::PositionY)[i], stream(BodyStream::PositionZ)[i]);
+}
+
+glm::quat RigidBodyWorld::orientation(BodyHandle body) const
+{
+	uint32_t i = index(body);
+	return glm::quat(stream(BodyStream::OrientationW)[i], stream(BodyStream::OrientationX)[i], stream(BodyStream::OrientationY)[i],
+					 stream(BodyStream::OrientationZ)[i]);
+}
+
+glm::vec3 RigidBodyWorld::linear_velocity(BodyHandle body) const
+{
+	uint32_t i = index(body);
+	return glm::vec3(stream(BodyStream::LinearVelocityX)[i], stream(BodyStream::LinearVelocityY)[i], stream(BodyStream::LinearVelocityZ)[i]);
+}
+
+glm::vec3 RigidBodyWorld::angular_velocity(BodyHandle body) const
+{
+	uint32_t i = index(body);
+	return glm::vec3(stream(BodyStream::AngularVelocityX)[i], stream(BodyStream::AngularVelocityY)[i], stream(BodyStream::AngularVelocityZ)[i]);
+}
+
+void RigidBodyWorld::set_transform(BodyHandle body, const glm::vec3 &position, const glm::quat &orientation)
+{
+	uint32_t i = index(body);
+	glm::quat q = glm::normalize(orientation);
+
+	stream(BodyStream::PositionX)[i] = stream(BodyStream::PreviousPositionX)[i] = position.x;
+	stream(BodyStream::PositionY)[i] = stream(BodyStream::PreviousPositionY)[i] = position.y;
+	stream(BodyStream::PositionZ)[i] = stream(BodyStream::PreviousPositionZ)[i] = position.z;
+	stream(BodyStream::OrientationX)[i] = stream(BodyStream::PreviousOrientationX)[i] = q.x;
+	stream(BodyStream::OrientationY)[i] = stream(BodyStream::PreviousOrientationY)[i] = q.y;
+	stream(BodyStream::OrientationZ)[i] = stream(BodyStream::PreviousOrientationZ)[i] = q.z;
+	stream(BodyStream::OrientationW)[i] = stream(BodyStream::PreviousOrientationW)[i] = q.w;
+
+	update_inertia(i, i + 1);
+}
+
+void RigidBodyWorld::set_velocity(BodyHandle body, const glm::vec3 &linear, const glm::vec3 &angular)
+{
+	uint32_t i = index(body);
+	stream(BodyStream::LinearVelocityX)[i] = linear.x;
+	stream(BodyStream::LinearVelocityY)[i] = linear.y;
+	stream(BodyStream::LinearVelocityZ)[i] = linear.z;
+	stream(BodyStream::AngularVelocityX)[i] = angular.x;
+	stream(BodyStream::AngularVelocityY)[i] = angular.y;
+	stream(BodyStream::AngularVelocityZ)[i] = angular.z;
+	wake(i);
+}
+
+void RigidBodyWorld::set_awake(BodyHandle body, bool awake)
+{
+	uint32_t i = index(body);
+	if (awake)
+	{
+		wake(i);
+		return;
+	}
+
+	// put to sleep at rest, so it wakes up still
+	for (BodyStream velocity : {BodyStream::LinearVelocityX, BodyStream::LinearVelocityY, BodyStream::LinearVelocityZ,
+								BodyStream::AngularVelocityX, BodyStream::AngularVelocityY, BodyStream::AngularVelocityZ})
+		stream(velocity)[i] = 0.f;
+	stream(BodyStream::Awake)[i] = 0.f;
+}
+
+void RigidBodyWorld::apply_force(BodyHandle body, const glm::vec3 &force)
+{
+	uint32_t i = index(body);
+	stream(BodyStream::ForceX)[i] += force.x;
+	stream(BodyStream::ForceY)[i] += force.y;
+	stream(BodyStream::ForceZ)[i] += force.z;
+	wake(i);
+}
+
+void RigidBodyWorld::apply_torque(BodyHandle body, const glm::vec3 &torque)
+{
+	uint32_t i = index(body);
+	stream(BodyStream::TorqueX)[i] += torque.x;
+	stream(BodyStream::TorqueY)[i] += torque.y;
+	stream(BodyStream::TorqueZ)[i] += torque.z;
+	wake(i);
+}
+
+void RigidBodyWorld::apply_impulse(BodyHandle body, const glm::vec3 &impulse, const glm::vec3 &point)
+{
+	uint32_t i = index(body);
+	float inverseMass = stream(BodyStream::InverseMass)[i];
+	if (inverseMass == 0.f)
+		return;
+
+	glm::vec3 linear = linear_velocity(body) + impulse * inverseMass;
+
+	const float *inertia[6] = {stream(BodyStream::InverseInertiaWorldXX), stream(BodyStream::InverseInertiaWorldYY), stream(BodyStream::InverseInertiaWorldZZ),
+							   stream(BodyStream::InverseInertiaWorldXY), stream(BodyStream::InverseInertiaWorldXZ), stream(BodyStream::InverseInertiaWorldYZ)};
+	glm::vec3 torque = glm::cross(point - position(body), impulse);
+	glm::vec3 angular = angular_velocity(body) + glm::vec3(inertia[0][i] * torque.x + inertia[3][i] * torque.y + inertia[4][i] * torque.z,
+														   inertia[3][i] * torque.x + inertia[1][i] * torque.y + inertia[5][i] * torque.z,
+														   inertia[4][i] * torque.x + inertia[5][i] * torque.y + inertia[2][i] * torque.z);
+
+	set_velocity(body, linear, angular);
+}
+
+void RigidBodyWorld::save_previous_state(uint32_t begin, uint32_t end)
+{
+	static constexpr BodyStream current[7] = {BodyStream::PositionX, BodyStream::PositionY, BodyStream::PositionZ,
+											  BodyStream::OrientationX, BodyStream::OrientationY, BodyStream::OrientationZ, BodyStream::OrientationW};
+	static constexpr BodyStream previous[7] = {BodyStream::PreviousPositionX, BodyStream::PreviousPositionY, BodyStream::PreviousPositionZ,
+											   BodyStream::PreviousOrientationX, BodyStream::PreviousOrientationY, BodyStream::PreviousOrientationZ,
+											   BodyStream::PreviousOrientationW};
+
+	for (int s = 0; s < 7; s++)
+		memcpy(stream(previous[s]) + begin, stream(current[s]) + begin, (end - begin) * sizeof(float));
+}
+
+void RigidBodyWorld::integrate_velocities(uint32_t begin, uint32_t end, float dt)
+{
+	const float *inverseMass = stream(BodyStream::InverseMass);
+	const float *linearDamping = stream(BodyStream::LinearDamping);
+	const float *awake = stream(BodyStream::Awake);
+
+	integrate_linear_velocity(begin, end, dt, gravity.x * dt, stream(BodyStream::LinearVelocityX), stream(BodyStream::ForceX), inverseMass, linearDamping, awake);
+	integrate_linear_velocity(begin, end, dt, gravity.y * dt, stream(BodyStream::LinearVelocityY), stream(BodyStream::ForceY), inverseMass, linearDamping, awake);
+	integrate_linear_velocity(begin, end, dt, gravity.z * dt, stream(BodyStream::LinearVelocityZ), stream(BodyStream::ForceZ), inverseMass, linearDamping, awake);
+
+	integrate_angular_velocity(begin, end, dt, stream(BodyStream::AngularVelocityX), stream(BodyStream::AngularVelocityY), stream(BodyStream::AngularVelocityZ),
+							   stream(BodyStream::TorqueX), stream(BodyStream::TorqueY), stream(BodyStream::TorqueZ),
+							   stream(BodyStream::InverseInertiaWorldXX), stream(BodyStream::InverseInertiaWorldYY), stream(BodyStream::InverseInertiaWorldZZ),
+							   stream(BodyStream::InverseInertiaWorldXY), stream(BodyStream::InverseInertiaWorldXZ), stream(BodyStream::InverseInertiaWorldYZ),
+							   stream(BodyStream::AngularDamping), awake);
+}
+
+void RigidBodyWorld::integrate_positions(uint32_t begin, uint32_t end, float dt)
+{
+	integrate_position(begin, end, dt, stream(BodyStream::PositionX), stream(BodyStream::LinearVelocityX));
+	integrate_position(begin, end, dt, stream(BodyStream::PositionY), stream(BodyStream::LinearVelocityY));
+	integrate_position(begin, end, dt, stream(BodyStream::PositionZ), stream(BodyStream::LinearVelocityZ));
+
+	integrate_orientation(begin, end, dt, stream(BodyStream::OrientationX), stream(BodyStream::OrientationY), stream(BodyStream::OrientationZ),
+						  stream(BodyStream::OrientationW), stream(BodyStream::AngularVelocityX), stream(BodyStream::AngularVelocityY),
+						  stream(BodyStream::AngularVelocityZ));
+}
+
+void RigidBodyWorld::update_inertia(uint32_t begin, uint32_t end)
+{
+	world_inverse_inertia(begin, end, stream(BodyStream::OrientationX), stream(BodyStream::OrientationY), stream(BodyStream::OrientationZ),
+						  stream(BodyStream::OrientationW), stream(BodyStream::InverseInertiaX), stream(BodyStream::InverseInertiaY),
+						  stream(BodyStream::InverseInertiaZ), stream(BodyStream::InverseInertiaWorldXX), stream(BodyStream::InverseInertiaWorldYY),
+						  stream(BodyStream::InverseInertiaWorldZZ), stream(BodyStream::InverseInertiaWorldXY), stream(BodyStream::InverseInertiaWorldXZ),
+						  stream(BodyStream::InverseInertiaWorldYZ));
+}
+
+uint32_t RigidBodyWorld::advance(float frameSeconds)
+{
+	accumulator += frameSeconds;
+
+	uint32_t steps = 0;
+	while (accumulator >= fixedTimestep && steps < maxStepsPerAdvance)
+	{
+		step(fixedTimestep);
+		accumulator -= fixedTimestep;
+		steps++;
+	}
+
+	// could not keep up, the simulation runs slower than real time instead of spiraling
+	if (accumulator >= fixedTimestep)
+		accumulator = fmodf(accumulator, fixedTimestep);
+
+	stats.steps = steps;
+	return steps;
+}
+
+void RigidBodyWorld::step(float dt)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	if (constraintSolver)
+	{
+		// two passes with the solver between them
+		for_each_range([this, dt](uint32_t begin, uint32_t end)
+					   {
+			save_previous_state(begin, end);
+			integrate_velocities(begin, end, dt); });
+
+		constraintSolver(dt);
+
+		for_each_range([this, dt](uint32_t begin, uint32_t end)
+					   {
+			integrate_positions(begin, end, dt);
+			update_inertia(begin, end); });
+	}
+	else
+	{
+		for_each_range([this, dt](uint32_t begin, uint32_t end)
+					   {
+			save_previous_state(begin, end);
+			integrate_velocities(begin, end, dt);
+			integrate_positions(begin, end, dt);
+			update_inertia(begin, end); });
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	stats.stepMs = std::chrono::duration<float, std::milli>(end - start).count();
+	stats.bodies = body_count();
+}
+
+glm::vec3 RigidBodyWorld::interpolated_position(BodyHandle body) const
+{
+	uint32_t i = index(body);
+	glm::vec3 previous(stream(BodyStream::PreviousPositionX)[i], stream(BodyStream::PreviousPositionY)[i], stream(BodyStream::PreviousPositionZ)[i]);
+	return previous + (position(body) - previous) * interpolation_alpha();
+}
+
+glm::quat RigidBodyWorld::interpolated_orientation(BodyHandle body) const
+{
+	uint32_t i = index(body);
+	glm::quat previous(stream(BodyStream::PreviousOrientationW)[i], stream(BodyStream::PreviousOrientationX)[i], stream(BodyStream::PreviousOrientationY)[i],
+					   stream(BodyStream::PreviousOrientationZ)[i]);
+	glm::quat current = orientation(body);
+
+	// nlerp along the shorter arc, steps are small enough for it to be close to slerp
+	float alpha = interpolation_alpha();
+	if (glm::dot(previous, current) < 0.f)
+		current = current * -1.f;
+	return glm::normalize(previous * (1.f - alpha) + current * alpha);
+}
+
+void run_physics_benchmark()
+{
+	constexpr uint32_t STEPS = 100;
+	constexpr uint32_t BODY_COUNTS[] = {10000, 100000};
+
+	fmt::print(fg(fmt::color::bisque), "\nRigid body integration benchmark ( {} steps, {} threads )\n", STEPS, JobSystem::Get().thread_count());
+	fmt::print("{:>8} {:>8} {:>12} {:>16}\n", "bodies", "threads", "ms/step", "ns/body/step");
+
+	for (uint32_t bodyCount : BODY_COUNTS)
+	{
+		RigidBodyWorld world;
+		world.reserve(bodyCount);
+
+		// deterministic spread of tumbling boxes
+		uint32_t seed = 1;
+		auto random = [&seed]()
+		{
+			seed = seed * 1664525u + 1013904223u;
+			return (seed >> 8) / 16777216.f;
+		};
+
+		for (uint32_t i = 0; i < bodyCount; i++)
+		{
+			RigidBodyDesc desc;
+			desc.position = glm::vec3(random() * 1000.f, random() * 100.f, random() * 1000.f);
+			desc.linearVelocity = glm::vec3(random() - 0.5f, random() * 10.f, random() - 0.5f);
+			desc.angularVelocity = glm::vec3(random() * 4.f - 2.f, random() * 4.f - 2.f, random() * 4.f - 2.f);
+			desc.mass = 1.f + random();
+			desc.inertia = glm::vec3(0.5f + random(), 0.5f + random(), 0.5f + random());
+			world.add_body(desc);
+		}
+
+		for (bool multithreaded : {false, true})
+		{
+			world.multithreaded = multithreaded;
+			world.step(world.fixedTimestep); // warm up
+
+			auto start = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < STEPS; i++)
+				world.step(world.fixedTimestep);
+			auto end = std::chrono::high_resolution_clock::now();
+
+			double ms = std::chrono::duration<double, std::milli>(end - start).count() / STEPS;
+			fmt::print("{:>8} {:>8} {:>12.3f} {:>16.2f}\n", bodyCount, multithreaded ? JobSystem::Get().thread_count() : 1, ms,
+					   ms * 1e6 / bodyCount);
+		}
+	}
+}
@@ -0,0 +1,50 @@
+#include "render_engine/alloc_counter.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    std::atomic<uint64_t> allocationCount{0};
+
+    void *allocate(std::size_t size, std::size_t alignment)
+    {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+        if (size == 0)
+            size = 1;
+
+        void *p = alignment > alignof(std::max_align_t) ? std::aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1)) : std::malloc(size);
+        if (p == nullptr)
+            throw std::bad_alloc();
+        return p;
+    }
+}
+
+uint64_t heap_allocation_count()
+{
+    return allocationCount.load(std::memory_order_relaxed);
+}
+
+// the array and nothrow forms of the standard library forward to these
+void *operator new(std::size_t size)
+{
+    return allocate(size, alignof(std::max_align_t));
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    return allocate(size, (std::size_t)alignment);
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
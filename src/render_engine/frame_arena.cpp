@@ -0,0 +1,66 @@
+#include "render_engine/frame_arena.h"
+
+#include <algorithm>
+#include <bit>
+#include <new>
+
+FrameArena::~FrameArena()
+{
+    destroy();
+}
+
+void FrameArena::init(size_t capacity)
+{
+    destroy();
+
+    _capacity = std::bit_ceil(std::max<size_t>(capacity, 4096));
+    _block = static_cast<std::byte *>(::operator new(_capacity, std::align_val_t{alignof(std::max_align_t)}));
+    _linear.emplace(_block, _capacity, &_overflow);
+}
+
+void FrameArena::destroy()
+{
+    if (!_linear)
+        return;
+
+    _linear.reset();
+
+    ::operator delete(_block, std::align_val_t{alignof(std::max_align_t)});
+    _block = nullptr;
+    _capacity = 0;
+    _used = 0;
+}
+
+void FrameArena::reset()
+{
+    _highWater = std::max(_highWater, _used);
+
+    // the frame did not fit, grow once instead of going to the heap every frame from now on
+    if (_overflow.count > 0)
+    {
+        _overflowCount += _overflow.count;
+        _overflow.count = 0;
+        init(_highWater * 2);
+        return;
+    }
+
+    _linear->release();
+    _used = 0;
+}
+
+void *FrameArena::do_allocate(size_t bytes, size_t alignment)
+{
+    _used += bytes;
+    return _linear->allocate(bytes, alignment);
+}
+
+void *FrameArena::Overflow::do_allocate(size_t bytes, size_t alignment)
+{
+    count++;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+void FrameArena::Overflow::do_deallocate(void *p, size_t bytes, size_t alignment)
+{
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+}
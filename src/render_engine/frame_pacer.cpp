@@ -0,0 +1,55 @@
+#include "render_engine/frame_pacer.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace
+{
+    constexpr std::chrono::microseconds MIN_MARGIN{50};
+    constexpr std::chrono::microseconds MAX_MARGIN{4000};
+}
+
+void FramePacer::set_target_fps(float fps)
+{
+    _targetFps = std::max(fps, 0.f);
+    _period = _targetFps > 0.f ? std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / _targetFps)) : clock::duration::zero();
+    _next = clock::time_point{};
+}
+
+float FramePacer::wait()
+{
+    if (_period == clock::duration::zero())
+        return 0.f;
+
+    clock::time_point start = clock::now();
+
+    // first frame, or so late that catching up would only produce a burst of frames
+    if (_next == clock::time_point{} || start > _next + _period)
+        _next = start;
+
+    while (true)
+    {
+        clock::time_point now = clock::now();
+        clock::duration remaining = _next - now;
+        if (remaining <= _margin)
+            break;
+
+        clock::duration request = remaining - _margin;
+        std::this_thread::sleep_for(request);
+
+        // grow right away when a sleep overshoots, shrink slowly so one quiet period does not cause misses
+        clock::duration overslept = clock::now() - (now + request);
+        if (overslept > _margin)
+            _margin = std::min<clock::duration>(overslept, MAX_MARGIN);
+        else
+            _margin = std::max<clock::duration>(_margin - (_margin - overslept) / 16, MIN_MARGIN);
+    }
+
+    while (clock::now() < _next)
+        std::this_thread::yield();
+
+    clock::time_point end = clock::now();
+    _next += _period;
+
+    return std::chrono::duration<float, std::milli>(end - start).count();
+}
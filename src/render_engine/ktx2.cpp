@@ -0,0 +1,261 @@
+#include "render_engine/ktx2.h"
+
+#include "render_engine/vk_images.h"
+
+#include "core/file_io.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+namespace
+{
+    const uint8_t KTX2_IDENTIFIER[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+    // identifier, 9 header fields, then the offsets and sizes of the dfd, kvd and sgd sections
+    constexpr size_t HEADER_SIZE = 12 + 9 * 4 + 4 * 4 + 2 * 8;
+    constexpr size_t LEVEL_INDEX_ENTRY_SIZE = 3 * 8;
+
+    // khr_df.h values the writer needs
+    constexpr uint8_t KHR_DF_MODEL_RGBSDA = 1;
+    constexpr uint8_t KHR_DF_MODEL_BC5 = 132;
+    constexpr uint8_t KHR_DF_MODEL_BC7 = 134;
+    constexpr uint8_t KHR_DF_PRIMARIES_BT709 = 1;
+    constexpr uint8_t KHR_DF_TRANSFER_LINEAR = 1;
+    constexpr uint8_t KHR_DF_TRANSFER_SRGB = 2;
+
+    void put_u8(std::vector<uint8_t> &out, uint8_t value)
+    {
+        out.push_back(value);
+    }
+
+    void put_u16(std::vector<uint8_t> &out, uint16_t value)
+    {
+        out.push_back(uint8_t(value));
+        out.push_back(uint8_t(value >> 8));
+    }
+
+    void put_u32(std::vector<uint8_t> &out, uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            out.push_back(uint8_t(value >> (i * 8)));
+    }
+
+    void put_u64(std::vector<uint8_t> &out, uint64_t value)
+    {
+        for (int i = 0; i < 8; i++)
+            out.push_back(uint8_t(value >> (i * 8)));
+    }
+
+    uint32_t get_u32(const uint8_t *data)
+    {
+        return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+    }
+
+    uint64_t get_u64(const uint8_t *data)
+    {
+        return get_u32(data) | ((uint64_t)get_u32(data + 4) << 32);
+    }
+
+    struct DfdSample
+    {
+        uint16_t bitOffset;
+        uint8_t bitLength;
+        uint8_t channel;
+        uint32_t upper;
+    };
+
+    // basic data format descriptor, loaders that go by it instead of vkFormat need it to be right
+    bool write_dfd(std::vector<uint8_t> &out, VkFormat format)
+    {
+        uint8_t model;
+        uint8_t transfer = KHR_DF_TRANSFER_LINEAR;
+        uint8_t blockDimension;
+        uint8_t bytesPlane0;
+        std::vector<DfdSample> samples;
+
+        switch (format)
+        {
+        case VK_FORMAT_BC7_SRGB_BLOCK:
+            transfer = KHR_DF_TRANSFER_SRGB;
+            [[fallthrough]];
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+            model = KHR_DF_MODEL_BC7;
+            blockDimension = 3;
+            bytesPlane0 = 16;
+            samples = {{0, 127, 0, 0xFFFFFFFFu}};
+            break;
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+            model = KHR_DF_MODEL_BC5;
+            blockDimension = 3;
+            bytesPlane0 = 16;
+            samples = {{0, 63, 0, 0xFFFFFFFFu}, {64, 63, 1, 0xFFFFFFFFu}};
+            break;
+        case VK_FORMAT_R8G8B8A8_SRGB:
+            transfer = KHR_DF_TRANSFER_SRGB;
+            [[fallthrough]];
+        case VK_FORMAT_R8G8B8A8_UNORM:
+            model = KHR_DF_MODEL_RGBSDA;
+            blockDimension = 0;
+            bytesPlane0 = 4;
+            samples = {{0, 7, 0, 255}, {8, 7, 1, 255}, {16, 7, 2, 255}, {24, 7, 15, 255}};
+            break;
+        default:
+            return false;
+        }
+
+        uint16_t blockSize = uint16_t(24 + 16 * samples.size());
+
+        put_u32(out, 4 + blockSize);
+        put_u32(out, 0); // khronos vendor, basic descriptor type
+        put_u16(out, 2); // version 1.3
+        put_u16(out, blockSize);
+        put_u8(out, model);
+        put_u8(out, KHR_DF_PRIMARIES_BT709);
+        put_u8(out, transfer);
+        put_u8(out, 0); // straight alpha
+
+        for (int i = 0; i < 4; i++)
+            put_u8(out, i < 2 ? blockDimension : 0);
+        for (int i = 0; i < 8; i++)
+            put_u8(out, i == 0 ? bytesPlane0 : 0);
+
+        for (const DfdSample &sample : samples)
+        {
+            put_u16(out, sample.bitOffset);
+            put_u8(out, sample.bitLength);
+            put_u8(out, sample.channel);
+            put_u32(out, 0); // sample position
+            put_u32(out, 0);
+            put_u32(out, sample.upper);
+        }
+
+        return true;
+    }
+}
+
+bool write_ktx2(const std::string &path, VkFormat format, VkExtent2D extent, const std::vector<std::vector<uint8_t>> &levels)
+{
+    std::vector<uint8_t> dfd;
+    if (levels.empty() || !write_dfd(dfd, format))
+        return false;
+
+    uint32_t levelCount = (uint32_t)levels.size();
+    for (uint32_t level = 0; level < levelCount; level++)
+    {
+        if (levels[level].size() != vkutil::image_level_size(format, extent, level))
+            return false;
+    }
+
+    // levels are stored from the smallest up, each aligned to lcm(texel block size, 4)
+    size_t alignment = std::lcm(vkutil::image_level_size(format, VkExtent2D{1, 1}), size_t(4));
+    size_t dfdOffset = HEADER_SIZE + LEVEL_INDEX_ENTRY_SIZE * levelCount;
+
+    std::vector<uint64_t> levelOffsets(levelCount);
+    size_t position = dfdOffset + dfd.size();
+    for (uint32_t level = levelCount; level-- > 0;)
+    {
+        position = (position + alignment - 1) & ~(alignment - 1);
+        levelOffsets[level] = position;
+        position += levels[level].size();
+    }
+
+    std::vector<uint8_t> header;
+    header.reserve(dfdOffset);
+    header.insert(header.end(), KTX2_IDENTIFIER, KTX2_IDENTIFIER + 12);
+
+    put_u32(header, format);
+    put_u32(header, 1); // typeSize, 1 for block compressed and 8 bit formats
+    put_u32(header, extent.width);
+    put_u32(header, extent.height);
+    put_u32(header, 0); // pixelDepth
+    put_u32(header, 0); // layerCount
+    put_u32(header, 1); // faceCount
+    put_u32(header, levelCount);
+    put_u32(header, 0); // no supercompression
+
+    put_u32(header, (uint32_t)dfdOffset);
+    put_u32(header, (uint32_t)dfd.size());
+    put_u32(header, 0); // no key/value data
+    put_u32(header, 0);
+    put_u64(header, 0); // no supercompression global data
+    put_u64(header, 0);
+
+    for (uint32_t level = 0; level < levelCount; level++)
+    {
+        put_u64(header, levelOffsets[level]);
+        put_u64(header, levels[level].size());
+        put_u64(header, levels[level].size());
+    }
+
+    // the padding between the levels stays zero
+    std::vector<uint8_t> file(position, 0);
+    memcpy(file.data(), header.data(), header.size());
+    memcpy(file.data() + dfdOffset, dfd.data(), dfd.size());
+    for (uint32_t level = 0; level < levelCount; level++)
+        memcpy(file.data() + levelOffsets[level], levels[level].data(), levels[level].size());
+
+    return write_file_atomically(path, file.data(), file.size());
+}
+
+std::unique_ptr<Ktx2TextureSource> Ktx2TextureSource::open(const std::string &path)
+{
+    std::unique_ptr<Ktx2TextureSource> source = std::make_unique<Ktx2TextureSource>();
+
+    source->_file.open(path, std::ios::binary);
+    if (!source->_file.is_open())
+        return nullptr;
+
+    uint8_t header[HEADER_SIZE];
+    if (!source->_file.read((char *)header, HEADER_SIZE) || memcmp(header, KTX2_IDENTIFIER, 12) != 0)
+    {
+        fmt::print("{} is not a ktx2 file\n", path);
+        return nullptr;
+    }
+
+    VkFormat format = (VkFormat)get_u32(header + 12);
+    uint32_t width = get_u32(header + 20);
+    uint32_t height = get_u32(header + 24);
+    uint32_t depth = get_u32(header + 28);
+    uint32_t layers = get_u32(header + 32);
+    uint32_t faces = get_u32(header + 36);
+    uint32_t levelCount = std::max(get_u32(header + 40), 1u);
+    uint32_t supercompression = get_u32(header + 44);
+
+    VkExtent2D extent = {width, height};
+    if (width == 0 || height == 0 || depth > 1 || layers > 1 || faces != 1 || supercompression != 0 ||
+        vkutil::image_level_size(format, extent) == 0)
+    {
+        fmt::print("{} is not a plain 2d texture in a format the engine uploads ( vkFormat {} )\n", path, (uint32_t)format);
+        return nullptr;
+    }
+
+    std::vector<uint8_t> index(LEVEL_INDEX_ENTRY_SIZE * levelCount);
+    if (!source->_file.read((char *)index.data(), index.size()))
+        return nullptr;
+
+    source->_levels.resize(levelCount);
+    for (uint32_t level = 0; level < levelCount; level++)
+    {
+        Level &entry = source->_levels[level];
+        entry.offset = get_u64(index.data() + level * LEVEL_INDEX_ENTRY_SIZE);
+        entry.size = get_u64(index.data() + level * LEVEL_INDEX_ENTRY_SIZE + 8);
+
+        if (entry.size != vkutil::image_level_size(format, extent, level))
+        {
+            fmt::print("{}: level {} is {} bytes, expected {}\n", path, level, entry.size, vkutil::image_level_size(format, extent, level));
+            return nullptr;
+        }
+    }
+
+    source->_format = format;
+    source->_extent = extent;
+    return source;
+}
+
+bool Ktx2TextureSource::read_level(uint32_t level, void *dst)
+{
+    _file.clear();
+    _file.seekg((std::streamoff)_levels[level].offset);
+    return (bool)_file.read((char *)dst, (std::streamsize)_levels[level].size);
+}
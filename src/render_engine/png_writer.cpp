@@ -0,0 +1,125 @@
+#include "render_engine/png_writer.h"
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <vector>
+
+namespace
+{
+    const std::array<uint32_t, 256> &crc_table()
+    {
+        static const std::array<uint32_t, 256> table = []()
+        {
+            std::array<uint32_t, 256> result;
+            for (uint32_t n = 0; n < 256; n++)
+            {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                result[n] = c;
+            }
+            return result;
+        }();
+        return table;
+    }
+
+    uint32_t crc32(uint32_t crc, const uint8_t *data, size_t size)
+    {
+        const std::array<uint32_t, 256> &table = crc_table();
+        for (size_t i = 0; i < size; i++)
+            crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        return crc;
+    }
+
+    void put_u32(std::vector<uint8_t> &out, uint32_t value)
+    {
+        out.push_back(uint8_t(value >> 24));
+        out.push_back(uint8_t(value >> 16));
+        out.push_back(uint8_t(value >> 8));
+        out.push_back(uint8_t(value));
+    }
+
+    void write_chunk(std::ofstream &file, const char type[4], const std::vector<uint8_t> &data)
+    {
+        std::vector<uint8_t> chunk;
+        chunk.reserve(data.size() + 12);
+
+        put_u32(chunk, (uint32_t)data.size());
+        chunk.insert(chunk.end(), type, type + 4);
+        chunk.insert(chunk.end(), data.begin(), data.end());
+
+        // the crc covers the type and the data, not the length
+        uint32_t crc = crc32(0xffffffffu, chunk.data() + 4, chunk.size() - 4) ^ 0xffffffffu;
+        put_u32(chunk, crc);
+
+        file.write((const char *)chunk.data(), chunk.size());
+    }
+}
+
+bool write_png(const std::string &path, uint32_t width, uint32_t height, const uint8_t *rgba)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        return false;
+
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    file.write((const char *)signature, sizeof(signature));
+
+    std::vector<uint8_t> header;
+    put_u32(header, width);
+    put_u32(header, height);
+    header.push_back(8); // bit depth
+    header.push_back(6); // color type RGBA
+    header.push_back(0); // deflate
+    header.push_back(0); // adaptive filtering
+    header.push_back(0); // no interlace
+    write_chunk(file, "IHDR", header);
+
+    // every scanline starts with its filter type, 0 leaves the bytes as they are
+    const size_t rowSize = (size_t)width * 4;
+    std::vector<uint8_t> raw;
+    raw.reserve((rowSize + 1) * height);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        raw.push_back(0);
+        raw.insert(raw.end(), rgba + y * rowSize, rgba + (y + 1) * rowSize);
+    }
+
+    // zlib stream made of stored blocks of at most 65535 bytes
+    std::vector<uint8_t> zlib;
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    zlib.push_back(0x78);
+    zlib.push_back(0x01);
+
+    size_t offset = 0;
+    do
+    {
+        size_t blockSize = std::min<size_t>(raw.size() - offset, 65535);
+        bool last = offset + blockSize == raw.size();
+
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(uint8_t(blockSize));
+        zlib.push_back(uint8_t(blockSize >> 8));
+        zlib.push_back(uint8_t(~blockSize));
+        zlib.push_back(uint8_t(~blockSize >> 8));
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + blockSize);
+
+        offset += blockSize;
+    } while (offset < raw.size());
+
+    // adler32 of the uncompressed data
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (uint8_t value : raw)
+    {
+        a = (a + value) % 65521;
+        b = (b + a) % 65521;
+    }
+    put_u32(zlib, (b << 16) | a);
+
+    write_chunk(file, "IDAT", zlib);
+    write_chunk(file, "IEND", {});
+
+    return bool(file);
+}
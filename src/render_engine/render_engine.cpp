@@ -230,6 +230,19 @@ int RenderEngine::MainWindow()
 	return 0;
 }
 
+int RenderEngine::Headless(const HeadlessSettings &settings)
+{
+	VulkanEngine engine;
+
+	engine.init_headless(settings);
+
+	int result = engine.run_headless();
+
+	engine.cleanup();
+
+	return result;
+}
+
 void RenderEngine::run()
 {
 
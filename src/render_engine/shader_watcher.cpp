@@ -0,0 +1,206 @@
+#include "render_engine/shader_watcher.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace
+{
+    // runs glslc straight from the PATH, no shell, so file names are passed on as they are
+    bool run_glslc(const std::vector<std::string> &arguments, bool quiet)
+    {
+        std::vector<char *> argv;
+        argv.push_back(const_cast<char *>("glslc"));
+        for (const std::string &argument : arguments)
+            argv.push_back(const_cast<char *>(argument.c_str()));
+        argv.push_back(nullptr);
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        if (quiet)
+        {
+            posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+            posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+        }
+
+        pid_t pid;
+        int error = posix_spawnp(&pid, "glslc", &actions, nullptr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        if (error != 0)
+            return false;
+
+        int status;
+        if (waitpid(pid, &status, 0) < 0)
+            return false;
+
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    bool ends_with(const std::string &value, const char *suffix)
+    {
+        std::string_view end(suffix);
+        return value.size() >= end.size() && value.compare(value.size() - end.size(), end.size(), end) == 0;
+    }
+
+    bool is_glsl_source(const std::string &name)
+    {
+        return ends_with(name, ".vert") || ends_with(name, ".frag") || ends_with(name, ".comp");
+    }
+}
+
+ShaderWatcher::~ShaderWatcher()
+{
+    cleanup();
+}
+
+bool ShaderWatcher::init(const std::string &directory)
+{
+    _directory = directory;
+    if (!_directory.empty() && _directory.back() != '/')
+        _directory += '/';
+
+    _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_fd < 0)
+    {
+        fmt::print("shader hot reload disabled, inotify is not available\n");
+        return false;
+    }
+
+    // editors either rewrite the file in place or write a temporary and rename it over the original
+    _watch = inotify_add_watch(_fd, _directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (_watch < 0)
+    {
+        fmt::print("shader hot reload disabled, can not watch {}\n", _directory);
+        cleanup();
+        return false;
+    }
+
+    _hasCompiler = run_glslc({"--version"}, true);
+    if (!_hasCompiler)
+        fmt::print("glslc not found, only rebuilt .spv files are reloaded\n");
+    else
+    {
+        _stopCompiler = false;
+        _compiler = std::thread([this]()
+                                { compile_loop(); });
+    }
+
+    return true;
+}
+
+void ShaderWatcher::cleanup()
+{
+    if (_compiler.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> guard(_compileLock);
+            _stopCompiler = true;
+        }
+        _compileWake.notify_one();
+        _compiler.join();
+    }
+
+    if (_fd < 0)
+        return;
+
+    if (_watch >= 0)
+        inotify_rm_watch(_fd, _watch);
+    close(_fd);
+
+    _fd = -1;
+    _watch = -1;
+}
+
+std::vector<std::string> ShaderWatcher::poll()
+{
+    std::vector<std::string> binaries;
+    if (_fd < 0)
+        return binaries;
+
+    std::vector<std::string> sources;
+
+    alignas(inotify_event) char buffer[4096];
+    while (true)
+    {
+        ssize_t length = read(_fd, buffer, sizeof(buffer));
+        if (length <= 0)
+            break;
+
+        for (char *ptr = buffer; ptr < buffer + length;)
+        {
+            const inotify_event *event = reinterpret_cast<const inotify_event *>(ptr);
+            ptr += sizeof(inotify_event) + event->len;
+
+            if (event->len == 0)
+                continue;
+
+            std::string name = event->name;
+            if (ends_with(name, ".spv"))
+                binaries.push_back(name);
+            else if (is_glsl_source(name))
+                sources.push_back(name);
+        }
+    }
+
+    // one save can produce several events, every file is handled once
+    std::sort(binaries.begin(), binaries.end());
+    binaries.erase(std::unique(binaries.begin(), binaries.end()), binaries.end());
+
+    if (_hasCompiler && !sources.empty())
+    {
+        {
+            std::lock_guard<std::mutex> guard(_compileLock);
+            _pendingSources.insert(_pendingSources.end(), sources.begin(), sources.end());
+        }
+        _compileWake.notify_one();
+    }
+
+    return binaries;
+}
+
+void ShaderWatcher::compile_loop()
+{
+    std::vector<std::string> sources;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> guard(_compileLock);
+            _compileWake.wait(guard, [this]()
+                              { return _stopCompiler || !_pendingSources.empty(); });
+            if (_stopCompiler)
+                return;
+
+            sources.swap(_pendingSources);
+        }
+
+        std::sort(sources.begin(), sources.end());
+        sources.erase(std::unique(sources.begin(), sources.end()), sources.end());
+
+        for (const std::string &source : sources)
+            compile(source);
+
+        sources.clear();
+    }
+}
+
+bool ShaderWatcher::compile(const std::string &source)
+{
+    // same flags and output name as the build rule, the write of the binary is picked up by a later poll
+    std::string path = _directory + source;
+    if (!run_glslc({"--target-env=vulkan1.3", path, "-o", path + ".spv"}, false))
+    {
+        fmt::print("failed to compile {}, keeping the previous pipelines\n", source);
+        return false;
+    }
+
+    fmt::print("compiled {}\n", source);
+    return true;
+}
@@ -0,0 +1,59 @@
+#version 450
+#extension GL_EXT_buffer_reference : require
+
+layout (location = 0) out vec3 outColor;
+layout (location = 1) out vec2 outUV;
+
+struct Vertex {
+
+	vec3 position;
+	float uv_x;
+	vec3 normal;
+	float uv_y;
+	vec4 color;
+};
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer{
+	Vertex vertices[];
+};
+
+// frame ring, bound with the offsets of this frame's allocations
+layout(set = 1, binding = 0) uniform SceneData {
+	mat4 view;
+	mat4 proj;
+	mat4 viewproj;
+	vec4 ambientColor;
+	vec4 sunlightDirection; // w for sun power
+	vec4 sunlightColor;
+} sceneData;
+
+struct DrawData {
+	mat4 worldMatrix;
+	uint materialIndex;
+};
+
+layout(set = 1, binding = 1, std430) readonly buffer DrawBuffer {
+	DrawData draws[];
+} drawBuffer;
+
+//push constants block, shared with mesh.frag
+layout( push_constant ) uniform constants
+{
+	VertexBuffer vertexBuffer;
+	uint materialBuffer;
+	uint drawIndex;
+} PushConstants;
+
+void main()
+{
+	//load vertex data from device adress
+	Vertex v = PushConstants.vertexBuffer.vertices[gl_VertexIndex];
+
+	mat4 worldMatrix = drawBuffer.draws[PushConstants.drawIndex].worldMatrix;
+
+	//output data
+	gl_Position = sceneData.viewproj * worldMatrix * vec4(v.position, 1.0f);
+	outColor = v.color.xyz;
+	outUV.x = v.uv_x;
+	outUV.y = v.uv_y;
+}
@@ -0,0 +1,82 @@
+#version 450
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout (location = 0) in vec3 inColor;
+layout (location = 1) in vec2 inUV;
+layout (location = 2) flat in uint inMaterialIndex;
+
+layout (location = 0) out vec4 outFragColor;
+
+struct Material {
+
+	vec4 colorFactors;
+	vec4 metal_rough_factors;
+	uvec4 textures; // color image, metal rough image, sampler, unused
+	vec4 extra[13];
+};
+
+// bindless set, see BindlessRegistry
+layout(set = 0, binding = 0) uniform texture2D textures[];
+layout(set = 0, binding = 1) uniform sampler samplers[];
+layout(set = 0, binding = 2, std430) readonly buffer MaterialBuffer {
+	Material materials[];
+} materialBuffers[];
+
+struct Vertex {
+
+	vec3 position;
+	float uv_x;
+	vec3 normal;
+	float uv_y;
+	vec4 color;
+};
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer{
+	Vertex vertices[];
+};
+
+struct ObjectData {
+
+	mat4 transform;
+	vec4 sphere;
+	VertexBuffer vertexBuffer;
+	uint firstIndex;
+	uint indexCount;
+	uint materialIndex;
+	uint batch;
+	uint commandBase;
+	uint pad;
+};
+
+layout(buffer_reference, std430) readonly buffer ObjectBuffer{
+	ObjectData objects[];
+};
+
+// bindless slot of every streamed texture this frame, see TextureStreamer
+layout(set = 1, binding = 2, std430) readonly buffer TextureTable {
+	uint slots[];
+} textureTable;
+
+// material indices with the top bit set name a streamed texture
+uint resolve_texture(uint index)
+{
+	return (index & 0x80000000u) != 0 ? textureTable.slots[index & 0x7fffffffu] : index;
+}
+
+layout( push_constant ) uniform constants
+{
+	mat4 viewproj;
+	ObjectBuffer objectBuffer;
+	uint materialBuffer;
+} PushConstants;
+
+void main()
+{
+	Material material = materialBuffers[PushConstants.materialBuffer].materials[inMaterialIndex];
+
+	// one indirect call covers many objects, so the texture index can differ between invocations
+	vec4 albedo = texture(nonuniformEXT(sampler2D(textures[resolve_texture(material.textures.x)], samplers[material.textures.z])), inUV);
+
+	outFragColor = vec4(inColor, 1.0f) * albedo * material.colorFactors;
+}
@@ -0,0 +1,57 @@
+#version 460
+#extension GL_EXT_buffer_reference : require
+
+layout (location = 0) out vec3 outColor;
+layout (location = 1) out vec2 outUV;
+layout (location = 2) flat out uint outMaterialIndex;
+
+struct Vertex {
+
+	vec3 position;
+	float uv_x;
+	vec3 normal;
+	float uv_y;
+	vec4 color;
+};
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer{
+	Vertex vertices[];
+};
+
+struct ObjectData {
+
+	mat4 transform;
+	vec4 sphere;
+	VertexBuffer vertexBuffer;
+	uint firstIndex;
+	uint indexCount;
+	uint materialIndex;
+	uint batch;
+	uint commandBase;
+	uint pad;
+};
+
+layout(buffer_reference, std430) readonly buffer ObjectBuffer{
+	ObjectData objects[];
+};
+
+//push constants block, shared with mesh_indirect.frag
+layout( push_constant ) uniform constants
+{
+	mat4 viewproj;
+	ObjectBuffer objectBuffer;
+	uint materialBuffer;
+} PushConstants;
+
+void main()
+{
+	// the culling pass writes the object index into firstInstance
+	ObjectData object = PushConstants.objectBuffer.objects[gl_InstanceIndex];
+	Vertex v = object.vertexBuffer.vertices[gl_VertexIndex];
+
+	gl_Position = PushConstants.viewproj * object.transform * vec4(v.position, 1.0f);
+	outColor = v.color.xyz;
+	outUV.x = v.uv_x;
+	outUV.y = v.uv_y;
+	outMaterialIndex = object.materialIndex;
+}
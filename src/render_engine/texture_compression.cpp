@@ -0,0 +1,301 @@
+#include "render_engine/texture_compression.h"
+
+#include "core/job_system.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    // interpolation weights of 4 bit indices, out of 64
+    constexpr int BC7_WEIGHTS4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    // writes bits from the least significant one up, the order every BCn block is laid out in
+    struct BitWriter
+    {
+        uint8_t *out;
+        uint32_t position{0};
+
+        void put(uint32_t value, uint32_t count)
+        {
+            for (uint32_t i = 0; i < count; i++, position++)
+            {
+                if ((value >> i) & 1)
+                    out[position >> 3] |= uint8_t(1u << (position & 7));
+            }
+        }
+    };
+
+    struct Bc7Mode6
+    {
+        int endpoints[2][4]; // 7 bit
+        int pbits[2];
+        uint8_t indices[16];
+        int error;
+    };
+
+    // quantizes both endpoints with the given p-bits and picks the closest palette entry for every texel
+    void fit_bc7_mode6(const uint8_t texels[64], const float ends[2][4], int pbit0, int pbit1, Bc7Mode6 &result)
+    {
+        int pbits[2] = {pbit0, pbit1};
+        int values[2][4];
+        for (int e = 0; e < 2; e++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                int q = (int)std::lround((ends[e][c] - pbits[e]) / 2.f);
+                result.endpoints[e][c] = std::clamp(q, 0, 127);
+                values[e][c] = (result.endpoints[e][c] << 1) | pbits[e];
+            }
+            result.pbits[e] = pbits[e];
+        }
+
+        int palette[16][4];
+        for (int i = 0; i < 16; i++)
+        {
+            for (int c = 0; c < 4; c++)
+                palette[i][c] = ((64 - BC7_WEIGHTS4[i]) * values[0][c] + BC7_WEIGHTS4[i] * values[1][c] + 32) >> 6;
+        }
+
+        result.error = 0;
+        for (int t = 0; t < 16; t++)
+        {
+            int best = 0;
+            int bestError = INT32_MAX;
+            for (int i = 0; i < 16; i++)
+            {
+                int error = 0;
+                for (int c = 0; c < 4; c++)
+                {
+                    int d = palette[i][c] - texels[t * 4 + c];
+                    error += d * d;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = i;
+                }
+            }
+            result.indices[t] = (uint8_t)best;
+            result.error += bestError;
+        }
+    }
+
+    void encode_bc4_block(const uint8_t values[16], uint8_t block[8])
+    {
+        uint8_t lo = *std::min_element(values, values + 16);
+        uint8_t hi = *std::max_element(values, values + 16);
+
+        memset(block, 0, 8);
+
+        // red0 > red1 selects the mode with 6 interpolated values between them
+        block[0] = hi;
+        block[1] = lo;
+        if (hi == lo)
+            return;
+
+        int palette[8] = {hi, lo};
+        for (int i = 2; i < 8; i++)
+            palette[i] = ((8 - i) * hi + (i - 1) * lo + 3) / 7;
+
+        BitWriter bits{block + 2};
+        for (int t = 0; t < 16; t++)
+        {
+            int best = 0;
+            for (int i = 1; i < 8; i++)
+            {
+                if (std::abs(palette[i] - values[t]) < std::abs(palette[best] - values[t]))
+                    best = i;
+            }
+            bits.put(best, 3);
+        }
+    }
+
+    template <typename Encoder>
+    std::vector<uint8_t> compress_level(const uint8_t *rgba, uint32_t width, uint32_t height, Encoder encode)
+    {
+        uint32_t blocksX = (width + 3) / 4;
+        uint32_t blocksY = (height + 3) / 4;
+        std::vector<uint8_t> result((size_t)blocksX * blocksY * 16);
+
+        JobSystem::Get().parallel_for(blocksY, 4, [&](uint32_t begin, uint32_t end)
+                                      {
+            uint8_t texels[64];
+            for (uint32_t by = begin; by < end; by++)
+            {
+                for (uint32_t bx = 0; bx < blocksX; bx++)
+                {
+                    for (uint32_t y = 0; y < 4; y++)
+                    {
+                        uint32_t sy = std::min(by * 4 + y, height - 1);
+                        for (uint32_t x = 0; x < 4; x++)
+                        {
+                            uint32_t sx = std::min(bx * 4 + x, width - 1);
+                            memcpy(texels + (y * 4 + x) * 4, rgba + ((size_t)sy * width + sx) * 4, 4);
+                        }
+                    }
+
+                    encode(texels, result.data() + ((size_t)by * blocksX + bx) * 16);
+                }
+            } });
+
+        return result;
+    }
+}
+
+void encode_bc7_block(const uint8_t texels[64], uint8_t block[16])
+{
+    // principal axis of the texels through their mean, found by power iteration on the covariance
+    float mean[4] = {};
+    for (int t = 0; t < 16; t++)
+    {
+        for (int c = 0; c < 4; c++)
+            mean[c] += texels[t * 4 + c] / 16.f;
+    }
+
+    float covariance[4][4] = {};
+    for (int t = 0; t < 16; t++)
+    {
+        float d[4];
+        for (int c = 0; c < 4; c++)
+            d[c] = texels[t * 4 + c] - mean[c];
+
+        for (int i = 0; i < 4; i++)
+        {
+            for (int j = 0; j < 4; j++)
+                covariance[i][j] += d[i] * d[j];
+        }
+    }
+
+    float axis[4] = {1.f, 1.f, 1.f, 1.f};
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        float next[4] = {};
+        for (int i = 0; i < 4; i++)
+        {
+            for (int j = 0; j < 4; j++)
+                next[i] += covariance[i][j] * axis[j];
+        }
+
+        float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+        if (length < 1e-6f)
+            break;
+
+        for (int i = 0; i < 4; i++)
+            axis[i] = next[i] / length;
+    }
+
+    float minT = 0.f;
+    float maxT = 0.f;
+    for (int t = 0; t < 16; t++)
+    {
+        float projected = 0.f;
+        for (int c = 0; c < 4; c++)
+            projected += (texels[t * 4 + c] - mean[c]) * axis[c];
+
+        minT = std::min(minT, projected);
+        maxT = std::max(maxT, projected);
+    }
+
+    float ends[2][4];
+    for (int c = 0; c < 4; c++)
+    {
+        ends[0][c] = std::clamp(mean[c] + axis[c] * minT, 0.f, 255.f);
+        ends[1][c] = std::clamp(mean[c] + axis[c] * maxT, 0.f, 255.f);
+    }
+
+    Bc7Mode6 best;
+    best.error = INT32_MAX;
+
+    // the extremes along the axis, then once more with endpoints refit to the chosen indices by least squares
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int p = 0; p < 4; p++)
+        {
+            Bc7Mode6 candidate;
+            fit_bc7_mode6(texels, ends, p & 1, p >> 1, candidate);
+            if (candidate.error < best.error)
+                best = candidate;
+        }
+
+        if (best.error == 0)
+            break;
+
+        float aa = 0.f, ab = 0.f, bb = 0.f;
+        float ax[4] = {}, bx[4] = {};
+        for (int t = 0; t < 16; t++)
+        {
+            float w = BC7_WEIGHTS4[best.indices[t]] / 64.f;
+            aa += (1.f - w) * (1.f - w);
+            ab += (1.f - w) * w;
+            bb += w * w;
+            for (int c = 0; c < 4; c++)
+            {
+                ax[c] += (1.f - w) * texels[t * 4 + c];
+                bx[c] += w * texels[t * 4 + c];
+            }
+        }
+
+        float det = aa * bb - ab * ab;
+        if (std::abs(det) < 1e-6f)
+            break;
+
+        for (int c = 0; c < 4; c++)
+        {
+            ends[0][c] = std::clamp((ax[c] * bb - bx[c] * ab) / det, 0.f, 255.f);
+            ends[1][c] = std::clamp((bx[c] * aa - ax[c] * ab) / det, 0.f, 255.f);
+        }
+    }
+
+    // the msb of the first index is implied 0, mirror the palette when it would be set
+    if (best.indices[0] & 8)
+    {
+        for (int c = 0; c < 4; c++)
+            std::swap(best.endpoints[0][c], best.endpoints[1][c]);
+        std::swap(best.pbits[0], best.pbits[1]);
+
+        for (uint8_t &index : best.indices)
+            index = 15 - index;
+    }
+
+    memset(block, 0, 16);
+    BitWriter bits{block};
+
+    bits.put(1u << 6, 7);
+    for (int c = 0; c < 4; c++)
+    {
+        bits.put(best.endpoints[0][c], 7);
+        bits.put(best.endpoints[1][c], 7);
+    }
+    bits.put(best.pbits[0], 1);
+    bits.put(best.pbits[1], 1);
+
+    bits.put(best.indices[0], 3);
+    for (int t = 1; t < 16; t++)
+        bits.put(best.indices[t], 4);
+}
+
+void encode_bc5_block(const uint8_t texels[64], uint8_t block[16])
+{
+    uint8_t red[16];
+    uint8_t green[16];
+    for (int t = 0; t < 16; t++)
+    {
+        red[t] = texels[t * 4 + 0];
+        green[t] = texels[t * 4 + 1];
+    }
+
+    encode_bc4_block(red, block);
+    encode_bc4_block(green, block + 8);
+}
+
+std::vector<uint8_t> compress_bc7(const uint8_t *rgba, uint32_t width, uint32_t height)
+{
+    return compress_level(rgba, width, height, encode_bc7_block);
+}
+
+std::vector<uint8_t> compress_bc5(const uint8_t *rgba, uint32_t width, uint32_t height)
+{
+    return compress_level(rgba, width, height, encode_bc5_block);
+}
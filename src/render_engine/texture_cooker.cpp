@@ -0,0 +1,173 @@
+#include "render_engine/texture_cooker.h"
+
+#include "render_engine/ktx2.h"
+#include "render_engine/texture_compression.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb/stb_image.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+
+namespace
+{
+    float srgb_to_linear(float value)
+    {
+        return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+    }
+
+    float linear_to_srgb(float value)
+    {
+        return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+    }
+
+    uint8_t to_unorm8(float value)
+    {
+        return (uint8_t)std::lround(std::clamp(value, 0.f, 1.f) * 255.f);
+    }
+
+    // 2x2 box filter, the last row or column is repeated for odd sizes
+    std::vector<uint8_t> downsample(const std::vector<uint8_t> &src, uint32_t width, uint32_t height, TextureKind kind)
+    {
+        static const std::array<float, 256> toLinear = []()
+        {
+            std::array<float, 256> table;
+            for (int i = 0; i < 256; i++)
+                table[i] = srgb_to_linear(i / 255.f);
+            return table;
+        }();
+
+        uint32_t nextWidth = std::max(width / 2, 1u);
+        uint32_t nextHeight = std::max(height / 2, 1u);
+        std::vector<uint8_t> dst((size_t)nextWidth * nextHeight * 4);
+
+        for (uint32_t y = 0; y < nextHeight; y++)
+        {
+            for (uint32_t x = 0; x < nextWidth; x++)
+            {
+                const uint8_t *texels[4];
+                for (uint32_t k = 0; k < 4; k++)
+                {
+                    uint32_t sx = std::min(x * 2 + (k & 1), width - 1);
+                    uint32_t sy = std::min(y * 2 + (k >> 1), height - 1);
+                    texels[k] = src.data() + ((size_t)sy * width + sx) * 4;
+                }
+
+                float sum[4] = {};
+                for (uint32_t k = 0; k < 4; k++)
+                {
+                    for (uint32_t c = 0; c < 4; c++)
+                    {
+                        if (kind == TextureKind::Normal && c < 3)
+                            sum[c] += texels[k][c] / 127.5f - 1.f;
+                        else if (kind == TextureKind::Color && c < 3)
+                            sum[c] += toLinear[texels[k][c]];
+                        else
+                            sum[c] += texels[k][c] / 255.f;
+                    }
+                }
+
+                uint8_t *out = dst.data() + ((size_t)y * nextWidth + x) * 4;
+                if (kind == TextureKind::Normal)
+                {
+                    float length = std::sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+                    for (uint32_t c = 0; c < 3; c++)
+                        out[c] = to_unorm8(length > 0.f ? sum[c] / length * 0.5f + 0.5f : 0.5f);
+                }
+                else
+                {
+                    for (uint32_t c = 0; c < 3; c++)
+                        out[c] = to_unorm8(linear_to_srgb(sum[c] / 4.f));
+                }
+                out[3] = to_unorm8(sum[3] / 4.f);
+            }
+        }
+
+        return dst;
+    }
+}
+
+bool cook_texture(const std::string &srcPath, const std::string &dstPath, TextureKind kind)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    int width, height, channels;
+    uint8_t *pixels = stbi_load(srcPath.c_str(), &width, &height, &channels, 4);
+    if (pixels == nullptr)
+    {
+        fmt::print("Failed to load {}: {}\n", srcPath, stbi_failure_reason());
+        return false;
+    }
+
+    std::vector<uint8_t> level(pixels, pixels + (size_t)width * height * 4);
+    stbi_image_free(pixels);
+
+    // the engine renders without an srgb conversion anywhere, so color stays in the unorm format it was
+    // authored in and only the filtering happens in linear light
+    VkFormat format = kind == TextureKind::Color ? VK_FORMAT_BC7_UNORM_BLOCK : VK_FORMAT_BC5_UNORM_BLOCK;
+    VkExtent2D extent = {(uint32_t)width, (uint32_t)height};
+
+    std::vector<std::vector<uint8_t>> levels;
+    uint32_t levelWidth = extent.width;
+    uint32_t levelHeight = extent.height;
+    while (true)
+    {
+        levels.push_back(kind == TextureKind::Color ? compress_bc7(level.data(), levelWidth, levelHeight)
+                                                    : compress_bc5(level.data(), levelWidth, levelHeight));
+
+        if (levelWidth == 1 && levelHeight == 1)
+            break;
+
+        level = downsample(level, levelWidth, levelHeight, kind);
+        levelWidth = std::max(levelWidth / 2, 1u);
+        levelHeight = std::max(levelHeight / 2, 1u);
+    }
+
+    if (!write_ktx2(dstPath, format, extent, levels))
+    {
+        fmt::print("Failed to write {}\n", dstPath);
+        return false;
+    }
+
+    size_t compressedBytes = 0;
+    for (const std::vector<uint8_t> &data : levels)
+        compressedBytes += data.size();
+
+    auto end = std::chrono::steady_clock::now();
+    fmt::print("{} -> {}: {}x{}, {} levels, {:.2f} MB ( rgba8 level 0 {:.2f} MB ) in {:.0f} ms\n", srcPath, dstPath, width, height,
+               levels.size(), compressedBytes / (1024.f * 1024.f), (size_t)width * height * 4 / (1024.f * 1024.f),
+               std::chrono::duration<float, std::milli>(end - start).count());
+
+    return true;
+}
+
+std::string cooked_texture_path(const std::string &srcPath)
+{
+    return srcPath + ".ktx2";
+}
+
+std::string load_cooked_texture(const std::string &srcPath, TextureKind kind)
+{
+    if (srcPath.ends_with(".ktx2"))
+        return srcPath;
+
+    std::string cookedPath = cooked_texture_path(srcPath);
+
+    std::error_code error;
+    auto sourceTime = std::filesystem::last_write_time(srcPath, error);
+    if (error)
+        return srcPath;
+
+    auto cookedTime = std::filesystem::last_write_time(cookedPath, error);
+    if (!error && cookedTime >= sourceTime)
+        return cookedPath;
+
+    // write_ktx2 replaces the file atomically
+    if (!cook_texture(srcPath, cookedPath, kind))
+        return srcPath;
+
+    return cookedPath;
+}
@@ -0,0 +1,138 @@
+#include "render_engine/vk_async_compute.h"
+#include "render_engine/vk_initializers.h"
+
+void AsyncCompute::init(VkDevice device, VkQueue computeQueue, uint32_t computeQueueFamily, uint32_t graphicsQueueFamily, uint32_t frameCount, uint32_t timestampValidBits)
+{
+    _device = device;
+    _computeQueue = computeQueue;
+    _computeQueueFamily = computeQueueFamily;
+    _graphicsQueueFamily = graphicsQueueFamily;
+
+    _frames.resize(frameCount);
+    for (FrameResources &frame : _frames)
+    {
+        VkCommandPoolCreateInfo commandPoolInfo = vkinit::command_pool_create_info(_computeQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+        VK_CHECK(vkCreateCommandPool(_device, &commandPoolInfo, nullptr, &frame.commandPool));
+
+        VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(frame.commandPool, 1);
+        VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &frame.commandBuffer));
+
+        frame.timestamps.init(_device, 8, timestampValidBits);
+    }
+
+    // every submit signals the next value, the graphics queue waits on the one it consumes
+    VkSemaphoreTypeCreateInfo timelineInfo = {.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    timelineInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo = vkinit::semaphore_create_info();
+    semaphoreInfo.pNext = &timelineInfo;
+    VK_CHECK(vkCreateSemaphore(_device, &semaphoreInfo, nullptr, &_timeline));
+}
+
+void AsyncCompute::cleanup()
+{
+    for (FrameResources &frame : _frames)
+    {
+        frame.timestamps.destroy(_device);
+        vkDestroyCommandPool(_device, frame.commandPool, nullptr);
+    }
+    _frames.clear();
+
+    vkDestroySemaphore(_device, _timeline, nullptr);
+}
+
+VkCommandBuffer AsyncCompute::begin(uint32_t frameIndex)
+{
+    FrameResources &frame = _frames[frameIndex];
+
+    VK_CHECK(vkResetCommandPool(_device, frame.commandPool, 0));
+
+    VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    VK_CHECK(vkBeginCommandBuffer(frame.commandBuffer, &beginInfo));
+
+    return frame.commandBuffer;
+}
+
+void AsyncCompute::release_image(VkImage image, VkImageAspectFlags aspect, VkImageLayout oldLayout, VkImageLayout newLayout,
+                                 VkPipelineStageFlags2 srcStages, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStages, VkAccessFlags2 dstAccess)
+{
+    VkImageMemoryBarrier2 barrier = {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = _computeQueueFamily;
+    barrier.dstQueueFamilyIndex = _graphicsQueueFamily;
+    barrier.image = image;
+    barrier.subresourceRange = vkinit::image_subresource_range(aspect);
+
+    // release, the destination half is ignored on this queue
+    VkImageMemoryBarrier2 release = barrier;
+    release.srcStageMask = srcStages;
+    release.srcAccessMask = srcAccess;
+    release.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+    release.dstAccessMask = VK_ACCESS_2_NONE;
+    _releases.push_back(release);
+
+    // acquire, must match the release. the source stages are the ones the semaphore wait blocks,
+    // which keeps the layout transition behind the wait
+    VkImageMemoryBarrier2 acquire = barrier;
+    acquire.srcStageMask = dstStages;
+    acquire.srcAccessMask = VK_ACCESS_2_NONE;
+    acquire.dstStageMask = dstStages;
+    acquire.dstAccessMask = dstAccess;
+    _acquires.push_back(acquire);
+}
+
+void AsyncCompute::submit(uint32_t frameIndex)
+{
+    FrameResources &frame = _frames[frameIndex];
+
+    if (!_releases.empty())
+    {
+        VkDependencyInfo depInfo = {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+        depInfo.imageMemoryBarrierCount = (uint32_t)_releases.size();
+        depInfo.pImageMemoryBarriers = _releases.data();
+        vkCmdPipelineBarrier2(frame.commandBuffer, &depInfo);
+
+        _releases.clear();
+    }
+
+    VK_CHECK(vkEndCommandBuffer(frame.commandBuffer));
+
+    VkCommandBufferSubmitInfo cmdInfo = vkinit::command_buffer_submit_info(frame.commandBuffer);
+
+    VkSemaphoreSubmitInfo signalInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _timeline);
+    signalInfo.value = _nextValue;
+
+    VkSubmitInfo2 submit = vkinit::submit_info(&cmdInfo, &signalInfo, nullptr);
+    VK_CHECK(vkQueueSubmit2(_computeQueue, 1, &submit, VK_NULL_HANDLE));
+
+    _pendingWaitValue = _nextValue++;
+}
+
+bool AsyncCompute::record_graphics_work(VkCommandBuffer cmd, VkSemaphoreSubmitInfo &waitInfo)
+{
+    if (_pendingWaitValue == 0)
+        return false;
+
+    VkPipelineStageFlags2 waitStages = VK_PIPELINE_STAGE_2_NONE;
+    for (const VkImageMemoryBarrier2 &acquire : _acquires)
+        waitStages |= acquire.dstStageMask;
+
+    if (!_acquires.empty())
+    {
+        VkDependencyInfo depInfo = {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+        depInfo.imageMemoryBarrierCount = (uint32_t)_acquires.size();
+        depInfo.pImageMemoryBarriers = _acquires.data();
+        vkCmdPipelineBarrier2(cmd, &depInfo);
+
+        _acquires.clear();
+    }
+
+    // graphics work in front of the first consumer does not wait for the compute queue
+    waitInfo = vkinit::semaphore_submit_info(waitStages != VK_PIPELINE_STAGE_2_NONE ? waitStages : VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _timeline);
+    waitInfo.value = _pendingWaitValue;
+
+    _pendingWaitValue = 0;
+    return true;
+}
@@ -0,0 +1,549 @@
+#include "render_engine/vk_culling.h"
+
+#include "render_engine/vk_engine.h"
+#include "render_engine/vk_images.h"
+#include "render_engine/vk_initializers.h"
+#include "render_engine/vk_pipelines.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    VkDeviceAddress buffer_address(VkDevice device, VkBuffer buffer)
+    {
+        VkBufferDeviceAddressInfo info{.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = buffer};
+        return vkGetBufferDeviceAddress(device, &info);
+    }
+
+    uint32_t previous_pow2(uint32_t value)
+    {
+        uint32_t result = 1;
+        while (result * 2 <= value)
+            result *= 2;
+        return result;
+    }
+
+    // push constants of cull.comp
+    struct CullPushConstants
+    {
+        VkDeviceAddress cullData;
+        VkDeviceAddress objects;
+        VkDeviceAddress drawCommands;
+        VkDeviceAddress counts;
+    };
+
+    // push constants of mesh_indirect.vert / mesh_indirect.frag
+    struct IndirectDrawPushConstants
+    {
+        glm::mat4 viewproj;
+        VkDeviceAddress objects;
+        uint32_t materialBuffer;
+        uint32_t pad;
+    };
+
+    struct ReducePushConstants
+    {
+        glm::vec2 outSize;
+        glm::vec2 uvScale;
+    };
+
+    // counts buffer: visible triangles, visible objects, then one draw count per batch
+    constexpr uint32_t COUNT_HEADER = 2;
+}
+
+void GpuCulling::init(VulkanEngine *engine, uint32_t frameCount)
+{
+    _engine = engine;
+
+    _frames.resize(frameCount);
+    for (FrameResources &frame : _frames)
+    {
+        frame.cullData = _engine->create_buffer(sizeof(GPUCullData), VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        frame.cullDataAddress = buffer_address(_engine->_device, frame.cullData.buffer);
+
+        frame.readback = _engine->create_buffer(COUNT_HEADER * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU, MemoryCategory::Staging);
+        frame.readbackObjects = 0;
+        frame.recorded = false;
+    }
+
+    init_pipelines();
+    init_pyramid();
+}
+
+void GpuCulling::init_pipelines()
+{
+    VkDevice device = _engine->_device;
+
+    // culling
+    {
+        VkPushConstantRange range{};
+        range.offset = 0;
+        range.size = sizeof(CullPushConstants);
+        range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipeline_layout_create_info();
+        layoutInfo.pSetLayouts = &_engine->_bindless.layout;
+        layoutInfo.setLayoutCount = 1;
+        layoutInfo.pPushConstantRanges = &range;
+        layoutInfo.pushConstantRangeCount = 1;
+
+        VK_CHECK(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &_cullLayout));
+
+        _cullPipeline = _engine->build_compute_pipeline(_cullLayout, "cull.comp.spv");
+        _engine->register_reloadable_pipeline({"cull.comp.spv"}, &_cullPipeline, [this]()
+                                              { return _engine->build_compute_pipeline(_cullLayout, "cull.comp.spv"); });
+    }
+
+    // depth pyramid reduction
+    {
+        DescriptorLayoutBuilder builder;
+        builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+        builder.add_binding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        _reduceSetLayout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+
+        VkPushConstantRange range{};
+        range.offset = 0;
+        range.size = sizeof(ReducePushConstants);
+        range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipeline_layout_create_info();
+        layoutInfo.pSetLayouts = &_reduceSetLayout;
+        layoutInfo.setLayoutCount = 1;
+        layoutInfo.pPushConstantRanges = &range;
+        layoutInfo.pushConstantRangeCount = 1;
+
+        VK_CHECK(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &_reduceLayout));
+
+        _reducePipeline = _engine->build_compute_pipeline(_reduceLayout, "depth_reduce.comp.spv");
+        _engine->register_reloadable_pipeline({"depth_reduce.comp.spv"}, &_reducePipeline, [this]()
+                                              { return _engine->build_compute_pipeline(_reduceLayout, "depth_reduce.comp.spv"); });
+    }
+
+    // indirect mesh drawing
+    {
+        VkPushConstantRange range{};
+        range.offset = 0;
+        range.size = sizeof(IndirectDrawPushConstants);
+        range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        // the frame data set carries the streamed texture table
+        VkDescriptorSetLayout layouts[] = {_engine->_bindless.layout, _engine->_frameDataLayout};
+
+        VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipeline_layout_create_info();
+        layoutInfo.pSetLayouts = layouts;
+        layoutInfo.setLayoutCount = 2;
+        layoutInfo.pPushConstantRanges = &range;
+        layoutInfo.pushConstantRangeCount = 1;
+
+        VK_CHECK(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &_drawPipeline.layout));
+
+        _drawPipeline.pipeline = build_draw_pipeline();
+        _engine->register_reloadable_pipeline({"mesh_indirect.vert.spv", "mesh_indirect.frag.spv"}, &_drawPipeline.pipeline, [this]()
+                                              { return build_draw_pipeline(); });
+    }
+}
+
+VkPipeline GpuCulling::build_draw_pipeline()
+{
+    VkDevice device = _engine->_device;
+
+    VkShaderModule fragShader;
+    if (!vkutil::load_shader_module((SHADERS_PATH + "mesh_indirect.frag.spv").c_str(), device, &fragShader))
+    {
+        fmt::print("Error when building the indirect mesh fragment shader module\n");
+        return VK_NULL_HANDLE;
+    }
+
+    VkShaderModule vertexShader;
+    if (!vkutil::load_shader_module((SHADERS_PATH + "mesh_indirect.vert.spv").c_str(), device, &vertexShader))
+    {
+        fmt::print("Error when building the indirect mesh vertex shader module\n");
+        vkDestroyShaderModule(device, fragShader, nullptr);
+        return VK_NULL_HANDLE;
+    }
+
+    PipelineBuilder pipelineBuilder;
+    pipelineBuilder._pipelineLayout = _drawPipeline.layout;
+    pipelineBuilder.set_shaders(vertexShader, fragShader);
+    pipelineBuilder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    pipelineBuilder.set_polygon_mode(VK_POLYGON_MODE_FILL);
+    pipelineBuilder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+    pipelineBuilder.set_multisampling_none();
+    pipelineBuilder.disable_blending();
+    pipelineBuilder.enable_depthtest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+    pipelineBuilder.set_color_attachment_format(_engine->_drawImage.imageFormat);
+    pipelineBuilder.set_depth_format(_engine->_depthImage.imageFormat);
+
+    VkPipeline pipeline = pipelineBuilder.build_pipeline(device, _engine->_pipelineCache.cache);
+
+    vkDestroyShaderModule(device, fragShader, nullptr);
+    vkDestroyShaderModule(device, vertexShader, nullptr);
+
+    return pipeline;
+}
+
+void GpuCulling::init_pyramid()
+{
+    VkDevice device = _engine->_device;
+
+    // power of two below the draw image, so every level halves exactly
+    _pyramidExtent.width = previous_pow2(_engine->_drawImage.imageExtent.width);
+    _pyramidExtent.height = previous_pow2(_engine->_drawImage.imageExtent.height);
+
+    _pyramid = _engine->create_image(VkExtent3D{_pyramidExtent.width, _pyramidExtent.height, 1}, VK_FORMAT_R32_SFLOAT,
+                                     VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, true, MemoryCategory::RenderTargets);
+
+    _pyramidLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(_pyramidExtent.width, _pyramidExtent.height)))) + 1;
+
+    _pyramidMips.resize(_pyramidLevels);
+    for (uint32_t i = 0; i < _pyramidLevels; i++)
+    {
+        VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(VK_FORMAT_R32_SFLOAT, _pyramid.image, VK_IMAGE_ASPECT_COLOR_BIT);
+        viewInfo.subresourceRange.baseMipLevel = i;
+        viewInfo.subresourceRange.levelCount = 1;
+
+        VK_CHECK(vkCreateImageView(device, &viewInfo, nullptr, &_pyramidMips[i]));
+    }
+
+    // linear filtering with a min reduction returns the farthest ( reversed depth ) of the 2x2 footprint
+    VkSamplerReductionModeCreateInfo reductionInfo = {.sType = VK_STRUCTURE_TYPE_SAMPLER_REDUCTION_MODE_CREATE_INFO};
+    reductionInfo.reductionMode = VK_SAMPLER_REDUCTION_MODE_MIN;
+
+    VkSamplerCreateInfo samplerInfo = {.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+    samplerInfo.pNext = &reductionInfo;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.minLod = 0.f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    VK_CHECK(vkCreateSampler(device, &samplerInfo, nullptr, &_reductionSampler));
+
+    // the pyramid stays in GENERAL, it is written and sampled every frame
+    _pyramidIndex = _engine->_bindless.add_image(_pyramid.imageView, VK_IMAGE_LAYOUT_GENERAL);
+    _reductionSamplerIndex = _engine->_bindless.add_sampler(_reductionSampler);
+
+    _pyramidValid = false;
+}
+
+void GpuCulling::cleanup()
+{
+    VkDevice device = _engine->_device;
+
+    destroy_object_buffers(_active);
+    destroy_object_buffers(_pending);
+
+    for (FrameResources &frame : _frames)
+    {
+        _engine->destroy_buffer(frame.cullData);
+        _engine->destroy_buffer(frame.readback);
+    }
+    _frames.clear();
+
+    _engine->_bindless.remove_image(_pyramidIndex);
+    _engine->_bindless.remove_sampler(_reductionSamplerIndex);
+
+    for (VkImageView view : _pyramidMips)
+        vkDestroyImageView(device, view, nullptr);
+    _pyramidMips.clear();
+    _engine->destroy_image(_pyramid);
+
+    vkDestroySampler(device, _reductionSampler, nullptr);
+
+    vkDestroyPipeline(device, _cullPipeline, nullptr);
+    vkDestroyPipelineLayout(device, _cullLayout, nullptr);
+
+    vkDestroyPipeline(device, _reducePipeline, nullptr);
+    vkDestroyPipelineLayout(device, _reduceLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, _reduceSetLayout, nullptr);
+
+    vkDestroyPipeline(device, _drawPipeline.pipeline, nullptr);
+    vkDestroyPipelineLayout(device, _drawPipeline.layout, nullptr);
+}
+
+void GpuCulling::destroy_object_buffers(const ObjectBuffers &buffers)
+{
+    if (buffers.objectCount == 0)
+        return;
+
+    _engine->destroy_buffer(buffers.objects);
+    _engine->destroy_buffer(buffers.drawCommands);
+    _engine->destroy_buffer(buffers.counts);
+}
+
+void GpuCulling::set_objects(std::vector<GPUObjectData> &&objects, std::vector<IndirectBatch> &&batches)
+{
+    // a list that was never drawn is only referenced by its upload
+    if (_pending.objectCount > 0)
+    {
+        ObjectBuffers stale = _pending;
+        _engine->get_current_frame()._deletionQueue.push_function([this, stale]()
+                                                                 {
+            _engine->_uploader.wait(stale.uploadTicket);
+            destroy_object_buffers(stale); });
+        _pending = {};
+    }
+
+    if (objects.empty())
+        return;
+
+    ObjectBuffers buffers;
+    buffers.objectCount = (uint32_t)objects.size();
+    buffers.batches = std::move(batches);
+
+    buffers.objects = _engine->create_buffer(objects.size() * sizeof(GPUObjectData),
+                                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                             VMA_MEMORY_USAGE_GPU_ONLY);
+    buffers.drawCommands = _engine->create_buffer(objects.size() * sizeof(VkDrawIndexedIndirectCommand),
+                                                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                                  VMA_MEMORY_USAGE_GPU_ONLY);
+    buffers.counts = _engine->create_buffer((COUNT_HEADER + buffers.batches.size()) * sizeof(uint32_t),
+                                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                            VMA_MEMORY_USAGE_GPU_ONLY);
+
+    buffers.objectsAddress = buffer_address(_engine->_device, buffers.objects.buffer);
+    buffers.drawCommandsAddress = buffer_address(_engine->_device, buffers.drawCommands.buffer);
+    buffers.countsAddress = buffer_address(_engine->_device, buffers.counts.buffer);
+
+    buffers.uploadTicket = _engine->_uploader.upload_buffer(buffers.objects.buffer, objects.data(), objects.size() * sizeof(GPUObjectData));
+
+    _pending = std::move(buffers);
+}
+
+void GpuCulling::activate_pending()
+{
+    if (_pending.objectCount == 0 || !_engine->_uploader.is_complete(_pending.uploadTicket))
+        return;
+
+    // the frame still in flight may use the old buffers, they go once this frame slot comes around again
+    if (_active.objectCount > 0)
+    {
+        ObjectBuffers retired = _active;
+        _engine->get_current_frame()._deletionQueue.push_function([this, retired]()
+                                                                 { destroy_object_buffers(retired); });
+    }
+
+    _active = std::move(_pending);
+    _pending = {};
+    _objectCount = _active.objectCount;
+}
+
+CullStats GpuCulling::read_stats(uint32_t frameIndex)
+{
+    FrameResources &frame = _frames[frameIndex];
+
+    CullStats stats = {};
+    if (!frame.recorded)
+        return stats;
+
+    uint32_t counts[COUNT_HEADER];
+    vmaInvalidateAllocation(_engine->_allocator, frame.readback.allocation, 0, VK_WHOLE_SIZE);
+    memcpy(counts, frame.readback.info.pMappedData, sizeof(counts));
+
+    stats.valid = true;
+    stats.totalObjects = frame.readbackObjects;
+    stats.visibleTriangles = counts[0];
+    stats.visibleObjects = counts[1];
+
+    return stats;
+}
+
+void GpuCulling::record_cull(VkCommandBuffer cmd, uint32_t frameIndex, const glm::mat4 &viewproj, bool occlusion)
+{
+    activate_pending();
+
+    FrameResources &frame = _frames[frameIndex];
+    frame.recorded = false;
+
+    if (_objectCount == 0)
+        return;
+
+    // frustum planes in world space ( Gribb / Hartmann ), from the rows of the view projection
+    glm::vec4 row0 = glm::vec4(viewproj[0][0], viewproj[1][0], viewproj[2][0], viewproj[3][0]);
+    glm::vec4 row1 = glm::vec4(viewproj[0][1], viewproj[1][1], viewproj[2][1], viewproj[3][1]);
+    glm::vec4 row2 = glm::vec4(viewproj[0][2], viewproj[1][2], viewproj[2][2], viewproj[3][2]);
+    glm::vec4 row3 = glm::vec4(viewproj[0][3], viewproj[1][3], viewproj[2][3], viewproj[3][3]);
+
+    GPUCullData cullData = {};
+    cullData.frustum[0] = row3 + row0;
+    cullData.frustum[1] = row3 - row0;
+    cullData.frustum[2] = row3 + row1;
+    cullData.frustum[3] = row3 - row1;
+    cullData.frustum[4] = row3 + row2;
+    cullData.frustum[5] = row3 - row2;
+
+    for (glm::vec4 &plane : cullData.frustum)
+        plane /= glm::length(glm::vec3(plane));
+
+    cullData.pyramidViewProj = _pyramidViewProj;
+    cullData.pyramidSize = glm::vec4(_pyramidExtent.width, _pyramidExtent.height, _pyramidLevels, 0);
+    cullData.objectCount = _objectCount;
+    cullData.occlusionEnabled = occlusion && _pyramidValid;
+    cullData.pyramidImage = _pyramidIndex;
+    cullData.pyramidSampler = _reductionSamplerIndex;
+
+    memcpy(frame.cullData.info.pMappedData, &cullData, sizeof(GPUCullData));
+    vmaFlushAllocation(_engine->_allocator, frame.cullData.allocation, 0, VK_WHOLE_SIZE);
+
+    // the counts are shared by the frames in flight, last frame's indirect draw and readback copy read
+    // them before they are zeroed
+    VkMemoryBarrier2 fillBarrier = {.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    fillBarrier.srcStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    fillBarrier.srcAccessMask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_TRANSFER_READ_BIT;
+    fillBarrier.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    fillBarrier.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+
+    VkDependencyInfo fillDependency = {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    fillDependency.memoryBarrierCount = 1;
+    fillDependency.pMemoryBarriers = &fillBarrier;
+    vkCmdPipelineBarrier2(cmd, &fillDependency);
+
+    vkCmdFillBuffer(cmd, _active.counts.buffer, 0, VK_WHOLE_SIZE, 0);
+
+    // counts cleared, last frame's indirect reads of the commands done and its depth pyramid written
+    VkMemoryBarrier2 clearBarrier = {.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    clearBarrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT;
+    clearBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_WRITE_BIT;
+    clearBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    clearBarrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT;
+
+    VkDependencyInfo clearDependency = {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    clearDependency.memoryBarrierCount = 1;
+    clearDependency.pMemoryBarriers = &clearBarrier;
+    vkCmdPipelineBarrier2(cmd, &clearDependency);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullLayout, 0, 1, &_engine->_bindless.set, 0, nullptr);
+
+    CullPushConstants pushConstants;
+    pushConstants.cullData = frame.cullDataAddress;
+    pushConstants.objects = _active.objectsAddress;
+    pushConstants.drawCommands = _active.drawCommandsAddress;
+    pushConstants.counts = _active.countsAddress;
+
+    vkCmdPushConstants(cmd, _cullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &pushConstants);
+
+    vkCmdDispatch(cmd, (_objectCount + 63) / 64, 1, 1);
+
+    // the draws consume the commands and counts, the stats get copied out
+    VkMemoryBarrier2 cullBarrier = {.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    cullBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    cullBarrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT;
+    cullBarrier.dstStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    cullBarrier.dstAccessMask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_TRANSFER_READ_BIT;
+
+    VkDependencyInfo cullDependency = {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    cullDependency.memoryBarrierCount = 1;
+    cullDependency.pMemoryBarriers = &cullBarrier;
+    vkCmdPipelineBarrier2(cmd, &cullDependency);
+
+    VkBufferCopy copy = {};
+    copy.size = COUNT_HEADER * sizeof(uint32_t);
+    vkCmdCopyBuffer(cmd, _active.counts.buffer, frame.readback.buffer, 1, &copy);
+
+    VkMemoryBarrier2 hostBarrier = {.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    hostBarrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    hostBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    hostBarrier.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT;
+
+    VkDependencyInfo hostDependency = {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    hostDependency.memoryBarrierCount = 1;
+    hostDependency.pMemoryBarriers = &hostBarrier;
+    vkCmdPipelineBarrier2(cmd, &hostDependency);
+
+    frame.readbackObjects = _objectCount;
+    frame.recorded = true;
+}
+
+void GpuCulling::record_draws(VkCommandBuffer cmd, const glm::mat4 &viewproj)
+{
+    if (_objectCount == 0)
+        return;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _drawPipeline.pipeline);
+    VkDescriptorSet sets[] = {_engine->_bindless.set, _engine->_frameDataSet};
+    uint32_t dynamicOffsets[] = {_engine->_sceneDataOffset, _engine->_drawDataOffset, _engine->_textureTableOffset};
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _drawPipeline.layout, 0, 2, sets, 3, dynamicOffsets);
+
+    IndirectDrawPushConstants pushConstants = {};
+    pushConstants.viewproj = viewproj;
+    pushConstants.objects = _active.objectsAddress;
+    pushConstants.materialBuffer = _engine->_materialBufferIndex;
+
+    vkCmdPushConstants(cmd, _drawPipeline.layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(IndirectDrawPushConstants), &pushConstants);
+
+    for (uint32_t i = 0; i < (uint32_t)_active.batches.size(); i++)
+    {
+        const IndirectBatch &batch = _active.batches[i];
+
+        vkCmdBindIndexBuffer(cmd, batch.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        vkCmdDrawIndexedIndirectCount(cmd, _active.drawCommands.buffer, batch.firstObject * sizeof(VkDrawIndexedIndirectCommand),
+                                      _active.counts.buffer, (COUNT_HEADER + i) * sizeof(uint32_t),
+                                      batch.objectCount, sizeof(VkDrawIndexedIndirectCommand));
+    }
+}
+
+void GpuCulling::record_depth_pyramid(VkCommandBuffer cmd, DescriptorAllocatorGrowable &frameDescriptors, const AllocatedImage &depthImage, VkExtent2D drawExtent, const glm::mat4 &viewproj)
+{
+    if (!_pyramidValid)
+    {
+        vkutil::transition_image(cmd, _pyramid.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    }
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _reducePipeline);
+
+    for (uint32_t level = 0; level < _pyramidLevels; level++)
+    {
+        VkDescriptorSet set = frameDescriptors.allocate(_engine->_device, _reduceSetLayout);
+
+        DescriptorWriter writer{&_engine->get_current_frame()._frameArena};
+        writer.write_image(0, _pyramidMips[level], VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+        if (level == 0)
+            writer.write_image(1, depthImage.imageView, _reductionSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        else
+            writer.write_image(1, _pyramidMips[level - 1], _reductionSampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        writer.update_set(_engine->_device, set);
+
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _reduceLayout, 0, 1, &set, 0, nullptr);
+
+        uint32_t width = std::max(_pyramidExtent.width >> level, 1u);
+        uint32_t height = std::max(_pyramidExtent.height >> level, 1u);
+
+        ReducePushConstants pushConstants;
+        pushConstants.outSize = glm::vec2(width, height);
+        // only the drawn part of the depth image holds this frame's depth
+        pushConstants.uvScale = level == 0 ? glm::vec2((float)drawExtent.width / depthImage.imageExtent.width, (float)drawExtent.height / depthImage.imageExtent.height) : glm::vec2(1.f);
+
+        vkCmdPushConstants(cmd, _reduceLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ReducePushConstants), &pushConstants);
+        vkCmdDispatch(cmd, (width + 15) / 16, (height + 15) / 16, 1);
+
+        // next level reads this one
+        VkImageMemoryBarrier2 barrier = {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+        barrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.image = _pyramid.image;
+        barrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+        barrier.subresourceRange.baseMipLevel = level;
+        barrier.subresourceRange.levelCount = 1;
+
+        VkDependencyInfo dependency = {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+        dependency.imageMemoryBarrierCount = 1;
+        dependency.pImageMemoryBarriers = &barrier;
+        vkCmdPipelineBarrier2(cmd, &dependency);
+    }
+
+    _pyramidViewProj = viewproj;
+    _pyramidValid = true;
+}
@@ -1,6 +1,8 @@
 #include "render_engine/vk_descriptors.h"
 #include "render_engine/vk_initializers.h"
 
+#include <algorithm>
+
 
 void DescriptorLayoutBuilder::add_binding(uint32_t binding, VkDescriptorType type)
 {
@@ -252,3 +254,173 @@ VkDescriptorSet DescriptorAllocatorGrowable::allocate(VkDevice device, VkDescrip
     readyPools.push_back(poolToUse);
     return ds;
 }
+
+uint32_t BindlessRegistry::Slots::allocate()
+{
+    if (!freeList.empty())
+    {
+        uint32_t index = freeList.back();
+        freeList.pop_back();
+        return index;
+    }
+
+    if (next >= capacity)
+    {
+        fmt::print("Bindless registry is full ( {} slots )\n", capacity);
+        abort();
+    }
+
+    return next++;
+}
+
+void BindlessRegistry::init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t maxImages, uint32_t maxSamplers, uint32_t maxBuffers)
+{
+    VkPhysicalDeviceVulkan12Properties properties12 = {.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES};
+    VkPhysicalDeviceProperties2 properties = {.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
+    properties.pNext = &properties12;
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+    images.capacity = std::min({maxImages, properties12.maxDescriptorSetUpdateAfterBindSampledImages, properties12.maxPerStageDescriptorUpdateAfterBindSampledImages});
+    samplers.capacity = std::min({maxSamplers, properties12.maxDescriptorSetUpdateAfterBindSamplers, properties12.maxPerStageDescriptorUpdateAfterBindSamplers});
+    buffers.capacity = std::min({maxBuffers, properties12.maxDescriptorSetUpdateAfterBindStorageBuffers, properties12.maxPerStageDescriptorUpdateAfterBindStorageBuffers});
+
+    imageViews.assign(images.capacity, VK_NULL_HANDLE);
+
+    VkDescriptorSetLayoutBinding bindings[3] = {};
+    bindings[0] = {SAMPLED_IMAGE_BINDING, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, images.capacity, VK_SHADER_STAGE_ALL, nullptr};
+    bindings[1] = {SAMPLER_BINDING, VK_DESCRIPTOR_TYPE_SAMPLER, samplers.capacity, VK_SHADER_STAGE_ALL, nullptr};
+    bindings[2] = {STORAGE_BUFFER_BINDING, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, buffers.capacity, VK_SHADER_STAGE_ALL, nullptr};
+
+    // slots nobody registered yet are never read, and a slot can be written while other slots are in use by the gpu
+    VkDescriptorBindingFlags flags = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+    VkDescriptorBindingFlags bindingFlags[3] = {flags, flags, flags};
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo = {.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO};
+    bindingFlagsInfo.bindingCount = 3;
+    bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+    layoutInfo.pNext = &bindingFlagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layoutInfo.bindingCount = 3;
+    layoutInfo.pBindings = bindings;
+
+    VK_CHECK(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &layout));
+
+    VkDescriptorPoolSize poolSizes[3] = {
+        {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, images.capacity},
+        {VK_DESCRIPTOR_TYPE_SAMPLER, samplers.capacity},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, buffers.capacity}};
+
+    VkDescriptorPoolCreateInfo pool_info = {.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+    pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    pool_info.maxSets = 1;
+    pool_info.poolSizeCount = 3;
+    pool_info.pPoolSizes = poolSizes;
+
+    VK_CHECK(vkCreateDescriptorPool(device, &pool_info, nullptr, &pool));
+
+    VkDescriptorSetAllocateInfo allocInfo = {.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+    allocInfo.descriptorPool = pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+
+    VK_CHECK(vkAllocateDescriptorSets(device, &allocInfo, &set));
+}
+
+void BindlessRegistry::destroy(VkDevice device)
+{
+    vkDestroyDescriptorPool(device, pool, nullptr);
+    vkDestroyDescriptorSetLayout(device, layout, nullptr);
+}
+
+uint32_t BindlessRegistry::add_image(VkImageView image, VkImageLayout layout)
+{
+    uint32_t index = images.allocate();
+    imageViews[index] = image;
+
+    VkDescriptorImageInfo &info = imageInfos.emplace_back(VkDescriptorImageInfo{
+        .sampler = VK_NULL_HANDLE,
+        .imageView = image,
+        .imageLayout = layout});
+
+    VkWriteDescriptorSet write = {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+    write.dstSet = set;
+    write.dstBinding = SAMPLED_IMAGE_BINDING;
+    write.dstArrayElement = index;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    write.pImageInfo = &info;
+
+    writes.push_back(write);
+    return index;
+}
+
+uint32_t BindlessRegistry::add_sampler(VkSampler sampler)
+{
+    uint32_t index = samplers.allocate();
+
+    VkDescriptorImageInfo &info = imageInfos.emplace_back(VkDescriptorImageInfo{
+        .sampler = sampler,
+        .imageView = VK_NULL_HANDLE,
+        .imageLayout = VK_IMAGE_LAYOUT_UNDEFINED});
+
+    VkWriteDescriptorSet write = {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+    write.dstSet = set;
+    write.dstBinding = SAMPLER_BINDING;
+    write.dstArrayElement = index;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    write.pImageInfo = &info;
+
+    writes.push_back(write);
+    return index;
+}
+
+uint32_t BindlessRegistry::add_buffer(VkBuffer buffer, VkDeviceSize size, VkDeviceSize offset)
+{
+    uint32_t index = buffers.allocate();
+
+    VkDescriptorBufferInfo &info = bufferInfos.emplace_back(VkDescriptorBufferInfo{
+        .buffer = buffer,
+        .offset = offset,
+        .range = size});
+
+    VkWriteDescriptorSet write = {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+    write.dstSet = set;
+    write.dstBinding = STORAGE_BUFFER_BINDING;
+    write.dstArrayElement = index;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &info;
+
+    writes.push_back(write);
+    return index;
+}
+
+void BindlessRegistry::remove_image(uint32_t index)
+{
+    images.freeList.push_back(index);
+}
+
+void BindlessRegistry::remove_sampler(uint32_t index)
+{
+    samplers.freeList.push_back(index);
+}
+
+void BindlessRegistry::remove_buffer(uint32_t index)
+{
+    buffers.freeList.push_back(index);
+}
+
+void BindlessRegistry::flush(VkDevice device)
+{
+    if (writes.empty())
+        return;
+
+    vkUpdateDescriptorSets(device, (uint32_t)writes.size(), writes.data(), 0, nullptr);
+
+    writes.clear();
+    imageInfos.clear();
+    bufferInfos.clear();
+}
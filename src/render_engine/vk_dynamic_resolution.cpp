@@ -0,0 +1,90 @@
+#include "render_engine/vk_dynamic_resolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+void DynamicResolution::init(VkDevice device, uint32_t frameCount, uint32_t timestampValidBits, float timestampPeriod)
+{
+    _timestampPeriod = timestampPeriod;
+
+    _frames.resize(frameCount);
+    for (FrameQueries &frame : _frames)
+    {
+        frame.timestamps.init(device, 1, timestampValidBits);
+    }
+}
+
+void DynamicResolution::destroy(VkDevice device)
+{
+    for (FrameQueries &frame : _frames)
+    {
+        frame.timestamps.destroy(device);
+    }
+    _frames.clear();
+}
+
+void DynamicResolution::update(VkDevice device, uint32_t frameIndex)
+{
+    if (!enabled)
+        _scale = 1.f;
+
+    FrameQueries &frame = _frames[frameIndex];
+    if (!frame.timestamps.read_results(device, _timestampPeriod, _timings) || _timings.empty())
+        return;
+
+    // frames recorded before the last change say nothing about the current scale
+    if (frame.scale != _scale)
+        return;
+
+    float ms = _timings.front().duration_ms;
+    _smoothedMs = _smoothedMs == 0.f ? ms : _smoothedMs + (ms - _smoothedMs) * 0.2f;
+
+    if (!enabled)
+        return;
+
+    // aim a bit below the budget, between the two thresholds the scale stays put so noise can not flip it
+    const float aimMs = targetMs * 0.9f;
+    if (_smoothedMs <= targetMs && _smoothedMs >= aimMs * 0.85f)
+        return;
+
+    // the cost follows the pixel count, the square of the scale. drops are taken quickly, climbs slowly
+    float scale = _scale * std::sqrt(aimMs / std::max(_smoothedMs, 0.01f));
+    scale = std::clamp(scale, _scale - 0.1f, _scale + 0.05f);
+    scale = std::clamp(scale, minScale, std::max(minScale, maxScale));
+
+    if (std::abs(scale - _scale) < 0.01f)
+        return;
+
+    // expected time at the new scale, until the first measurement of it comes back
+    _smoothedMs *= (scale * scale) / (_scale * _scale);
+    _scale = scale;
+}
+
+void DynamicResolution::begin(VkCommandBuffer cmd, uint32_t frameIndex)
+{
+    FrameQueries &frame = _frames[frameIndex];
+    frame.scale = _scale;
+
+    frame.timestamps.reset(cmd);
+    frame.timestamps.begin_scope(cmd, "scaled passes");
+}
+
+void DynamicResolution::end(VkCommandBuffer cmd, uint32_t frameIndex)
+{
+    _frames[frameIndex].timestamps.end_scope(cmd);
+}
+
+VkExtent2D DynamicResolution::scaled_extent(VkExtent2D full) const
+{
+    if (_scale >= 1.f)
+        return full;
+
+    // multiples of 8 match the compute tiles, and a slightly different scale does not change the extent every frame
+    auto scaled = [this](uint32_t size)
+    {
+        uint32_t value = (uint32_t)(size * _scale) & ~7u;
+        return std::clamp(value, std::min(size, 8u), size);
+    };
+
+    return VkExtent2D{scaled(full.width), scaled(full.height)};
+}
@@ -2,31 +2,59 @@
 #include "render_engine/vk_mem_alloc.h"
 
 #include "render_engine/vk_engine.h"
+#include "render_engine/alloc_counter.h"
 #include "render_engine/vk_images.h"
+#include "render_engine/ktx2.h"
 #include "render_engine/vk_descriptors.h"
 #include "render_engine/vk_initializers.h"
+#include "render_engine/vk_loader.h"
 #include "render_engine/vk_pipelines.h"
 #include "render_engine/vk_types.h"
+#include "render_engine/png_writer.h"
+#include "render_engine/texture_cooker.h"
+
+#include "core/job_system.h"
 
 #include "third_party/imgui/imgui.h"
 #include "third_party/imgui/backends/imgui_impl_sdl3.h"
 #include "third_party/imgui/backends/imgui_impl_vulkan.h"
 
+#include <glm/gtc/packing.hpp>
 #include <glm/gtx/transform.hpp>
 
+#include <stb/stb_image.h>
+
 #include <VkBootstrap.h>
 
 #include <iostream>
 
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_vulkan.h>
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
 #include <thread>
+#include <unordered_map>
 
 std::string SHADERS_PATH = "../src/render_engine/shaders/";
 
 constexpr bool bUseValidationLayers = true;
 
+// upper bound of threads recording geometry in parallel, and the smallest slice of draws worth a thread
+constexpr uint32_t MAX_RECORD_THREADS = 64;
+constexpr uint32_t MIN_DRAWS_PER_CHUNK = 64;
+
+// entries in the bindless material table
+constexpr uint32_t MAX_MATERIALS = 4096;
+
+// vertical field of view of the camera, the texture streaming heuristic projects with it as well
+constexpr float CAMERA_FOV_DEGREES = 70.f;
+
+// relative to the working directory, like the shaders
+constexpr const char *PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+
 VulkanEngine *loadedEngine = nullptr;
 
 VulkanEngine &VulkanEngine::Get() { return *loadedEngine; }
@@ -38,15 +66,18 @@ void VulkanEngine::init()
     loadedEngine = this;
 
     // We initialize SDL and create a window with it.
-    SDL_Init(SDL_INIT_VIDEO);
+    if (!_headless)
+    {
+        SDL_Init(SDL_INIT_VIDEO);
 
-    SDL_WindowFlags window_flags = (SDL_WindowFlags)(SDL_WINDOW_VULKAN);
+        SDL_WindowFlags window_flags = (SDL_WindowFlags)(SDL_WINDOW_VULKAN);
 
-    _window = SDL_CreateWindow(
-        "Collaboration v1.0",
-        _windowExtent.width,
-        _windowExtent.height,
-        window_flags);
+        _window = SDL_CreateWindow(
+            "Collaboration v1.0",
+            _windowExtent.width,
+            _windowExtent.height,
+            window_flags);
+    }
 
     init_vulkan();
 
@@ -56,11 +87,24 @@ void VulkanEngine::init()
 
     init_sync_structures();
 
+    init_uploader();
+
+    init_profiler();
+
     init_descriptors();
 
+    init_bindless();
+
+    init_frame_data();
+
     init_pipelines();
 
-    init_imgui();
+    // imgui draws into the swapchain, there is nothing to show it on without a window
+    if (!_headless)
+        init_imgui();
+
+    mainCamera.velocity = glm::vec3(0.f);
+    mainCamera.position = glm::vec3(0.f, 0.f, 5.f);
 
     _isInitialized = true;
 }
@@ -74,6 +118,7 @@ void VulkanEngine::init_vulkan()
                         .request_validation_layers(bUseValidationLayers)
                         .use_default_debug_messenger()
                         .require_api_version(1, 3, 0)
+                        .set_headless(_headless)
                         .build();
 
     vkb::Instance vkb_inst = inst_ret.value();
@@ -82,7 +127,8 @@ void VulkanEngine::init_vulkan()
     _instance = vkb_inst.instance;
     _debug_messenger = vkb_inst.debug_messenger;
 
-    SDL_Vulkan_CreateSurface(_window, _instance, NULL, &_surface);
+    if (!_headless)
+        SDL_Vulkan_CreateSurface(_window, _instance, NULL, &_surface);
 
     VkPhysicalDeviceVulkan13Features features13{};
     features13.dynamicRendering = true;
@@ -94,15 +140,33 @@ void VulkanEngine::init_vulkan()
     features12.descriptorBindingPartiallyBound = true;
     features12.descriptorBindingVariableDescriptorCount = true;
     features12.runtimeDescriptorArray = true;
+    features12.timelineSemaphore = true;
+    features12.descriptorBindingSampledImageUpdateAfterBind = true;
+    features12.descriptorBindingStorageBufferUpdateAfterBind = true;
+    features12.descriptorBindingUpdateUnusedWhilePending = true;
+    features12.shaderSampledImageArrayNonUniformIndexing = true;
+    features12.drawIndirectCount = true;
+    features12.samplerFilterMinmax = true;
 
     VkPhysicalDeviceFeatures features{};
     features.fillModeNonSolid = true;
     features.geometryShader = true;
+    features.shaderSampledImageArrayDynamicIndexing = true;
+    features.shaderStorageBufferArrayDynamicIndexing = true;
+    features.multiDrawIndirect = true;
+    features.drawIndirectFirstInstance = true;
 
     // use vkbootstrap to select a gpu.
     // We want a gpu that can write to the SDL surface and supports vulkan 1.2
     vkb::PhysicalDeviceSelector selector{vkb_inst};
-    vkb::PhysicalDevice physicalDevice = selector.set_minimum_version(1, 3).set_required_features(features).set_required_features_13(features13).set_required_features_12(features12).set_surface(_surface).select().value();
+    selector.set_minimum_version(1, 3).set_required_features(features).set_required_features_13(features13).set_required_features_12(features12);
+    if (!_headless)
+        selector.set_surface(_surface);
+
+    // heap usage and budget for the memory panel and the texture streamer, vma estimates them without it
+    selector.add_desired_extension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    vkb::PhysicalDevice physicalDevice = selector.select().value();
 
     // physicalDevice.features.
     // create the final vulkan device
@@ -120,13 +184,34 @@ void VulkanEngine::init_vulkan()
 
     _graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
+    // uploads go through a dedicated transfer queue if the device exposes one
+    auto transferQueue = vkbDevice.get_dedicated_queue(vkb::QueueType::transfer);
+    if (transferQueue)
+    {
+        _transferQueue = transferQueue.value();
+        _transferQueueFamily = vkbDevice.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+    }
+    else
+    {
+        _transferQueue = _graphicsQueue;
+        _transferQueueFamily = _graphicsQueueFamily;
+    }
+
+    // compute of a family without graphics can overlap the graphics queue, otherwise it stays on the graphics queue
+    auto computeQueue = vkbDevice.get_separate_queue(vkb::QueueType::compute);
+    if (computeQueue)
+    {
+        _computeQueue = computeQueue.value();
+        _computeQueueFamily = vkbDevice.get_separate_queue_index(vkb::QueueType::compute).value();
+        _hasAsyncCompute = true;
+    }
+
     // initialize the memory allocator
-    VmaAllocatorCreateInfo allocatorInfo = {};
-    allocatorInfo.physicalDevice = _chosenGPU;
-    allocatorInfo.device = _device;
-    allocatorInfo.instance = _instance;
-    allocatorInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
-    vmaCreateAllocator(&allocatorInfo, &_allocator);
+    std::vector<std::string> extensions = physicalDevice.get_extensions();
+    bool memoryBudget = std::find(extensions.begin(), extensions.end(), VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) != extensions.end();
+
+    _memory.init(_instance, _chosenGPU, _device, memoryBudget);
+    _allocator = _memory.allocator();
 
     std::cout << "Vulkan initialized" << std::endl;
     std::cout << "GPU: " << physicalDevice.name << std::endl;
@@ -136,6 +221,12 @@ void VulkanEngine::init_vulkan()
     // Limits
     VkPhysicalDeviceLimits limits = physicalDevice.properties.limits;
     //print_physical_device_limits(limits);
+
+    _timestampPeriod = limits.timestampPeriod;
+    _bufferOffsetAlignment = std::max(limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment);
+    _timestampValidBits = physicalDevice.get_queue_families()[_graphicsQueueFamily].timestampValidBits;
+    if (_hasAsyncCompute)
+        _computeTimestampValidBits = physicalDevice.get_queue_families()[_computeQueueFamily].timestampValidBits;
 }
 
 void VulkanEngine::print_physical_device_limits(const VkPhysicalDeviceLimits& limits) {
@@ -259,7 +350,11 @@ void VulkanEngine::print_physical_device_limits(const VkPhysicalDeviceLimits& li
 
 void VulkanEngine::init_swapchain()
 {
-    create_swapchain(_windowExtent.width, _windowExtent.height);
+    // headless frames end in the draw image, the blit extent just follows it
+    if (_headless)
+        _swapchainExtent = _windowExtent;
+    else
+        create_swapchain(_windowExtent.width, _windowExtent.height);
 
     // depth image size will match the window
     VkExtent3D drawImageExtent = {
@@ -273,6 +368,8 @@ void VulkanEngine::init_swapchain()
 
     VkImageUsageFlags drawImageUsages{};
     drawImageUsages |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    // the background comes in as a copy when it is rendered on the compute queue
+    drawImageUsages |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
     drawImageUsages |= VK_IMAGE_USAGE_STORAGE_BIT;
     drawImageUsages |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
@@ -284,38 +381,63 @@ void VulkanEngine::init_swapchain()
     rimg_allocinfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
     // allocate and create the image
-    vmaCreateImage(_allocator, &rimg_info, &rimg_allocinfo, &_drawImage.image, &_drawImage.allocation, nullptr);
+    VK_CHECK(vmaCreateImage(_allocator, &rimg_info, &rimg_allocinfo, &_drawImage.image, &_drawImage.allocation, nullptr));
+    _memory.tag(_drawImage.allocation, MemoryCategory::RenderTargets);
 
     // build a image-view for the draw image to use for rendering
     VkImageViewCreateInfo rview_info = vkinit::imageview_create_info(_drawImage.imageFormat, _drawImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
 
     VK_CHECK(vkCreateImageView(_device, &rview_info, nullptr, &_drawImage.imageView));
 
-    // create a depth image too
+    // one background target per frame slot for the compute queue, a frame's background is written
+    // while the graphics queue may still read the one of the frame before
+    if (_hasAsyncCompute)
+    {
+        VkImageUsageFlags backgroundUsages = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        VkImageCreateInfo bimg_info = vkinit::image_create_info(_drawImage.imageFormat, backgroundUsages, drawImageExtent);
+
+        for (FrameData &frame : _frames)
+        {
+            frame._backgroundImage.imageFormat = _drawImage.imageFormat;
+            frame._backgroundImage.imageExtent = drawImageExtent;
+            VK_CHECK(vmaCreateImage(_allocator, &bimg_info, &rimg_allocinfo, &frame._backgroundImage.image, &frame._backgroundImage.allocation, nullptr));
+            _memory.tag(frame._backgroundImage.allocation, MemoryCategory::RenderTargets);
+
+            VkImageViewCreateInfo bview_info = vkinit::imageview_create_info(_drawImage.imageFormat, frame._backgroundImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+            VK_CHECK(vkCreateImageView(_device, &bview_info, nullptr, &frame._backgroundImage.imageView));
+        }
+
+        _mainDeletionQueue.push_function([this]()
+                                         {
+            for (FrameData &frame : _frames)
+            {
+                destroy_image(frame._backgroundImage);
+            } });
+    }
+
+    // the depth image is a transient image of the render graph, only its format is fixed up front.
     // hardcoding the draw format to 32 bit float
     _depthImage.imageFormat = VK_FORMAT_D32_SFLOAT;
     _depthImage.imageExtent = drawImageExtent;
-    VkImageUsageFlags depthImageUsages{};
-    depthImageUsages |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
 
-    VkImageCreateInfo dimg_info = vkinit::image_create_info(_depthImage.imageFormat, depthImageUsages, drawImageExtent);
+    _renderGraph.init(_device, &_memory, MAX_FRAMES_IN_FLIGHT);
 
-    // allocate and create the image
-    vmaCreateImage(_allocator, &dimg_info, &rimg_allocinfo, &_depthImage.image, &_depthImage.allocation, nullptr);
-
-    // build a image-view for the draw image to use for rendering
-    VkImageViewCreateInfo dview_info = vkinit::imageview_create_info(_depthImage.imageFormat, _depthImage.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+    // headless captures copy the draw image out as it is, 8 bytes per RGBA16F texel
+    if (_headless && !_headlessSettings.capturePath.empty())
+    {
+        _captureBuffer = create_buffer((size_t)drawImageExtent.width * drawImageExtent.height * 8, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU,
+                                       MemoryCategory::Staging);
 
-    VK_CHECK(vkCreateImageView(_device, &dview_info, nullptr, &_depthImage.imageView));
+        _mainDeletionQueue.push_function([this]()
+                                         { destroy_buffer(_captureBuffer); });
+    }
 
     // add to deletion queues
     _mainDeletionQueue.push_function([this]()
                                      {
-		vkDestroyImageView(_device, _drawImage.imageView, nullptr);
-		vmaDestroyImage(_allocator, _drawImage.image, _drawImage.allocation);
+		destroy_image(_drawImage);
 
-		vkDestroyImageView(_device, _depthImage.imageView, nullptr);
-		vmaDestroyImage(_allocator, _depthImage.image, _depthImage.allocation); });
+		_renderGraph.cleanup(); });
 }
 
 void VulkanEngine::create_swapchain(uint32_t width, uint32_t height)
@@ -324,16 +446,37 @@ void VulkanEngine::create_swapchain(uint32_t width, uint32_t height)
 
     _swapchainImageFormat = VK_FORMAT_B8G8R8A8_UNORM;
 
+    uint32_t modeCount = 0;
+    VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(_chosenGPU, _surface, &modeCount, nullptr));
+    _supportedPresentModes.resize(modeCount);
+    VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(_chosenGPU, _surface, &modeCount, _supportedPresentModes.data()));
+
+    // fifo is the only mode every surface has to support
+    VkPresentModeKHR presentMode = _presentMode;
+    if (std::find(_supportedPresentModes.begin(), _supportedPresentModes.end(), presentMode) == _supportedPresentModes.end())
+    {
+        fmt::print("present mode {} is not supported, using fifo\n", string_VkPresentModeKHR(presentMode));
+        presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    }
+
     vkb::Swapchain vkbSwapchain = swapchainBuilder
                                       //.use_default_format_selection()
                                       .set_desired_format(VkSurfaceFormatKHR{.format = _swapchainImageFormat, .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR})
-                                      // use vsync present mode
-                                      .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
+                                      .set_desired_present_mode(presentMode)
                                       .set_desired_extent(width, height)
                                       .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
                                       .build()
                                       .value();
 
+    _activePresentMode = vkbSwapchain.present_mode;
+
+    // the latency estimate adds the wait for the display
+    if (const SDL_DisplayMode *displayMode = SDL_GetCurrentDisplayMode(SDL_GetDisplayForWindow(_window)))
+    {
+        if (displayMode->refresh_rate > 0.f)
+            _displayRefreshRate = displayMode->refresh_rate;
+    }
+
     _swapchainExtent = vkbSwapchain.extent;
     // store swapchain and its related images
     _swapchain = vkbSwapchain.swapchain;
@@ -374,7 +517,7 @@ void VulkanEngine::init_commands()
     // we also want the pool to allow for resetting of individual command buffers
     VkCommandPoolCreateInfo commandPoolInfo = vkinit::command_pool_create_info(_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
 
-    for (int i = 0; i < FRAME_OVERLAP; i++)
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     {
         VK_CHECK(vkCreateCommandPool(_device, &commandPoolInfo, nullptr, &_frames[i]._commandPool));
 
@@ -382,6 +525,20 @@ void VulkanEngine::init_commands()
         VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(_frames[i]._commandPool, 1);
 
         VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_frames[i]._mainCommandBuffer));
+
+        // per thread pools for the secondary command buffers recorded by the job system, reset as a whole every frame
+        uint32_t threadCount = std::clamp(JobSystem::Get().thread_count(), 1u, MAX_RECORD_THREADS);
+        VkCommandPoolCreateInfo threadPoolInfo = vkinit::command_pool_create_info(_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+
+        _frames[i]._threadCommandPools.resize(threadCount);
+        _frames[i]._threadCommandBuffers.resize(threadCount);
+        for (uint32_t t = 0; t < threadCount; t++)
+        {
+            VK_CHECK(vkCreateCommandPool(_device, &threadPoolInfo, nullptr, &_frames[i]._threadCommandPools[t]));
+
+            VkCommandBufferAllocateInfo secondaryAllocInfo = vkinit::command_buffer_allocate_info(_frames[i]._threadCommandPools[t], 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+            VK_CHECK(vkAllocateCommandBuffers(_device, &secondaryAllocInfo, &_frames[i]._threadCommandBuffers[t]));
+        }
     }
 
     VK_CHECK(vkCreateCommandPool(_device, &commandPoolInfo, nullptr, &_immCommandPool));
@@ -393,8 +550,12 @@ void VulkanEngine::init_commands()
 
     _mainDeletionQueue.push_function([this]()
                                      { vkDestroyCommandPool(_device, _immCommandPool, nullptr);
-                                        vkDestroyCommandPool(_device, _frames[0]._commandPool, nullptr);
-                                        vkDestroyCommandPool(_device, _frames[1]._commandPool, nullptr); });
+                                        for (FrameData &frame : _frames)
+                                        {
+                                            vkDestroyCommandPool(_device, frame._commandPool, nullptr);
+                                            for (VkCommandPool pool : frame._threadCommandPools)
+                                                vkDestroyCommandPool(_device, pool, nullptr);
+                                        } });
 }
 
 void VulkanEngine::init_sync_structures()
@@ -410,7 +571,7 @@ void VulkanEngine::init_sync_structures()
     _mainDeletionQueue.push_function([this]()
                                      { vkDestroyFence(_device, _immFence, nullptr); });
 
-    for (int i = 0; i < FRAME_OVERLAP; i++)
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     {
 
         VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_frames[i]._renderFence));
@@ -428,6 +589,150 @@ void VulkanEngine::init_sync_structures()
     }
 }
 
+void VulkanEngine::init_uploader()
+{
+    // 64 MB of staging space, bigger uploads get a dedicated staging buffer
+    _uploader.init(_device, &_memory, _transferQueue, _transferQueueFamily, _graphicsQueueFamily, 64 * 1024 * 1024);
+
+    _mainDeletionQueue.push_function([this]()
+                                     { _uploader.cleanup(); });
+
+    if (_hasAsyncCompute)
+    {
+        _asyncCompute.init(_device, _computeQueue, _computeQueueFamily, _graphicsQueueFamily, MAX_FRAMES_IN_FLIGHT, _computeTimestampValidBits);
+
+        _mainDeletionQueue.push_function([this]()
+                                         { _asyncCompute.cleanup(); });
+    }
+}
+
+void VulkanEngine::init_profiler()
+{
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        _frames[i]._gpuTimestamps.init(_device, 32, _timestampValidBits);
+
+        // grows on its own when a frame needs more
+        _frames[i]._frameArena.init(64 * 1024);
+    }
+
+    _dynamicResolution.init(_device, MAX_FRAMES_IN_FLIGHT, _timestampValidBits, _timestampPeriod);
+
+    _mainDeletionQueue.push_function([this]()
+                                     {
+        for (FrameData &frame : _frames)
+            frame._gpuTimestamps.destroy(_device);
+        _dynamicResolution.destroy(_device); });
+}
+
+void VulkanEngine::init_bindless()
+{
+    _bindless.init(_device, _chosenGPU, 16384, 32, 1024);
+
+    _mainDeletionQueue.push_function([this]()
+                                     { _bindless.destroy(_device); });
+
+    VkSamplerCreateInfo sampl = {.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+    sampl.magFilter = VK_FILTER_LINEAR;
+    sampl.minFilter = VK_FILTER_LINEAR;
+    sampl.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    sampl.maxLod = VK_LOD_CLAMP_NONE;
+    VK_CHECK(vkCreateSampler(_device, &sampl, nullptr, &_defaultSamplerLinear));
+
+    uint32_t white = 0xFFFFFFFF;
+    _whiteImage = create_image((void *)&white, VkExtent3D{1, 1, 1}, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, false);
+
+    // material table, every MaterialInstance is an index into it
+    _materialBuffer = create_buffer(MAX_MATERIALS * sizeof(GPUGLTFMaterial), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+
+    _mainDeletionQueue.push_function([this]()
+                                     {
+        destroy_buffer(_materialBuffer);
+        destroy_image(_whiteImage);
+        vkDestroySampler(_device, _defaultSamplerLinear, nullptr); });
+
+    // slot 0 of every array is the fallback
+    _whiteImageIndex = _bindless.add_image(_whiteImage.imageView);
+    _defaultSamplerIndex = _bindless.add_sampler(_defaultSamplerLinear);
+    _materialBufferIndex = _bindless.add_buffer(_materialBuffer.buffer, MAX_MATERIALS * sizeof(GPUGLTFMaterial));
+}
+
+void VulkanEngine::init_frame_data()
+{
+    // room for the scene data and roughly 50k draws per frame
+    _frameRing.init(&_memory, 4 * 1024 * 1024, MAX_FRAMES_IN_FLIGHT, _bufferOffsetAlignment);
+
+    {
+        DescriptorLayoutBuilder builder;
+        builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+        builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC);
+        builder.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC);
+        _frameDataLayout = builder.build(_device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+    }
+
+    // the offsets only come in at bind time, the draw array may span a whole frame region
+    _frameDataSet = globalDescriptorAllocator.allocate(_device, _frameDataLayout);
+    {
+        DescriptorWriter writer;
+        writer.write_buffer(0, _frameRing.buffer(), sizeof(GPUSceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+        writer.write_buffer(1, _frameRing.buffer(), _frameRing.frame_size(), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC);
+        writer.write_buffer(2, _frameRing.buffer(), _frameRing.frame_size(), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC);
+        writer.update_set(_device, _frameDataSet);
+    }
+
+    _mainDeletionQueue.push_function([this]()
+                                     {
+        vkDestroyDescriptorSetLayout(_device, _frameDataLayout, nullptr);
+        _frameRing.destroy(); });
+
+    // streamed textures show the white image until their tail arrives
+    _textureStreamer.init(this, _whiteImageIndex, 512 * 1024 * 1024);
+
+    _mainDeletionQueue.push_function([this]()
+                                     { _textureStreamer.cleanup(); });
+}
+
+StreamedTexture VulkanEngine::load_texture(const std::string &path)
+{
+    std::unique_ptr<TextureSource> source;
+    if (path.ends_with(".ktx2"))
+    {
+        source = Ktx2TextureSource::open(path);
+    }
+    else
+    {
+        int width, height, channels;
+        stbi_uc *pixels = stbi_load(path.c_str(), &width, &height, &channels, 4);
+        if (pixels != nullptr)
+        {
+            source = std::make_unique<MemoryTextureSource>(pixels, VkExtent2D{(uint32_t)width, (uint32_t)height});
+            stbi_image_free(pixels);
+        }
+    }
+
+    if (!source)
+    {
+        fmt::print("failed to load texture {}\n", path);
+        return StreamedTexture{};
+    }
+
+    return _textureStreamer.add(std::move(source));
+}
+
+uint32_t VulkanEngine::add_material(const GPUGLTFMaterial &material)
+{
+    if (_materialCount >= MAX_MATERIALS)
+    {
+        fmt::print("Material table is full ( {} materials )\n", MAX_MATERIALS);
+        abort();
+    }
+
+    uint32_t index = _materialCount++;
+    _uploader.upload_buffer(_materialBuffer.buffer, &material, sizeof(GPUGLTFMaterial), index * sizeof(GPUGLTFMaterial));
+
+    return index;
+}
+
 void VulkanEngine::init_descriptors()
 {
     // create a descriptor pool
@@ -435,6 +740,8 @@ void VulkanEngine::init_descriptors()
         {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 3},
         {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3},
         {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 2},
     };
 
     globalDescriptorAllocator.init_pool(_device, 10, sizes);
@@ -461,7 +768,7 @@ void VulkanEngine::init_descriptors()
         writer.update_set(_device, _drawImageDescriptors);
     }
 
-    for (int i = 0; i < FRAME_OVERLAP; i++)
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     {
         // create a descriptor pool
         std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> frame_sizes = {
@@ -478,7 +785,7 @@ void VulkanEngine::init_descriptors()
     }
 }
 
-AllocatedBuffer VulkanEngine::create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage)
+AllocatedBuffer VulkanEngine::create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, MemoryCategory category)
 {
     // allocate buffer
     VkBufferCreateInfo bufferInfo = {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
@@ -495,49 +802,336 @@ AllocatedBuffer VulkanEngine::create_buffer(size_t allocSize, VkBufferUsageFlags
     // allocate the buffer
     VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &newBuffer.buffer, &newBuffer.allocation,
                              &newBuffer.info));
+    _memory.tag(newBuffer.allocation, category);
 
     return newBuffer;
 }
 
 void VulkanEngine::destroy_buffer(const AllocatedBuffer &buffer)
 {
+    _memory.untag(buffer.allocation);
     vmaDestroyBuffer(_allocator, buffer.buffer, buffer.allocation);
 }
 
-void VulkanEngine::init_pipelines()
+GPUMeshBuffers VulkanEngine::upload_mesh(std::span<const uint32_t> indices, std::span<const Vertex> vertices, uint64_t &ticket)
 {
-    init_background_pipelines();
+    const size_t vertexBufferSize = vertices.size() * sizeof(Vertex);
+    const size_t indexBufferSize = indices.size() * sizeof(uint32_t);
 
-    init_triangle_pipeline();
+    GPUMeshBuffers newSurface;
+
+    // vertex buffer is read through its device address, never bound
+    newSurface.vertexBuffer = create_buffer(vertexBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                            VMA_MEMORY_USAGE_GPU_ONLY, MemoryCategory::Meshes);
+
+    VkBufferDeviceAddressInfo deviceAdressInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = newSurface.vertexBuffer.buffer};
+    newSurface.vertexBufferAddress = vkGetBufferDeviceAddress(_device, &deviceAdressInfo);
+
+    newSurface.indexBuffer = create_buffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                           VMA_MEMORY_USAGE_GPU_ONLY, MemoryCategory::Meshes);
+
+    // both copies go out in the same transfer batch, so the second ticket covers the first
+    _uploader.upload_buffer(newSurface.vertexBuffer.buffer, vertices.data(), vertexBufferSize);
+    ticket = _uploader.upload_buffer(newSurface.indexBuffer.buffer, indices.data(), indexBufferSize);
+
+    return newSurface;
 }
 
-void VulkanEngine::init_triangle_pipeline()
+void VulkanEngine::load_scene_async(const std::string &path)
 {
-    VkShaderModule triangleFragShader;
-    if (!vkutil::load_shader_module("../src/render_engine/shaders/colored_triangle.frag.spv", _device, &triangleFragShader))
+    auto request = std::make_unique<SceneLoadRequest>();
+    request->path = path;
+
+    // assimp blocks for the whole import, a dedicated thread keeps it from stalling a job system worker
+    // the frame loop might be waiting on. the per mesh work inside still goes wide on the job system
+    SceneLoadRequest *load = request.get();
+    load->thread = std::thread([load]()
+                               {
+        load->cooked = load_cooked_mesh_scene(load->path, load->imported);
+        if (load->cooked)
+            load->materials = load->cooked->materials();
+        else if (load->imported)
+            load->materials = load->imported->materials;
+
+        // BC7 from the texture cache, so the frame that picks the scene up only reads the file headers
+        for (SceneMaterial &material : load->materials)
+        {
+            if (!material.colorTexture.empty())
+                material.colorTexture = load_cooked_texture(material.colorTexture, TextureKind::Color);
+        }
+        load->done.store(true, std::memory_order_release); });
+
+    _sceneLoads.push_back(std::move(request));
+}
+
+void VulkanEngine::update_scene()
+{
+    // pick up finished imports and queue their uploads
+    for (auto it = _sceneLoads.begin(); it != _sceneLoads.end();)
     {
-        fmt::print("Error when building the triangle fragment shader module");
+        SceneLoadRequest &load = **it;
+        if (!load.done.load(std::memory_order_acquire))
+        {
+            it++;
+            continue;
+        }
+
+        load.thread.join();
+
+        auto scene = std::make_shared<MeshScene>();
+        scene->name = load.path;
+
+        // the cooked geometry is copied from the mapping straight into the staging ring
+        if (load.cooked && !load.cooked->indices().empty())
+        {
+            scene->surfaces = load.cooked->surfaces();
+            scene->instances = load.cooked->instances();
+            scene->meshBuffers = upload_mesh(load.cooked->indices(), load.cooked->vertices(), scene->uploadTicket);
+            create_scene_materials(*scene, load.materials);
+
+            loadedScenes.push_back(scene);
+        }
+        else if (load.imported && !load.imported->indices.empty())
+        {
+            MeshSceneData &data = *load.imported;
+
+            scene->surfaces = std::move(data.surfaces);
+            scene->instances = std::move(data.instances);
+            scene->meshBuffers = upload_mesh(data.indices, data.vertices, scene->uploadTicket);
+            create_scene_materials(*scene, load.materials);
+
+            loadedScenes.push_back(scene);
+        }
+
+        it = _sceneLoads.erase(it);
     }
-    else
+
+    mainCamera.update();
+
+    glm::mat4 view = mainCamera.getViewMatrix();
+
+    // camera projection, reversed depth so near is 1 and far is 0
+    glm::mat4 projection = glm::perspective(glm::radians(CAMERA_FOV_DEGREES), (float)_windowExtent.width / (float)_windowExtent.height, 10000.f, 0.1f);
+
+    // invert the Y direction on projection matrix so that we are more similar to opengl and gltf axis
+    projection[1][1] *= -1;
+
+    sceneData.view = view;
+    sceneData.proj = projection;
+    sceneData.viewproj = projection * view;
+
+    mainDrawContext.OpaqueSurfaces.clear();
+
+    if (_gpuDriven)
     {
-        fmt::print("Triangle fragment shader succesfully loaded\n");
+        update_culling_objects();
+        return;
     }
 
-    VkShaderModule triangleVertexShader;
-    if (!vkutil::load_shader_module("../src/render_engine/shaders/colored_triangle.vert.spv", _device, &triangleVertexShader))
+    for (const std::shared_ptr<MeshScene> &scene : loadedScenes)
     {
-        fmt::print("Error when building the triangle vertex shader module");
+        // drawn once the graphics queue has taken the buffers over
+        if (!_uploader.is_complete(scene->uploadTicket))
+            continue;
+
+        for (const MeshInstance &instance : scene->instances)
+        {
+            const GeoSurface &surface = scene->surfaces[instance.surface];
+
+            RenderObject draw;
+            draw.indexCount = surface.count;
+            draw.firstIndex = surface.startIndex;
+            draw.indexBuffer = scene->meshBuffers.indexBuffer.buffer;
+            draw.material = surface.material < scene->materials.size() ? &scene->materials[surface.material] : &_defaultMaterial;
+            draw.transform = instance.transform;
+            draw.vertexBufferAddress = scene->meshBuffers.vertexBufferAddress + surface.firstVertex * sizeof(Vertex);
+
+            mainDrawContext.OpaqueSurfaces.push_back(draw);
+        }
     }
-    else
+}
+
+void VulkanEngine::create_scene_materials(MeshScene &scene, const std::vector<SceneMaterial> &materials)
+{
+    // materials of one scene often share their images, each file is streamed once
+    std::unordered_map<std::string, StreamedTexture> textures;
+
+    for (const SceneMaterial &material : materials)
+    {
+        StreamedTexture texture;
+        if (!material.colorTexture.empty())
+        {
+            auto [it, inserted] = textures.try_emplace(material.colorTexture);
+            if (inserted)
+                it->second = load_texture(material.colorTexture);
+            texture = it->second;
+        }
+
+        GPUGLTFMaterial gpuMaterial = {};
+        gpuMaterial.colorFactors = material.colorFactors;
+        gpuMaterial.metal_rough_factors = glm::vec4(1.f, 0.5f, 0.f, 0.f);
+        gpuMaterial.textures = glm::uvec4(texture.valid() ? TextureStreamer::material_index(texture) : _whiteImageIndex, _whiteImageIndex, _defaultSamplerIndex, 0);
+
+        MaterialInstance instance;
+        instance.pipeline = &_meshPipeline;
+        instance.materialIndex = add_material(gpuMaterial);
+        instance.passType = MaterialPass::MainColor;
+
+        scene.materials.push_back(instance);
+        scene.materialTextures.push_back(texture);
+    }
+}
+
+void VulkanEngine::request_texture_levels()
+{
+    // pixels a unit long object covers at a distance of one, same projection as update_scene
+    float pixelsPerUnit = (float)_windowExtent.height / (2.f * std::tan(glm::radians(CAMERA_FOV_DEGREES) * 0.5f));
+
+    for (const std::shared_ptr<MeshScene> &scene : loadedScenes)
+    {
+        if (scene->materialTextures.empty() || !_uploader.is_complete(scene->uploadTicket))
+            continue;
+
+        for (const MeshInstance &instance : scene->instances)
+        {
+            const GeoSurface &surface = scene->surfaces[instance.surface];
+            if (surface.material >= scene->materialTextures.size() || !scene->materialTextures[surface.material].valid())
+                continue;
+
+            // the texture is assumed to span the surface once, so it needs as many texels as the bounds cover pixels
+            glm::vec3 center = glm::vec3(instance.transform * glm::vec4(glm::vec3(surface.bounds), 1.f));
+            float scale = std::max({glm::length(glm::vec3(instance.transform[0])), glm::length(glm::vec3(instance.transform[1])), glm::length(glm::vec3(instance.transform[2]))});
+            float radius = surface.bounds.w * scale;
+
+            float distance = std::max(glm::length(center - mainCamera.position) - radius, 0.1f);
+            _textureStreamer.request_screen_size(scene->materialTextures[surface.material], 2.f * radius * pixelsPerUnit / distance);
+        }
+    }
+}
+
+void VulkanEngine::update_culling_objects()
+{
+    // scenes become resident in load order, so the count of uploaded ones identifies the set
+    size_t residentScenes = 0;
+    while (residentScenes < loadedScenes.size() && _uploader.is_complete(loadedScenes[residentScenes]->uploadTicket))
+        residentScenes++;
+
+    if (residentScenes == _culledSceneCount)
+        return;
+
+    _culledSceneCount = residentScenes;
+
+    std::vector<GPUObjectData> objects;
+    std::vector<IndirectBatch> batches;
+
+    // one batch per scene, its objects share the index buffer
+    for (size_t s = 0; s < residentScenes; s++)
     {
-        fmt::print("Triangle vertex shader succesfully loaded\n");
+        const MeshScene &scene = *loadedScenes[s];
+
+        IndirectBatch batch;
+        batch.indexBuffer = scene.meshBuffers.indexBuffer.buffer;
+        batch.firstObject = (uint32_t)objects.size();
+        batch.objectCount = (uint32_t)scene.instances.size();
+
+        for (const MeshInstance &instance : scene.instances)
+        {
+            const GeoSurface &surface = scene.surfaces[instance.surface];
+
+            GPUObjectData object = {};
+            object.transform = instance.transform;
+            object.sphere = surface.bounds;
+            object.vertexBuffer = scene.meshBuffers.vertexBufferAddress + surface.firstVertex * sizeof(Vertex);
+            object.firstIndex = surface.startIndex;
+            object.indexCount = surface.count;
+            object.materialIndex = surface.material < scene.materials.size() ? scene.materials[surface.material].materialIndex : _defaultMaterial.materialIndex;
+            object.batch = (uint32_t)batches.size();
+            object.commandBase = batch.firstObject;
+
+            objects.push_back(object);
+        }
+
+        if (batch.objectCount > 0)
+            batches.push_back(batch);
     }
 
+    _gpuCulling.set_objects(std::move(objects), std::move(batches));
+}
+
+void VulkanEngine::init_pipelines()
+{
+    auto start = std::chrono::system_clock::now();
+
+    // COLLAB_NO_PIPELINE_CACHE=1 measures a cold start without touching the file
+    const char *noCache = std::getenv("COLLAB_NO_PIPELINE_CACHE");
+    _usePipelineCache = noCache == nullptr || noCache[0] == '\0' || noCache[0] == '0';
+
+    bool warm = false;
+    if (_usePipelineCache)
+        warm = _pipelineCache.load(_device, _chosenGPU, PIPELINE_CACHE_PATH);
+
+    init_background_pipelines();
+
+    init_triangle_pipeline();
+
+    init_mesh_pipeline();
+
+    _gpuCulling.init(this, MAX_FRAMES_IN_FLIGHT);
+
+    _mainDeletionQueue.push_function([&]()
+                                     { _gpuCulling.cleanup(); });
+
+    _shaderWatcher.init(SHADERS_PATH);
+
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+    stats.pipeline_build_time = elapsed.count() / 1000.f;
+    stats.pipeline_cold_build_time = warm ? _pipelineCache.coldBuildTime() : stats.pipeline_build_time;
+
+    if (!_usePipelineCache)
+        fmt::println("pipelines built in {:.2f} ms without a pipeline cache", stats.pipeline_build_time);
+    else if (warm)
+        fmt::println("pipelines built in {:.2f} ms from the pipeline cache, {:.2f} ms when it was cold", stats.pipeline_build_time, stats.pipeline_cold_build_time);
+    else
+        fmt::println("pipelines built in {:.2f} ms, pipeline cache was cold", stats.pipeline_build_time);
+}
+
+void VulkanEngine::init_triangle_pipeline()
+{
     // build the pipeline layout that controls the inputs/outputs of the shader
     // we are not using descriptor sets or other systems yet, so no need to use anything other than empty default
     VkPipelineLayoutCreateInfo pipeline_layout_info = vkinit::pipeline_layout_create_info();
     VK_CHECK(vkCreatePipelineLayout(_device, &pipeline_layout_info, nullptr, &_trianglePipelineLayout));
 
+    _trianglePipeline = build_triangle_pipeline();
+
+    register_reloadable_pipeline({"colored_triangle.vert.spv", "colored_triangle.frag.spv"}, &_trianglePipeline, [this]()
+                                 { return build_triangle_pipeline(); });
+
+    _mainDeletionQueue.push_function([this]()
+                                     {
+		vkDestroyPipelineLayout(_device, _trianglePipelineLayout, nullptr);
+		vkDestroyPipeline(_device, _trianglePipeline, nullptr); });
+}
+
+VkPipeline VulkanEngine::build_triangle_pipeline()
+{
+    VkShaderModule triangleFragShader;
+    if (!vkutil::load_shader_module((SHADERS_PATH + "colored_triangle.frag.spv").c_str(), _device, &triangleFragShader))
+    {
+        fmt::print("Error when building the triangle fragment shader module\n");
+        return VK_NULL_HANDLE;
+    }
+
+    VkShaderModule triangleVertexShader;
+    if (!vkutil::load_shader_module((SHADERS_PATH + "colored_triangle.vert.spv").c_str(), _device, &triangleVertexShader))
+    {
+        fmt::print("Error when building the triangle vertex shader module\n");
+        vkDestroyShaderModule(_device, triangleFragShader, nullptr);
+        return VK_NULL_HANDLE;
+    }
+
     PipelineBuilder pipelineBuilder;
 
     // use the triangle layout we created
@@ -558,20 +1152,97 @@ void VulkanEngine::init_triangle_pipeline()
     pipelineBuilder.disable_depthtest();
 
     // connect the image format we will draw into, from draw image
+    // the depth format has to match the rendering scope it is drawn in, even with the depth test off
     pipelineBuilder.set_color_attachment_format(_drawImage.imageFormat);
-    pipelineBuilder.set_depth_format(VK_FORMAT_UNDEFINED);
+    pipelineBuilder.set_depth_format(_depthImage.imageFormat);
 
     // finally build the pipeline
-    _trianglePipeline = pipelineBuilder.build_pipeline(_device);
+    VkPipeline pipeline = pipelineBuilder.build_pipeline(_device, _pipelineCache.cache);
 
     // clean structures
     vkDestroyShaderModule(_device, triangleFragShader, nullptr);
     vkDestroyShaderModule(_device, triangleVertexShader, nullptr);
 
-    _mainDeletionQueue.push_function([this]()
-                                     {
-		vkDestroyPipelineLayout(_device, _trianglePipelineLayout, nullptr);
-		vkDestroyPipeline(_device, _trianglePipeline, nullptr); });
+    return pipeline;
+}
+
+void VulkanEngine::init_mesh_pipeline()
+{
+    // vertices are pulled through the buffer device address in the push constants, the transform and
+    // material index come from the draw's entry in the frame ring, the material through the bindless set
+    VkPushConstantRange bufferRange{};
+    bufferRange.offset = 0;
+    bufferRange.size = sizeof(GPUDrawPushConstants);
+    bufferRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorSetLayout layouts[] = {_bindless.layout, _frameDataLayout};
+
+    VkPipelineLayoutCreateInfo pipeline_layout_info = vkinit::pipeline_layout_create_info();
+    pipeline_layout_info.pPushConstantRanges = &bufferRange;
+    pipeline_layout_info.pushConstantRangeCount = 1;
+    pipeline_layout_info.pSetLayouts = layouts;
+    pipeline_layout_info.setLayoutCount = 2;
+
+    VK_CHECK(vkCreatePipelineLayout(_device, &pipeline_layout_info, nullptr, &_meshPipeline.layout));
+
+    _meshPipeline.pipeline = build_mesh_pipeline();
+
+    register_reloadable_pipeline({"mesh.vert.spv", "mesh.frag.spv"}, &_meshPipeline.pipeline, [this]()
+                                 { return build_mesh_pipeline(); });
+
+    GPUGLTFMaterial defaultMaterial = {};
+    defaultMaterial.colorFactors = glm::vec4(1.f);
+    defaultMaterial.metal_rough_factors = glm::vec4(1.f, 0.5f, 0.f, 0.f);
+    defaultMaterial.textures = glm::uvec4(_whiteImageIndex, _whiteImageIndex, _defaultSamplerIndex, 0);
+
+    _defaultMaterial.pipeline = &_meshPipeline;
+    _defaultMaterial.materialIndex = add_material(defaultMaterial);
+    _defaultMaterial.passType = MaterialPass::MainColor;
+
+    _mainDeletionQueue.push_function([this]()
+                                     {
+		vkDestroyPipelineLayout(_device, _meshPipeline.layout, nullptr);
+		vkDestroyPipeline(_device, _meshPipeline.pipeline, nullptr); });
+}
+
+VkPipeline VulkanEngine::build_mesh_pipeline()
+{
+    VkShaderModule meshFragShader;
+    if (!vkutil::load_shader_module((SHADERS_PATH + "mesh.frag.spv").c_str(), _device, &meshFragShader))
+    {
+        fmt::print("Error when building the mesh fragment shader module\n");
+        return VK_NULL_HANDLE;
+    }
+
+    VkShaderModule meshVertexShader;
+    if (!vkutil::load_shader_module((SHADERS_PATH + "mesh.vert.spv").c_str(), _device, &meshVertexShader))
+    {
+        fmt::print("Error when building the mesh vertex shader module\n");
+        vkDestroyShaderModule(_device, meshFragShader, nullptr);
+        return VK_NULL_HANDLE;
+    }
+
+    PipelineBuilder pipelineBuilder;
+
+    pipelineBuilder._pipelineLayout = _meshPipeline.layout;
+    pipelineBuilder.set_shaders(meshVertexShader, meshFragShader);
+    pipelineBuilder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    pipelineBuilder.set_polygon_mode(VK_POLYGON_MODE_FILL);
+    pipelineBuilder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+    pipelineBuilder.set_multisampling_none();
+    pipelineBuilder.disable_blending();
+    // reversed depth, near plane at 1
+    pipelineBuilder.enable_depthtest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+
+    pipelineBuilder.set_color_attachment_format(_drawImage.imageFormat);
+    pipelineBuilder.set_depth_format(_depthImage.imageFormat);
+
+    VkPipeline pipeline = pipelineBuilder.build_pipeline(_device, _pipelineCache.cache);
+
+    vkDestroyShaderModule(_device, meshFragShader, nullptr);
+    vkDestroyShaderModule(_device, meshVertexShader, nullptr);
+
+    return pipeline;
 }
 
 void VulkanEngine::init_background_pipelines()
@@ -592,92 +1263,126 @@ void VulkanEngine::init_background_pipelines()
 
     VK_CHECK(vkCreatePipelineLayout(_device, &computeLayout, nullptr, &_gradientPipelineLayout));
 
-    // layout code
-    VkShaderModule gradientShader;
-    if (!vkutil::load_shader_module("../src/render_engine/shaders/gradient_color.comp.spv", _device, &gradientShader))
-    {
-        fmt::print("Error when building the compute shader \n");
-    }
-
-    VkShaderModule skyShader;
-    if (!vkutil::load_shader_module("../src/render_engine/shaders/sky.comp.spv", _device, &skyShader))
-    {
-        fmt::print("Error when building the compute shader \n");
-    }
-
-    VkShaderModule gradient2Shader;
-    if (!vkutil::load_shader_module("../src/render_engine/shaders/gradient.comp.spv", _device, &gradient2Shader))
-    {
-        fmt::print("Error when building the compute shader \n");
-    }
-
-    VkPipelineShaderStageCreateInfo stageinfo{};
-    stageinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    stageinfo.pNext = nullptr;
-    stageinfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-    stageinfo.module = gradientShader;
-    stageinfo.pName = "main";
-
-    VkComputePipelineCreateInfo computePipelineCreateInfo{};
-    computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-    computePipelineCreateInfo.pNext = nullptr;
-    computePipelineCreateInfo.layout = _gradientPipelineLayout;
-    computePipelineCreateInfo.stage = stageinfo;
-
     ComputeEffect gradient;
     gradient.layout = _gradientPipelineLayout;
     gradient.name = "gradient";
+    gradient.shader = "gradient_color.comp.spv";
     gradient.data = {};
 
     // default colors
     gradient.data.data1 = glm::vec4(1, 0, 0, 1);
     gradient.data.data2 = glm::vec4(0, 0, 1, 1);
 
-    VK_CHECK(vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &gradient.pipeline));
-
-    // change the shader module only to create the sky shader
-    computePipelineCreateInfo.stage.module = skyShader;
-
     ComputeEffect sky;
     sky.layout = _gradientPipelineLayout;
     sky.name = "sky";
+    sky.shader = "sky.comp.spv";
     sky.data = {};
     // default sky parameters
     sky.data.data1 = glm::vec4(0.1, 0.2, 0.4, 0.97);
 
-    VK_CHECK(vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &sky.pipeline));
-
     ComputeEffect gradient2;
     gradient2.layout = _gradientPipelineLayout;
     gradient2.name = "gradient2";
+    gradient2.shader = "gradient.comp.spv";
     gradient2.data = {};
 
     gradient2.data.data1 = glm::vec4(0, 1, 1, 1);
     gradient2.data.data2 = glm::vec4(1, 1, 0, 1);
 
-    computePipelineCreateInfo.stage.module = gradient2Shader;
-
-    VK_CHECK(vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &gradient2.pipeline));
-
-    // add the 2 background effects into the array
+    // add the 3 background effects into the array
     backgroundEffects.push_back(sky);
     backgroundEffects.push_back(gradient);
     backgroundEffects.push_back(gradient2);
 
-    // destroy structures properly
-    vkDestroyShaderModule(_device, gradientShader, nullptr);
-    vkDestroyShaderModule(_device, skyShader, nullptr);
-    vkDestroyShaderModule(_device, gradient2Shader, nullptr);
+    // the array is not touched after this point, the reload entries can point into it
+    for (ComputeEffect &effect : backgroundEffects)
+    {
+        effect.pipeline = build_compute_pipeline(effect.layout, effect.shader);
+
+        ComputeEffect *target = &effect;
+        register_reloadable_pipeline({effect.shader}, &effect.pipeline, [this, target]()
+                                     { return build_compute_pipeline(target->layout, target->shader); });
+    }
 
-    _mainDeletionQueue.push_function([this, sky, gradient, gradient2]()
+    // destroy structures properly, reloads may have replaced the pipelines since
+    _mainDeletionQueue.push_function([this]()
                                      {
 	vkDestroyPipelineLayout(_device, _gradientPipelineLayout, nullptr);
-	vkDestroyPipeline(_device, sky.pipeline, nullptr);
-	vkDestroyPipeline(_device, gradient.pipeline, nullptr);
-    vkDestroyPipeline(_device, gradient2.pipeline, nullptr); });
+	for (ComputeEffect &effect : backgroundEffects)
+		vkDestroyPipeline(_device, effect.pipeline, nullptr); });
 }
 
-AllocatedImage VulkanEngine::create_image(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped)
+VkPipeline VulkanEngine::build_compute_pipeline(VkPipelineLayout layout, const char *shaderFile)
+{
+    VkShaderModule shader;
+    if (!vkutil::load_shader_module((SHADERS_PATH + shaderFile).c_str(), _device, &shader))
+    {
+        fmt::print("Error when building the compute shader {}\n", shaderFile);
+        return VK_NULL_HANDLE;
+    }
+
+    VkPipelineShaderStageCreateInfo stageinfo{};
+    stageinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stageinfo.pNext = nullptr;
+    stageinfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    stageinfo.module = shader;
+    stageinfo.pName = "main";
+
+    VkComputePipelineCreateInfo computePipelineCreateInfo{};
+    computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    computePipelineCreateInfo.pNext = nullptr;
+    computePipelineCreateInfo.layout = layout;
+    computePipelineCreateInfo.stage = stageinfo;
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    if (vkCreateComputePipelines(_device, _pipelineCache.cache, 1, &computePipelineCreateInfo, nullptr, &pipeline) != VK_SUCCESS)
+    {
+        fmt::print("failed to create the compute pipeline {}\n", shaderFile);
+        pipeline = VK_NULL_HANDLE;
+    }
+
+    vkDestroyShaderModule(_device, shader, nullptr);
+
+    return pipeline;
+}
+
+void VulkanEngine::register_reloadable_pipeline(std::vector<std::string> shaders, VkPipeline *pipeline, std::function<VkPipeline()> &&build)
+{
+    _reloadablePipelines.push_back(ReloadablePipeline{std::move(shaders), pipeline, std::move(build)});
+}
+
+void VulkanEngine::reload_changed_shaders()
+{
+    std::vector<std::string> changed = _shaderWatcher.poll();
+    if (changed.empty())
+        return;
+
+    for (ReloadablePipeline &reloadable : _reloadablePipelines)
+    {
+        // rebuilt once, even when several of its stages changed together
+        bool affected = std::any_of(reloadable.shaders.begin(), reloadable.shaders.end(), [&](const std::string &shader)
+                                    { return std::find(changed.begin(), changed.end(), shader) != changed.end(); });
+        if (!affected)
+            continue;
+
+        // a shader that does not build keeps the old pipeline running
+        VkPipeline pipeline = reloadable.build();
+        if (pipeline == VK_NULL_HANDLE)
+            continue;
+
+        // the previous frame may still be executing with the old pipeline, it goes once this frame slot is reused
+        VkPipeline retired = *reloadable.pipeline;
+        get_current_frame()._deletionQueue.push_function([this, retired]()
+                                                         { vkDestroyPipeline(_device, retired, nullptr); });
+
+        *reloadable.pipeline = pipeline;
+
+        fmt::print("reloaded pipeline of {}\n", reloadable.shaders.front());
+    }
+}
+
+AllocatedImage VulkanEngine::create_image(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped, MemoryCategory category)
 {
     AllocatedImage newImage;
     newImage.imageFormat = format;
@@ -696,6 +1401,7 @@ AllocatedImage VulkanEngine::create_image(VkExtent3D size, VkFormat format, VkIm
 
     // allocate and create the image
     VK_CHECK(vmaCreateImage(_allocator, &img_info, &allocinfo, &newImage.image, &newImage.allocation, nullptr));
+    _memory.tag(newImage.allocation, category);
 
     // if the format is a depth format, we will need to have it use the correct
     // aspect flag
@@ -717,46 +1423,53 @@ AllocatedImage VulkanEngine::create_image(VkExtent3D size, VkFormat format, VkIm
 //> create_mip_2
 AllocatedImage VulkanEngine::create_image(void *data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped)
 {
-    size_t data_size = size.depth * size.width * size.height * 4;
-    AllocatedBuffer uploadbuffer = create_buffer(data_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
-    memcpy(uploadbuffer.info.pMappedData, data, data_size);
+    size_t data_size = size.depth * vkutil::image_level_size(format, VkExtent2D{size.width, size.height});
 
     AllocatedImage new_image = create_image(size, format, usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, mipmapped);
 
-    immediate_submit([&](VkCommandBuffer cmd)
-                     {
-        vkutil::transition_image(cmd, new_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-        VkBufferImageCopy copyRegion = {};
-        copyRegion.bufferOffset = 0;
-        copyRegion.bufferRowLength = 0;
-        copyRegion.bufferImageHeight = 0;
-
-        copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        copyRegion.imageSubresource.mipLevel = 0;
-        copyRegion.imageSubresource.baseArrayLayer = 0;
-        copyRegion.imageSubresource.layerCount = 1;
-        copyRegion.imageExtent = size;
-
-        // copy the buffer into the image
-        vkCmdCopyBufferToImage(cmd, uploadbuffer.buffer, new_image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
-            &copyRegion);
-
-        if (mipmapped) {
-            vkutil::generate_mipmaps(cmd, new_image.image,VkExtent2D{new_image.imageExtent.width,new_image.imageExtent.height});
-        } else {
-            vkutil::transition_image(cmd, new_image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-        } });
-    destroy_buffer(uploadbuffer);
+    // the copy is batched with the other uploads of this frame and runs on the transfer queue,
+    // the image is ready once the uploader reports the ticket as complete
+    _uploader.upload_image(new_image, data, data_size, mipmapped);
+
     return new_image;
 }
 //< create_mip_2
 
 FrameData &VulkanEngine::get_last_frame()
 {
-    return _frames[(_frameNumber - 1) % FRAME_OVERLAP];
+    return _frames[_lastFrameSlot];
+}
+
+void VulkanEngine::set_frames_in_flight(uint32_t count)
+{
+    _requestedFramesInFlight = std::clamp(count, 1u, MAX_FRAMES_IN_FLIGHT);
+}
+
+void VulkanEngine::set_present_mode(VkPresentModeKHR mode)
+{
+    if (mode == _presentMode)
+        return;
+
+    _presentMode = mode;
+    resize_requested = true;
+}
+
+void VulkanEngine::apply_frames_in_flight()
+{
+    if (_requestedFramesInFlight == _framesInFlight)
+        return;
+
+    // every slot is idle afterwards, numbering restarts at the first one
+    vkDeviceWaitIdle(_device);
+    for (FrameData &frame : _frames)
+    {
+        frame._deletionQueue.flush();
+        frame._submittedFrame = -1;
+    }
+
+    _framesInFlight = _requestedFramesInFlight;
+    _frameSlot = 0;
+    _lastFrameSlot = 0;
 }
 
 void VulkanEngine::immediate_submit(std::function<void(VkCommandBuffer cmd)> &&function)
@@ -787,6 +1500,7 @@ void VulkanEngine::immediate_submit(std::function<void(VkCommandBuffer cmd)> &&f
 void VulkanEngine::destroy_image(const AllocatedImage &img)
 {
     vkDestroyImageView(_device, img.imageView, nullptr);
+    _memory.untag(img.allocation);
     vmaDestroyImage(_allocator, img.image, img.allocation);
 }
 
@@ -797,19 +1511,41 @@ void VulkanEngine::cleanup()
         // make sure the gpu has stopped doing its things
         vkDeviceWaitIdle(_device);
 
-        _mainDeletionQueue.flush();
+        for (std::unique_ptr<SceneLoadRequest> &load : _sceneLoads)
+            load->thread.join();
+        _sceneLoads.clear();
+
+        for (const std::shared_ptr<MeshScene> &scene : loadedScenes)
+        {
+            destroy_buffer(scene->meshBuffers.indexBuffer);
+            destroy_buffer(scene->meshBuffers.vertexBuffer);
+        }
+        loadedScenes.clear();
+
+        // resources retired during the last frames
+        for (FrameData &frame : _frames)
+            frame._deletionQueue.flush();
 
-        destroy_swapchain();
+        if (_usePipelineCache && !_pipelineCache.save(_device, stats.pipeline_build_time))
+            fmt::println("failed to write the pipeline cache {}", PIPELINE_CACHE_PATH);
+        _pipelineCache.destroy(_device);
+
+        _mainDeletionQueue.flush();
 
-        vkDestroySurfaceKHR(_instance, _surface, nullptr);
+        if (!_headless)
+        {
+            destroy_swapchain();
+            vkDestroySurfaceKHR(_instance, _surface, nullptr);
+        }
 
-        vmaDestroyAllocator(_allocator);
+        _memory.destroy();
 
         vkDestroyDevice(_device, nullptr);
         vkb::destroy_debug_utils_messenger(_instance, _debug_messenger);
         vkDestroyInstance(_instance, nullptr);
 
-        SDL_DestroyWindow(_window);
+        if (_window)
+            SDL_DestroyWindow(_window);
     }
 }
 
@@ -865,6 +1601,7 @@ void VulkanEngine::init_imgui()
     init_info.PipelineRenderingCreateInfo.pColorAttachmentFormats = &_swapchainImageFormat;
 
     init_info.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
+    init_info.PipelineCache = _pipelineCache.cache;
 
     ImGui_ImplVulkan_Init(&init_info);
 
@@ -877,15 +1614,15 @@ void VulkanEngine::init_imgui()
 		vkDestroyDescriptorPool(_device, imguiPool, nullptr); });
 }
 
-void VulkanEngine::draw_background(VkCommandBuffer cmd)
+void VulkanEngine::draw_background(VkCommandBuffer cmd, VkDescriptorSet targetImage)
 {
     ComputeEffect &effect = backgroundEffects[currentBackgroundEffect];
 
     // bind the background compute pipeline
     vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, effect.pipeline);
 
-    // bind the descriptor set containing the draw image for the compute pipeline
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _gradientPipelineLayout, 0, 1, &_drawImageDescriptors, 0, nullptr);
+    // bind the descriptor set containing the target image for the compute pipeline
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _gradientPipelineLayout, 0, 1, &targetImage, 0, nullptr);
 
     vkCmdPushConstants(cmd, _gradientPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ComputePushConstants), &effect.data);
     // execute the compute pipeline dispatch. We are using 16x16 workgroup size so we need to divide by it
@@ -927,27 +1664,96 @@ void VulkanEngine::draw_main(VkCommandBuffer cmd)
 
 void VulkanEngine::draw()
 {
-    // wait until the gpu has finished rendering the last frame. Timeout of 1 second
+    apply_frames_in_flight();
+
+    // wait until the gpu has finished rendering the frame last recorded into this slot. Timeout of 1 second
+    auto waitStart = std::chrono::steady_clock::now();
     VK_CHECK(vkWaitForFences(_device, 1, &get_current_frame()._renderFence, true, 1000000000));
+    auto waitEnd = std::chrono::steady_clock::now();
+
+    stats.fence_wait_time = std::chrono::duration<float, std::milli>(waitEnd - waitStart).count();
+    update_latency(waitStart, waitEnd);
 
     get_current_frame()._deletionQueue.flush();
+    stats.frame_arena_used = get_current_frame()._frameArena.used();
+    get_current_frame()._frameArena.reset();
+    stats.frame_arena_capacity = get_current_frame()._frameArena.capacity();
     get_current_frame()._frameDescriptors.clear_pools(_device);
+    _frameRing.begin_frame(_frameSlot);
+
+    // pipelines of shaders edited since last frame, retired ones go through this frame's deletion queue
+    reload_changed_shaders();
+
+    // the fence guarantees the timestamps of this frame slot are written
+    if (get_current_frame()._gpuTimestamps.read_results(_device, _timestampPeriod, stats.gpu_timings))
+        stats.gpu_timings_frame = get_current_frame()._submittedFrame;
+
+    _dynamicResolution.update(_device, _frameSlot);
+
+    // the compute batch of this slot was waited on by the graphics submit the fence belongs to
+    if (_hasAsyncCompute && _asyncCompute.timestamps(_frameSlot).read_results(_device, _timestampPeriod, _computeTimings))
+        stats.async_compute_time = _computeTimings.empty() ? 0.f : _computeTimings.front().duration_ms;
+    if (!_useAsyncCompute)
+        stats.async_compute_time = 0.f;
+
+    // visible counts written by the culling pass of this frame slot
+    if (_gpuDriven)
+    {
+        CullStats cullStats = _gpuCulling.read_stats(_frameSlot);
+
+        // the triangle of the test pipeline is drawn on top of the culled objects
+        stats.drawcall_count = 1 + (cullStats.valid ? cullStats.visibleObjects : 0);
+        stats.triangle_count = 4 + (cullStats.valid ? cullStats.visibleTriangles : 0);
+        stats.culled_count = cullStats.valid ? cullStats.totalObjects - cullStats.visibleObjects : 0;
+    }
+
+    update_scene();
+
+    // swaps in finished mip uploads and queues new ones, the slots it registers go out with the flush below
+    request_texture_levels();
+    _textureStreamer.update();
+
+    // everything registered since last frame becomes visible with one descriptor update
+    _bindless.flush(_device);
+
+    // send the uploads queued since last frame to the transfer queue
+    _uploader.flush();
+
+    // constants every mesh pipeline binds, the draw array is only allocated on the cpu path so its
+    // offset points at the table until draw_geometry replaces it
+    _sceneDataOffset = _frameRing.push(sceneData);
+    _textureTableOffset = _textureStreamer.write_residency_table(_frameRing);
+    _drawDataOffset = _textureTableOffset;
     // request image from the swapchain
-    uint32_t swapchainImageIndex;
+    uint32_t swapchainImageIndex = 0;
 
-    VkResult e = vkAcquireNextImageKHR(_device, _swapchain, 1000000000, get_current_frame()._swapchainSemaphore, nullptr, &swapchainImageIndex);
-    if (e == VK_ERROR_OUT_OF_DATE_KHR)
+    if (!_headless)
     {
-        resize_requested = true;
-        return;
+        VkResult e = vkAcquireNextImageKHR(_device, _swapchain, 1000000000, get_current_frame()._swapchainSemaphore, nullptr, &swapchainImageIndex);
+        if (e == VK_ERROR_OUT_OF_DATE_KHR)
+        {
+            resize_requested = true;
+            return;
+        }
     }
-    _drawExtent.height = std::min(_swapchainExtent.height, _drawImage.imageExtent.height) * 1.f;
-    _drawExtent.width = std::min(_swapchainExtent.width, _drawImage.imageExtent.width) * 1.f;
+    VkExtent2D fullExtent;
+    fullExtent.height = std::min(_swapchainExtent.height, _drawImage.imageExtent.height);
+    fullExtent.width = std::min(_swapchainExtent.width, _drawImage.imageExtent.width);
+    _drawExtent = _dynamicResolution.scaled_extent(fullExtent);
+
+    // submitted ahead of the graphics work, it overlaps with whatever the graphics queue still runs
+    bool asyncBackground = _hasAsyncCompute && _useAsyncCompute;
+    if (asyncBackground)
+        record_async_background();
 
     VK_CHECK(vkResetFences(_device, 1, &get_current_frame()._renderFence));
 
     // now that we are sure that the commands finished executing, we can safely reset the command buffer to begin recording again.
     VK_CHECK(vkResetCommandBuffer(get_current_frame()._mainCommandBuffer, 0));
+    for (VkCommandPool pool : get_current_frame()._threadCommandPools)
+    {
+        VK_CHECK(vkResetCommandPool(_device, pool, 0));
+    }
 
     // naming it cmd for shorter writing
     VkCommandBuffer cmd = get_current_frame()._mainCommandBuffer;
@@ -957,36 +1763,32 @@ void VulkanEngine::draw()
 
     VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
 
-    // transition our main draw image into general layout so we can write into it
-    // we will overwrite it all so we dont care about what was the older layout
-    vkutil::transition_image(cmd, _drawImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
-
-    draw_background(cmd);
-
-    vkutil::transition_image(cmd, _drawImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    GpuTimestamps &timestamps = get_current_frame()._gpuTimestamps;
+    timestamps.reset(cmd);
+    timestamps.begin_scope(cmd, "frame");
 
-    draw_geometry(cmd);
+    // take over the resources of finished uploads
+    VkSemaphoreSubmitInfo uploadWaitInfo = {};
+    bool waitForUploads = _uploader.record_graphics_work(cmd, uploadWaitInfo);
 
-    // transtion the draw image and the swapchain image into their correct transfer layouts
-    vkutil::transition_image(cmd, _drawImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-    vkutil::transition_image(cmd, _swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    // and the background rendered on the compute queue
+    VkSemaphoreSubmitInfo computeWaitInfo = {};
+    bool waitForCompute = _asyncCompute.record_graphics_work(cmd, computeWaitInfo);
 
-    VkExtent2D extent;
-    extent.height = _windowExtent.height;
-    extent.width = _windowExtent.width;
-    // extent.depth = 1;
+    // streamed textures moved by defragmentation, the residency table of this frame already points at the copies
+    _textureStreamer.record_defragmentation(cmd);
 
-    // execute a copy from the draw image into the swapchain
-    vkutil::copy_image_to_image(cmd, _drawImage.image, _swapchainImages[swapchainImageIndex], _drawExtent, _swapchainExtent);
+    // the passes of the frame, barriers between them come from what they declare
+    build_render_graph(swapchainImageIndex, asyncBackground);
+    _renderGraph.compile();
 
-    // set swapchain image layout to Attachment Optimal so we can draw it
-    vkutil::transition_image(cmd, _swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    // the depth image is a transient of the graph, the draw functions find it in _depthImage
+    _depthImage = _renderGraph.image(_depthImageHandle);
 
-    // draw imgui into the swapchain image
-    draw_imgui(cmd, _swapchainImageViews[swapchainImageIndex]);
+    _renderGraph.execute(cmd);
+    stats.render_graph = _renderGraph.stats();
 
-    // set swapchain image layout to Present so we can draw it
-    vkutil::transition_image(cmd, _swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    timestamps.end_scope(cmd);
 
     // finalize the command buffer (we can no longer add commands, but it can now be executed)
     VK_CHECK(vkEndCommandBuffer(cmd));
@@ -995,17 +1797,41 @@ void VulkanEngine::draw()
     // we want to wait on the _presentSemaphore, as that semaphore is signaled when the swapchain is ready
     // we will signal the _renderSemaphore, to signal that rendering has finished
 
+    // everything the recorded commands read from the frame ring is written by now
+    _frameRing.flush();
+    stats.frame_ring_used = _frameRing.used();
+
     VkCommandBufferSubmitInfo cmdinfo = vkinit::command_buffer_submit_info(cmd);
 
-    VkSemaphoreSubmitInfo waitInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, get_current_frame()._swapchainSemaphore);
+    VkSemaphoreSubmitInfo waitInfos[3];
+    uint32_t waitCount = 0;
+
+    // no swapchain image to wait for or to hand to the presentation engine when headless
+    if (!_headless)
+        waitInfos[waitCount++] = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, get_current_frame()._swapchainSemaphore);
+    if (waitForUploads)
+        waitInfos[waitCount++] = uploadWaitInfo;
+    if (waitForCompute)
+        waitInfos[waitCount++] = computeWaitInfo;
+
     VkSemaphoreSubmitInfo signalInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, get_current_frame()._renderSemaphore);
 
-    VkSubmitInfo2 submit = vkinit::submit_info(&cmdinfo, &signalInfo, &waitInfo);
+    VkSubmitInfo2 submit = vkinit::submit_info(&cmdinfo, _headless ? nullptr : &signalInfo, waitCount > 0 ? waitInfos : nullptr);
+    submit.waitSemaphoreInfoCount = waitCount;
 
     // submit command buffer to the queue and execute it.
     //  _renderFence will now block until the graphic commands finish execution
     VK_CHECK(vkQueueSubmit2(_graphicsQueue, 1, &submit, get_current_frame()._renderFence));
 
+    get_current_frame()._submittedFrame = _frameNumber;
+    get_current_frame()._inputTime = _inputTime;
+
+    if (_headless)
+    {
+        advance_frame();
+        return;
+    }
+
     // prepare present
     //  this will put the image we just rendered to into the visible window.
     //  we want to wait on the _renderSemaphore for that,
@@ -1021,87 +1847,986 @@ void VulkanEngine::draw()
     presentInfo.pImageIndices = &swapchainImageIndex;
 
     VkResult presentResult = vkQueuePresentKHR(_graphicsQueue, &presentInfo);
-    if (e == VK_ERROR_OUT_OF_DATE_KHR)
-    {
+
+    // the frame was submitted either way, its slot is in flight
+    advance_frame();
+
+    if (presentResult == VK_ERROR_OUT_OF_DATE_KHR)
         resize_requested = true;
-        return;
-    }
+}
+
+void VulkanEngine::advance_frame()
+{
+    _lastFrameSlot = _frameSlot;
+    _frameSlot = (_frameSlot + 1) % _framesInFlight;
+
     // increase the number of frames drawn
     _frameNumber++;
 }
 
-void VulkanEngine::draw_geometry(VkCommandBuffer cmd)
+void VulkanEngine::update_latency(std::chrono::steady_clock::time_point waitStart, std::chrono::steady_clock::time_point waitEnd)
 {
-    
-    // begin a render pass  connected to our draw image
-    VkRenderingAttachmentInfo colorAttachment = vkinit::attachment_info(_drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    const FrameData &frame = get_current_frame();
+    if (frame._submittedFrame < 0)
+        return;
 
-    VkRenderingInfo renderInfo = vkinit::rendering_info(_drawExtent, &colorAttachment, nullptr);
-    vkCmdBeginRendering(cmd, &renderInfo);
+    // a fence that was already signaled only tells the gpu finished before the wait, which makes this an upper bound
+    bool blocked = waitEnd - waitStart > std::chrono::microseconds(50);
+    auto completed = blocked ? waitEnd : waitStart;
+    float latency = std::chrono::duration<float, std::milli>(completed - frame._inputTime).count();
 
-    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _trianglePipeline);
+    // the image waits for the next vblank with fifo, about half a refresh with mailbox, not at all with immediate
+    float refresh = 1000.f / _displayRefreshRate;
+    float displayWait = 0.f;
+    if (!_headless)
+    {
+        switch (_activePresentMode)
+        {
+        case VK_PRESENT_MODE_FIFO_KHR:
+        case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+            displayWait = refresh;
+            break;
+        case VK_PRESENT_MODE_MAILBOX_KHR:
+            displayWait = refresh * 0.5f;
+            break;
+        default:
+            break;
+        }
+    }
 
-    // set dynamic viewport and scissor
-    VkViewport viewport = {};
-    viewport.x = 0;
-    viewport.y = 0;
-    viewport.width = _drawExtent.width;
-    viewport.height = _drawExtent.height;
-    viewport.minDepth = 0.f;
-    viewport.maxDepth = 1.f;
+    // smoothed, single frames jump with the os scheduling
+    const float blend = 0.1f;
+    stats.input_to_gpu_latency += (latency - stats.input_to_gpu_latency) * blend;
+    stats.input_to_present_latency = stats.input_to_gpu_latency + displayWait;
+}
 
-    vkCmdSetViewport(cmd, 0, 1, &viewport);
+void VulkanEngine::build_render_graph(uint32_t swapchainImageIndex, bool asyncBackground)
+{
+    RenderGraph &graph = _renderGraph;
+    graph.reset(&get_current_frame()._frameArena);
 
-    VkRect2D scissor = {};
-    scissor.offset.x = 0;
-    scissor.offset.y = 0;
-    scissor.extent.width = _drawExtent.width;
-    scissor.extent.height = _drawExtent.height;
+    RGImage drawImage = graph.import_image("draw image", _drawImage, VK_IMAGE_ASPECT_COLOR_BIT, &_drawImageState);
 
-    vkCmdSetScissor(cmd, 0, 1, &scissor);
+    RGTransientDesc depthDesc;
+    depthDesc.format = _depthImage.imageFormat;
+    depthDesc.extent = _drawImage.imageExtent;
+    // read by the depth pyramid reduction of the occlusion culling
+    depthDesc.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    depthDesc.aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+    RGImage depthImage = graph.create_image("depth", depthDesc);
+    _depthImageHandle = depthImage;
 
-    // launch a draw command to draw 12 vertices
-    vkCmdDraw(cmd, 12, 1, 0, 0);
+    GpuTimestamps *timestamps = &get_current_frame()._gpuTimestamps;
 
-    vkCmdEndRendering(cmd);
+    // the background overwrites the draw image, whatever the last frame left in it is not needed
+    if (asyncBackground)
+    {
+        // rendered on the compute queue, the image was acquired at the start of the command buffer
+        graph.add_pass("background copy", {{drawImage, RGUsage::TransferDst, true}}, [this, timestamps](VkCommandBuffer cmd)
+                       {
+            // everything up to the blit runs at the scaled extent
+            _dynamicResolution.begin(cmd, _frameSlot);
+
+            timestamps->begin_scope(cmd, "background copy");
+
+            VkImageCopy2 region = {.sType = VK_STRUCTURE_TYPE_IMAGE_COPY_2};
+            region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+            region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+            region.extent = {_drawExtent.width, _drawExtent.height, 1};
+
+            VkCopyImageInfo2 copyInfo = {.sType = VK_STRUCTURE_TYPE_COPY_IMAGE_INFO_2};
+            copyInfo.srcImage = get_current_frame()._backgroundImage.image;
+            copyInfo.srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            copyInfo.dstImage = _drawImage.image;
+            copyInfo.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            copyInfo.regionCount = 1;
+            copyInfo.pRegions = &region;
+            vkCmdCopyImage2(cmd, &copyInfo);
+
+            timestamps->end_scope(cmd); });
+    }
+    else
+    {
+        graph.add_pass("background compute", {{drawImage, RGUsage::ComputeStorageWrite, true}}, [this, timestamps](VkCommandBuffer cmd)
+                       {
+            // everything up to the blit runs at the scaled extent
+            _dynamicResolution.begin(cmd, _frameSlot);
+
+            timestamps->begin_scope(cmd, "background compute");
+            draw_background(cmd, _drawImageDescriptors);
+            timestamps->end_scope(cmd); });
+    }
+
+    if (_gpuDriven)
+    {
+        // only buffers, the culling pass places its own buffer barriers
+        graph.add_pass("culling", {}, [this, timestamps](VkCommandBuffer cmd)
+                       {
+            timestamps->begin_scope(cmd, "culling");
+            _gpuCulling.record_cull(cmd, _frameSlot, sceneData.viewproj, _occlusionCulling);
+            timestamps->end_scope(cmd); });
+
+        graph.add_pass("geometry", {{drawImage, RGUsage::ColorAttachment}, {depthImage, RGUsage::DepthAttachment, true}}, [this, timestamps](VkCommandBuffer cmd)
+                       {
+            timestamps->begin_scope(cmd, "geometry");
+            draw_geometry_indirect(cmd);
+            timestamps->end_scope(cmd); });
+
+        // next frame tests its objects against this depth
+        graph.add_pass("depth pyramid", {{depthImage, RGUsage::ComputeSampled}}, [this, timestamps](VkCommandBuffer cmd)
+                       {
+            timestamps->begin_scope(cmd, "depth pyramid");
+            _gpuCulling.record_depth_pyramid(cmd, get_current_frame()._frameDescriptors, _depthImage, _drawExtent, sceneData.viewproj);
+            timestamps->end_scope(cmd);
+
+            _dynamicResolution.end(cmd, _frameSlot); });
+    }
+    else
+    {
+        graph.add_pass("geometry", {{drawImage, RGUsage::ColorAttachment}, {depthImage, RGUsage::DepthAttachment, true}}, [this, timestamps](VkCommandBuffer cmd)
+                       {
+            timestamps->begin_scope(cmd, "geometry");
+            draw_geometry(cmd);
+            timestamps->end_scope(cmd);
+
+            _dynamicResolution.end(cmd, _frameSlot); });
+    }
+
+    if (_headless)
+    {
+        // the frame ends in the draw image, copied out when a capture was asked for
+        if (_captureRequested)
+        {
+            graph.add_pass("capture", {{drawImage, RGUsage::TransferSrc}}, [this](VkCommandBuffer cmd)
+                           {
+                VkBufferImageCopy copy = {};
+                copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                copy.imageSubresource.layerCount = 1;
+                copy.imageExtent = {_drawExtent.width, _drawExtent.height, 1};
+
+                vkCmdCopyImageToBuffer(cmd, _drawImage.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, _captureBuffer.buffer, 1, &copy); });
+        }
+        return;
+    }
+
+    // the acquire semaphore is waited on at the color attachment output stage, the first barrier chains to it
+    AllocatedImage swapchain = {};
+    swapchain.image = _swapchainImages[swapchainImageIndex];
+    swapchain.imageView = _swapchainImageViews[swapchainImageIndex];
+    swapchain.imageExtent = {_swapchainExtent.width, _swapchainExtent.height, 1};
+    swapchain.imageFormat = _swapchainImageFormat;
+
+    _swapchainImageState = RGImageState{};
+    _swapchainImageState.writeStages = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+
+    RGImage swapchainImage = graph.import_image("swapchain", swapchain, VK_IMAGE_ASPECT_COLOR_BIT, &_swapchainImageState);
+
+    // execute a copy from the draw image into the swapchain, the linear blit upscales a reduced draw extent
+    graph.add_pass("blit to swapchain", {{drawImage, RGUsage::TransferSrc}, {swapchainImage, RGUsage::TransferDst, true}}, [this, swapchain, timestamps](VkCommandBuffer cmd)
+                   {
+        timestamps->begin_scope(cmd, "blit to swapchain");
+        vkutil::copy_image_to_image(cmd, _drawImage.image, swapchain.image, _drawExtent, _swapchainExtent);
+        timestamps->end_scope(cmd); });
+
+    // draw imgui into the swapchain image
+    graph.add_pass("imgui", {{swapchainImage, RGUsage::ColorAttachment}}, [this, swapchain, timestamps](VkCommandBuffer cmd)
+                   {
+        timestamps->begin_scope(cmd, "imgui");
+        draw_imgui(cmd, swapchain.imageView);
+        timestamps->end_scope(cmd); });
+
+    graph.set_final_usage(swapchainImage, RGUsage::Present);
 }
 
-void VulkanEngine::draw_imgui(VkCommandBuffer cmd, VkImageView targetImageView)
+void VulkanEngine::record_async_background()
 {
-    VkRenderingAttachmentInfo colorAttachment = vkinit::attachment_info(targetImageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-    VkRenderingInfo renderInfo = vkinit::rendering_info(_swapchainExtent, &colorAttachment, nullptr);
+    FrameData &frame = get_current_frame();
+
+    VkCommandBuffer cmd = _asyncCompute.begin(_frameSlot);
+
+    GpuTimestamps &timestamps = _asyncCompute.timestamps(_frameSlot);
+    timestamps.reset(cmd);
+    timestamps.begin_scope(cmd, "async background");
+
+    // the graphics copy of the last background in this slot finished with the slot's fence, nothing to wait for
+    VkImageMemoryBarrier2 barrier = {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+    barrier.srcAccessMask = VK_ACCESS_2_NONE;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.image = frame._backgroundImage.image;
+    barrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+
+    VkDependencyInfo depInfo = {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    depInfo.imageMemoryBarrierCount = 1;
+    depInfo.pImageMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(cmd, &depInfo);
+
+    VkDescriptorSet targetImage = frame._frameDescriptors.allocate(_device, _drawImageDescriptorLayout);
+    {
+        DescriptorWriter writer{&frame._frameArena};
+        writer.write_image(0, frame._backgroundImage.imageView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+        writer.update_set(_device, targetImage);
+    }
 
-    vkCmdBeginRendering(cmd, &renderInfo);
+    draw_background(cmd, targetImage);
 
-    ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
+    timestamps.end_scope(cmd);
 
-    vkCmdEndRendering(cmd);
+    _asyncCompute.release_image(frame._backgroundImage.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+    _asyncCompute.submit(_frameSlot);
 }
 
-void VulkanEngine::run()
+void VulkanEngine::draw_geometry(VkCommandBuffer cmd)
 {
-    SDL_Event e;
-    bool bQuit = false;
+    auto start = std::chrono::system_clock::now();
 
-    // main loop
-    while (!bQuit)
-    {
-        auto start = std::chrono::system_clock::now();
+    FrameData &frame = get_current_frame();
 
-        // Handle events on queue
-        while (SDL_PollEvent(&e) != 0)
-        {
-            // close the window when user alt-f4s or clicks the X button
-            if (e.type == SDL_EVENT_QUIT)
-                bQuit = true;
+    // split the draw list in slices, every slice is recorded by a job into its own secondary command buffer
+    uint32_t objectCount = (uint32_t)mainDrawContext.OpaqueSurfaces.size();
 
-            if (e.key.scancode == SDL_SCANCODE_ESCAPE)
-                bQuit = true;
+    // the jobs fill in the draw constants of their slice, the ring itself is only touched here
+    FrameRingBuffer::Allocation drawData = _frameRing.allocate(std::max(objectCount, 1u) * sizeof(GPUDrawData));
+    _drawDataOffset = drawData.offset;
+    GPUDrawData *draws = static_cast<GPUDrawData *>(drawData.data);
+    uint32_t chunkCount = std::clamp((objectCount + MIN_DRAWS_PER_CHUNK - 1) / MIN_DRAWS_PER_CHUNK, 1u, (uint32_t)frame._threadCommandBuffers.size());
 
-            if (e.type == SDL_EVENT_WINDOW_SHOWN)
-            {
-                if (e.window.type == SDL_EVENT_WINDOW_MINIMIZED)
-                {
+    stats.record_times.assign(std::max(JobSystem::Get().thread_index_count(), 1u), 0.f);
+
+    int drawcallCounts[MAX_RECORD_THREADS] = {};
+    int triangleCounts[MAX_RECORD_THREADS] = {};
+    float chunkTimes[MAX_RECORD_THREADS] = {};
+    uint32_t chunkThreads[MAX_RECORD_THREADS] = {};
+
+    JobSystem::Get().parallel_for(chunkCount, 1, [&](uint32_t begin, uint32_t end)
+                                  {
+        for (uint32_t chunk = begin; chunk < end; chunk++)
+        {
+            chunkTimes[chunk] = record_geometry_chunk(chunk, chunkCount, draws, drawcallCounts[chunk], triangleCounts[chunk]);
+            chunkThreads[chunk] = JobSystem::thread_index();
+        } });
+
+    // begin a render pass  connected to our draw image, the draws themselves live in the secondary command buffers
+    VkRenderingAttachmentInfo colorAttachment = vkinit::attachment_info(_drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    VkRenderingAttachmentInfo depthAttachment = vkinit::depth_attachment_info(_depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+
+    VkRenderingInfo renderInfo = vkinit::rendering_info(_drawExtent, &colorAttachment, &depthAttachment);
+    renderInfo.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+    vkCmdBeginRendering(cmd, &renderInfo);
+
+    vkCmdExecuteCommands(cmd, chunkCount, frame._threadCommandBuffers.data());
+
+    vkCmdEndRendering(cmd);
+
+    stats.drawcall_count = 0;
+    stats.triangle_count = 0;
+    for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+    {
+        stats.drawcall_count += drawcallCounts[chunk];
+        stats.triangle_count += triangleCounts[chunk];
+
+        // threads outside the job system report as the main thread
+        stats.record_times[std::min<size_t>(chunkThreads[chunk], stats.record_times.size() - 1)] += chunkTimes[chunk];
+    }
+
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+    stats.mesh_draw_time = elapsed.count() / 1000.f;
+}
+
+void VulkanEngine::draw_geometry_indirect(VkCommandBuffer cmd)
+{
+    auto start = std::chrono::system_clock::now();
+
+    // a handful of commands, recorded inline instead of going wide on the job system
+    VkRenderingAttachmentInfo colorAttachment = vkinit::attachment_info(_drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    VkRenderingAttachmentInfo depthAttachment = vkinit::depth_attachment_info(_depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+
+    VkRenderingInfo renderInfo = vkinit::rendering_info(_drawExtent, &colorAttachment, &depthAttachment);
+    vkCmdBeginRendering(cmd, &renderInfo);
+
+    VkViewport viewport = {};
+    viewport.x = 0;
+    viewport.y = 0;
+    viewport.width = _drawExtent.width;
+    viewport.height = _drawExtent.height;
+    viewport.minDepth = 0.f;
+    viewport.maxDepth = 1.f;
+
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+    VkRect2D scissor = {};
+    scissor.offset.x = 0;
+    scissor.offset.y = 0;
+    scissor.extent.width = _drawExtent.width;
+    scissor.extent.height = _drawExtent.height;
+
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _trianglePipeline);
+    vkCmdDraw(cmd, 12, 1, 0, 0);
+
+    _gpuCulling.record_draws(cmd, sceneData.viewproj);
+
+    vkCmdEndRendering(cmd);
+
+    stats.record_times.assign(1, 0.f);
+
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+    stats.mesh_draw_time = elapsed.count() / 1000.f;
+    stats.record_times[0] = stats.mesh_draw_time;
+}
+
+float VulkanEngine::record_geometry_chunk(uint32_t chunkIndex, uint32_t chunkCount, GPUDrawData *draws, int &drawcallCount, int &triangleCount)
+{
+    auto start = std::chrono::system_clock::now();
+
+    VkCommandBuffer cmd = get_current_frame()._threadCommandBuffers[chunkIndex];
+
+    // the secondary command buffer continues the dynamic rendering scope begun in draw_geometry
+    VkCommandBufferInheritanceRenderingInfo renderingInheritance = vkinit::command_buffer_inheritance_rendering_info(&_drawImage.imageFormat, _depthImage.imageFormat);
+
+    VkCommandBufferInheritanceInfo inheritanceInfo = {.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO};
+    inheritanceInfo.pNext = &renderingInheritance;
+
+    VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+    cmdBeginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+
+    // set dynamic viewport and scissor, dynamic state is not inherited by secondary command buffers
+    VkViewport viewport = {};
+    viewport.x = 0;
+    viewport.y = 0;
+    viewport.width = _drawExtent.width;
+    viewport.height = _drawExtent.height;
+    viewport.minDepth = 0.f;
+    viewport.maxDepth = 1.f;
+
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+    VkRect2D scissor = {};
+    scissor.offset.x = 0;
+    scissor.offset.y = 0;
+    scissor.extent.width = _drawExtent.width;
+    scissor.extent.height = _drawExtent.height;
+
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+    if (chunkIndex == 0)
+    {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _trianglePipeline);
+
+        // launch a draw command to draw 12 vertices
+        vkCmdDraw(cmd, 12, 1, 0, 0);
+        drawcallCount++;
+        triangleCount += 4;
+    }
+
+    const std::vector<RenderObject> &surfaces = mainDrawContext.OpaqueSurfaces;
+    uint32_t objectCount = (uint32_t)surfaces.size();
+    uint32_t firstObject = (uint32_t)((uint64_t)objectCount * chunkIndex / chunkCount);
+    uint32_t lastObject = (uint32_t)((uint64_t)objectCount * (chunkIndex + 1) / chunkCount);
+
+    MaterialPipeline *lastPipeline = nullptr;
+    VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
+
+    for (uint32_t i = firstObject; i < lastObject; i++)
+    {
+        const RenderObject &draw = surfaces[i];
+
+        if (draw.material->pipeline != lastPipeline)
+        {
+            // every material pipeline shares the bindless and frame data layouts, so the sets stay bound across pipeline changes
+            if (lastPipeline == nullptr)
+            {
+                VkDescriptorSet sets[] = {_bindless.set, _frameDataSet};
+                uint32_t dynamicOffsets[] = {_sceneDataOffset, _drawDataOffset, _textureTableOffset};
+                vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.material->pipeline->layout, 0, 2, sets, 3, dynamicOffsets);
+            }
+
+            lastPipeline = draw.material->pipeline;
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, lastPipeline->pipeline);
+        }
+
+        if (draw.indexBuffer != lastIndexBuffer)
+        {
+            lastIndexBuffer = draw.indexBuffer;
+            vkCmdBindIndexBuffer(cmd, draw.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        }
+
+        draws[i].worldMatrix = draw.transform;
+        draws[i].materialIndex = draw.material->materialIndex;
+
+        GPUDrawPushConstants pushConstants;
+        pushConstants.vertexBuffer = draw.vertexBufferAddress;
+        pushConstants.materialBuffer = _materialBufferIndex;
+        pushConstants.drawIndex = i;
+
+        vkCmdPushConstants(cmd, lastPipeline->layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(GPUDrawPushConstants), &pushConstants);
+
+        vkCmdDrawIndexed(cmd, draw.indexCount, 1, draw.firstIndex, 0, 0);
+        drawcallCount++;
+        triangleCount += draw.indexCount / 3;
+    }
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
+
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+    return elapsed.count() / 1000.f;
+}
+
+void VulkanEngine::draw_imgui(VkCommandBuffer cmd, VkImageView targetImageView)
+{
+    VkRenderingAttachmentInfo colorAttachment = vkinit::attachment_info(targetImageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    VkRenderingInfo renderInfo = vkinit::rendering_info(_swapchainExtent, &colorAttachment, nullptr);
+
+    vkCmdBeginRendering(cmd, &renderInfo);
+
+    ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
+
+    vkCmdEndRendering(cmd);
+}
+
+void VulkanEngine::draw_gpu_timeline()
+{
+    if (stats.gpu_timings.empty())
+    {
+        ImGui::Text("gpu timings not available");
+        return;
+    }
+
+    ImGui::SeparatorText("GPU");
+
+    // scopes nest in recording order, so indenting by depth gives the hierarchy
+    for (const GpuTiming &timing : stats.gpu_timings)
+    {
+        ImGui::Text("%*s%s %.3f ms", timing.depth * 2, "", timing.name, timing.duration_ms);
+    }
+
+    // timeline, one row per nesting level scaled to the root scope
+    const float rowHeight = ImGui::GetTextLineHeight();
+    const float width = ImGui::GetContentRegionAvail().x;
+    const float total = std::max(stats.gpu_timings.front().duration_ms, 0.001f);
+
+    uint32_t maxDepth = 0;
+    for (const GpuTiming &timing : stats.gpu_timings)
+        maxDepth = std::max(maxDepth, timing.depth);
+
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImDrawList *drawList = ImGui::GetWindowDrawList();
+
+    for (size_t i = 0; i < stats.gpu_timings.size(); i++)
+    {
+        const GpuTiming &timing = stats.gpu_timings[i];
+
+        ImVec2 min = ImVec2(origin.x + width * timing.start_ms / total, origin.y + timing.depth * (rowHeight + 2.f));
+        ImVec2 max = ImVec2(min.x + std::max(width * timing.duration_ms / total, 1.f), min.y + rowHeight);
+
+        ImU32 color = ImGui::GetColorU32(ImVec4(0.3f + 0.15f * (i % 4), 0.5f, 0.8f - 0.1f * (i % 4), 1.f));
+        drawList->AddRectFilled(min, max, color);
+        drawList->PushClipRect(min, max, true);
+        drawList->AddText(ImVec2(min.x + 2.f, min.y), IM_COL32_WHITE, timing.name);
+        drawList->PopClipRect();
+    }
+
+    ImGui::Dummy(ImVec2(width, (maxDepth + 1) * (rowHeight + 2.f)));
+}
+
+void VulkanEngine::draw_frame_pacing_settings()
+{
+    if (!ImGui::CollapsingHeader("Frame pacing"))
+        return;
+
+    int framesInFlight = (int)_requestedFramesInFlight;
+    if (ImGui::SliderInt("frames in flight", &framesInFlight, 1, MAX_FRAMES_IN_FLIGHT))
+        set_frames_in_flight((uint32_t)framesInFlight);
+
+    if (ImGui::BeginCombo("present mode", string_VkPresentModeKHR(_presentMode)))
+    {
+        for (VkPresentModeKHR mode : _supportedPresentModes)
+        {
+            if (ImGui::Selectable(string_VkPresentModeKHR(mode), mode == _presentMode))
+                set_present_mode(mode);
+        }
+        ImGui::EndCombo();
+    }
+
+    float targetFps = _framePacer.target_fps();
+    if (ImGui::InputFloat("fps limit ( 0 off )", &targetFps, 10.f, 60.f, "%.0f"))
+        _framePacer.set_target_fps(std::max(targetFps, 0.f));
+
+    ImGui::Text("fence wait %.2f ms, limiter wait %.2f ms ( margin %.2f ms )", stats.fence_wait_time, stats.pacer_wait_time, _framePacer.sleep_margin_ms());
+    ImGui::Text("input to gpu done ~%.1f ms, to present ~%.1f ms ( %.0f hz )", stats.input_to_gpu_latency, stats.input_to_present_latency, _displayRefreshRate);
+}
+
+void VulkanEngine::draw_dynamic_resolution_settings()
+{
+    if (!ImGui::CollapsingHeader("Dynamic resolution"))
+        return;
+
+    ImGui::Checkbox("enabled", &_dynamicResolution.enabled);
+    ImGui::SliderFloat("gpu budget ms", &_dynamicResolution.targetMs, 1.f, 33.f, "%.1f");
+    ImGui::SliderFloat("min scale", &_dynamicResolution.minScale, 0.25f, 1.f, "%.2f");
+
+    ImGui::Text("scale %.2f, %ux%u, scaled passes %.2f ms", _dynamicResolution.scale(), _drawExtent.width, _drawExtent.height, _dynamicResolution.gpu_time_ms());
+}
+
+void VulkanEngine::draw_render_graph_stats()
+{
+    if (!ImGui::CollapsingHeader("Render graph"))
+        return;
+
+    const RenderGraphStats &graph = stats.render_graph;
+
+    ImGui::Checkbox("conservative barriers", &_renderGraph.conservativeBarriers);
+    ImGui::Text("%u passes, %u image barriers in %u batches, %u on ALL_COMMANDS", graph.passes, graph.imageBarriers, graph.barrierBatches, graph.fullPipelineBarriers);
+    ImGui::Text("transient images %.2f MB, aliased into %.2f MB", graph.transientBytes / (1024.f * 1024.f), graph.aliasedBytes / (1024.f * 1024.f));
+}
+
+void VulkanEngine::draw_texture_streaming_stats()
+{
+    if (!ImGui::CollapsingHeader("Texture streaming"))
+        return;
+
+    const TextureStreamingStats &streaming = _textureStreamer.stats();
+
+    int budgetMB = (int)(_textureStreamer.budgetBytes / (1024 * 1024));
+    if (ImGui::SliderInt("budget MB", &budgetMB, 16, 4096))
+        _textureStreamer.budgetBytes = (VkDeviceSize)budgetMB * 1024 * 1024;
+
+    ImGui::Text("%u textures, %u uploads pending, %u evictions", streaming.textures, streaming.pendingUploads, streaming.evictions);
+    ImGui::Text("resident %.2f / %.2f MB, streamed %.2f MB", streaming.residentBytes / (1024.f * 1024.f), streaming.budgetBytes / (1024.f * 1024.f),
+                streaming.streamedBytes / (1024.f * 1024.f));
+}
+
+void VulkanEngine::draw_memory_stats()
+{
+    if (!ImGui::CollapsingHeader("Memory"))
+        return;
+
+    const VkPhysicalDeviceMemoryProperties *memoryProperties;
+    vmaGetMemoryProperties(_allocator, &memoryProperties);
+
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets(_allocator, budgets);
+
+    // without the extension vma estimates usage from its own allocations and the budget from the heap size
+    ImGui::Text("heaps ( %s )", _memory.has_memory_budget() ? "VK_EXT_memory_budget" : "estimated");
+    for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; i++)
+    {
+        bool deviceLocal = memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+        ImGui::Text("  %u%s: %.1f / %.1f MB, %.1f MB in %u blocks", i, deviceLocal ? " device" : "", budgets[i].usage / (1024.f * 1024.f),
+                    budgets[i].budget / (1024.f * 1024.f), budgets[i].statistics.blockBytes / (1024.f * 1024.f), budgets[i].statistics.blockCount);
+    }
+
+    for (uint32_t i = 0; i < (uint32_t)MemoryCategory::Count; i++)
+    {
+        MemoryCategoryStats category = _memory.category_stats((MemoryCategory)i);
+        ImGui::Text("%s: %.2f MB in %u allocations", memory_category_name((MemoryCategory)i), category.bytes / (1024.f * 1024.f), category.allocations);
+    }
+
+    const TextureStreamingStats &streaming = _textureStreamer.stats();
+    ImGui::SliderFloat("defragment above", &_textureStreamer.defragmentThreshold, 0.05f, 1.f, "%.2f");
+    if (ImGui::Button("defragment textures"))
+        _textureStreamer.request_defragmentation();
+
+    ImGui::Text("texture pool fragmentation %.2f%s", streaming.fragmentation, streaming.defragmenting ? ", defragmenting" : "");
+    ImGui::Text("%u runs, %.2f MB moved", streaming.defragmentations, streaming.defragmentedBytes / (1024.f * 1024.f));
+}
+
+void VulkanEngine::init_headless(const HeadlessSettings &settings)
+{
+    _headless = true;
+    _headlessSettings = settings;
+    _windowExtent = VkExtent2D{settings.width, settings.height};
+
+    // frame times are compared between runs, the resolution has to stay fixed
+    _dynamicResolution.enabled = false;
+    _renderGraph.conservativeBarriers = settings.conservativeBarriers;
+    _useAsyncCompute = settings.asyncCompute;
+
+    init();
+
+    // a small budget makes the streamer evict, the run then shows which levels it kept
+    if (settings.textureBudgetMB > 0)
+        _textureStreamer.budgetBytes = (VkDeviceSize)settings.textureBudgetMB * 1024 * 1024;
+}
+
+namespace
+{
+    struct HeadlessFrame
+    {
+        float cpu_ms;
+        float gpu_ms;
+        int drawcalls;
+        int triangles;
+        uint64_t heap_allocations;
+    };
+
+    float frame_gpu_time(const std::vector<GpuTiming> &timings)
+    {
+        // the outermost scope spans the whole command buffer
+        for (const GpuTiming &timing : timings)
+        {
+            if (timing.depth == 0)
+                return timing.duration_ms;
+        }
+        return -1.f;
+    }
+
+    void print_frame_time_summary(const char *name, std::vector<float> times)
+    {
+        std::erase_if(times, [](float time)
+                      { return time < 0.f; });
+        if (times.empty())
+            return;
+
+        std::sort(times.begin(), times.end());
+
+        float sum = 0.f;
+        for (float time : times)
+            sum += time;
+
+        fmt::print("{:>4}: avg {:.3f} ms, min {:.3f} ms, p50 {:.3f} ms, p95 {:.3f} ms, max {:.3f} ms\n", name, sum / times.size(),
+                   times.front(), times[times.size() / 2], times[std::min(times.size() - 1, times.size() * 95 / 100)], times.back());
+    }
+}
+
+void VulkanEngine::write_capture(const std::string &path)
+{
+    // the copy was recorded into the frame submitted last
+    FrameData &frame = get_last_frame();
+    VK_CHECK(vkWaitForFences(_device, 1, &frame._renderFence, true, UINT64_MAX));
+
+    vmaInvalidateAllocation(_allocator, _captureBuffer.allocation, 0, VK_WHOLE_SIZE);
+    const uint16_t *texels = static_cast<const uint16_t *>(_captureBuffer.info.pMappedData);
+
+    // the swapchain is UNORM, so the values are shown as they are, only clamped
+    size_t count = (size_t)_drawExtent.width * _drawExtent.height * 4;
+    std::vector<uint8_t> pixels(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        float value = glm::unpackHalf1x16(texels[i]);
+        pixels[i] = (uint8_t)(std::clamp(value, 0.f, 1.f) * 255.f + 0.5f);
+    }
+
+    if (!write_png(path, _drawExtent.width, _drawExtent.height, pixels.data()))
+        fmt::print("failed to write {}\n", path);
+}
+
+int VulkanEngine::run_headless()
+{
+    const HeadlessSettings &settings = _headlessSettings;
+
+    if (settings.defragmentationCheck)
+        return run_defragmentation_check();
+
+    if (!settings.scenePath.empty())
+    {
+        load_scene_async(settings.scenePath);
+
+        // frames keep the uploads moving, nothing is measured until the scene is resident
+        auto resident = [this]()
+        {
+            return _sceneLoads.empty() && std::all_of(loadedScenes.begin(), loadedScenes.end(), [this](const std::shared_ptr<MeshScene> &scene)
+                                                      { return _uploader.is_complete(scene->uploadTicket); });
+        };
+
+        while (!resident())
+            draw();
+
+        if (loadedScenes.empty())
+        {
+            fmt::print("failed to load {}\n", settings.scenePath);
+            return 1;
+        }
+
+        // and the textures streamed in at the levels the camera needs, done once a frame neither swaps
+        // in a finished upload nor starts a new one
+        for (uint32_t frame = 0; frame < 1000; frame++)
+        {
+            VkDeviceSize streamed = _textureStreamer.stats().streamedBytes;
+            draw();
+            if (_textureStreamer.stats().pendingUploads == 0 && _textureStreamer.stats().streamedBytes == streamed)
+                break;
+        }
+    }
+
+    vkDeviceWaitIdle(_device);
+
+    const int firstFrame = _frameNumber;
+    std::vector<HeadlessFrame> frames(settings.frameCount, HeadlessFrame{0.f, -1.f, 0, 0, 0});
+
+    for (uint32_t i = 0; i < settings.frameCount; i++)
+    {
+        bool lastFrame = i + 1 == settings.frameCount;
+        _captureRequested = !settings.capturePath.empty() && (settings.captureInterval > 0 ? i % settings.captureInterval == 0 : lastFrame);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        _inputTime = std::chrono::steady_clock::now();
+        uint64_t allocations = heap_allocation_count();
+
+        draw();
+
+        stats.draw_heap_allocations = heap_allocation_count() - allocations;
+        auto end = std::chrono::high_resolution_clock::now();
+        stats.frametime = std::chrono::duration<float, std::milli>(end - start).count();
+        frames[i].heap_allocations = stats.draw_heap_allocations;
+
+        frames[i].cpu_ms = stats.frametime;
+        frames[i].drawcalls = stats.drawcall_count;
+        frames[i].triangles = stats.triangle_count;
+
+        // gpu times come back when the frame slot is reused, they belong to an earlier frame
+        if (stats.gpu_timings_frame >= firstFrame)
+            frames[stats.gpu_timings_frame - firstFrame].gpu_ms = frame_gpu_time(stats.gpu_timings);
+
+        // the wait for the readback stalls the pipeline, the frame after a capture is not representative
+        if (_captureRequested)
+            write_capture(fmt::format("{}_{:05}.png", settings.capturePath, i));
+    }
+
+    _captureRequested = false;
+
+    // the last frames in flight are read once the gpu is idle
+    vkDeviceWaitIdle(_device);
+    for (uint32_t slot = 0; slot < _framesInFlight; slot++)
+    {
+        int frame = _frames[slot]._submittedFrame;
+        if (frame < firstFrame)
+            continue;
+
+        std::vector<GpuTiming> timings;
+        if (_frames[slot]._gpuTimestamps.read_results(_device, _timestampPeriod, timings))
+            frames[frame - firstFrame].gpu_ms = frame_gpu_time(timings);
+    }
+
+    std::ofstream csv(settings.timingsPath, std::ios::trunc);
+    if (csv.is_open())
+    {
+        csv << "frame,cpu_ms,gpu_ms,drawcalls,triangles,heap_allocations\n";
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            csv << fmt::format("{},{:.4f},{:.4f},{},{},{}\n", i, frames[i].cpu_ms, frames[i].gpu_ms, frames[i].drawcalls, frames[i].triangles, frames[i].heap_allocations);
+        }
+        fmt::print("frame timings written to {}\n", settings.timingsPath);
+    }
+    else
+    {
+        fmt::print("failed to write {}\n", settings.timingsPath);
+    }
+
+    std::vector<float> cpuTimes(frames.size());
+    std::vector<float> gpuTimes(frames.size());
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        cpuTimes[i] = frames[i].cpu_ms;
+        gpuTimes[i] = frames[i].gpu_ms;
+    }
+
+    fmt::print("{} headless frames at {}x{}\n", frames.size(), _drawExtent.width, _drawExtent.height);
+    print_frame_time_summary("cpu", cpuTimes);
+    print_frame_time_summary("gpu", gpuTimes);
+
+    fmt::print("background on the {} queue\n", _hasAsyncCompute && _useAsyncCompute ? "compute" : "graphics");
+
+    // the first frame of every slot grows its arena, the rest should not touch the heap
+    uint64_t steadyAllocations = 0;
+    uint32_t allocatingFrames = 0;
+    for (size_t i = _framesInFlight; i < frames.size(); i++)
+    {
+        steadyAllocations = std::max(steadyAllocations, frames[i].heap_allocations);
+        allocatingFrames += frames[i].heap_allocations > 0 ? 1 : 0;
+    }
+    fmt::print("heap allocations in draw: at most {} per frame, {} frames allocating after the first {}\n", steadyAllocations, allocatingFrames, _framesInFlight);
+    if (steadyAllocations > 0)
+        fmt::print("steady state frames are expected to allocate nothing\n");
+
+    const RenderGraphStats &graph = stats.render_graph;
+    fmt::print("{} barriers: {} image barriers in {} batches, {} on ALL_COMMANDS, per frame\n", _renderGraph.conservativeBarriers ? "conservative" : "render graph",
+               graph.imageBarriers, graph.barrierBatches, graph.fullPipelineBarriers);
+    fmt::print("transient images: {:.2f} MB, aliased into {:.2f} MB\n", graph.transientBytes / (1024.0 * 1024.0), graph.aliasedBytes / (1024.0 * 1024.0));
+
+    const TextureStreamingStats &streaming = _textureStreamer.stats();
+    fmt::print("streamed textures: {}, {:.2f} MB resident of {:.2f} MB budget, {:.2f} MB streamed, {} evictions\n", streaming.textures,
+               streaming.residentBytes / (1024.0 * 1024.0), streaming.budgetBytes / (1024.0 * 1024.0), streaming.streamedBytes / (1024.0 * 1024.0), streaming.evictions);
+
+    return csv.is_open() && steadyAllocations == 0 ? 0 : 1;
+}
+
+int VulkanEngine::run_defragmentation_check()
+{
+    if (_memory.movable_image_pool() == VK_NULL_HANDLE)
+    {
+        fmt::print("defragmentation check skipped, the device has no movable image pool\n");
+        return 0;
+    }
+
+    // only the run requested below, the threshold would start one on its own while the pool fills
+    _textureStreamer.defragmentThreshold = 1.f;
+
+    // enough full resolution textures to fill more than one block of the pool
+    constexpr uint32_t TEXTURE_COUNT = 96;
+    constexpr uint32_t TEXTURE_SIZE = 512;
+
+    // every texture is one solid color, one showing the memory of another is told apart by any texel
+    auto color = [](uint32_t texture)
+    { return 0xff000000u | ((texture + 1) * 2654435761u & 0x00ffffffu); };
+
+    std::vector<StreamedTexture> textures;
+    std::vector<uint32_t> pixels((size_t)TEXTURE_SIZE * TEXTURE_SIZE);
+    for (uint32_t i = 0; i < TEXTURE_COUNT; i++)
+    {
+        std::fill(pixels.begin(), pixels.end(), color(i));
+        textures.push_back(_textureStreamer.add(std::make_unique<MemoryTextureSource>(reinterpret_cast<const uint8_t *>(pixels.data()), VkExtent2D{TEXTURE_SIZE, TEXTURE_SIZE})));
+    }
+
+    // the textures still alive are asked for at full resolution every frame, nothing gets evicted or restreamed
+    auto frame = [&]()
+    {
+        for (StreamedTexture texture : textures)
+        {
+            if (texture.valid())
+                _textureStreamer.request(texture, 0);
+        }
+        draw();
+    };
+
+    for (uint32_t i = 0; i < 1000; i++)
+    {
+        VkDeviceSize streamed = _textureStreamer.stats().streamedBytes;
+        frame();
+        if (_textureStreamer.stats().pendingUploads == 0 && _textureStreamer.stats().streamedBytes == streamed)
+            break;
+    }
+
+    // every other texture goes, its memory is released once the frames in flight are done with it
+    for (uint32_t i = 1; i < TEXTURE_COUNT; i += 2)
+    {
+        _textureStreamer.remove(textures[i]);
+        textures[i] = StreamedTexture{};
+    }
+    for (uint32_t i = 0; i <= MAX_FRAMES_IN_FLIGHT; i++)
+        frame();
+
+    VmaStatistics before;
+    vmaGetPoolStatistics(_allocator, _memory.movable_image_pool(), &before);
+    float fragmentationBefore = _memory.movable_image_fragmentation();
+
+    std::vector<VkImage> imagesBefore(TEXTURE_COUNT, VK_NULL_HANDLE);
+    for (uint32_t i = 0; i < TEXTURE_COUNT; i += 2)
+        imagesBefore[i] = _textureStreamer.resident_image(textures[i]).image;
+
+    uint32_t runs = _textureStreamer.stats().defragmentations;
+    _textureStreamer.request_defragmentation();
+    for (uint32_t i = 0; i < 1000 && _textureStreamer.stats().defragmentations == runs; i++)
+        frame();
+
+    vkDeviceWaitIdle(_device);
+
+    VmaStatistics after;
+    vmaGetPoolStatistics(_allocator, _memory.movable_image_pool(), &after);
+    float fragmentationAfter = _memory.movable_image_fragmentation();
+
+    fmt::print("movable image pool: {} blocks, {:.2f} MB, fragmentation {:.2f} before defragmentation, {} blocks, {:.2f} MB, fragmentation {:.2f} after\n",
+               before.blockCount, before.blockBytes / (1024.0 * 1024.0), fragmentationBefore, after.blockCount, after.blockBytes / (1024.0 * 1024.0), fragmentationAfter);
+
+    bool passed = true;
+    if (_textureStreamer.stats().defragmentations == runs)
+    {
+        fmt::print("defragmentation did not finish\n");
+        passed = false;
+    }
+    if (fragmentationBefore == 0.f || after.blockBytes >= before.blockBytes)
+    {
+        fmt::print("the pool was not compacted\n");
+        passed = false;
+    }
+
+    // every texture left has to sample its own contents through the slot the residency table gives it
+    AllocatedBuffer readback = create_buffer(pixels.size() * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU, MemoryCategory::Staging);
+    uint32_t moved = 0;
+    uint32_t wrong = 0;
+    for (uint32_t i = 0; i < TEXTURE_COUNT; i += 2)
+    {
+        const AllocatedImage &image = _textureStreamer.resident_image(textures[i]);
+        if (image.image != imagesBefore[i])
+            moved++;
+
+        if (_bindless.image_view(_textureStreamer.resident_slot(textures[i])) != image.imageView)
+        {
+            wrong++;
+            continue;
+        }
+
+        immediate_submit([&](VkCommandBuffer cmd)
+                         {
+            vkutil::transition_image(cmd, image.image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+            VkBufferImageCopy copy = {};
+            copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            copy.imageSubresource.layerCount = 1;
+            copy.imageExtent = {TEXTURE_SIZE, TEXTURE_SIZE, 1};
+            vkCmdCopyImageToBuffer(cmd, image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback.buffer, 1, &copy);
+
+            vkutil::transition_image(cmd, image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL); });
+
+        vmaInvalidateAllocation(_allocator, readback.allocation, 0, VK_WHOLE_SIZE);
+        const uint32_t *texels = static_cast<const uint32_t *>(readback.info.pMappedData);
+        if (!std::all_of(texels, texels + pixels.size(), [&](uint32_t texel)
+                         { return texel == color(i); }))
+            wrong++;
+    }
+    destroy_buffer(readback);
+
+    const TextureStreamingStats &streaming = _textureStreamer.stats();
+    fmt::print("{} of {} textures moved, {:.2f} MB, {} showing the wrong contents\n", moved, TEXTURE_COUNT / 2, streaming.defragmentedBytes / (1024.0 * 1024.0), wrong);
+
+    if (moved == 0 || wrong > 0)
+        passed = false;
+
+    fmt::print("defragmentation check {}\n", passed ? "passed" : "failed");
+    return passed ? 0 : 1;
+}
+
+void VulkanEngine::run()
+{
+    SDL_Event e;
+    bool bQuit = false;
+
+    // main loop
+    while (!bQuit)
+    {
+        auto start = std::chrono::system_clock::now();
+
+        // sleeping before the input is read keeps the limited frames from adding latency
+        stats.pacer_wait_time = _framePacer.wait();
+        _inputTime = std::chrono::steady_clock::now();
+
+        // Handle events on queue
+        while (SDL_PollEvent(&e) != 0)
+        {
+            // close the window when user alt-f4s or clicks the X button
+            if (e.type == SDL_EVENT_QUIT)
+                bQuit = true;
+
+            if (e.key.scancode == SDL_SCANCODE_ESCAPE)
+                bQuit = true;
+
+            if (e.type == SDL_EVENT_WINDOW_SHOWN)
+            {
+                if (e.window.type == SDL_EVENT_WINDOW_MINIMIZED)
+                {
                     stop_rendering = true;
                 }
                 if (e.window.type == SDL_EVENT_WINDOW_RESTORED)
@@ -1110,6 +2835,8 @@ void VulkanEngine::run()
                 }
             }
 
+            mainCamera.processSDLEvent(e);
+
             // send SDL event to imgui for handling
             ImGui_ImplSDL3_ProcessEvent(&e);
         }
@@ -1134,6 +2861,29 @@ void VulkanEngine::run()
         ImGui::Text("drawtime %f ms", stats.mesh_draw_time);
         ImGui::Text("triangles %i", stats.triangle_count);
         ImGui::Text("draws %i", stats.drawcall_count);
+        if (_gpuDriven)
+            ImGui::Text("culled %i", stats.culled_count);
+        ImGui::Checkbox("GPU driven", &_gpuDriven);
+        if (_hasAsyncCompute)
+        {
+            ImGui::Checkbox("async compute background", &_useAsyncCompute);
+            ImGui::Text("async compute %.3f ms", stats.async_compute_time);
+        }
+        ImGui::Checkbox("occlusion culling", &_occlusionCulling);
+        for (size_t i = 0; i < stats.record_times.size(); i++)
+        {
+            ImGui::Text("thread %zu recording %f ms", i, stats.record_times[i]);
+        }
+        ImGui::Text("pipelines built in %.2f ms ( %.2f ms cold )", stats.pipeline_build_time, stats.pipeline_cold_build_time);
+        ImGui::Text("draw heap allocations %llu, frame arena %.1f / %.1f KB", (unsigned long long)stats.draw_heap_allocations,
+                    stats.frame_arena_used / 1024.f, stats.frame_arena_capacity / 1024.f);
+        ImGui::Text("frame ring %.1f / %.1f KB", stats.frame_ring_used / 1024.f, _frameRing.frame_size() / 1024.f);
+        draw_frame_pacing_settings();
+        draw_dynamic_resolution_settings();
+        draw_render_graph_stats();
+        draw_texture_streaming_stats();
+        draw_memory_stats();
+        draw_gpu_timeline();
         ImGui::End();
 
         if (ImGui::Begin("background"))
@@ -1153,9 +2903,31 @@ void VulkanEngine::run()
             ImGui::End();
         }
 
+        if (ImGui::Begin("Scene"))
+        {
+            static char scenePath[256] = "";
+            ImGui::InputText("path", scenePath, sizeof(scenePath));
+            if (ImGui::Button("Load") && scenePath[0] != '\0')
+            {
+                load_scene_async(scenePath);
+            }
+
+            if (!_sceneLoads.empty())
+                ImGui::Text("loading %zu scenes", _sceneLoads.size());
+
+            for (const std::shared_ptr<MeshScene> &scene : loadedScenes)
+            {
+                ImGui::Text("%s: %zu meshes, %zu instances%s", scene->name.c_str(), scene->surfaces.size(), scene->instances.size(),
+                            _uploader.is_complete(scene->uploadTicket) ? "" : " ( uploading )");
+            }
+        }
+        ImGui::End();
+
         ImGui::Render();
 
+        uint64_t allocations = heap_allocation_count();
         draw();
+        stats.draw_heap_allocations = heap_allocation_count() - allocations;
 
         auto end = std::chrono::system_clock::now();
         auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
@@ -0,0 +1,62 @@
+#include "render_engine/vk_frame_ring.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+void FrameRingBuffer::init(GpuMemory *memory, VkDeviceSize frameSize, uint32_t frameCount, VkDeviceSize alignment)
+{
+    _memory = memory;
+    _allocator = memory->allocator();
+    _alignment = std::max<VkDeviceSize>(alignment, 16);
+    _frameSize = (frameSize + _alignment - 1) & ~(_alignment - 1);
+
+    VkBufferCreateInfo bufferInfo = {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    // one region of slack at the end, a binding of frame_size() bytes from any offset of the last slot stays inside the buffer
+    bufferInfo.size = _frameSize * (frameCount + 1);
+    bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    // written once per frame and read once by the gpu, host visible device memory when there is some
+    VmaAllocationCreateInfo vmaallocInfo = {};
+    vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+    vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &_buffer.buffer, &_buffer.allocation, &_buffer.info));
+    _memory->tag(_buffer.allocation, MemoryCategory::Buffers);
+
+    _frameStart = 0;
+    _head = 0;
+}
+
+void FrameRingBuffer::destroy()
+{
+    _memory->untag(_buffer.allocation);
+    vmaDestroyBuffer(_allocator, _buffer.buffer, _buffer.allocation);
+}
+
+void FrameRingBuffer::begin_frame(uint32_t frameIndex)
+{
+    _highWater = std::max(_highWater, used());
+
+    _frameStart = _frameSize * frameIndex;
+    _head = _frameStart;
+}
+
+FrameRingBuffer::Allocation FrameRingBuffer::allocate(VkDeviceSize size)
+{
+    VkDeviceSize offset = (_head + _alignment - 1) & ~(_alignment - 1);
+    if (offset + size > _frameStart + _frameSize)
+    {
+        fmt::print("Frame ring buffer is full ( {} bytes per frame )\n", _frameSize);
+        abort();
+    }
+
+    _head = offset + size;
+
+    return Allocation{(char *)_buffer.info.pMappedData + offset, (uint32_t)offset};
+}
+
+void FrameRingBuffer::flush()
+{
+    if (_head > _frameStart)
+        VK_CHECK(vmaFlushAllocation(_allocator, _buffer.allocation, _frameStart, _head - _frameStart));
+}
@@ -13,7 +13,7 @@ VkCommandPoolCreateInfo vkinit::command_pool_create_info(uint32_t queueFamilyInd
 }
 
 VkCommandBufferAllocateInfo vkinit::command_buffer_allocate_info(
-    VkCommandPool pool, uint32_t count /*= 1*/)
+    VkCommandPool pool, uint32_t count /*= 1*/, VkCommandBufferLevel level /*= VK_COMMAND_BUFFER_LEVEL_PRIMARY*/)
 {
     VkCommandBufferAllocateInfo info = {};
     info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -21,7 +21,7 @@ VkCommandBufferAllocateInfo vkinit::command_buffer_allocate_info(
 
     info.commandPool = pool;
     info.commandBufferCount = count;
-    info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    info.level = level;
     return info;
 }
 //< init_cmd
@@ -37,6 +37,22 @@ VkCommandBufferBeginInfo vkinit::command_buffer_begin_info(VkCommandBufferUsageF
     info.flags = flags;
     return info;
 }
+
+VkCommandBufferInheritanceRenderingInfo vkinit::command_buffer_inheritance_rendering_info(const VkFormat *colorFormat, VkFormat depthFormat)
+{
+    // secondary command buffers recorded inside a dynamic rendering scope need to know the attachment formats
+    VkCommandBufferInheritanceRenderingInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+    info.pNext = nullptr;
+
+    info.flags = 0;
+    info.colorAttachmentCount = colorFormat ? 1 : 0;
+    info.pColorAttachmentFormats = colorFormat;
+    info.depthAttachmentFormat = depthFormat;
+    info.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+    info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    return info;
+}
 //< init_cmd_draw
 
 //> init_sync
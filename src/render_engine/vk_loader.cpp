@@ -0,0 +1,431 @@
+#include "render_engine/vk_loader.h"
+
+#include "core/hash.h"
+#include "core/job_system.h"
+
+#include <assimp/DefaultIOSystem.h>
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <unordered_map>
+
+// size of the post-transform cache Tipsify optimizes for, 16 is a safe lower bound on current gpus
+constexpr uint32_t VERTEX_CACHE_SIZE = 16;
+
+namespace
+{
+    // the files assimp opens for reading, the mesh cache goes stale when any of them changes
+    class RecordingIOSystem : public Assimp::DefaultIOSystem
+    {
+        std::vector<std::string> &_files;
+
+    public:
+        explicit RecordingIOSystem(std::vector<std::string> &files) : _files(files) {}
+
+        Assimp::IOStream *Open(const char *file, const char *mode) override
+        {
+            Assimp::IOStream *stream = Assimp::DefaultIOSystem::Open(file, mode);
+            if (stream && mode[0] == 'r' && std::find(_files.begin(), _files.end(), file) == _files.end())
+                _files.push_back(file);
+            return stream;
+        }
+    };
+
+    struct VertexHash
+    {
+        size_t operator()(const Vertex &v) const
+        {
+            // over the raw bytes, Vertex has no padding
+            return (size_t)hash_bytes(&v, sizeof(Vertex));
+        }
+    };
+
+    struct VertexEqual
+    {
+        bool operator()(const Vertex &a, const Vertex &b) const
+        {
+            return memcmp(&a, &b, sizeof(Vertex)) == 0;
+        }
+    };
+
+    static_assert(sizeof(Vertex) == 48, "Vertex is hashed bytewise and must not contain padding");
+
+    void deduplicate_vertices(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices)
+    {
+        std::unordered_map<Vertex, uint32_t, VertexHash, VertexEqual> unique;
+        unique.reserve(vertices.size());
+
+        std::vector<Vertex> uniqueVertices;
+        uniqueVertices.reserve(vertices.size());
+
+        std::vector<uint32_t> remap(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            auto [it, inserted] = unique.try_emplace(vertices[i], (uint32_t)uniqueVertices.size());
+            if (inserted)
+                uniqueVertices.push_back(vertices[i]);
+
+            remap[i] = it->second;
+        }
+
+        for (uint32_t &index : indices)
+            index = remap[index];
+
+        vertices = std::move(uniqueVertices);
+    }
+
+    // Tipsify, Sander et al. 2007 "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw".
+    // fans around the current vertex and picks the next fanning vertex among the ones still in the cache
+    void optimize_vertex_cache(std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize)
+    {
+        uint32_t triangleCount = (uint32_t)(indices.size() / 3);
+        if (triangleCount == 0)
+            return;
+
+        // vertex -> triangle adjacency
+        std::vector<uint32_t> liveTriangles(vertexCount, 0);
+        for (uint32_t index : indices)
+            liveTriangles[index]++;
+
+        std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+        for (uint32_t v = 0; v < vertexCount; v++)
+            adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+
+        std::vector<uint32_t> adjacency(indices.size());
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (uint32_t t = 0; t < triangleCount; t++)
+        {
+            for (uint32_t k = 0; k < 3; k++)
+                adjacency[fill[indices[t * 3 + k]]++] = t;
+        }
+
+        std::vector<uint32_t> cacheTime(vertexCount, 0);
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<uint32_t> deadEnd;
+        std::vector<uint32_t> candidates;
+
+        std::vector<uint32_t> output;
+        output.reserve(indices.size());
+
+        uint32_t timestamp = cacheSize + 1;
+        uint32_t cursor = 1;
+        int64_t fanning = 0;
+
+        while (fanning >= 0)
+        {
+            candidates.clear();
+
+            for (uint32_t a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; a++)
+            {
+                uint32_t t = adjacency[a];
+                if (emitted[t])
+                    continue;
+
+                for (uint32_t k = 0; k < 3; k++)
+                {
+                    uint32_t v = indices[t * 3 + k];
+                    output.push_back(v);
+                    deadEnd.push_back(v);
+                    candidates.push_back(v);
+                    liveTriangles[v]--;
+
+                    if (timestamp - cacheTime[v] > cacheSize)
+                        cacheTime[v] = timestamp++;
+                }
+                emitted[t] = true;
+            }
+
+            // prefer the candidate that is still in the cache with the most triangles left
+            fanning = -1;
+            int64_t bestPriority = -1;
+            for (uint32_t v : candidates)
+            {
+                if (liveTriangles[v] == 0)
+                    continue;
+
+                int64_t priority = 0;
+                if (timestamp - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+                    priority = timestamp - cacheTime[v];
+
+                if (priority > bestPriority)
+                {
+                    bestPriority = priority;
+                    fanning = v;
+                }
+            }
+
+            if (fanning >= 0)
+                continue;
+
+            // dead end, go back through the recently emitted vertices and then scan forward
+            while (!deadEnd.empty())
+            {
+                uint32_t v = deadEnd.back();
+                deadEnd.pop_back();
+                if (liveTriangles[v] > 0)
+                {
+                    fanning = v;
+                    break;
+                }
+            }
+
+            while (fanning < 0 && cursor < vertexCount)
+            {
+                if (liveTriangles[cursor] > 0)
+                    fanning = cursor;
+                cursor++;
+            }
+        }
+
+        indices = std::move(output);
+    }
+
+    // renumber the vertices in order of first use so the fetches walk the buffer linearly
+    void optimize_vertex_fetch(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices)
+    {
+        constexpr uint32_t UNUSED = ~0u;
+        std::vector<uint32_t> remap(vertices.size(), UNUSED);
+
+        std::vector<Vertex> ordered;
+        ordered.reserve(vertices.size());
+
+        for (uint32_t &index : indices)
+        {
+            if (remap[index] == UNUSED)
+            {
+                remap[index] = (uint32_t)ordered.size();
+                ordered.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+
+        // vertices no triangle references are dropped
+        vertices = std::move(ordered);
+    }
+
+    glm::mat4 to_glm(const aiMatrix4x4 &m)
+    {
+        // assimp matrices are row major
+        return glm::transpose(glm::make_mat4(&m.a1));
+    }
+
+    void gather_instances(const aiNode *node, const glm::mat4 &parentMatrix, const std::vector<int32_t> &meshToSurface, std::vector<MeshInstance> &instances)
+    {
+        glm::mat4 world = parentMatrix * to_glm(node->mTransformation);
+
+        for (uint32_t i = 0; i < node->mNumMeshes; i++)
+        {
+            int32_t surface = meshToSurface[node->mMeshes[i]];
+            if (surface >= 0)
+                instances.push_back(MeshInstance{(uint32_t)surface, world});
+        }
+
+        for (uint32_t i = 0; i < node->mNumChildren; i++)
+            gather_instances(node->mChildren[i], world, meshToSurface, instances);
+    }
+
+    SceneMaterial convert_material(const aiMaterial *material, const std::filesystem::path &directory)
+    {
+        SceneMaterial converted;
+
+        aiColor4D color(1.f, 1.f, 1.f, 1.f);
+        material->Get(AI_MATKEY_COLOR_DIFFUSE, color);
+        converted.colorFactors = glm::vec4(color.r, color.g, color.b, color.a);
+
+        // glTF base color maps to the diffuse slot as well. textures embedded in the file ( "*0" ) are not
+        // streamed, those materials keep their factor
+        aiString texture;
+        if (material->GetTexture(aiTextureType_DIFFUSE, 0, &texture) == AI_SUCCESS && texture.length > 0 && texture.C_Str()[0] != '*')
+            converted.colorTexture = (directory / texture.C_Str()).lexically_normal().string();
+
+        return converted;
+    }
+}
+
+float mesh_acmr(const std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize)
+{
+    if (indices.size() < 3)
+        return 0.f;
+
+    // FIFO cache, a vertex is in the cache if it was transformed within the last cacheSize misses
+    std::vector<uint32_t> cachedAt(vertexCount, 0);
+    uint32_t misses = 0;
+
+    for (uint32_t index : indices)
+    {
+        if (cachedAt[index] == 0 || misses + 1 - cachedAt[index] > cacheSize)
+        {
+            misses++;
+            cachedAt[index] = misses;
+        }
+    }
+
+    return (float)misses / (float)(indices.size() / 3);
+}
+
+void optimize_mesh(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices)
+{
+    deduplicate_vertices(vertices, indices);
+    optimize_vertex_cache(indices, (uint32_t)vertices.size(), VERTEX_CACHE_SIZE);
+    optimize_vertex_fetch(vertices, indices);
+}
+
+std::optional<MeshSceneData> load_mesh_scene(const std::string &path)
+{
+    auto start = std::chrono::system_clock::now();
+
+    std::vector<std::string> files;
+
+    // no JoinIdenticalVertices, the deduplication in optimize_mesh covers it
+    Assimp::Importer importer;
+    importer.SetIOHandler(new RecordingIOSystem(files)); // owned by the importer
+    const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_SortByPType | aiProcess_FlipUVs);
+
+    if (!scene || (scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) || !scene->mRootNode)
+    {
+        fmt::print("Failed to load mesh {}: {}\n", path, importer.GetErrorString());
+        return {};
+    }
+
+    struct ConvertedMesh
+    {
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        float acmrBefore;
+        float acmrAfter;
+    };
+
+    std::vector<ConvertedMesh> converted(scene->mNumMeshes);
+
+    // meshes are independent, convert and optimize them in parallel
+    JobSystem::Get().parallel_for(scene->mNumMeshes, 1, [&](uint32_t begin, uint32_t end)
+                                  {
+        for (uint32_t m = begin; m < end; m++)
+        {
+            const aiMesh *mesh = scene->mMeshes[m];
+            if (!(mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE))
+                continue;
+
+            ConvertedMesh &out = converted[m];
+
+            out.vertices.resize(mesh->mNumVertices);
+            for (uint32_t v = 0; v < mesh->mNumVertices; v++)
+            {
+                Vertex &vertex = out.vertices[v];
+
+                vertex.position = glm::vec3(mesh->mVertices[v].x, mesh->mVertices[v].y, mesh->mVertices[v].z);
+                vertex.normal = mesh->HasNormals() ? glm::vec3(mesh->mNormals[v].x, mesh->mNormals[v].y, mesh->mNormals[v].z) : glm::vec3(1, 0, 0);
+
+                vertex.uv_x = mesh->HasTextureCoords(0) ? mesh->mTextureCoords[0][v].x : 0.f;
+                vertex.uv_y = mesh->HasTextureCoords(0) ? mesh->mTextureCoords[0][v].y : 0.f;
+
+                // without vertex colors tint by the normal, so the shape reads before materials are bound
+                vertex.color = mesh->HasVertexColors(0) ? glm::vec4(mesh->mColors[0][v].r, mesh->mColors[0][v].g, mesh->mColors[0][v].b, mesh->mColors[0][v].a) : glm::vec4(vertex.normal * 0.5f + 0.5f, 1.f);
+            }
+
+            out.indices.reserve(mesh->mNumFaces * 3);
+            for (uint32_t f = 0; f < mesh->mNumFaces; f++)
+            {
+                const aiFace &face = mesh->mFaces[f];
+                if (face.mNumIndices != 3)
+                    continue;
+
+                out.indices.push_back(face.mIndices[0]);
+                out.indices.push_back(face.mIndices[1]);
+                out.indices.push_back(face.mIndices[2]);
+            }
+
+            out.acmrBefore = mesh_acmr(out.indices, (uint32_t)out.vertices.size(), VERTEX_CACHE_SIZE);
+            optimize_mesh(out.vertices, out.indices);
+            out.acmrAfter = mesh_acmr(out.indices, (uint32_t)out.vertices.size(), VERTEX_CACHE_SIZE);
+        } });
+
+    // pack everything into one vertex and one index array
+    MeshSceneData data;
+    data.name = path;
+
+    for (std::string &file : files)
+    {
+        if (file != path)
+            data.dependencies.push_back(std::move(file));
+    }
+
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+    for (const ConvertedMesh &mesh : converted)
+    {
+        vertexCount += mesh.vertices.size();
+        indexCount += mesh.indices.size();
+    }
+    data.vertices.reserve(vertexCount);
+    data.indices.reserve(indexCount);
+
+    std::vector<int32_t> meshToSurface(scene->mNumMeshes, -1);
+    double acmrBefore = 0.0;
+    double acmrAfter = 0.0;
+
+    for (uint32_t m = 0; m < scene->mNumMeshes; m++)
+    {
+        ConvertedMesh &mesh = converted[m];
+        if (mesh.indices.empty())
+            continue;
+
+        GeoSurface surface;
+        surface.name = scene->mMeshes[m]->mName.C_Str();
+        surface.startIndex = (uint32_t)data.indices.size();
+        surface.count = (uint32_t)mesh.indices.size();
+        surface.firstVertex = (uint32_t)data.vertices.size();
+        surface.vertexCount = (uint32_t)mesh.vertices.size();
+        surface.material = scene->mMeshes[m]->mMaterialIndex;
+
+        // sphere around the center of the aabb, a bit looser than the minimal one but cheap
+        glm::vec3 minPos = mesh.vertices[0].position;
+        glm::vec3 maxPos = mesh.vertices[0].position;
+        for (const Vertex &vertex : mesh.vertices)
+        {
+            minPos = glm::min(minPos, vertex.position);
+            maxPos = glm::max(maxPos, vertex.position);
+        }
+
+        glm::vec3 center = (minPos + maxPos) * 0.5f;
+        float radius = 0.f;
+        for (const Vertex &vertex : mesh.vertices)
+            radius = std::max(radius, glm::length(vertex.position - center));
+
+        surface.bounds = glm::vec4(center, radius);
+
+        meshToSurface[m] = (int32_t)data.surfaces.size();
+        data.surfaces.push_back(surface);
+
+        data.vertices.insert(data.vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+        data.indices.insert(data.indices.end(), mesh.indices.begin(), mesh.indices.end());
+
+        acmrBefore += mesh.acmrBefore * (mesh.indices.size() / 3);
+        acmrAfter += mesh.acmrAfter * (mesh.indices.size() / 3);
+    }
+
+    gather_instances(scene->mRootNode, glm::mat4(1.f), meshToSurface, data.instances);
+
+    // texture paths are relative to the scene file
+    std::filesystem::path directory = std::filesystem::path(path).parent_path();
+    for (uint32_t i = 0; i < scene->mNumMaterials; i++)
+        data.materials.push_back(convert_material(scene->mMaterials[i], directory));
+
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+
+    size_t triangleCount = std::max<size_t>(data.indices.size() / 3, 1);
+    fmt::print("Loaded {} in {} ms: {} meshes, {} instances, {} materials, {} vertices, {} triangles, ACMR {:.3f} -> {:.3f}\n",
+               path, elapsed.count(), data.surfaces.size(), data.instances.size(), data.materials.size(), data.vertices.size(), data.indices.size() / 3,
+               acmrBefore / triangleCount, acmrAfter / triangleCount);
+
+    return data;
+}
@@ -0,0 +1,115 @@
+#include "render_engine/vk_memory.h"
+
+#include "render_engine/vk_initializers.h"
+
+// small enough that compacting the movable images gives whole blocks back, larger images go to the default pools
+constexpr VkDeviceSize MOVABLE_IMAGE_BLOCK_SIZE = 64 * 1024 * 1024;
+
+const char *memory_category_name(MemoryCategory category)
+{
+    switch (category)
+    {
+    case MemoryCategory::Textures:
+        return "textures";
+    case MemoryCategory::Meshes:
+        return "meshes";
+    case MemoryCategory::Staging:
+        return "staging";
+    case MemoryCategory::RenderTargets:
+        return "render targets";
+    case MemoryCategory::Buffers:
+        return "buffers";
+    default:
+        return "unknown";
+    }
+}
+
+void GpuMemory::init(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device, bool memoryBudget)
+{
+    _memoryBudget = memoryBudget;
+
+    VmaAllocatorCreateInfo allocatorInfo = {};
+    allocatorInfo.physicalDevice = physicalDevice;
+    allocatorInfo.device = device;
+    allocatorInfo.instance = instance;
+    allocatorInfo.vulkanApiVersion = VK_API_VERSION_1_3;
+    allocatorInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+    if (_memoryBudget)
+        allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+    VK_CHECK(vmaCreateAllocator(&allocatorInfo, &_allocator));
+
+    // the memory type a sampled, device local image ends up in. Every color format the textures use
+    // lands in the same one on the drivers we run on, the streamer falls back to the default pools if not
+    VkImageCreateInfo imageInfo = vkinit::image_create_info(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                                                            VkExtent3D{256, 256, 1});
+
+    VmaAllocationCreateInfo allocInfo = {};
+    allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    allocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    uint32_t memoryType;
+    if (vmaFindMemoryTypeIndexForImageInfo(_allocator, &imageInfo, &allocInfo, &memoryType) == VK_SUCCESS)
+    {
+        VmaPoolCreateInfo poolInfo = {};
+        poolInfo.memoryTypeIndex = memoryType;
+        poolInfo.blockSize = MOVABLE_IMAGE_BLOCK_SIZE;
+        VK_CHECK(vmaCreatePool(_allocator, &poolInfo, &_movableImagePool));
+        vmaSetPoolName(_allocator, _movableImagePool, "movable images");
+    }
+}
+
+void GpuMemory::destroy()
+{
+    if (_movableImagePool != VK_NULL_HANDLE)
+        vmaDestroyPool(_allocator, _movableImagePool);
+
+    vmaDestroyAllocator(_allocator);
+}
+
+void GpuMemory::tag(VmaAllocation allocation, MemoryCategory category)
+{
+    // the category rides along in the user data, so untag finds it without a lookup table
+    vmaSetAllocationUserData(_allocator, allocation, (void *)((uintptr_t)category + 1));
+
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(_allocator, allocation, &info);
+
+    _categoryBytes[(size_t)category].fetch_add(info.size, std::memory_order_relaxed);
+    _categoryAllocations[(size_t)category].fetch_add(1, std::memory_order_relaxed);
+}
+
+void GpuMemory::untag(VmaAllocation allocation)
+{
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(_allocator, allocation, &info);
+
+    uintptr_t tag = (uintptr_t)info.pUserData;
+    if (tag == 0)
+        return;
+
+    size_t category = tag - 1;
+    _categoryBytes[category].fetch_sub(info.size, std::memory_order_relaxed);
+    _categoryAllocations[category].fetch_sub(1, std::memory_order_relaxed);
+
+    vmaSetAllocationUserData(_allocator, allocation, nullptr);
+}
+
+MemoryCategoryStats GpuMemory::category_stats(MemoryCategory category) const
+{
+    return MemoryCategoryStats{_categoryBytes[(size_t)category].load(std::memory_order_relaxed),
+                               _categoryAllocations[(size_t)category].load(std::memory_order_relaxed)};
+}
+
+float GpuMemory::movable_image_fragmentation() const
+{
+    if (_movableImagePool == VK_NULL_HANDLE)
+        return 0.f;
+
+    VmaStatistics statistics;
+    vmaGetPoolStatistics(_allocator, _movableImagePool, &statistics);
+
+    if (statistics.blockCount < 2 || statistics.blockBytes == 0)
+        return 0.f;
+
+    return 1.f - (float)statistics.allocationBytes / (float)statistics.blockBytes;
+}
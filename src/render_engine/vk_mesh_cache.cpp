@@ -0,0 +1,434 @@
+#include "render_engine/vk_mesh_cache.h"
+
+#include "core/file_io.h"
+#include "core/hash.h"
+
+#include <fmt/color.h>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    uint64_t align_up(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    bool stamp_file(const std::string &path, uint64_t &size, int64_t &modified)
+    {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+            return false;
+
+        size = (uint64_t)info.st_size;
+        modified = (int64_t)info.st_mtim.tv_sec * 1000000000ll + info.st_mtim.tv_nsec;
+        return true;
+    }
+
+    // drops the file from the page cache so the next read comes from the disk, best effort
+    void evict_page_cache(const std::string &path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+std::optional<uint64_t> hash_file(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return {};
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return {};
+    }
+
+    size_t size = (size_t)info.st_size;
+    if (size == 0)
+    {
+        close(fd);
+        return hash_bytes(nullptr, 0);
+    }
+
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return {};
+
+    madvise(data, size, MADV_SEQUENTIAL);
+    uint64_t hash = hash_bytes(static_cast<const uint8_t *>(data), size);
+    munmap(data, size);
+
+    return hash;
+}
+
+std::string cooked_mesh_path(const std::string &sourcePath)
+{
+    return sourcePath + ".cmesh";
+}
+
+bool cook_mesh_scene(const MeshSceneData &data, uint64_t sourceHash, const std::string &path)
+{
+    CookedMeshHeader header = {};
+    header.magic = COOKED_MESH_MAGIC;
+    header.version = COOKED_MESH_VERSION;
+    header.sourceHash = sourceHash;
+    header.vertexStride = sizeof(Vertex);
+    header.surfaceCount = (uint32_t)data.surfaces.size();
+    header.instanceCount = (uint32_t)data.instances.size();
+    header.dependencyCount = (uint32_t)data.dependencies.size();
+    header.materialCount = (uint32_t)data.materials.size();
+    header.vertexCount = data.vertices.size();
+    header.indexCount = data.indices.size();
+
+    header.dependenciesOffset = align_up(sizeof(CookedMeshHeader), 16);
+    header.materialsOffset = align_up(header.dependenciesOffset + header.dependencyCount * sizeof(CookedDependency), 16);
+    header.surfacesOffset = align_up(header.materialsOffset + header.materialCount * sizeof(CookedMaterial), 16);
+    header.instancesOffset = align_up(header.surfacesOffset + header.surfaceCount * sizeof(CookedSurface), 16);
+    header.verticesOffset = align_up(header.instancesOffset + header.instanceCount * sizeof(CookedInstance), 16);
+    header.indicesOffset = align_up(header.verticesOffset + header.vertexCount * sizeof(Vertex), 16);
+    header.fileSize = header.indicesOffset + header.indexCount * sizeof(uint32_t);
+
+    std::vector<uint8_t> file(header.fileSize, 0);
+
+    memcpy(file.data(), &header, sizeof(header));
+
+    // a dependency that can not be recorded could change unseen, better no cache at all
+    CookedDependency *dependencies = reinterpret_cast<CookedDependency *>(file.data() + header.dependenciesOffset);
+    for (size_t i = 0; i < data.dependencies.size(); i++)
+    {
+        const std::string &dependency = data.dependencies[i];
+        if (dependency.size() >= sizeof(dependencies[i].path) || !stamp_file(dependency, dependencies[i].size, dependencies[i].modified))
+            return false;
+
+        memcpy(dependencies[i].path, dependency.c_str(), dependency.size());
+    }
+
+    CookedMaterial *materials = reinterpret_cast<CookedMaterial *>(file.data() + header.materialsOffset);
+    for (size_t i = 0; i < data.materials.size(); i++)
+    {
+        const SceneMaterial &material = data.materials[i];
+        if (material.colorTexture.size() >= sizeof(materials[i].colorTexture))
+            return false;
+
+        memcpy(materials[i].colorTexture, material.colorTexture.c_str(), material.colorTexture.size());
+        memcpy(materials[i].colorFactors, &material.colorFactors, sizeof(materials[i].colorFactors));
+    }
+
+    CookedSurface *surfaces = reinterpret_cast<CookedSurface *>(file.data() + header.surfacesOffset);
+    for (size_t i = 0; i < data.surfaces.size(); i++)
+    {
+        const GeoSurface &surface = data.surfaces[i];
+        strncpy(surfaces[i].name, surface.name.c_str(), sizeof(surfaces[i].name) - 1);
+        surfaces[i].startIndex = surface.startIndex;
+        surfaces[i].count = surface.count;
+        surfaces[i].firstVertex = surface.firstVertex;
+        surfaces[i].vertexCount = surface.vertexCount;
+        surfaces[i].material = surface.material;
+        memcpy(surfaces[i].bounds, &surface.bounds, sizeof(surfaces[i].bounds));
+    }
+
+    CookedInstance *instances = reinterpret_cast<CookedInstance *>(file.data() + header.instancesOffset);
+    for (size_t i = 0; i < data.instances.size(); i++)
+    {
+        instances[i].surface = data.instances[i].surface;
+        memcpy(instances[i].transform, glm::value_ptr(data.instances[i].transform), sizeof(instances[i].transform));
+    }
+
+    memcpy(file.data() + header.verticesOffset, data.vertices.data(), data.vertices.size() * sizeof(Vertex));
+    memcpy(file.data() + header.indicesOffset, data.indices.data(), data.indices.size() * sizeof(uint32_t));
+
+    return write_file_atomically(path, file.data(), file.size());
+}
+
+CookedMeshScene::~CookedMeshScene()
+{
+    if (_data)
+        munmap(_data, _size);
+}
+
+std::unique_ptr<CookedMeshScene> CookedMeshScene::open(const std::string &path, uint64_t sourceHash)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(CookedMeshHeader))
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    size_t size = (size_t)info.st_size;
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return nullptr;
+
+    std::unique_ptr<CookedMeshScene> scene(new CookedMeshScene());
+    scene->_data = data;
+    scene->_size = size;
+    scene->_header = static_cast<const CookedMeshHeader *>(data);
+
+    const CookedMeshHeader &header = *scene->_header;
+    if (header.magic != COOKED_MESH_MAGIC || header.version != COOKED_MESH_VERSION || header.vertexStride != sizeof(Vertex) ||
+        header.sourceHash != sourceHash || header.fileSize != size ||
+        header.dependenciesOffset + header.dependencyCount * sizeof(CookedDependency) > size ||
+        header.materialsOffset + header.materialCount * sizeof(CookedMaterial) > size ||
+        header.surfacesOffset + header.surfaceCount * sizeof(CookedSurface) > size ||
+        header.instancesOffset + header.instanceCount * sizeof(CookedInstance) > size ||
+        header.indicesOffset + header.indexCount * sizeof(uint32_t) > size ||
+        header.verticesOffset + header.vertexCount * sizeof(Vertex) > size)
+    {
+        return nullptr;
+    }
+
+    // the whole payload goes to the staging ring right away, let the kernel read ahead
+    madvise(data, size, MADV_SEQUENTIAL);
+    madvise(data, size, MADV_WILLNEED);
+
+    return scene;
+}
+
+std::span<const Vertex> CookedMeshScene::vertices() const
+{
+    const uint8_t *base = static_cast<const uint8_t *>(_data);
+    return {reinterpret_cast<const Vertex *>(base + _header->verticesOffset), (size_t)_header->vertexCount};
+}
+
+std::span<const uint32_t> CookedMeshScene::indices() const
+{
+    const uint8_t *base = static_cast<const uint8_t *>(_data);
+    return {reinterpret_cast<const uint32_t *>(base + _header->indicesOffset), (size_t)_header->indexCount};
+}
+
+bool CookedMeshScene::dependencies_unchanged() const
+{
+    const uint8_t *base = static_cast<const uint8_t *>(_data);
+    const CookedDependency *dependencies = reinterpret_cast<const CookedDependency *>(base + _header->dependenciesOffset);
+
+    for (uint32_t i = 0; i < _header->dependencyCount; i++)
+    {
+        uint64_t size;
+        int64_t modified;
+        std::string path(dependencies[i].path, strnlen(dependencies[i].path, sizeof(dependencies[i].path)));
+        if (!stamp_file(path, size, modified) || size != dependencies[i].size || modified != dependencies[i].modified)
+            return false;
+    }
+
+    return true;
+}
+
+std::vector<GeoSurface> CookedMeshScene::surfaces() const
+{
+    const uint8_t *base = static_cast<const uint8_t *>(_data);
+    const CookedSurface *cooked = reinterpret_cast<const CookedSurface *>(base + _header->surfacesOffset);
+
+    std::vector<GeoSurface> surfaces(_header->surfaceCount);
+    for (uint32_t i = 0; i < _header->surfaceCount; i++)
+    {
+        surfaces[i].name = std::string(cooked[i].name, strnlen(cooked[i].name, sizeof(cooked[i].name)));
+        surfaces[i].startIndex = cooked[i].startIndex;
+        surfaces[i].count = cooked[i].count;
+        surfaces[i].firstVertex = cooked[i].firstVertex;
+        surfaces[i].vertexCount = cooked[i].vertexCount;
+        surfaces[i].material = cooked[i].material;
+        surfaces[i].bounds = glm::vec4(cooked[i].bounds[0], cooked[i].bounds[1], cooked[i].bounds[2], cooked[i].bounds[3]);
+    }
+
+    return surfaces;
+}
+
+std::vector<MeshInstance> CookedMeshScene::instances() const
+{
+    const uint8_t *base = static_cast<const uint8_t *>(_data);
+    const CookedInstance *cooked = reinterpret_cast<const CookedInstance *>(base + _header->instancesOffset);
+
+    std::vector<MeshInstance> instances(_header->instanceCount);
+    for (uint32_t i = 0; i < _header->instanceCount; i++)
+    {
+        instances[i].surface = cooked[i].surface;
+        instances[i].transform = glm::make_mat4(cooked[i].transform);
+    }
+
+    return instances;
+}
+
+std::vector<SceneMaterial> CookedMeshScene::materials() const
+{
+    const uint8_t *base = static_cast<const uint8_t *>(_data);
+    const CookedMaterial *cooked = reinterpret_cast<const CookedMaterial *>(base + _header->materialsOffset);
+
+    std::vector<SceneMaterial> materials(_header->materialCount);
+    for (uint32_t i = 0; i < _header->materialCount; i++)
+    {
+        materials[i].colorFactors = glm::make_vec4(cooked[i].colorFactors);
+        materials[i].colorTexture = std::string(cooked[i].colorTexture, strnlen(cooked[i].colorTexture, sizeof(cooked[i].colorTexture)));
+    }
+
+    return materials;
+}
+
+std::unique_ptr<CookedMeshScene> load_cooked_mesh_scene(const std::string &sourcePath, std::optional<MeshSceneData> &imported)
+{
+    std::optional<uint64_t> sourceHash = hash_file(sourcePath);
+    if (!sourceHash)
+    {
+        fmt::print("Failed to read {}\n", sourcePath);
+        return nullptr;
+    }
+
+    std::string cachePath = cooked_mesh_path(sourcePath);
+
+    std::unique_ptr<CookedMeshScene> cooked = CookedMeshScene::open(cachePath, *sourceHash);
+    if (cooked && cooked->dependencies_unchanged())
+        return cooked;
+
+    // no cache or a stale one, import and cook
+    cooked.reset();
+    imported = load_mesh_scene(sourcePath);
+    if (!imported)
+        return nullptr;
+
+    if (!cook_mesh_scene(*imported, *sourceHash, cachePath))
+    {
+        fmt::print("Could not write the mesh cache {}\n", cachePath);
+        return nullptr;
+    }
+
+    fmt::print("Cooked {}\n", cachePath);
+
+    imported.reset();
+    return CookedMeshScene::open(cachePath, *sourceHash);
+}
+
+void run_mesh_cache_benchmark()
+{
+    constexpr uint32_t GRID_SIZE = 512;
+
+    std::filesystem::path directory = std::filesystem::temp_directory_path();
+    std::string sourcePath = (directory / "collab_mesh_benchmark.obj").string();
+    std::string cachePath = cooked_mesh_path(sourcePath);
+
+    fmt::print(fg(fmt::color::bisque), "\nMesh cache benchmark ( {}x{} grid, {} triangles )\n", GRID_SIZE, GRID_SIZE, GRID_SIZE * GRID_SIZE * 2);
+
+    // generated source asset, written as obj so assimp has real text to parse
+    {
+        std::ofstream obj(sourcePath, std::ios::trunc);
+        for (uint32_t y = 0; y <= GRID_SIZE; y++)
+        {
+            for (uint32_t x = 0; x <= GRID_SIZE; x++)
+            {
+                obj << "v " << x << " " << 0.05f * ((x * 7 + y * 13) % 17) << " " << y << "\n";
+                obj << "vt " << (float)x / GRID_SIZE << " " << (float)y / GRID_SIZE << "\n";
+            }
+        }
+        obj << "vn 0 1 0\n";
+
+        for (uint32_t y = 0; y < GRID_SIZE; y++)
+        {
+            for (uint32_t x = 0; x < GRID_SIZE; x++)
+            {
+                // obj indices are 1 based
+                uint32_t a = y * (GRID_SIZE + 1) + x + 1;
+                uint32_t b = a + 1;
+                uint32_t c = a + GRID_SIZE + 1;
+                uint32_t d = c + 1;
+                obj << "f " << a << "/" << a << "/1 " << c << "/" << c << "/1 " << b << "/" << b << "/1\n";
+                obj << "f " << b << "/" << b << "/1 " << c << "/" << c << "/1 " << d << "/" << d << "/1\n";
+            }
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::remove(cachePath, error);
+
+    auto elapsed_ms = [](auto start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    // assimp path, what every launch paid before the cache
+    evict_page_cache(sourcePath);
+    auto start = std::chrono::high_resolution_clock::now();
+    std::optional<MeshSceneData> imported = load_mesh_scene(sourcePath);
+    double importMs = elapsed_ms(start);
+
+    if (!imported)
+    {
+        fmt::print(fg(fmt::color::red), "Import failed, benchmark aborted.\n");
+        return;
+    }
+
+    start = std::chrono::high_resolution_clock::now();
+    std::optional<uint64_t> sourceHash = hash_file(sourcePath);
+    bool cooked = sourceHash && cook_mesh_scene(*imported, *sourceHash, cachePath);
+    double cookMs = elapsed_ms(start);
+
+    if (!cooked)
+    {
+        fmt::print(fg(fmt::color::red), "Cooking failed, benchmark aborted.\n");
+        return;
+    }
+
+    // the copy target stands in for the staging ring
+    size_t payloadSize = imported->vertices.size() * sizeof(Vertex) + imported->indices.size() * sizeof(uint32_t);
+    std::vector<uint8_t> staging(payloadSize);
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        // first pass cold, second with the files in the page cache
+        if (pass == 0)
+        {
+            evict_page_cache(sourcePath);
+            evict_page_cache(cachePath);
+        }
+
+        start = std::chrono::high_resolution_clock::now();
+        std::optional<uint64_t> hash = hash_file(sourcePath);
+        double hashMs = elapsed_ms(start);
+
+        start = std::chrono::high_resolution_clock::now();
+        std::unique_ptr<CookedMeshScene> scene = CookedMeshScene::open(cachePath, hash.value_or(0));
+        if (!scene)
+        {
+            fmt::print(fg(fmt::color::red), "Cooked file rejected, benchmark aborted.\n");
+            return;
+        }
+
+        std::span<const Vertex> vertices = scene->vertices();
+        std::span<const uint32_t> indices = scene->indices();
+        memcpy(staging.data(), vertices.data(), vertices.size_bytes());
+        memcpy(staging.data() + vertices.size_bytes(), indices.data(), indices.size_bytes());
+        double mapMs = elapsed_ms(start);
+
+        fmt::print("{:>6} mmap + copy {:>9.3f} ms   source hash {:>9.3f} ms\n", pass == 0 ? "cold" : "warm", mapMs, hashMs);
+    }
+
+    fmt::print("{:>6} assimp      {:>9.3f} ms   cook {:>9.3f} ms   {:.1f} MB payload\n", "cold", importMs, cookMs, payloadSize / (1024.0 * 1024.0));
+
+    std::filesystem::remove(sourcePath, error);
+    std::filesystem::remove(cachePath, error);
+}
@@ -2,8 +2,33 @@
 #include "render_engine/vk_initializers.h"
 #include "render_engine/vk_types.h"
 
+#include "core/file_io.h"
+#include "core/hash.h"
+
+#include <cstring>
 #include <fstream>
 
+namespace
+{
+    constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x48435050; // "PPCH"
+    constexpr uint32_t PIPELINE_CACHE_VERSION = 2;
+
+    // the header vulkan puts in front of the cache data only identifies the device, the driver version
+    // is what changes on every driver update, so it is kept here next to a hash of the data
+    struct PipelineCacheFileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        float buildTime;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+        uint64_t dataSize;
+        uint64_t dataHash;
+    };
+}
+
 void PipelineBuilder::clear()
 {
     // clear all of the structs we need back to 0 with their correct stype
@@ -25,7 +50,7 @@ void PipelineBuilder::clear()
     _shaderStages.clear();
 }
 
-VkPipeline PipelineBuilder::build_pipeline(VkDevice device)
+VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkPipelineCache cache)
 {
     // make viewport state from our stored viewport and scissor.
     // at the moment we wont support multiple viewports or scissors
@@ -80,7 +105,7 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device)
 
     VkPipeline newPipeline;
 
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
+    if (vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo,
                                   nullptr, &newPipeline) != VK_SUCCESS)
     {
         fmt::println("failed to create pipeline");
@@ -209,6 +234,106 @@ void PipelineBuilder::enable_depthtest(bool depthWriteEnable, VkCompareOp op)
     _depthStencil.maxDepthBounds = 1.f;
 }
 
+bool PipelineCache::load(VkDevice device, VkPhysicalDevice physicalDevice, const std::string &path)
+{
+    _path = path;
+    _coldBuildTime = -1.f;
+    vkGetPhysicalDeviceProperties(physicalDevice, &_properties);
+
+    std::vector<uint8_t> data;
+
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (file.is_open())
+    {
+        size_t fileSize = (size_t)file.tellg();
+        file.seekg(0);
+
+        PipelineCacheFileHeader header = {};
+        if (fileSize >= sizeof(header))
+        {
+            file.read((char *)&header, sizeof(header));
+
+            bool valid = header.magic == PIPELINE_CACHE_MAGIC && header.version == PIPELINE_CACHE_VERSION &&
+                         header.vendorID == _properties.vendorID && header.deviceID == _properties.deviceID &&
+                         header.driverVersion == _properties.driverVersion &&
+                         memcmp(header.pipelineCacheUUID, _properties.pipelineCacheUUID, VK_UUID_SIZE) == 0 &&
+                         header.dataSize == fileSize - sizeof(header);
+
+            if (valid)
+            {
+                data.resize(header.dataSize);
+                file.read((char *)data.data(), data.size());
+
+                if (!file || hash_bytes(data.data(), data.size()) != header.dataHash)
+                {
+                    fmt::println("pipeline cache {} is corrupted, rebuilding it", path);
+                    data.clear();
+                }
+                else
+                {
+                    _coldBuildTime = header.buildTime;
+                }
+            }
+            else
+            {
+                fmt::println("pipeline cache {} was written by another device or driver, rebuilding it", path);
+            }
+        }
+    }
+
+    VkPipelineCacheCreateInfo info = {.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
+    info.initialDataSize = data.size();
+    info.pInitialData = data.empty() ? nullptr : data.data();
+
+    // the driver checks its own header too, an empty cache is the fallback when it refuses the data
+    if (vkCreatePipelineCache(device, &info, nullptr, &cache) != VK_SUCCESS)
+    {
+        info.initialDataSize = 0;
+        info.pInitialData = nullptr;
+        data.clear();
+        _coldBuildTime = -1.f;
+        VK_CHECK(vkCreatePipelineCache(device, &info, nullptr, &cache));
+    }
+
+    return !data.empty();
+}
+
+bool PipelineCache::save(VkDevice device, float buildTime)
+{
+    if (cache == VK_NULL_HANDLE)
+        return false;
+
+    size_t dataSize = 0;
+    VK_CHECK(vkGetPipelineCacheData(device, cache, &dataSize, nullptr));
+
+    // the file is the header followed by the cache data, which the driver writes in place
+    std::vector<uint8_t> file(sizeof(PipelineCacheFileHeader) + dataSize);
+    uint8_t *data = file.data() + sizeof(PipelineCacheFileHeader);
+    VK_CHECK(vkGetPipelineCacheData(device, cache, &dataSize, data));
+    file.resize(sizeof(PipelineCacheFileHeader) + dataSize);
+
+    PipelineCacheFileHeader header = {};
+    header.magic = PIPELINE_CACHE_MAGIC;
+    header.version = PIPELINE_CACHE_VERSION;
+    header.vendorID = _properties.vendorID;
+    header.deviceID = _properties.deviceID;
+    header.driverVersion = _properties.driverVersion;
+    // a warm start keeps the time of the cold build it was compared against
+    header.buildTime = _coldBuildTime >= 0.f ? _coldBuildTime : buildTime;
+    memcpy(header.pipelineCacheUUID, _properties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = dataSize;
+    header.dataHash = hash_bytes(data, dataSize);
+    memcpy(file.data(), &header, sizeof(header));
+
+    return write_file_atomically(_path, file.data(), file.size());
+}
+
+void PipelineCache::destroy(VkDevice device)
+{
+    vkDestroyPipelineCache(device, cache, nullptr);
+    cache = VK_NULL_HANDLE;
+}
+
 bool vkutil::load_shader_module(const char *filePath,
                                 VkDevice device,
                                 VkShaderModule *outShaderModule)
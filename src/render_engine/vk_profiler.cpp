@@ -0,0 +1,119 @@
+#include "render_engine/vk_profiler.h"
+
+// open scope that got no queries because the pool was full, its end_scope only pops it
+static constexpr uint32_t SKIPPED_SCOPE = ~0u;
+
+void GpuTimestamps::init(VkDevice device, uint32_t maxScopes, uint32_t timestampValidBits)
+{
+    _maxQueries = maxScopes * 2;
+
+    // the queue can not write timestamps, every call becomes a no-op
+    if (timestampValidBits == 0)
+        return;
+
+    VkQueryPoolCreateInfo poolInfo = {.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = _maxQueries;
+
+    VK_CHECK(vkCreateQueryPool(device, &poolInfo, nullptr, &_pool));
+
+    // only the low bits of a timestamp are meaningful on some queues
+    _timestampMask = timestampValidBits >= 64 ? ~0ull : ((1ull << timestampValidBits) - 1);
+
+    _scopes.reserve(maxScopes);
+    _openScopes.reserve(maxScopes);
+    _results.resize(_maxQueries);
+}
+
+void GpuTimestamps::destroy(VkDevice device)
+{
+    if (_pool == VK_NULL_HANDLE)
+        return;
+
+    vkDestroyQueryPool(device, _pool, nullptr);
+    _pool = VK_NULL_HANDLE;
+}
+
+void GpuTimestamps::reset(VkCommandBuffer cmd)
+{
+    if (_pool == VK_NULL_HANDLE)
+        return;
+
+    vkCmdResetQueryPool(cmd, _pool, 0, _maxQueries);
+
+    _nextQuery = 0;
+    _scopes.clear();
+    _openScopes.clear();
+}
+
+void GpuTimestamps::begin_scope(VkCommandBuffer cmd, const char *name)
+{
+    if (_pool == VK_NULL_HANDLE)
+        return;
+
+    // still pushed so the matching end_scope does not close the enclosing scope
+    if (_nextQuery + 2 > _maxQueries)
+    {
+        _openScopes.push_back(SKIPPED_SCOPE);
+        return;
+    }
+
+    Scope scope;
+    scope.name = name;
+    scope.depth = (uint32_t)_openScopes.size();
+    scope.beginQuery = _nextQuery++;
+    scope.endQuery = _nextQuery++;
+
+    // ALL_COMMANDS makes the timestamp wait for everything recorded before it
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _pool, scope.beginQuery);
+
+    _openScopes.push_back((uint32_t)_scopes.size());
+    _scopes.push_back(scope);
+}
+
+void GpuTimestamps::end_scope(VkCommandBuffer cmd)
+{
+    if (_openScopes.empty())
+        return;
+
+    uint32_t open = _openScopes.back();
+    _openScopes.pop_back();
+    if (open == SKIPPED_SCOPE)
+        return;
+
+    Scope &scope = _scopes[open];
+
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _pool, scope.endQuery);
+}
+
+bool GpuTimestamps::read_results(VkDevice device, float timestampPeriod, std::vector<GpuTiming> &timings)
+{
+    if (_nextQuery == 0 || !_openScopes.empty())
+        return false;
+
+    // no WAIT bit, if the gpu is not done we keep the previous numbers
+    VkResult result = vkGetQueryPoolResults(device, _pool, 0, _nextQuery, _nextQuery * sizeof(uint64_t), _results.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS)
+        return false;
+
+    uint64_t frameStart = _results[_scopes.front().beginQuery] & _timestampMask;
+
+    // timestampPeriod is in nanoseconds per tick
+    float toMs = timestampPeriod / 1000000.f;
+
+    timings.clear();
+    for (const Scope &scope : _scopes)
+    {
+        uint64_t begin = _results[scope.beginQuery] & _timestampMask;
+        uint64_t end = _results[scope.endQuery] & _timestampMask;
+
+        GpuTiming timing;
+        timing.name = scope.name;
+        timing.depth = scope.depth;
+        timing.start_ms = (begin - frameStart) * toMs;
+        timing.duration_ms = end >= begin ? (end - begin) * toMs : 0.f;
+        timings.push_back(timing);
+    }
+
+    return true;
+}
@@ -0,0 +1,435 @@
+#include "render_engine/vk_render_graph.h"
+#include "render_engine/vk_initializers.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace
+{
+    struct UsageInfo
+    {
+        VkImageLayout layout;
+        VkPipelineStageFlags2 stages;
+        VkAccessFlags2 access;
+        bool writes;
+    };
+
+    constexpr VkAccessFlags2 WRITE_ACCESS = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+                                            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
+
+    UsageInfo usage_info(RGUsage usage)
+    {
+        switch (usage)
+        {
+        case RGUsage::ComputeStorageWrite:
+            return {VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, true};
+        case RGUsage::ComputeStorageReadWrite:
+            return {VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, true};
+        case RGUsage::ComputeSampled:
+            return {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, false};
+        case RGUsage::FragmentSampled:
+            return {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, false};
+        case RGUsage::ColorAttachment:
+            return {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                    VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, true};
+        case RGUsage::DepthAttachment:
+            return {VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                    VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, true};
+        case RGUsage::TransferSrc:
+            return {VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, false};
+        case RGUsage::TransferDst:
+            return {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, true};
+        case RGUsage::Present:
+            // the semaphore signalled at the end of the submit continues the chain from this stage
+            return {VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_NONE, false};
+        }
+
+        return {VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT, true};
+    }
+}
+
+void RenderGraph::init(VkDevice device, GpuMemory *memory, uint32_t retiredFrames)
+{
+    _device = device;
+    _memory = memory;
+    _allocator = memory->allocator();
+    _retiredFrames = retiredFrames;
+
+    // room for every pass the engine adds, an occasional extra one like the capture does not grow them
+    _passes.reserve(16);
+    _uses.reserve(32);
+    _images.reserve(16);
+}
+
+void RenderGraph::cleanup()
+{
+    destroy_pool(_pool);
+    for (RetiredPool &retired : _retired)
+    {
+        destroy_pool(retired.pool);
+    }
+    _retired.clear();
+
+    reset(nullptr);
+}
+
+void RenderGraph::reset(std::pmr::memory_resource *passMemory)
+{
+    _passMemory = passMemory;
+    _images.clear();
+    _passes.clear();
+    _uses.clear();
+}
+
+RGImage RenderGraph::import_image(const char *name, const AllocatedImage &image, VkImageAspectFlags aspect, RGImageState *state)
+{
+    ImageResource resource = {};
+    resource.name = name;
+    resource.image = image;
+    resource.aspect = aspect;
+    resource.state = *state;
+    resource.imported = state;
+
+    _images.push_back(resource);
+    return RGImage{(uint32_t)_images.size() - 1};
+}
+
+RGImage RenderGraph::create_image(const char *name, const RGTransientDesc &desc)
+{
+    ImageResource resource = {};
+    resource.name = name;
+    resource.aspect = desc.aspect;
+    resource.desc = desc;
+    resource.image.imageExtent = desc.extent;
+    resource.image.imageFormat = desc.format;
+
+    _images.push_back(resource);
+    return RGImage{(uint32_t)_images.size() - 1};
+}
+
+void RenderGraph::add_pass(const char *name, std::initializer_list<RGImageUse> uses, void *closure, void (*record)(void *closure, VkCommandBuffer cmd))
+{
+    _passes.push_back(Pass{name, (uint32_t)_uses.size(), (uint32_t)uses.size(), closure, record});
+    _uses.insert(_uses.end(), uses.begin(), uses.end());
+}
+
+void RenderGraph::set_final_usage(RGImage image, RGUsage usage)
+{
+    _images[image.index].hasFinalUsage = true;
+    _images[image.index].finalUsage = usage;
+}
+
+void RenderGraph::compile()
+{
+    for (ImageResource &resource : _images)
+    {
+        resource.firstPass = ~0u;
+        resource.lastPass = 0;
+    }
+
+    for (uint32_t i = 0; i < _passes.size(); i++)
+    {
+        const Pass &pass = _passes[i];
+        for (uint32_t u = pass.firstUse; u < pass.firstUse + pass.useCount; u++)
+        {
+            ImageResource &resource = _images[_uses[u].image.index];
+            resource.firstPass = std::min(resource.firstPass, i);
+            resource.lastPass = std::max(resource.lastPass, i);
+        }
+    }
+
+    _key.clear();
+    for (const ImageResource &resource : _images)
+    {
+        if (resource.imported == nullptr)
+            _key.push_back(TransientPool::Entry{resource.desc, resource.firstPass, resource.lastPass});
+    }
+
+    // a different set of transient images or lifetimes gets new memory, the old one may still be in use on the gpu
+    if (_key != _pool.key)
+    {
+        if (!_pool.images.empty())
+            _retired.push_back(RetiredPool{std::move(_pool), _retiredFrames});
+        _pool = TransientPool{};
+
+        build_pool(_key);
+    }
+
+    uint32_t transient = 0;
+    for (ImageResource &resource : _images)
+    {
+        if (resource.imported != nullptr)
+            continue;
+
+        resource.image = _pool.images[transient];
+        resource.memorySlot = _pool.imageSlots[transient];
+        transient++;
+    }
+}
+
+void RenderGraph::build_pool(const std::vector<TransientPool::Entry> &key)
+{
+    _pool.key = key;
+
+    const size_t count = _pool.key.size();
+    _pool.images.resize(count);
+    _pool.imageSlots.resize(count);
+
+    std::vector<VkMemoryRequirements> requirements(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        const RGTransientDesc &desc = _pool.key[i].desc;
+
+        VkImageCreateInfo imageInfo = vkinit::image_create_info(desc.format, desc.usage, desc.extent);
+        VK_CHECK(vkCreateImage(_device, &imageInfo, nullptr, &_pool.images[i].image));
+        vkGetImageMemoryRequirements(_device, _pool.images[i].image, &requirements[i]);
+
+        _pool.transientBytes += requirements[i].size;
+    }
+
+    // largest first, every image goes into the first slot whose images are all dead or not yet alive during its passes
+    std::vector<uint32_t> order(count);
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+              { return requirements[a].size > requirements[b].size; });
+
+    std::vector<VkMemoryRequirements> slotRequirements;
+    std::vector<std::vector<uint32_t>> slotImages;
+
+    for (uint32_t image : order)
+    {
+        const TransientPool::Entry &entry = _pool.key[image];
+
+        uint32_t slot = 0;
+        for (; slot < slotImages.size(); slot++)
+        {
+            if ((slotRequirements[slot].memoryTypeBits & requirements[image].memoryTypeBits) == 0)
+                continue;
+
+            bool overlaps = std::any_of(slotImages[slot].begin(), slotImages[slot].end(), [&](uint32_t other)
+                                        { return !(_pool.key[other].lastPass < entry.firstPass || entry.lastPass < _pool.key[other].firstPass); });
+            if (!overlaps)
+                break;
+        }
+
+        if (slot == slotImages.size())
+        {
+            slotRequirements.push_back(requirements[image]);
+            slotImages.emplace_back();
+        }
+        else
+        {
+            VkMemoryRequirements &merged = slotRequirements[slot];
+            merged.size = std::max(merged.size, requirements[image].size);
+            merged.alignment = std::max(merged.alignment, requirements[image].alignment);
+            merged.memoryTypeBits &= requirements[image].memoryTypeBits;
+        }
+
+        slotImages[slot].push_back(image);
+        _pool.imageSlots[image] = slot;
+    }
+
+    VmaAllocationCreateInfo allocInfo = {};
+    allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    allocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    _pool.slots.resize(slotRequirements.size());
+    for (size_t slot = 0; slot < slotRequirements.size(); slot++)
+    {
+        VK_CHECK(vmaAllocateMemory(_allocator, &slotRequirements[slot], &allocInfo, &_pool.slots[slot].allocation, nullptr));
+        _memory->tag(_pool.slots[slot].allocation, MemoryCategory::RenderTargets);
+        _pool.slots[slot].lastStages = VK_PIPELINE_STAGE_2_NONE;
+        _pool.slots[slot].lastWriteAccess = VK_ACCESS_2_NONE;
+
+        _pool.aliasedBytes += slotRequirements[slot].size;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const RGTransientDesc &desc = _pool.key[i].desc;
+        AllocatedImage &image = _pool.images[i];
+
+        VK_CHECK(vmaBindImageMemory(_allocator, _pool.slots[_pool.imageSlots[i]].allocation, image.image));
+
+        VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(desc.format, image.image, desc.aspect);
+        VK_CHECK(vkCreateImageView(_device, &viewInfo, nullptr, &image.imageView));
+
+        // the memory belongs to the slot
+        image.allocation = VK_NULL_HANDLE;
+        image.imageExtent = desc.extent;
+        image.imageFormat = desc.format;
+    }
+}
+
+void RenderGraph::destroy_pool(TransientPool &pool)
+{
+    for (AllocatedImage &image : pool.images)
+    {
+        vkDestroyImageView(_device, image.imageView, nullptr);
+        vkDestroyImage(_device, image.image, nullptr);
+    }
+
+    for (TransientPool::Slot &slot : pool.slots)
+    {
+        _memory->untag(slot.allocation);
+        vmaFreeMemory(_allocator, slot.allocation);
+    }
+
+    pool = TransientPool{};
+}
+
+void RenderGraph::add_barrier(ImageResource &resource, const RGImageUse &use)
+{
+    UsageInfo info = usage_info(use.usage);
+    RGImageState &state = resource.state;
+
+    VkImageMemoryBarrier2 barrier = {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+    barrier.image = resource.image.image;
+    barrier.subresourceRange = vkinit::image_subresource_range(resource.aspect);
+    barrier.dstStageMask = info.stages;
+    barrier.dstAccessMask = info.access;
+    barrier.newLayout = info.layout;
+
+    bool layoutChange = info.layout != state.layout;
+
+    if (!info.writes && !layoutChange)
+    {
+        // read after read, or after a write these stages already wait for
+        bool visible = (info.stages & ~state.visibleStages) == 0 && (info.access & ~state.visibleAccess) == 0;
+        state.readStages |= info.stages;
+        if (visible || state.writeStages == VK_PIPELINE_STAGE_2_NONE)
+            return;
+
+        barrier.srcStageMask = state.writeStages;
+        barrier.srcAccessMask = state.writeAccess;
+        barrier.oldLayout = state.layout;
+
+        state.visibleStages |= info.stages;
+        state.visibleAccess |= info.access;
+    }
+    else
+    {
+        // writes and layout transitions wait for the last write and every read since
+        barrier.srcStageMask = state.writeStages | state.readStages;
+        barrier.srcAccessMask = state.writeAccess;
+        barrier.oldLayout = use.discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+
+        bool untouched = barrier.srcStageMask == VK_PIPELINE_STAGE_2_NONE;
+
+        // a layout transition is a write of its own, later readers wait for it like for any other
+        state.layout = info.layout;
+        state.writeStages = info.stages;
+        state.writeAccess = info.access & WRITE_ACCESS;
+        state.visibleStages = info.stages;
+        state.visibleAccess = info.access;
+        state.readStages = info.writes ? VK_PIPELINE_STAGE_2_NONE : info.stages;
+
+        if (untouched && !layoutChange)
+            return;
+    }
+
+    if (conservativeBarriers)
+    {
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+        barrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_MEMORY_READ_BIT;
+    }
+
+    if (barrier.srcStageMask & VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT)
+        _stats.fullPipelineBarriers++;
+    _stats.imageBarriers++;
+
+    _barriers.push_back(barrier);
+}
+
+void RenderGraph::flush_barriers(VkCommandBuffer cmd)
+{
+    if (_barriers.empty())
+        return;
+
+    // one call per barrier is what hand written transitions end up with
+    uint32_t batchSize = conservativeBarriers ? 1 : (uint32_t)_barriers.size();
+    for (uint32_t first = 0; first < _barriers.size(); first += batchSize)
+    {
+        VkDependencyInfo dependency = {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+        dependency.imageMemoryBarrierCount = std::min(batchSize, (uint32_t)_barriers.size() - first);
+        dependency.pImageMemoryBarriers = &_barriers[first];
+        vkCmdPipelineBarrier2(cmd, &dependency);
+
+        _stats.barrierBatches++;
+    }
+
+    _barriers.clear();
+}
+
+void RenderGraph::execute(VkCommandBuffer cmd)
+{
+    // executions are frames, after enough of them nothing on the gpu uses the replaced memory
+    for (auto it = _retired.begin(); it != _retired.end();)
+    {
+        if (--it->framesLeft == 0)
+        {
+            destroy_pool(it->pool);
+            it = _retired.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+
+    _stats = {};
+    _stats.passes = (uint32_t)_passes.size();
+    _stats.transientBytes = _pool.transientBytes;
+    _stats.aliasedBytes = _pool.aliasedBytes;
+
+    for (uint32_t i = 0; i < _passes.size(); i++)
+    {
+        Pass &pass = _passes[i];
+
+        for (uint32_t u = pass.firstUse; u < pass.firstUse + pass.useCount; u++)
+        {
+            const RGImageUse &use = _uses[u];
+            ImageResource &resource = _images[use.image.index];
+
+            // a transient image starts without contents, after whatever used its memory before
+            if (resource.imported == nullptr && resource.firstPass == i && resource.state.layout == VK_IMAGE_LAYOUT_UNDEFINED)
+            {
+                const TransientPool::Slot &slot = _pool.slots[resource.memorySlot];
+                resource.state.writeStages = slot.lastStages;
+                resource.state.writeAccess = slot.lastWriteAccess;
+            }
+
+            add_barrier(resource, use);
+
+            if (resource.imported == nullptr)
+            {
+                TransientPool::Slot &slot = _pool.slots[resource.memorySlot];
+                slot.lastStages = resource.state.writeStages | resource.state.readStages;
+                slot.lastWriteAccess = resource.state.writeAccess;
+            }
+        }
+
+        flush_barriers(cmd);
+        pass.record(pass.closure, cmd);
+    }
+
+    for (ImageResource &resource : _images)
+    {
+        if (resource.hasFinalUsage)
+            add_barrier(resource, RGImageUse{RGImage{(uint32_t)(&resource - _images.data())}, resource.finalUsage});
+
+        if (resource.imported != nullptr)
+        {
+            *resource.imported = resource.state;
+        }
+        else if (resource.firstPass != ~0u)
+        {
+            TransientPool::Slot &slot = _pool.slots[resource.memorySlot];
+            slot.lastStages = resource.state.writeStages | resource.state.readStages;
+            slot.lastWriteAccess = resource.state.writeAccess;
+        }
+    }
+    flush_barriers(cmd);
+}
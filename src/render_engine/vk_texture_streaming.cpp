@@ -0,0 +1,586 @@
+#include "render_engine/vk_texture_streaming.h"
+
+#include "render_engine/vk_engine.h"
+#include "render_engine/vk_images.h"
+#include "render_engine/vk_initializers.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    // level offsets in the staging data, copies need them aligned to the texel block size
+    constexpr VkDeviceSize LEVEL_ALIGNMENT = 16;
+
+    // a defragmentation pass holds on to both copies of what it moves until its frames are done
+    constexpr VkDeviceSize DEFRAGMENTATION_BYTES_PER_PASS = 32 * 1024 * 1024;
+    constexpr uint32_t DEFRAGMENTATION_MOVES_PER_PASS = 16;
+    constexpr uint64_t DEFRAGMENTATION_INTERVAL = 300; // frames between runs started by the threshold
+
+    VkDeviceSize chain_bytes(TextureSource &source, uint32_t firstLevel)
+    {
+        VkDeviceSize bytes = 0;
+        for (uint32_t level = firstLevel; level < source.level_count(); level++)
+            bytes += source.level_size(level);
+        return bytes;
+    }
+}
+
+MemoryTextureSource::MemoryTextureSource(const uint8_t *pixels, VkExtent2D extent, VkFormat format)
+    : _format(format), _extent(extent)
+{
+    _levels.emplace_back(pixels, pixels + (size_t)extent.width * extent.height * 4);
+
+    // 2x2 box filter, the last row or column is repeated for odd sizes
+    uint32_t width = extent.width;
+    uint32_t height = extent.height;
+    while (width > 1 || height > 1)
+    {
+        uint32_t nextWidth = std::max(width / 2, 1u);
+        uint32_t nextHeight = std::max(height / 2, 1u);
+
+        const std::vector<uint8_t> &src = _levels.back();
+        std::vector<uint8_t> dst((size_t)nextWidth * nextHeight * 4);
+
+        for (uint32_t y = 0; y < nextHeight; y++)
+        {
+            uint32_t y0 = std::min(y * 2, height - 1);
+            uint32_t y1 = std::min(y * 2 + 1, height - 1);
+            for (uint32_t x = 0; x < nextWidth; x++)
+            {
+                uint32_t x0 = std::min(x * 2, width - 1);
+                uint32_t x1 = std::min(x * 2 + 1, width - 1);
+                for (uint32_t c = 0; c < 4; c++)
+                {
+                    uint32_t sum = src[((size_t)y0 * width + x0) * 4 + c] + src[((size_t)y0 * width + x1) * 4 + c] +
+                                   src[((size_t)y1 * width + x0) * 4 + c] + src[((size_t)y1 * width + x1) * 4 + c];
+                    dst[((size_t)y * nextWidth + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+                }
+            }
+        }
+
+        _levels.push_back(std::move(dst));
+        width = nextWidth;
+        height = nextHeight;
+    }
+}
+
+bool MemoryTextureSource::read_level(uint32_t level, void *dst)
+{
+    if (level >= _levels.size())
+        return false;
+
+    memcpy(dst, _levels[level].data(), _levels[level].size());
+    return true;
+}
+
+void TextureStreamer::init(VulkanEngine *engine, uint32_t fallbackImage, VkDeviceSize budget, uint32_t tailSize)
+{
+    _engine = engine;
+    _fallbackImage = fallbackImage;
+    _tailSize = std::max(tailSize, 1u);
+    budgetBytes = budget;
+
+    // the mip chain of a 32k texture, recording the moves then never allocates
+    _moveRegions.reserve(16);
+}
+
+void TextureStreamer::cleanup()
+{
+    // the device is idle, nothing has to go through the deletion queues
+    if (_defragmentation != VK_NULL_HANDLE)
+    {
+        for (Move &move : _moves)
+        {
+            vkDestroyImageView(_engine->_device, move.source.imageView, nullptr);
+            vkDestroyImage(_engine->_device, move.source.image, nullptr);
+        }
+        _moves.clear();
+
+        if (_passOpen)
+            vmaEndDefragmentationPass(_engine->_allocator, _defragmentation, &_defragmentationPass);
+        vmaEndDefragmentation(_engine->_allocator, _defragmentation, nullptr);
+        _defragmentation = VK_NULL_HANDLE;
+    }
+
+    for (Texture &texture : _textures)
+    {
+        for (Residency *residency : {&texture.resident, &texture.pending})
+        {
+            if (residency->firstLevel == ~0u)
+                continue;
+
+            vkDestroyImageView(_engine->_device, residency->image.imageView, nullptr);
+            _engine->_memory.untag(residency->image.allocation);
+            vmaDestroyImage(_engine->_allocator, residency->image.image, residency->image.allocation);
+        }
+    }
+
+    _textures.clear();
+    _freeTextures.clear();
+}
+
+StreamedTexture TextureStreamer::add(std::unique_ptr<TextureSource> &&source)
+{
+    uint32_t index;
+    if (!_freeTextures.empty())
+    {
+        index = _freeTextures.back();
+        _freeTextures.pop_back();
+    }
+    else
+    {
+        index = (uint32_t)_textures.size();
+        _textures.emplace_back();
+    }
+
+    Texture &texture = _textures[index];
+    texture = Texture{};
+    texture.source = std::move(source);
+
+    // the first level small enough to always stay resident
+    VkExtent2D extent = texture.source->extent();
+    uint32_t lastLevel = texture.source->level_count() - 1;
+    texture.tailLevel = 0;
+    while (texture.tailLevel < lastLevel && std::max(extent.width >> texture.tailLevel, extent.height >> texture.tailLevel) > _tailSize)
+        texture.tailLevel++;
+
+    texture.requestedLevel = texture.tailLevel;
+    stream(texture, texture.tailLevel);
+
+    return StreamedTexture{index};
+}
+
+void TextureStreamer::remove(StreamedTexture handle)
+{
+    Texture &texture = _textures[handle.index];
+
+    retire(texture.pending);
+    texture.source.reset();
+
+    // memory under a defragmentation move is only freed once the pass ends, end_defragmentation_pass retires it
+    if (texture.moving)
+        return;
+
+    retire(texture.resident);
+    _freeTextures.push_back(handle.index);
+}
+
+void TextureStreamer::request(StreamedTexture handle, uint32_t level)
+{
+    Texture &texture = _textures[handle.index];
+
+    if (texture.lastRequestFrame != _frame)
+        texture.requestedLevel = texture.tailLevel;
+
+    texture.requestedLevel = std::min(texture.requestedLevel, level);
+    texture.lastRequestFrame = _frame;
+}
+
+void TextureStreamer::request_screen_size(StreamedTexture handle, float pixels)
+{
+    VkExtent2D extent = _textures[handle.index].source->extent();
+    float size = (float)std::max(extent.width, extent.height);
+
+    // one texel per pixel, anything finer would only alias
+    uint32_t level = pixels >= size ? 0 : (uint32_t)std::floor(std::log2(size / std::max(pixels, 1.f)));
+    request(handle, level);
+}
+
+uint32_t TextureStreamer::current_level(const Texture &texture) const
+{
+    return texture.pending.firstLevel != ~0u ? texture.pending.firstLevel : texture.resident.firstLevel;
+}
+
+VkDeviceSize TextureStreamer::effective_budget()
+{
+    if (_memoryHeap == ~0u)
+        return budgetBytes;
+
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets(_engine->_allocator, budgets);
+
+    // whatever else lives in the heap is not ours to evict, only take the room it leaves
+    const VmaBudget &heap = budgets[_memoryHeap];
+    VkDeviceSize room = heap.budget > heap.usage ? heap.budget - heap.usage : 0;
+    return std::min(budgetBytes, _stats.residentBytes + room);
+}
+
+bool TextureStreamer::stream(Texture &texture, uint32_t firstLevel)
+{
+    TextureSource &source = *texture.source;
+    uint32_t levelCount = source.level_count() - firstLevel;
+
+    _levelOffsets.clear();
+    VkDeviceSize size = 0;
+    for (uint32_t level = firstLevel; level < source.level_count(); level++)
+    {
+        size = (size + LEVEL_ALIGNMENT - 1) & ~(LEVEL_ALIGNMENT - 1);
+        _levelOffsets.push_back(size);
+        size += source.level_size(level);
+    }
+
+    _staging.resize(size);
+    for (uint32_t i = 0; i < levelCount; i++)
+    {
+        if (!source.read_level(firstLevel + i, _staging.data() + _levelOffsets[i]))
+        {
+            fmt::print("failed to read level {} of a streamed texture\n", firstLevel + i);
+            return false;
+        }
+    }
+
+    VkExtent2D extent = source.extent();
+    VkExtent3D levelExtent = {std::max(extent.width >> firstLevel, 1u), std::max(extent.height >> firstLevel, 1u), 1};
+
+    Residency residency;
+    residency.firstLevel = firstLevel;
+    residency.image.imageFormat = source.format();
+    residency.image.imageExtent = levelExtent;
+
+    // transfer src so defragmentation can copy it somewhere else
+    VkImageCreateInfo imgInfo = vkinit::image_create_info(source.format(), VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, levelExtent);
+    imgInfo.mipLevels = levelCount;
+
+    VmaAllocationCreateInfo allocInfo = {};
+    allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    allocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    allocInfo.pool = _engine->_memory.movable_image_pool();
+
+    VmaAllocationInfo allocationInfo;
+    VkResult result = vmaCreateImage(_engine->_allocator, &imgInfo, &allocInfo, &residency.image.image, &residency.image.allocation, &allocationInfo);
+    if (result != VK_SUCCESS && allocInfo.pool != VK_NULL_HANDLE)
+    {
+        // a format whose memory type differs from the pool's, it stays where it is put
+        allocInfo.pool = VK_NULL_HANDLE;
+        result = vmaCreateImage(_engine->_allocator, &imgInfo, &allocInfo, &residency.image.image, &residency.image.allocation, &allocationInfo);
+    }
+    VK_CHECK(result);
+
+    _engine->_memory.tag(residency.image.allocation, MemoryCategory::Textures);
+    residency.bytes = allocationInfo.size;
+
+    if (_memoryHeap == ~0u)
+    {
+        const VkPhysicalDeviceMemoryProperties *memoryProperties;
+        vmaGetMemoryProperties(_engine->_allocator, &memoryProperties);
+        _memoryHeap = memoryProperties->memoryTypes[allocationInfo.memoryType].heapIndex;
+    }
+
+    VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(source.format(), residency.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+    viewInfo.subresourceRange.levelCount = levelCount;
+    VK_CHECK(vkCreateImageView(_engine->_device, &viewInfo, nullptr, &residency.image.imageView));
+
+    residency.uploadTicket = _engine->_uploader.upload_image_levels(residency.image, _staging.data(), size, _levelOffsets);
+
+    // an upload that was not swapped in yet is superseded
+    retire(texture.pending);
+    texture.pending = residency;
+
+    _stats.residentBytes += residency.bytes;
+    _stats.streamedBytes += size;
+    return true;
+}
+
+void TextureStreamer::retire(Residency &residency)
+{
+    if (residency.firstLevel == ~0u)
+        return;
+
+    _stats.residentBytes -= residency.bytes;
+
+    // frames in flight may still sample it, and its upload may still be running
+    _engine->get_current_frame()._deletionQueue.push_function([engine = _engine, residency]()
+                                                             {
+        engine->_uploader.wait(residency.uploadTicket);
+        if (residency.bindlessIndex != ~0u)
+            engine->_bindless.remove_image(residency.bindlessIndex);
+        vkDestroyImageView(engine->_device, residency.image.imageView, nullptr);
+        engine->_memory.untag(residency.image.allocation);
+        vmaDestroyImage(engine->_allocator, residency.image.image, residency.image.allocation); });
+
+    residency = Residency{};
+}
+
+void TextureStreamer::update()
+{
+    update_defragmentation();
+
+    // finished uploads take over, the table of this frame points at them
+    _stats.pendingUploads = 0;
+    for (Texture &texture : _textures)
+    {
+        if (!alive(texture) || texture.pending.firstLevel == ~0u)
+            continue;
+
+        if (texture.moving)
+        {
+            _stats.pendingUploads++;
+            continue;
+        }
+
+        if (!_engine->_uploader.is_complete(texture.pending.uploadTicket))
+        {
+            _stats.pendingUploads++;
+            continue;
+        }
+
+        texture.pending.bindlessIndex = _engine->_bindless.add_image(texture.pending.image.imageView);
+        retire(texture.resident);
+        texture.resident = texture.pending;
+        texture.pending = Residency{};
+    }
+
+    // planned memory, every texture at the level it is resident at or on its way to
+    VkDeviceSize budget = effective_budget();
+    VkDeviceSize planned = 0;
+    _order.clear();
+    for (uint32_t i = 0; i < _textures.size(); i++)
+    {
+        if (!alive(_textures[i]))
+            continue;
+
+        planned += chain_bytes(*_textures[i].source, current_level(_textures[i]));
+        _order.push_back(i);
+    }
+
+    // least recently requested first
+    std::sort(_order.begin(), _order.end(), [this](uint32_t a, uint32_t b)
+              { return _textures[a].lastRequestFrame < _textures[b].lastRequestFrame; });
+
+    // drops the finest level of the least recently requested texture that still has one above its tail
+    auto evict = [&]()
+    {
+        for (uint32_t index : _order)
+        {
+            Texture &texture = _textures[index];
+            uint32_t level = current_level(texture);
+            if (texture.lastRequestFrame == _frame || level >= texture.tailLevel)
+                continue;
+
+            VkDeviceSize before = chain_bytes(*texture.source, level);
+            if (!stream(texture, level + 1))
+                continue;
+
+            planned -= before - chain_bytes(*texture.source, level + 1);
+            _stats.evictions++;
+            return true;
+        }
+        return false;
+    };
+
+    while (planned > budget && evict())
+    {
+    }
+
+    // finer levels for what was requested this frame, most needed first
+    VkDeviceSize uploaded = 0;
+    for (auto it = _order.rbegin(); it != _order.rend() && uploaded < maxUploadBytesPerFrame; ++it)
+    {
+        Texture &texture = _textures[*it];
+        if (texture.lastRequestFrame != _frame)
+            break;
+
+        uint32_t level = current_level(texture);
+        uint32_t target = std::min(texture.requestedLevel, texture.tailLevel);
+        if (target >= level)
+            continue;
+
+        // step towards the request as far as the budget allows
+        VkDeviceSize current = chain_bytes(*texture.source, level);
+        while (target < level)
+        {
+            VkDeviceSize needed = chain_bytes(*texture.source, target) - current;
+            while (planned + needed > budget && evict())
+            {
+            }
+            if (planned + needed <= budget)
+                break;
+            target++;
+        }
+
+        if (target < level && stream(texture, target))
+        {
+            planned += chain_bytes(*texture.source, target) - current;
+            uploaded += chain_bytes(*texture.source, target);
+        }
+    }
+
+    _stats.textures = (uint32_t)_order.size();
+    _stats.budgetBytes = budget;
+
+    // requests made from here on belong to the next update
+    _frame++;
+}
+
+void TextureStreamer::update_defragmentation()
+{
+    VmaPool pool = _engine->_memory.movable_image_pool();
+    if (pool == VK_NULL_HANDLE)
+        return;
+
+    // the frame that recorded the copies has to be done before the old images go
+    if (_passOpen && _frame >= _passFrame + MAX_FRAMES_IN_FLIGHT)
+        end_defragmentation_pass();
+
+    _stats.fragmentation = _engine->_memory.movable_image_fragmentation();
+
+    // a run that could not get below the threshold is not retried right away
+    bool fragmented = _stats.fragmentation > defragmentThreshold && _frame >= _defragmentationFrame + DEFRAGMENTATION_INTERVAL;
+    if (_defragmentation == VK_NULL_HANDLE && (_defragmentationRequested || fragmented))
+    {
+        VmaDefragmentationInfo info = {};
+        info.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT;
+        info.pool = pool;
+        info.maxBytesPerPass = DEFRAGMENTATION_BYTES_PER_PASS;
+        info.maxAllocationsPerPass = DEFRAGMENTATION_MOVES_PER_PASS;
+
+        VK_CHECK(vmaBeginDefragmentation(_engine->_allocator, &info, &_defragmentation));
+        _defragmentationRequested = false;
+    }
+
+    if (_defragmentation != VK_NULL_HANDLE && !_passOpen)
+        begin_defragmentation_pass();
+
+    _stats.defragmenting = _defragmentation != VK_NULL_HANDLE;
+}
+
+void TextureStreamer::begin_defragmentation_pass()
+{
+    if (vmaBeginDefragmentationPass(_engine->_allocator, _defragmentation, &_defragmentationPass) == VK_SUCCESS)
+    {
+        VmaDefragmentationStats stats;
+        vmaEndDefragmentation(_engine->_allocator, _defragmentation, &stats);
+        _defragmentation = VK_NULL_HANDLE;
+
+        _stats.defragmentations++;
+        _stats.defragmentedBytes += stats.bytesMoved;
+        _defragmentationFrame = _frame;
+        return;
+    }
+
+    for (uint32_t i = 0; i < _defragmentationPass.moveCount; i++)
+    {
+        VmaDefragmentationMove &move = _defragmentationPass.pMoves[i];
+
+        // only resident images can be moved, pending ones are still being written by the transfer queue
+        uint32_t index = 0;
+        while (index < _textures.size() && _textures[index].resident.image.allocation != move.srcAllocation)
+            index++;
+
+        if (index == _textures.size() || _textures[index].resident.firstLevel == ~0u)
+        {
+            move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+            continue;
+        }
+
+        Texture &texture = _textures[index];
+        AllocatedImage &image = texture.resident.image;
+
+        Move pending;
+        pending.texture = index;
+        pending.source = image;
+        pending.sourceBindlessIndex = texture.resident.bindlessIndex;
+        pending.levelCount = texture.source ? texture.source->level_count() - texture.resident.firstLevel : 1;
+
+        VkImageCreateInfo imgInfo = vkinit::image_create_info(image.imageFormat, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, image.imageExtent);
+        imgInfo.mipLevels = pending.levelCount;
+        VK_CHECK(vkCreateImage(_engine->_device, &imgInfo, nullptr, &pending.destination));
+        VK_CHECK(vmaBindImageMemory(_engine->_allocator, move.dstTmpAllocation, pending.destination));
+
+        VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(image.imageFormat, pending.destination, VK_IMAGE_ASPECT_COLOR_BIT);
+        viewInfo.subresourceRange.levelCount = pending.levelCount;
+
+        // the table of this frame already points at the copy, record_defragmentation fills it first thing
+        image.image = pending.destination;
+        VK_CHECK(vkCreateImageView(_engine->_device, &viewInfo, nullptr, &image.imageView));
+        texture.resident.bindlessIndex = _engine->_bindless.add_image(image.imageView);
+        texture.moving = true;
+
+        _moves.push_back(pending);
+    }
+
+    _passOpen = true;
+    _passFrame = _frame;
+    _movesRecorded = false;
+
+    if (_moves.empty())
+        end_defragmentation_pass();
+}
+
+void TextureStreamer::end_defragmentation_pass()
+{
+    for (Move &move : _moves)
+    {
+        // the memory goes back to vma with the pass, only the handles are left to destroy
+        vkDestroyImageView(_engine->_device, move.source.imageView, nullptr);
+        vkDestroyImage(_engine->_device, move.source.image, nullptr);
+        _engine->_bindless.remove_image(move.sourceBindlessIndex);
+
+        Texture &texture = _textures[move.texture];
+        texture.moving = false;
+
+        // removed while it was being moved
+        if (!alive(texture))
+        {
+            retire(texture.resident);
+            _freeTextures.push_back(move.texture);
+        }
+    }
+    _moves.clear();
+
+    _passOpen = false;
+    if (vmaEndDefragmentationPass(_engine->_allocator, _defragmentation, &_defragmentationPass) == VK_SUCCESS)
+    {
+        VmaDefragmentationStats stats;
+        vmaEndDefragmentation(_engine->_allocator, _defragmentation, &stats);
+        _defragmentation = VK_NULL_HANDLE;
+
+        _stats.defragmentations++;
+        _stats.defragmentedBytes += stats.bytesMoved;
+        _defragmentationFrame = _frame;
+    }
+}
+
+void TextureStreamer::record_defragmentation(VkCommandBuffer cmd)
+{
+    if (_movesRecorded)
+        return;
+    _movesRecorded = true;
+
+    for (const Move &move : _moves)
+    {
+        vkutil::transition_image(cmd, move.source.image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+        vkutil::transition_image(cmd, move.destination, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+        _moveRegions.resize(move.levelCount);
+        for (uint32_t level = 0; level < move.levelCount; level++)
+        {
+            VkImageCopy &region = _moveRegions[level];
+            region = {};
+            region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+            region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+            region.extent = {std::max(move.source.imageExtent.width >> level, 1u), std::max(move.source.imageExtent.height >> level, 1u), 1};
+        }
+
+        vkCmdCopyImage(cmd, move.source.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, move.destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)_moveRegions.size(), _moveRegions.data());
+
+        vkutil::transition_image(cmd, move.destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+}
+
+uint32_t TextureStreamer::write_residency_table(FrameRingBuffer &ring)
+{
+    FrameRingBuffer::Allocation allocation = ring.allocate(std::max<size_t>(_textures.size(), 1) * sizeof(uint32_t));
+    uint32_t *slots = static_cast<uint32_t *>(allocation.data);
+
+    slots[0] = _fallbackImage;
+    for (size_t i = 0; i < _textures.size(); i++)
+    {
+        const Texture &texture = _textures[i];
+        slots[i] = alive(texture) && texture.resident.bindlessIndex != ~0u ? texture.resident.bindlessIndex : _fallbackImage;
+    }
+
+    return allocation.offset;
+}
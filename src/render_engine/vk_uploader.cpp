@@ -0,0 +1,521 @@
+#include "render_engine/vk_uploader.h"
+#include "render_engine/vk_images.h"
+#include "render_engine/vk_initializers.h"
+
+#include <algorithm>
+#include <cstring>
+
+// copy offsets need to be a multiple of the texel block size, 16 covers every format we upload
+constexpr size_t STAGING_ALIGNMENT = 16;
+
+void TransferUploader::init(VkDevice device, GpuMemory *memory, VkQueue transferQueue, uint32_t transferQueueFamily, uint32_t graphicsQueueFamily, size_t ringSize)
+{
+    _device = device;
+    _memory = memory;
+    _allocator = memory->allocator();
+    _transferQueue = transferQueue;
+    _transferQueueFamily = transferQueueFamily;
+    _graphicsQueueFamily = graphicsQueueFamily;
+
+    VkCommandPoolCreateInfo commandPoolInfo = vkinit::command_pool_create_info(_transferQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+    VK_CHECK(vkCreateCommandPool(_device, &commandPoolInfo, nullptr, &_commandPool));
+
+    VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(_commandPool, COMMAND_BUFFER_COUNT);
+    VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, _commandBuffers));
+
+    // one timeline semaphore tracks every batch, batch N signals value N
+    VkSemaphoreTypeCreateInfo timelineInfo = {.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    timelineInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo = vkinit::semaphore_create_info();
+    semaphoreInfo.pNext = &timelineInfo;
+    VK_CHECK(vkCreateSemaphore(_device, &semaphoreInfo, nullptr, &_timeline));
+
+    // persistently mapped staging ring
+    VkBufferCreateInfo bufferInfo = {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    bufferInfo.size = ringSize;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+    VmaAllocationCreateInfo vmaallocInfo = {};
+    vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+    vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &_ring.buffer, &_ring.allocation, &_ring.info));
+    _memory->tag(_ring.allocation, MemoryCategory::Staging);
+
+    _ringSize = ringSize;
+    _ringHead = 0;
+    _ringTail = 0;
+}
+
+void TransferUploader::cleanup()
+{
+    vkDestroyCommandPool(_device, _commandPool, nullptr);
+    vkDestroySemaphore(_device, _timeline, nullptr);
+
+    for (Batch &batch : _inFlight)
+    {
+        for (AllocatedBuffer &buffer : batch.oversized)
+            destroy_staging(buffer);
+    }
+    for (AllocatedBuffer &buffer : _pendingOversized)
+        destroy_staging(buffer);
+
+    destroy_staging(_ring);
+
+    _inFlight.clear();
+    _graphicsWork.clear();
+    _pendingOversized.clear();
+    _pendingImages.clear();
+    _pendingBuffers.clear();
+}
+
+uint64_t TransferUploader::completed_value()
+{
+    uint64_t value = 0;
+    VK_CHECK(vkGetSemaphoreCounterValue(_device, _timeline, &value));
+    return value;
+}
+
+bool TransferUploader::is_complete(uint64_t ticket)
+{
+    // complete means the graphics queue has synchronized with it, so it is safe to use in any frame recorded from now on
+    return ticket <= _lastGraphicsWaitValue;
+}
+
+void TransferUploader::wait(uint64_t ticket)
+{
+    if (ticket >= _nextValue)
+        flush();
+
+    VkSemaphoreWaitInfo waitInfo = {.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &_timeline;
+    waitInfo.pValues = &ticket;
+
+    VK_CHECK(vkWaitSemaphores(_device, &waitInfo, UINT64_MAX));
+
+    collect();
+}
+
+bool TransferUploader::try_allocate_ring(size_t size, size_t &offset)
+{
+    size = (size + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+
+    if (_ringHead >= _ringTail)
+    {
+        // free space is [head, end) and [0, tail)
+        if (_ringHead + size <= _ringSize)
+        {
+            offset = _ringHead;
+            _ringHead += size;
+            return true;
+        }
+        // wrap around, strictly less so a full ring never looks empty
+        if (size < _ringTail)
+        {
+            offset = 0;
+            _ringHead = size;
+            return true;
+        }
+        return false;
+    }
+
+    // free space is [head, tail)
+    if (_ringHead + size < _ringTail)
+    {
+        offset = _ringHead;
+        _ringHead += size;
+        return true;
+    }
+    return false;
+}
+
+void TransferUploader::destroy_staging(const AllocatedBuffer &buffer)
+{
+    _memory->untag(buffer.allocation);
+    vmaDestroyBuffer(_allocator, buffer.buffer, buffer.allocation);
+}
+
+bool TransferUploader::allocate_staging(size_t size, VkBuffer &buffer, VkDeviceSize &offset, void *&mapped)
+{
+    size_t ringOffset = 0;
+    bool allocated = size <= _ringSize / 2;
+
+    while (allocated && !try_allocate_ring(size, ringOffset))
+    {
+        // the ring is full, push out what is queued and recycle the oldest batch
+        if (!_pendingImages.empty() || !_pendingBuffers.empty())
+        {
+            flush();
+            continue;
+        }
+
+        if (_inFlight.empty())
+        {
+            allocated = false;
+            break;
+        }
+
+        wait(_inFlight.front().timelineValue);
+    }
+
+    if (allocated)
+    {
+        buffer = _ring.buffer;
+        offset = ringOffset;
+        mapped = (char *)_ring.info.pMappedData + ringOffset;
+        return true;
+    }
+
+    // too big for the ring, give it its own staging buffer that dies with the batch
+    VkBufferCreateInfo bufferInfo = {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+    VmaAllocationCreateInfo vmaallocInfo = {};
+    vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+    vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    AllocatedBuffer staging;
+    VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &staging.buffer, &staging.allocation, &staging.info));
+    _memory->tag(staging.allocation, MemoryCategory::Staging);
+    _pendingOversized.push_back(staging);
+
+    buffer = staging.buffer;
+    offset = 0;
+    mapped = staging.info.pMappedData;
+    return false;
+}
+
+uint64_t TransferUploader::upload_image(const AllocatedImage &image, const void *data, size_t size, bool mipmapped)
+{
+    VkBuffer srcBuffer;
+    VkDeviceSize srcOffset;
+    void *mapped;
+    allocate_staging(size, srcBuffer, srcOffset, mapped);
+
+    memcpy(mapped, data, size);
+
+    _pendingImages.push_back(ImageCopy{
+        .image = image,
+        .srcBuffer = srcBuffer,
+        .srcOffset = srcOffset,
+        .mipmapped = mipmapped});
+
+    // the next flush signals this value
+    return _nextValue;
+}
+
+uint64_t TransferUploader::upload_image_levels(const AllocatedImage &image, const void *data, size_t size, std::span<const VkDeviceSize> levelOffsets)
+{
+    VkBuffer srcBuffer;
+    VkDeviceSize srcOffset;
+    void *mapped;
+    allocate_staging(size, srcBuffer, srcOffset, mapped);
+
+    memcpy(mapped, data, size);
+
+    _pendingImages.push_back(ImageCopy{
+        .image = image,
+        .srcBuffer = srcBuffer,
+        .srcOffset = srcOffset,
+        .mipmapped = false,
+        .levelOffsets = std::vector<VkDeviceSize>(levelOffsets.begin(), levelOffsets.end())});
+
+    return _nextValue;
+}
+
+uint64_t TransferUploader::upload_buffer(VkBuffer buffer, const void *data, size_t size, size_t dstOffset)
+{
+    VkBuffer srcBuffer;
+    VkDeviceSize srcOffset;
+    void *mapped;
+    allocate_staging(size, srcBuffer, srcOffset, mapped);
+
+    memcpy(mapped, data, size);
+
+    _pendingBuffers.push_back(BufferCopy{
+        .dstBuffer = buffer,
+        .srcBuffer = srcBuffer,
+        .srcOffset = srcOffset,
+        .dstOffset = dstOffset,
+        .size = size});
+
+    return _nextValue;
+}
+
+void TransferUploader::collect()
+{
+    uint64_t completed = completed_value();
+
+    while (!_inFlight.empty() && _inFlight.front().timelineValue <= completed)
+    {
+        Batch &batch = _inFlight.front();
+
+        _ringTail = batch.ringEnd;
+        for (AllocatedBuffer &buffer : batch.oversized)
+            destroy_staging(buffer);
+
+        _inFlight.pop_front();
+    }
+
+    // nothing alive in the ring, start over from the beginning
+    if (_inFlight.empty() && _pendingImages.empty() && _pendingBuffers.empty())
+    {
+        _ringHead = 0;
+        _ringTail = 0;
+    }
+}
+
+void TransferUploader::flush()
+{
+    collect();
+
+    if (_pendingImages.empty() && _pendingBuffers.empty())
+        return;
+
+    uint32_t index = _nextCommandBuffer;
+    _nextCommandBuffer = (_nextCommandBuffer + 1) % COMMAND_BUFFER_COUNT;
+
+    // the command buffer may still be executing a previous batch
+    if (_commandBufferValues[index] > completed_value())
+        wait(_commandBufferValues[index]);
+
+    VkCommandBuffer cmd = _commandBuffers[index];
+    VK_CHECK(vkResetCommandBuffer(cmd, 0));
+
+    VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+
+    bool ownershipTransfer = _transferQueueFamily != _graphicsQueueFamily;
+
+    // every image goes to TRANSFER_DST in a single barrier batch
+    std::vector<VkImageMemoryBarrier2> imageBarriers;
+    imageBarriers.reserve(_pendingImages.size());
+    for (ImageCopy &copy : _pendingImages)
+    {
+        VkImageMemoryBarrier2 barrier = {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+        barrier.srcAccessMask = VK_ACCESS_2_NONE;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = copy.image.image;
+        barrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+        imageBarriers.push_back(barrier);
+    }
+
+    if (!imageBarriers.empty())
+    {
+        VkDependencyInfo depInfo = {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+        depInfo.imageMemoryBarrierCount = (uint32_t)imageBarriers.size();
+        depInfo.pImageMemoryBarriers = imageBarriers.data();
+        vkCmdPipelineBarrier2(cmd, &depInfo);
+    }
+
+    std::vector<VkBufferImageCopy> copyRegions;
+    for (ImageCopy &copy : _pendingImages)
+    {
+        uint32_t levelCount = std::max<uint32_t>((uint32_t)copy.levelOffsets.size(), 1);
+
+        copyRegions.clear();
+        for (uint32_t level = 0; level < levelCount; level++)
+        {
+            VkBufferImageCopy copyRegion = {};
+            copyRegion.bufferOffset = copy.srcOffset + (copy.levelOffsets.empty() ? 0 : copy.levelOffsets[level]);
+            copyRegion.bufferRowLength = 0;
+            copyRegion.bufferImageHeight = 0;
+
+            copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            copyRegion.imageSubresource.mipLevel = level;
+            copyRegion.imageSubresource.baseArrayLayer = 0;
+            copyRegion.imageSubresource.layerCount = 1;
+            copyRegion.imageExtent = VkExtent3D{std::max(copy.image.imageExtent.width >> level, 1u), std::max(copy.image.imageExtent.height >> level, 1u), 1};
+            copyRegions.push_back(copyRegion);
+        }
+
+        vkCmdCopyBufferToImage(cmd, copy.srcBuffer, copy.image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)copyRegions.size(), copyRegions.data());
+    }
+
+    for (BufferCopy &copy : _pendingBuffers)
+    {
+        VkBufferCopy region = {};
+        region.srcOffset = copy.srcOffset;
+        region.dstOffset = copy.dstOffset;
+        region.size = copy.size;
+
+        vkCmdCopyBuffer(cmd, copy.srcBuffer, copy.dstBuffer, 1, &region);
+    }
+
+    // release to the graphics queue, or finish the layout transition right here when no transfer is needed
+    imageBarriers.clear();
+    for (ImageCopy &copy : _pendingImages)
+    {
+        if (!ownershipTransfer && copy.mipmapped)
+            continue; // stays in TRANSFER_DST, mip generation happens on the graphics queue
+
+        VkImageMemoryBarrier2 barrier = {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+        barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+        barrier.dstAccessMask = VK_ACCESS_2_NONE;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = copy.mipmapped ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcQueueFamilyIndex = ownershipTransfer ? _transferQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = ownershipTransfer ? _graphicsQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = copy.image.image;
+        barrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+        imageBarriers.push_back(barrier);
+    }
+
+    std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+    if (ownershipTransfer)
+    {
+        bufferBarriers.reserve(_pendingBuffers.size());
+        for (BufferCopy &copy : _pendingBuffers)
+        {
+            VkBufferMemoryBarrier2 barrier = {.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2};
+            barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+            barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+            barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+            barrier.dstAccessMask = VK_ACCESS_2_NONE;
+            barrier.srcQueueFamilyIndex = _transferQueueFamily;
+            barrier.dstQueueFamilyIndex = _graphicsQueueFamily;
+            barrier.buffer = copy.dstBuffer;
+            barrier.offset = copy.dstOffset;
+            barrier.size = copy.size;
+            bufferBarriers.push_back(barrier);
+        }
+    }
+
+    if (!imageBarriers.empty() || !bufferBarriers.empty())
+    {
+        VkDependencyInfo depInfo = {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+        depInfo.imageMemoryBarrierCount = (uint32_t)imageBarriers.size();
+        depInfo.pImageMemoryBarriers = imageBarriers.data();
+        depInfo.bufferMemoryBarrierCount = (uint32_t)bufferBarriers.size();
+        depInfo.pBufferMemoryBarriers = bufferBarriers.data();
+        vkCmdPipelineBarrier2(cmd, &depInfo);
+    }
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
+
+    uint64_t value = _nextValue++;
+
+    VkCommandBufferSubmitInfo cmdinfo = vkinit::command_buffer_submit_info(cmd);
+    VkSemaphoreSubmitInfo signalInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, _timeline);
+    signalInfo.value = value;
+
+    VkSubmitInfo2 submit = vkinit::submit_info(&cmdinfo, &signalInfo, nullptr);
+    VK_CHECK(vkQueueSubmit2(_transferQueue, 1, &submit, VK_NULL_HANDLE));
+
+    _commandBufferValues[index] = value;
+
+    _inFlight.push_back(Batch{
+        .timelineValue = value,
+        .ringEnd = _ringHead,
+        .oversized = std::move(_pendingOversized)});
+
+    _graphicsWork.push_back(GraphicsWork{
+        .timelineValue = value,
+        .images = std::move(_pendingImages),
+        .buffers = std::move(_pendingBuffers)});
+
+    _pendingOversized.clear();
+    _pendingImages.clear();
+    _pendingBuffers.clear();
+}
+
+bool TransferUploader::record_graphics_work(VkCommandBuffer cmd, VkSemaphoreSubmitInfo &waitInfo)
+{
+    collect();
+
+    // only pick up batches that already finished, so the graphics queue never stalls on a transfer
+    uint64_t completed = completed_value();
+    bool ownershipTransfer = _transferQueueFamily != _graphicsQueueFamily;
+
+    std::vector<VkImageMemoryBarrier2> imageBarriers;
+    std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+    std::vector<AllocatedImage> mipmapped;
+
+    uint64_t waitValue = 0;
+
+    while (!_graphicsWork.empty() && _graphicsWork.front().timelineValue <= completed)
+    {
+        GraphicsWork &work = _graphicsWork.front();
+
+        for (ImageCopy &copy : work.images)
+        {
+            if (copy.mipmapped)
+                mipmapped.push_back(copy.image);
+
+            if (!ownershipTransfer)
+                continue;
+
+            // acquire, must match the release done on the transfer queue
+            VkImageMemoryBarrier2 barrier = {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+            barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+            barrier.srcAccessMask = VK_ACCESS_2_NONE;
+            barrier.dstStageMask = copy.mipmapped ? VK_PIPELINE_STAGE_2_BLIT_BIT : VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+            barrier.dstAccessMask = copy.mipmapped ? VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT : VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout = copy.mipmapped ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            barrier.srcQueueFamilyIndex = _transferQueueFamily;
+            barrier.dstQueueFamilyIndex = _graphicsQueueFamily;
+            barrier.image = copy.image.image;
+            barrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+            imageBarriers.push_back(barrier);
+        }
+
+        if (ownershipTransfer)
+        {
+            for (BufferCopy &copy : work.buffers)
+            {
+                VkBufferMemoryBarrier2 barrier = {.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2};
+                barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+                barrier.srcAccessMask = VK_ACCESS_2_NONE;
+                barrier.dstStageMask = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+                barrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT;
+                barrier.srcQueueFamilyIndex = _transferQueueFamily;
+                barrier.dstQueueFamilyIndex = _graphicsQueueFamily;
+                barrier.buffer = copy.dstBuffer;
+                barrier.offset = copy.dstOffset;
+                barrier.size = copy.size;
+                bufferBarriers.push_back(barrier);
+            }
+        }
+
+        waitValue = work.timelineValue;
+        _graphicsWork.pop_front();
+    }
+
+    if (!imageBarriers.empty() || !bufferBarriers.empty())
+    {
+        VkDependencyInfo depInfo = {.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+        depInfo.imageMemoryBarrierCount = (uint32_t)imageBarriers.size();
+        depInfo.pImageMemoryBarriers = imageBarriers.data();
+        depInfo.bufferMemoryBarrierCount = (uint32_t)bufferBarriers.size();
+        depInfo.pBufferMemoryBarriers = bufferBarriers.data();
+        vkCmdPipelineBarrier2(cmd, &depInfo);
+    }
+
+    for (AllocatedImage &image : mipmapped)
+    {
+        vkutil::generate_mipmaps(cmd, image.image, VkExtent2D{image.imageExtent.width, image.imageExtent.height});
+    }
+
+    if (waitValue == 0)
+        return false;
+
+    // the value is already signaled, the wait only makes the transfer writes visible to this submit
+    waitInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _timeline);
+    waitInfo.value = waitValue;
+
+    _lastGraphicsWaitValue = waitValue;
+    return true;
+}